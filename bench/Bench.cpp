@@ -0,0 +1,202 @@
+#include "Bench.h"
+
+#include "engine/Profiler.h"
+#include "engine/Memory.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+static u32 failure_count = 0;
+
+JsonWriter::JsonWriter(std::ostream& out)
+	: out(out), first(true), after_key(false)
+{
+}
+
+void JsonWriter::separate()
+{
+	if (!first && !after_key)
+		out << ",";
+	after_key = false;
+}
+
+void JsonWriter::begin_object()
+{
+	separate();
+	out << "{";
+	first = true;
+}
+
+void JsonWriter::end_object()
+{
+	out << "}";
+	first = false;
+}
+
+void JsonWriter::begin_array()
+{
+	separate();
+	out << "[";
+	first = true;
+}
+
+void JsonWriter::end_array()
+{
+	out << "]";
+	first = false;
+}
+
+void JsonWriter::key(std::string_view name)
+{
+	separate();
+	write_string(name);
+	out << ":";
+	after_key = true;
+}
+
+void JsonWriter::write_number(f64 number)
+{
+	// JSON has no representation for nan or inf
+	if (!std::isfinite(number))
+		out << "null";
+	else
+		out << number;
+}
+
+void JsonWriter::write_string(std::string_view string)
+{
+	out << '"';
+	for (char c : string)
+	{
+		if (c == '"' || c == '\\')
+			out << '\\' << c;
+		else if ((u8)c < 0x20)
+			out << ' ';
+		else
+			out << c;
+	}
+	out << '"';
+}
+
+void write_stats(JsonWriter& json, std::vector<f64> samples)
+{
+	json.begin_object();
+	json.field("samples", samples.size());
+	if (samples.empty())
+	{
+		json.end_object();
+		return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	f64 sum = 0.0;
+	for (f64 sample : samples)
+		sum += sample;
+
+	// Nearest rank percentile
+	auto percentile = [&](f64 p)
+		{
+			usz rank = (usz)std::ceil(p * (f64)samples.size());
+			return samples[std::clamp<usz>(rank, 1, samples.size()) - 1];
+		};
+
+	json.field("mean", sum / (f64)samples.size());
+	json.field("min", samples.front());
+	json.field("p50", percentile(0.50));
+	json.field("p95", percentile(0.95));
+	json.field("p99", percentile(0.99));
+	json.field("max", samples.back());
+	json.end_object();
+}
+
+void report_failure(std::string_view message)
+{
+	std::cerr << "FAILED: " << message << std::endl;
+	failure_count++;
+}
+
+bool has_failures()
+{
+	return failure_count > 0;
+}
+
+FrameSampler::FrameSampler(bool require_allocation_free)
+	: require_allocation_free(require_allocation_free), frame_start(0), allocations_start(0)
+{
+	if (!Profiler::is_capturing())
+		Profiler::begin_capture();
+}
+
+void FrameSampler::begin_frame()
+{
+	// Drop the zones of the unmeasured frames
+	Profiler::consume_events([](u32, const ProfileEvent&) {});
+
+	allocations_start = Memory::get_allocation_count();
+	frame_start = Profiler::now();
+}
+
+void FrameSampler::end_frame(entt::registry& registry)
+{
+	u64 frame_end = Profiler::now();
+	u64 allocations = Memory::get_allocation_count() - allocations_start;
+
+	frame_ms.push_back((frame_end - frame_start) * 1e-6);
+	frame_allocations.push_back((f64)allocations);
+	entity_counts.push_back((f64)registry.storage<entt::entity>().free_list());
+
+	// A zone can run multiple times per frame, the samples are the frame totals
+	for (auto& [name, ms] : frame_zone_ms)
+		ms = 0.0;
+	Profiler::consume_events([this](u32, const ProfileEvent& event)
+		{
+			if (!event.is_counter)
+				frame_zone_ms[event.name] += event.duration * 1e-6;
+		});
+	for (auto& [name, ms] : frame_zone_ms)
+		zone_ms[name].push_back(ms);
+}
+
+void FrameSampler::write(JsonWriter& json) const
+{
+	json.key("frame_ms");
+	write_stats(json, frame_ms);
+
+	json.key("systems_ms");
+	json.begin_object();
+	for (auto& [name, samples] : zone_ms)
+	{
+		// Zones that first ran in a later frame get 0 for the frames before
+		std::vector<f64> all_samples(frame_ms.size() - samples.size(), 0.0);
+		all_samples.insert(all_samples.end(), samples.begin(), samples.end());
+		json.key(name);
+		write_stats(json, std::move(all_samples));
+	}
+	json.end_object();
+
+	f64 total_allocations = 0.0;
+	for (f64 allocations : frame_allocations)
+		total_allocations += allocations;
+	json.field("allocations_total", (u64)total_allocations);
+	json.key("allocations_per_frame");
+	write_stats(json, frame_allocations);
+	u64 allocation_free_frames = (u64)std::count(frame_allocations.begin(), frame_allocations.end(), 0.0);
+	json.field("allocation_free_frames", allocation_free_frames);
+	if (require_allocation_free)
+	{
+		bool passed = allocation_free_frames == frame_allocations.size();
+		json.field("allocation_free_required", true);
+		json.field("allocation_check_passed", passed);
+		if (!passed)
+		{
+			auto first = std::find_if(frame_allocations.begin(), frame_allocations.end(), [](f64 allocations) { return allocations != 0.0; });
+			report_failure(std::to_string(frame_allocations.size() - allocation_free_frames) + " measured frames allocated, the first one is frame " +
+				std::to_string(first - frame_allocations.begin()) + " with " + std::to_string((u64)*first) + " allocations");
+		}
+	}
+	json.field("frame_arena_high_water", Memory::get_frame_arena().high_water);
+
+	json.key("entities");
+	write_stats(json, entity_counts);
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "engine/Types.h"
+#include "engine/Memory.h"
+
+#include "entt/entt.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <ostream>
+#include <type_traits>
+
+/// Settings of a benchmark run; set from the command line
+struct BenchConfig
+{
+	u32 frames = 600;
+	u32 warmup_frames = 60;
+	u32 tanks = 64;
+	u32 projectiles = 512;
+	u32 explosions = 64;
+	u32 emitters = 256;
+	u32 agents = 256;
+	u32 path_queries = 256;
+	u32 clients = 8;
+	u32 map_load_repeats = 5;
+	std::vector<u32> map_sizes = { 64, 256, 1024 };
+	u32 seed = 1;
+	f32 delta_time = 1.0f / 60.0f;
+};
+
+/// Minimal streaming JSON writer; takes care of the separators between values
+struct JsonWriter : NoCopy
+{
+	JsonWriter(std::ostream& out);
+
+	void begin_object();
+	void end_object();
+	void begin_array();
+	void end_array();
+	void key(std::string_view name);
+
+	template<typename T>
+	void value(const T& value)
+	{
+		separate();
+		if constexpr (std::is_same_v<T, bool>)
+			out << (value ? "true" : "false");
+		else if constexpr (std::is_integral_v<T>)
+			out << value;
+		else if constexpr (std::is_floating_point_v<T>)
+			write_number((f64)value);
+		else
+			write_string(value);
+		first = false;
+	}
+
+	template<typename T>
+	void field(std::string_view name, const T& value)
+	{
+		key(name);
+		this->value(value);
+	}
+
+private:
+	void separate();
+	void write_number(f64 number);
+	void write_string(std::string_view string);
+
+	std::ostream& out;
+	bool first;
+	bool after_key;
+};
+
+/// Writes mean, min, max and percentiles of the samples
+void write_stats(JsonWriter& json, std::vector<f64> samples);
+
+/// A check of a scenario failed: prints the message, the bench finishes the report and exits with an error
+void report_failure(std::string_view message);
+bool has_failures();
+
+/// Collects the frame time, the time of every profiler zone (per system) and the heap allocations of each measured frame.
+/// The allocations are only counted when built with TANKGAME_PROFILING. With require_allocation_free (scenarios in a steady
+/// state after the warmup) a measured frame that allocated fails the bench
+struct FrameSampler : NoCopy
+{
+	FrameSampler(bool require_allocation_free = false);
+
+	void begin_frame();
+	void end_frame(entt::registry& registry);
+
+	void write(JsonWriter& json) const;
+
+private:
+	bool require_allocation_free;
+	u64 frame_start;
+	u64 allocations_start;
+	std::vector<f64> frame_ms;
+	std::vector<f64> frame_allocations;
+	std::vector<f64> entity_counts;
+	std::map<std::string, std::vector<f64>> zone_ms;
+	std::map<std::string, f64> frame_zone_ms;
+};
+
+/// Runs warmup frames and then the measured frames; frame(index) simulates one frame
+template<typename F>
+void run_frames(const BenchConfig& config, FrameSampler& sampler, entt::registry& registry, F&& frame)
+{
+	for (u32 i = 0; i < config.warmup_frames + config.frames; i++)
+	{
+		Memory::begin_frame();
+		bool measure = i >= config.warmup_frames;
+		if (measure)
+			sampler.begin_frame();
+		frame(i);
+		if (measure)
+			sampler.end_frame(registry);
+	}
+}
+
+void run_tanks_scenario(const BenchConfig& config, JsonWriter& json);
+void run_projectiles_scenario(const BenchConfig& config, JsonWriter& json);
+void run_analytic_projectiles_scenario(const BenchConfig& config, JsonWriter& json);
+void run_map_collision_scenario(const BenchConfig& config, JsonWriter& json);
+void run_particles_scenario(const BenchConfig& config, JsonWriter& json);
+void run_map_load_scenario(const BenchConfig& config, JsonWriter& json);
+void run_map_streaming_scenario(const BenchConfig& config, JsonWriter& json);
+void run_navigation_scenario(const BenchConfig& config, JsonWriter& json);
+void run_visibility_scenario(const BenchConfig& config, JsonWriter& json);
+void run_map_destruction_scenario(const BenchConfig& config, JsonWriter& json);
+void run_spatial_hash_scenario(const BenchConfig& config, JsonWriter& json);
+void run_scheduler_scenario(const BenchConfig& config, JsonWriter& json);
+void run_replication_scenario(const BenchConfig& config, JsonWriter& json);
+void run_prediction_scenario(const BenchConfig& config, JsonWriter& json);
+void run_serialization_scenario(const BenchConfig& config, JsonWriter& json);
+void run_loopback_scenario(const BenchConfig& config, JsonWriter& json);
+void run_interest_scenario(const BenchConfig& config, JsonWriter& json);
+void run_rewind_scenario(const BenchConfig& config, JsonWriter& json);
+void run_lockstep_scenario(const BenchConfig& config, JsonWriter& json);
+void run_snapshot_scenario(const BenchConfig& config, JsonWriter& json);
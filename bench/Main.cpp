@@ -0,0 +1,175 @@
+#include "Bench.h"
+
+#include "engine/Profiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+struct BenchScenario
+{
+	const char* name;
+	const char* description;
+	void (*run)(const BenchConfig& config, JsonWriter& json);
+};
+
+const static BenchScenario SCENARIOS[] = {
+	{ "tanks", "N scripted tanks driving and shooting on collision_map.tmx", run_tanks_scenario },
+	{ "projectiles", "M physics projectiles bouncing on collision_map.tmx", run_projectiles_scenario },
+	{ "analytic_projectiles", "M analytic projectiles bouncing on collision_map.tmx", run_analytic_projectiles_scenario },
+	{ "map_collision", "Tanks and projectiles on collision_map.tmx with per tile and with merged collision boxes", run_map_collision_scenario },
+	{ "particles", "Particle storm of K explosions every 0.5 s and continuous smoke emitters", run_particles_scenario },
+	{ "map_load", "Parsing (csv, base64, zlib, gzip) and physics creation of generated maps up to 1024x1024", run_map_load_scenario },
+	{ "map_streaming", "Chunk streaming around a moving camera and N scripted tanks on generated maps up to 1024x1024", run_map_streaming_scenario },
+	{ "navigation", "Nav grid and hierarchy build, path queries, flow fields and N navigating tanks on collision_map.tmx", run_navigation_scenario },
+	{ "visibility", "Visibility polygons and cached all-pairs line of sight between N tanks on collision_map.tmx", run_visibility_scenario },
+	{ "map_destruction", "Destructible blocks shot by N tanks, per tile patch cost against a full body rebuild and change log replay", run_map_destruction_scenario },
+	{ "spatial_hash", "Radius and k-nearest queries of N tanks among tanks and projectiles: spatial hash, registry scan and a threaded batch", run_spatial_hash_scenario },
+	{ "scheduler", "Tanks, projectiles, particles and visibility observers with the systems run serially and on the thread pool", run_scheduler_scenario },
+	{ "replication", "Snapshots of N scripted tanks delta encoded for C clients behind lossy links, at several bandwidth budgets", run_replication_scenario },
+	{ "prediction", "A client predicting its tank among N scripted tanks over a lossy loopback link, at several latencies", run_prediction_scenario },
+	{ "serialization", "Quantized bit packed entity states against raw floats: GB/s and bytes per entity of N * 1024 states", run_serialization_scenario },
+	{ "loopback", "Server with N bots and C simulated clients in one process over loopback links: clean, lossy and congested", run_loopback_scenario },
+	{ "interest", "Bytes and encode cost of C clients watching one of N scripted tanks each: everything, area of interest, interest at 20 Hz", run_interest_scenario },
+	{ "rewind", "Lag compensated raycasts and overlaps among N scripted tanks rewound 0 to 30 ticks, against raycasts of the present bodies", run_rewind_scenario },
+	{ "lockstep", "N scripted tanks in fixed deterministic ticks: state hash cost, and a repeated, a replayed and a perturbed run checked against it", run_lockstep_scenario },
+	{ "snapshot", "N scripted tanks saved halfway and rolled back 1 to 8 ticks: save and restore cost, restored state hash, resimulation and a rematch", run_snapshot_scenario },
+};
+
+static void print_usage()
+{
+	std::cerr << "Usage: tankgame_bench [options]\n"
+		"  --scenario <name>    Runs only this scenario (can be repeated)\n"
+		"  --frames <n>         Measured frames per scenario\n"
+		"  --warmup <n>         Unmeasured frames before measuring\n"
+		"  --tanks <n>          Tanks of the tanks scenario\n"
+		"  --projectiles <n>    Projectiles of the projectile scenarios\n"
+		"  --explosions <n>     Explosions per wave of the particles scenario\n"
+		"  --emitters <n>       Continuous emitters of the particles scenario\n"
+		"  --map-repeats <n>    Loads per map size of the map_load scenario\n"
+		"  --agents <n>         Navigating tanks of the navigation scenario\n"
+		"  --queries <n>        Path queries of the navigation scenario\n"
+		"  --clients <n>        Clients of the replication scenario\n"
+		"  --seed <n>           Seed of the scripted inputs\n"
+		"  --out <file>         Writes the JSON report to a file instead of stdout\n"
+		"  --list               Lists the scenarios\n";
+}
+
+int main(int argc, char** argv)
+{
+	BenchConfig config;
+	std::vector<std::string> selected;
+	const char* out_file = nullptr;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (strcmp(arg, "--list") == 0)
+		{
+			for (const BenchScenario& scenario : SCENARIOS)
+				std::cout << scenario.name << ": " << scenario.description << "\n";
+			return 0;
+		}
+		else if (strcmp(arg, "--scenario") == 0 && has_value)
+			selected.push_back(argv[++i]);
+		else if (strcmp(arg, "--frames") == 0 && has_value)
+			config.frames = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--warmup") == 0 && has_value)
+			config.warmup_frames = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--tanks") == 0 && has_value)
+			config.tanks = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--projectiles") == 0 && has_value)
+			config.projectiles = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--explosions") == 0 && has_value)
+			config.explosions = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--emitters") == 0 && has_value)
+			config.emitters = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--map-repeats") == 0 && has_value)
+			config.map_load_repeats = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--agents") == 0 && has_value)
+			config.agents = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--queries") == 0 && has_value)
+			config.path_queries = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--clients") == 0 && has_value)
+			config.clients = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--seed") == 0 && has_value)
+			config.seed = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--out") == 0 && has_value)
+			out_file = argv[++i];
+		else
+		{
+			print_usage();
+			return 1;
+		}
+	}
+
+	for (const std::string& name : selected)
+	{
+		if (std::none_of(std::begin(SCENARIOS), std::end(SCENARIOS), [&](const BenchScenario& scenario) { return name == scenario.name; }))
+		{
+			std::cerr << "Unknown scenario: " << name << std::endl;
+			return 1;
+		}
+	}
+
+	Profiler::set_thread_name("main");
+
+	std::ofstream file;
+	if (out_file)
+	{
+		file.open(out_file);
+		if (!file)
+		{
+			std::cerr << "Failed to open file: " << out_file << std::endl;
+			return 1;
+		}
+	}
+	std::ostream& out = out_file ? file : std::cout;
+
+	JsonWriter json(out);
+	json.begin_object();
+	json.field("benchmark", "tankgame_bench");
+#ifdef TANKGAME_PROFILING
+	json.field("profiling", true);
+#else
+	json.field("profiling", false);
+#endif
+
+	json.key("config");
+	json.begin_object();
+	json.field("frames", config.frames);
+	json.field("warmup_frames", config.warmup_frames);
+	json.field("delta_time", config.delta_time);
+	json.field("tanks", config.tanks);
+	json.field("projectiles", config.projectiles);
+	json.field("explosions", config.explosions);
+	json.field("emitters", config.emitters);
+	json.field("map_load_repeats", config.map_load_repeats);
+	json.field("agents", config.agents);
+	json.field("path_queries", config.path_queries);
+	json.field("clients", config.clients);
+	json.field("seed", config.seed);
+	json.end_object();
+
+	json.key("scenarios");
+	json.begin_array();
+	for (const BenchScenario& scenario : SCENARIOS)
+	{
+		if (!selected.empty() && std::find(selected.begin(), selected.end(), scenario.name) == selected.end())
+			continue;
+
+		std::cerr << "Running " << scenario.name << "..." << std::endl;
+		json.begin_object();
+		scenario.run(config, json);
+		json.end_object();
+	}
+	json.end_array();
+
+	json.end_object();
+	out << std::endl;
+	return has_failures() ? 1 : 0;
+}
@@ -0,0 +1,2249 @@
+#include "Bench.h"
+
+#include "AssetManager.h"
+#include "engine/Camera.h"
+#include "engine/Profiler.h"
+#include "engine/ThreadPool.h"
+#include "engine/Memory.h"
+#include "entities/World.h"
+#include "entities/Components.h"
+#include "entities/Map.h"
+#include "entities/MapBlob.h"
+#include "entities/MapStreamer.h"
+#include "entities/MapDestruction.h"
+#include "entities/Navigation.h"
+#include "entities/Visibility.h"
+#include "entities/SpatialHash.h"
+#include "entities/SystemScheduler.h"
+#include "entities/Tank.h"
+#include "entities/Projectile.h"
+#include "entities/AnalyticProjectiles.h"
+#include "entities/Particle.h"
+#include "entities/CollisionCategory.h"
+#include "entities/LagCompensation.h"
+#include "entities/Lockstep.h"
+#include "entities/WorldSnapshot.h"
+#include "net/Replication.h"
+#include "net/Prediction.h"
+#include "net/Loopback.h"
+#include "net/NetHarness.h"
+#include "engine/util/MathUtil.h"
+
+#include "stb_image/stb_image_write.h"
+
+// Implemented with stb_image_write (in the stb_image library) but only declared in its implementation part
+extern "C" unsigned char* stbi_zlib_compress(unsigned char* data, int data_len, int* out_len, int quality);
+
+#include <random>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+
+const static char* COLLISION_MAP = RESOURCES_PATH "maps/collision_map.tmx";
+const static char* TILESET = RESOURCES_PATH "images/map/Tileset.tsx";
+
+// The particle storm spawns a new wave of explosions at this interval
+const static f32 EXPLOSION_INTERVAL = 0.5f;
+// Particles per second of each continuous emitter of the particles scenario
+const static f32 EMITTER_RATE = 30.0f;
+// One way latency of the replication links in frames and the share of lost unreliable packets
+const static u32 REPLICATION_LATENCY_FRAMES = 3;
+const static f32 REPLICATION_LOSS = 0.05f;
+// Entity states serialized per tank of the config and the passes over them
+const static u32 SERIALIZED_STATES_PER_TANK = 1024;
+const static u32 SERIALIZATION_PASSES = 20;
+
+static f64 elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void write_pool_stats(JsonWriter& json, const EntityPool& pool)
+{
+	EntityPoolStats stats = pool.get_stats();
+	json.begin_object();
+	json.field("active", stats.active);
+	json.field("pooled", stats.pooled);
+	json.field("created", stats.created);
+	json.field("recycled", stats.recycled);
+	json.field("released", stats.released);
+	json.end_object();
+}
+
+static void write_pools(JsonWriter& json, entt::registry& registry)
+{
+	EntityPools& pools = registry.ctx().get<EntityPools>();
+	json.key("pools");
+	json.begin_object();
+	json.key("projectiles");
+	write_pool_stats(json, pools.projectiles);
+	json.end_object();
+}
+
+static entt::entity load_collision_map(World& world, Tileset& tileset, bool merge_collision = true)
+{
+	entt::entity map_entity = Map::create_map_entity(world.registry, COLLISION_MAP, PIXEL_SCALE);
+	world.registry.get<Map>(map_entity).compute_collision_shapes(tileset, merge_collision);
+	Map::create_map_physics(world.registry, map_entity, tileset);
+	return map_entity;
+}
+
+static ProjectileType create_bouncing_projectile_type()
+{
+	ProjectileType type;
+	type.sprite_type = ProjectileSpriteType::Laser;
+	type.velocity = 15.0f;
+	type.max_collisons = std::numeric_limits<u16>::max();
+	type.fix_orientation = true;
+	type.fix_velocity = true;
+	type.restitution = 1.0f;
+	type.density = 200;
+	type.particle_type = 1;
+	type.allow_projectile_collision = false;
+	return type;
+}
+
+/// Projectile of the scripted tanks
+static ProjectileType create_tank_projectile_type()
+{
+	ProjectileType type;
+	type.max_collisons = 2;
+	return type;
+}
+
+void run_tanks_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	std::mt19937 rng(config.seed);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = load_collision_map(world, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+	Projectile::prewarm_pool(world.registry, 32);
+
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	ScriptedTanks tanks(map, config.seed);
+	tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+
+	FrameSampler sampler;
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			world.handle_inputs(config.delta_time, &tanks);
+			world.update(config.delta_time);
+		});
+
+	json.field("name", "tanks");
+	json.field("tanks", config.tanks);
+	sampler.write(json);
+	write_pools(json, world.registry);
+}
+
+void run_projectiles_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	std::mt19937 rng(config.seed);
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = load_collision_map(world, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+
+	ProjectileType type = create_bouncing_projectile_type();
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	for (u32 i = 0; i < config.projectiles; i++)
+		Projectile::create_projectile(world.registry, entt::null, type, ScriptedTanks::get_spawn_point(spawn_points, i, map.tile_size), unit(rng) * 2.0f * MathUtil::PI_32);
+
+	// Only simulates what exists after the setup: the frames after the warmup must not allocate
+	FrameSampler sampler(true);
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			world.update(config.delta_time);
+		});
+
+	json.field("name", "projectiles");
+	json.field("projectiles", config.projectiles);
+	sampler.write(json);
+	write_pools(json, world.registry);
+}
+
+void run_analytic_projectiles_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	std::mt19937 rng(config.seed);
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = load_collision_map(world, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+
+	ProjectileType type = create_bouncing_projectile_type();
+	type.analytic = true;
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	for (u32 i = 0; i < config.projectiles; i++)
+		AnalyticProjectiles::spawn(world.registry, entt::null, type, ScriptedTanks::get_spawn_point(spawn_points, i, map.tile_size), unit(rng) * 2.0f * MathUtil::PI_32);
+
+	// Only simulates what exists after the setup: the frames after the warmup must not allocate
+	FrameSampler sampler(true);
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			world.update(config.delta_time);
+		});
+
+	json.field("name", "analytic_projectiles");
+	json.field("projectiles", config.projectiles);
+	json.field("projectiles_alive", world.registry.ctx().get<AnalyticProjectiles>().size());
+	sampler.write(json);
+}
+
+void run_map_collision_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	json.field("name", "map_collision");
+	json.field("tanks", config.tanks);
+	json.field("projectiles", config.projectiles);
+
+	json.key("geometry");
+	json.begin_array();
+	for (bool merge : { false, true })
+	{
+		// Same seed for both, so both runs get the same inputs until the geometry makes them diverge
+		std::mt19937 rng(config.seed);
+		std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+		World world;
+		Tileset tileset(TILESET, PIXEL_SCALE);
+		entt::entity map_entity = load_collision_map(world, tileset, merge);
+		Map& map = world.registry.get<Map>(map_entity);
+		Projectile::prewarm_pool(world.registry, 32);
+
+		std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+		ScriptedTanks tanks(map, config.seed);
+		tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+		ProjectileType type = create_bouncing_projectile_type();
+		for (u32 i = 0; i < config.projectiles; i++)
+			Projectile::create_projectile(world.registry, entt::null, type, ScriptedTanks::get_spawn_point(spawn_points, i, map.tile_size), unit(rng) * 2.0f * MathUtil::PI_32);
+
+		FrameSampler sampler;
+		run_frames(config, sampler, world.registry, [&](u32 frame)
+			{
+				world.handle_inputs(config.delta_time, &tanks);
+				world.update(config.delta_time);
+			});
+
+		json.begin_object();
+		json.field("merged", merge);
+		json.field("unmerged_collision_shapes", map.unmerged_collision_shape_count);
+		json.field("collision_shapes", map.collision_shapes.size());
+		sampler.write(json);
+		json.end_object();
+	}
+	json.end_array();
+}
+
+void run_particles_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	std::mt19937 rng(config.seed);
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = load_collision_map(world, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+	ParticleSystem::create_particle_system(world.registry);
+	ParticleSystem& particles = world.registry.ctx().get<ParticleSystem>();
+
+	AssetManager& assets = AssetManager::get_instance();
+	u32 wave_frames = std::max(1u, (u32)(EXPLOSION_INTERVAL / config.delta_time));
+
+	// Static smoke stacks; without a Velocity they always emit at the full rate
+	for (u32 i = 0; i < config.emitters; i++)
+	{
+		entt::entity entity = world.registry.create();
+		world.registry.emplace<Transform>(entity, glm::vec2(unit(rng) * map.world_width, unit(rng) * map.world_height), unit(rng) * 2.0f * MathUtil::PI_32);
+		world.registry.emplace<ParticleEmitters>(entity).add({ &assets.particle_smoke, ParticleEmitterMode::Continuous, EMITTER_RATE,
+			glm::vec2(0.0f), { 0.0f, 0.5f }, MathUtil::PI_32 * 0.25f, 0.0f, 0.5f, 10.0f });
+	}
+
+	u64 max_particles = 0;
+	// The explosions take particles from the fixed capacity: the frames after the warmup must not allocate
+	FrameSampler sampler(true);
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			if (frame % wave_frames == 0)
+			{
+				for (u32 i = 0; i < config.explosions; i++)
+				{
+					Transform transform{ glm::vec2(unit(rng) * map.world_width, unit(rng) * map.world_height), unit(rng) * 2.0f * MathUtil::PI_32 };
+					ParticleSystem::spawn(world.registry, assets.particle_explosion[i % assets.particle_explosion.size()], transform, 20.0f);
+				}
+			}
+			world.update(config.delta_time);
+			max_particles = std::max<u64>(max_particles, particles.size());
+		});
+
+	json.field("name", "particles");
+	json.field("explosions_per_wave", config.explosions);
+	json.field("emitters", config.emitters);
+	json.field("max_live_particles", max_particles);
+	json.field("particles_spawned", particles.spawned);
+	json.field("particles_dropped", particles.dropped);
+	sampler.write(json);
+}
+
+enum class MapEncoding : u8
+{
+	Csv = 0,
+	Base64 = 1,
+	Zlib = 2,
+	Gzip = 3
+};
+
+const static char* MAP_ENCODING_NAMES[4] = { "csv", "base64", "zlib", "gzip" };
+
+static std::string encode_base64(const u8* data, usz size)
+{
+	const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string text;
+	text.reserve((size + 2) / 3 * 4);
+	for (usz i = 0; i < size; i += 3)
+	{
+		u32 block = (u32)data[i] << 16;
+		if (i + 1 < size)
+			block |= (u32)data[i + 1] << 8;
+		if (i + 2 < size)
+			block |= data[i + 2];
+
+		text += alphabet[(block >> 18) & 63];
+		text += alphabet[(block >> 12) & 63];
+		text += i + 1 < size ? alphabet[(block >> 6) & 63] : '=';
+		text += i + 2 < size ? alphabet[block & 63] : '=';
+	}
+	return text;
+}
+
+static u32 crc32(const u8* data, usz size)
+{
+	u32 crc = 0xFFFFFFFF;
+	for (usz i = 0; i < size; i++)
+	{
+		crc ^= data[i];
+		for (u32 bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+/// Compresses with the zlib encoder of stb_image_write; gzip wraps the same deflate stream in a gzip header and trailer
+static std::vector<u8> compress(const std::vector<u8>& data, MapEncoding encoding)
+{
+	int zlib_size;
+	u8* zlib_data = stbi_zlib_compress((u8*)data.data(), (int)data.size(), &zlib_size, 8);
+	if (!zlib_data)
+		throw std::runtime_error("Failed to compress map data");
+
+	std::vector<u8> compressed;
+	if (encoding == MapEncoding::Zlib)
+	{
+		compressed.assign(zlib_data, zlib_data + zlib_size);
+	}
+	else
+	{
+		// Strip the 2 byte zlib header and the adler32 trailer
+		compressed = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+		compressed.insert(compressed.end(), zlib_data + 2, zlib_data + zlib_size - 4);
+
+		u32 crc = crc32(data.data(), data.size());
+		u32 size = (u32)data.size();
+		for (u32 i = 0; i < 4; i++)
+			compressed.push_back((u8)(crc >> (i * 8)));
+		for (u32 i = 0; i < 4; i++)
+			compressed.push_back((u8)(size >> (i * 8)));
+	}
+
+	free(zlib_data);
+	return compressed;
+}
+
+/// Writes a TMX map of the given size that repeats the tiles of the source map
+static usz write_tiled_map(const Map& source, u32 size, MapEncoding encoding, const std::filesystem::path& path)
+{
+	const MapGridLayer* source_layer = nullptr;
+	for (auto& variant : source.layers)
+	{
+		if (std::holds_alternative<MapGridLayer>(variant))
+		{
+			source_layer = &std::get<MapGridLayer>(variant);
+			break;
+		}
+	}
+	if (!source_layer)
+		throw std::runtime_error("Map has no tile layer: " + std::string(COLLISION_MAP));
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("Failed to open file: " + path.string());
+
+	file << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+	file << "<map version=\"1.8\" orientation=\"orthogonal\" renderorder=\"right-down\" width=\"" << size << "\" height=\"" << size
+		<< "\" tilewidth=\"" << PIXEL_SCALE << "\" tileheight=\"" << PIXEL_SCALE << "\" infinite=\"0\">\n";
+	file << " <tileset firstgid=\"" << source.first_gid << "\" source=\"" << TILESET << "\"/>\n";
+	file << " <layer id=\"1\" name=\"Tile Layer 1\" width=\"" << size << "\" height=\"" << size << "\">\n";
+
+	auto get_gid = [&](u32 x, u32 y)
+		{
+			return source_layer->tile_ids[(y % source_layer->v_tiles) * source_layer->h_tiles + x % source_layer->h_tiles];
+		};
+
+	if (encoding == MapEncoding::Csv)
+	{
+		file << "  <data encoding=\"csv\">\n";
+		for (u32 y = 0; y < size; y++)
+		{
+			for (u32 x = 0; x < size; x++)
+			{
+				file << get_gid(x, y);
+				if (x + 1 < size || y + 1 < size)
+					file << ',';
+			}
+			file << '\n';
+		}
+	}
+	else
+	{
+		std::vector<u8> bytes;
+		bytes.reserve((usz)size * size * 4);
+		for (u32 y = 0; y < size; y++)
+		{
+			for (u32 x = 0; x < size; x++)
+			{
+				u32 gid = get_gid(x, y);
+				for (u32 i = 0; i < 4; i++)
+					bytes.push_back((u8)(gid >> (i * 8)));
+			}
+		}
+
+		file << "  <data encoding=\"base64\"";
+		if (encoding != MapEncoding::Base64)
+		{
+			bytes = compress(bytes, encoding);
+			file << " compression=\"" << MAP_ENCODING_NAMES[(u8)encoding] << "\"";
+		}
+		file << ">\n   " << encode_base64(bytes.data(), bytes.size()) << "\n  ";
+	}
+	file << "</data>\n </layer>\n</map>\n";
+	file.close();
+
+	return std::filesystem::file_size(path);
+}
+
+void run_map_load_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	Map source(COLLISION_MAP, PIXEL_SCALE);
+	Tileset tileset(TILESET, PIXEL_SCALE);
+
+	json.field("name", "map_load");
+	json.key("maps");
+	json.begin_array();
+	for (u32 size : config.map_sizes)
+	{
+		for (u8 encoding = 0; encoding < 4; encoding++)
+		{
+			const char* encoding_name = MAP_ENCODING_NAMES[encoding];
+			std::filesystem::path path = std::filesystem::temp_directory_path() / ("tankgame_bench_map_" + std::to_string(size) + "_" + encoding_name + ".tmx");
+			usz file_bytes = write_tiled_map(source, size, (MapEncoding)encoding, path);
+			std::string location = path.string();
+
+			// The map physics and the compiled blob don't depend on the encoding, they are only measured for csv
+			bool measure_physics = (MapEncoding)encoding == MapEncoding::Csv;
+
+			std::vector<f64> parse_ms;
+			std::vector<f64> parse_allocations;
+			std::vector<f64> physics_ms;
+			std::vector<f64> blob_load_ms;
+			std::vector<f64> blob_physics_ms;
+			u32 shape_count = 0;
+			usz blob_bytes = 0;
+
+			for (u32 i = 0; i < config.map_load_repeats; i++)
+			{
+				World world;
+
+				u64 allocations_start = Memory::get_allocation_count();
+				auto start = std::chrono::steady_clock::now();
+				entt::entity map_entity = Map::create_map_entity(world.registry, location.c_str(), PIXEL_SCALE);
+				parse_ms.push_back(elapsed_ms(start));
+				parse_allocations.push_back((f64)(Memory::get_allocation_count() - allocations_start));
+
+				if (measure_physics)
+				{
+					start = std::chrono::steady_clock::now();
+					Map::create_map_physics(world.registry, map_entity, tileset);
+					physics_ms.push_back(elapsed_ms(start));
+					shape_count = b2Body_GetShapeCount(world.registry.get<Physics>(map_entity).body);
+				}
+			}
+
+			if (measure_physics)
+			{
+				std::filesystem::path blob_path = path;
+				blob_path.replace_extension(".tgmap");
+				std::string blob_location = blob_path.string();
+				MapBlob::compile(location.c_str(), TILESET, blob_location.c_str(), PIXEL_SCALE);
+				blob_bytes = std::filesystem::file_size(blob_path);
+
+				for (u32 i = 0; i < config.map_load_repeats; i++)
+				{
+					World world;
+					Tileset blob_tileset;
+
+					auto start = std::chrono::steady_clock::now();
+					entt::entity map_entity = MapBlob::load_map_entity(world.registry, blob_location.c_str(), blob_tileset);
+					blob_load_ms.push_back(elapsed_ms(start));
+
+					start = std::chrono::steady_clock::now();
+					Map::create_map_physics(world.registry, map_entity, blob_tileset);
+					blob_physics_ms.push_back(elapsed_ms(start));
+				}
+				std::filesystem::remove(blob_path);
+			}
+
+			std::filesystem::remove(path);
+
+			json.begin_object();
+			json.field("size", size);
+			json.field("encoding", encoding_name);
+			json.field("tiles", (u64)size * size);
+			json.field("file_bytes", file_bytes);
+			json.key("parse_ms");
+			write_stats(json, parse_ms);
+			json.key("parse_allocations");
+			write_stats(json, parse_allocations);
+			if (measure_physics)
+			{
+				json.field("shapes", shape_count);
+				json.key("physics_ms");
+				write_stats(json, physics_ms);
+				json.field("blob_bytes", blob_bytes);
+				json.key("blob_load_ms");
+				write_stats(json, blob_load_ms);
+				json.key("blob_physics_ms");
+				write_stats(json, blob_physics_ms);
+			}
+			json.end_object();
+		}
+	}
+	json.end_array();
+}
+
+void run_map_streaming_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// Camera panning around the map, in world units per second
+	const static f32 CAMERA_SPEED = 24.0f;
+
+	Map source(COLLISION_MAP, PIXEL_SCALE);
+
+	json.field("name", "map_streaming");
+	json.field("tanks", config.tanks);
+	json.key("maps");
+	json.begin_array();
+	for (u32 size : config.map_sizes)
+	{
+		std::filesystem::path path = std::filesystem::temp_directory_path() / ("tankgame_bench_streamed_map_" + std::to_string(size) + ".tmx");
+		write_tiled_map(source, size, MapEncoding::Base64, path);
+
+		std::mt19937 rng(config.seed);
+
+		World world;
+		Tileset tileset(TILESET, PIXEL_SCALE);
+		entt::entity map_entity = Map::create_map_entity(world.registry, path.string().c_str(), PIXEL_SCALE);
+		std::filesystem::remove(path);
+		MapStreamer::create_map_streamer(world.registry, map_entity, tileset);
+		Map& map = world.registry.get<Map>(map_entity);
+		MapStreamer& streamer = world.registry.get<MapStreamer>(map_entity);
+		Projectile::prewarm_pool(world.registry, 32);
+
+		std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+		ScriptedTanks tanks(map, config.seed);
+		tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+
+		// The camera circles around the map center, so it keeps entering new chunks
+		Camera camera(1280.0f, 720.0f);
+		camera.h_scope = 32.0f;
+		glm::vec2 map_center = glm::vec2(map.world_width, map.world_height) * 0.5f;
+		f32 orbit_radius = std::min(map.world_width, map.world_height) * 0.35f;
+
+		std::vector<f64> resident_chunks;
+		std::vector<f64> resident_shapes;
+		std::vector<f64> resident_render_tiles;
+
+		FrameSampler sampler;
+		run_frames(config, sampler, world.registry, [&](u32 frame)
+			{
+				f32 angle = frame * config.delta_time * CAMERA_SPEED / std::max(orbit_radius, 1.0f);
+				camera.center = map_center + orbit_radius * glm::vec2(std::cos(angle), std::sin(angle));
+				camera.update_matrix();
+
+				Rect view = camera.get_bounding_rect();
+				MapStreamer::update_streaming(world.registry, { &view, 1 });
+				world.handle_inputs(config.delta_time, &tanks);
+				world.update(config.delta_time);
+
+				if (frame >= config.warmup_frames)
+				{
+					MapStreamingStats stats = streamer.get_stats();
+					resident_chunks.push_back(stats.resident_chunks);
+					resident_shapes.push_back(stats.resident_shapes);
+					resident_render_tiles.push_back(stats.resident_render_tiles);
+				}
+			});
+
+		MapStreamingStats stats = streamer.get_stats();
+
+		json.begin_object();
+		json.field("size", size);
+		json.field("tiles", (u64)size * size);
+		json.field("chunks", stats.chunks);
+		json.field("chunk_loads", stats.chunk_loads);
+		json.field("chunk_unloads", stats.chunk_unloads);
+		json.key("resident_chunks");
+		write_stats(json, resident_chunks);
+		json.key("resident_shapes");
+		write_stats(json, resident_shapes);
+		json.key("resident_render_tiles");
+		write_stats(json, resident_render_tiles);
+		sampler.write(json);
+		json.end_object();
+	}
+	json.end_array();
+}
+
+void run_navigation_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// Flow field agents share this many goals
+	const static u32 SHARED_GOALS = 4;
+
+	std::mt19937 rng(config.seed);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = load_collision_map(world, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+
+	json.field("name", "navigation");
+	json.field("agents", config.agents);
+
+	std::vector<f64> grid_ms, hierarchy_ms;
+	for (u32 i = 0; i < config.map_load_repeats; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		NavGrid grid(map, tileset, Navigation::get_tank_agent_radius());
+		grid_ms.push_back(elapsed_ms(start));
+
+		start = std::chrono::steady_clock::now();
+		NavHierarchy hierarchy(grid);
+		hierarchy_ms.push_back(elapsed_ms(start));
+	}
+	json.key("grid_build_ms");
+	write_stats(json, grid_ms);
+	json.key("hierarchy_build_ms");
+	write_stats(json, hierarchy_ms);
+
+	Navigation::create_navigation(world.registry, map_entity, tileset);
+	Navigation& navigation = world.registry.ctx().get<Navigation>();
+	json.field("grid_cells", (u64)navigation.grid.width * navigation.grid.height);
+	json.field("hierarchy_nodes", navigation.hierarchy.nodes.size());
+
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	std::uniform_int_distribution<usz> pick(0, spawn_points.size() - 1);
+
+	// The same pairs with hierarchical and with plain A*
+	std::vector<f64> hierarchical_ms, grid_path_ms;
+	u32 unreachable = 0;
+	std::vector<glm::vec2> path;
+	for (u32 i = 0; i < config.path_queries; i++)
+	{
+		glm::vec2 start_pos = spawn_points[pick(rng)];
+		glm::vec2 goal_pos = spawn_points[pick(rng)];
+
+		auto start = std::chrono::steady_clock::now();
+		unreachable += !navigation.find_path(start_pos, goal_pos, path);
+		hierarchical_ms.push_back(elapsed_ms(start));
+
+		start = std::chrono::steady_clock::now();
+		navigation.find_grid_path(start_pos, goal_pos, path);
+		grid_path_ms.push_back(elapsed_ms(start));
+	}
+	json.field("path_queries", config.path_queries);
+	json.field("unreachable_queries", unreachable);
+	json.key("hierarchical_query_ms");
+	write_stats(json, hierarchical_ms);
+	json.key("grid_query_ms");
+	write_stats(json, grid_path_ms);
+
+	std::vector<glm::vec2> goals;
+	std::vector<f64> flow_field_ms;
+	for (u32 i = 0; i < SHARED_GOALS; i++)
+	{
+		goals.push_back(spawn_points[pick(rng)]);
+
+		NavFlowField field(navigation.grid, navigation.grid.to_cell(goals.back()));
+		auto start = std::chrono::steady_clock::now();
+		field.build(navigation.grid, std::numeric_limits<u32>::max());
+		flow_field_ms.push_back(elapsed_ms(start));
+	}
+	json.key("flow_field_build_ms");
+	write_stats(json, flow_field_ms);
+
+	// Half of the agents path to their own goals, the others follow the flow fields of the shared goals. Agents pick a new goal on arrival
+	std::vector<entt::entity> agents;
+	for (u32 i = 0; i < config.agents; i++)
+	{
+		TankDesign design{ (u8)(i % 4), (u8)(i % 8), (u8)(i % 8), (u8)(i % 4) };
+		entt::entity tank = Tank::create_tank(world.registry, design, ScriptedTanks::get_spawn_point(spawn_points, i, map.tile_size));
+		if (i % 2 == 0)
+			world.registry.emplace<NavAgent>(tank, spawn_points[pick(rng)], NavAgentMode::Path);
+		else
+			world.registry.emplace<NavAgent>(tank, goals[i / 2 % SHARED_GOALS], NavAgentMode::FlowField);
+		agents.push_back(tank);
+	}
+
+	u64 arrivals = 0;
+	std::vector<f64> pending_agents;
+
+	FrameSampler sampler;
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			u32 pending = 0;
+			for (u32 i = 0; i < agents.size(); i++)
+			{
+				NavAgent& agent = world.registry.get<NavAgent>(agents[i]);
+				if (agent.status == NavAgentStatus::Arrived || agent.status == NavAgentStatus::Unreachable)
+				{
+					arrivals += agent.status == NavAgentStatus::Arrived;
+					agent.set_goal(agent.mode == NavAgentMode::Path ? spawn_points[pick(rng)] : goals[(i / 2 + frame) % SHARED_GOALS]);
+				}
+				pending += agent.status == NavAgentStatus::Pending;
+			}
+			if (frame >= config.warmup_frames)
+				pending_agents.push_back(pending);
+
+			world.handle_inputs(config.delta_time);
+			world.update(config.delta_time);
+		});
+
+	json.field("arrivals", arrivals);
+	json.key("pending_agents");
+	write_stats(json, pending_agents);
+	sampler.write(json);
+}
+
+void run_visibility_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// View radius of the tank observers in tiles
+	const static f32 OBSERVER_RADIUS_TILES = 12.0f;
+
+	std::mt19937 rng(config.seed);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = load_collision_map(world, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+	Projectile::prewarm_pool(world.registry, 32);
+
+	json.field("name", "visibility");
+	json.field("tanks", config.tanks);
+
+	std::vector<f64> build_ms;
+	for (u32 i = 0; i < config.map_load_repeats; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		Visibility visibility(map, tileset);
+		build_ms.push_back(elapsed_ms(start));
+	}
+	json.key("build_ms");
+	write_stats(json, build_ms);
+
+	Visibility::create_visibility(world.registry, map_entity, tileset);
+	Visibility& visibility = world.registry.ctx().get<Visibility>();
+	json.field("segments", visibility.segments.size());
+
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	ScriptedTanks tanks(map, config.seed);
+	tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+	for (entt::entity tank : tanks.tanks)
+		world.registry.emplace<VisibilityObserver>(tank, OBSERVER_RADIUS_TILES * map.tile_size);
+
+	std::vector<std::pair<entt::entity, entt::entity>> pairs;
+	for (usz i = 0; i < tanks.tanks.size(); i++)
+	{
+		for (usz j = i + 1; j < tanks.tanks.size(); j++)
+			pairs.emplace_back(tanks.tanks[i], tanks.tanks[j]);
+	}
+	std::vector<u8> results(pairs.size());
+
+	b2QueryFilter filter = b2DefaultQueryFilter();
+	filter.maskBits = CATEGORY_MAP;
+
+	// Polygons from scratch at every tank, independent of the observer cache
+	std::vector<f64> polygon_ms;
+	std::vector<f64> polygon_vertices;
+	std::vector<glm::vec2> polygon;
+
+	// All pairs of tanks: cached batched queries against one physics raycast per pair
+	std::vector<f64> cached_ms, raycast_ms;
+	u64 mismatches = 0;
+
+	FrameSampler sampler;
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			world.handle_inputs(config.delta_time, &tanks);
+			world.update(config.delta_time);
+
+			if (frame < config.warmup_frames)
+				return;
+
+			auto start = std::chrono::steady_clock::now();
+			visibility.can_see(world.registry, pairs, results);
+			cached_ms.push_back(elapsed_ms(start));
+
+			start = std::chrono::steady_clock::now();
+			for (usz i = 0; i < pairs.size(); i++)
+			{
+				glm::vec2 from = world.registry.get<Transform>(pairs[i].first).pos;
+				glm::vec2 to = world.registry.get<Transform>(pairs[i].second).pos;
+				b2RayResult result = b2World_CastRayClosest(world.physics_world, { from.x, from.y }, { to.x - from.x, to.y - from.y }, filter);
+				mismatches += result.hit == (results[i] != 0);
+			}
+			raycast_ms.push_back(elapsed_ms(start));
+
+			start = std::chrono::steady_clock::now();
+			for (entt::entity tank : tanks.tanks)
+			{
+				visibility.compute_visibility_polygon(world.registry.get<Transform>(tank).pos, OBSERVER_RADIUS_TILES * map.tile_size, polygon);
+				polygon_vertices.push_back(polygon.size());
+			}
+			polygon_ms.push_back(elapsed_ms(start));
+		});
+
+	json.field("pairs", pairs.size());
+	json.key("cached_line_of_sight_ms");
+	write_stats(json, cached_ms);
+	json.key("raycast_line_of_sight_ms");
+	write_stats(json, raycast_ms);
+	json.field("cache_hits", visibility.cache_hits);
+	json.field("cache_misses", visibility.cache_misses);
+	// Differences come from the rounded corners of the physics shapes and the cached results of tanks that moved less than the threshold
+	json.field("raycast_mismatches", mismatches);
+	json.key("polygon_ms");
+	write_stats(json, polygon_ms);
+	json.key("polygon_vertices");
+	write_stats(json, polygon_vertices);
+	sampler.write(json);
+}
+
+void run_map_destruction_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// Side length of the generated map in tiles
+	const static u32 MAP_SIZE = 128;
+	// Share of the empty tiles that get a destructible block
+	const static f32 BLOCK_DENSITY = 0.1f;
+	// Tileset tile id of the small destructible block
+	const static u32 BLOCK_TILE_ID = 80;
+
+	std::mt19937 rng(config.seed);
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+	// collision_map.tmx with destructible blocks scattered over the empty tiles
+	Map source(COLLISION_MAP, PIXEL_SCALE);
+	for (auto& variant : source.layers)
+	{
+		if (!std::holds_alternative<MapGridLayer>(variant))
+			continue;
+
+		MapGridLayer& layer = std::get<MapGridLayer>(variant);
+		for (u32 i = 0; i < layer.h_tiles * layer.v_tiles; i++)
+		{
+			if (layer.tile_ids[i] == 0 && unit(rng) < BLOCK_DENSITY)
+				layer.tile_ids[i] = source.first_gid + BLOCK_TILE_ID;
+		}
+		break;
+	}
+	std::filesystem::path path = std::filesystem::temp_directory_path() / "tankgame_bench_destruction_map.tmx";
+	write_tiled_map(source, MAP_SIZE, MapEncoding::Csv, path);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = Map::create_map_entity(world.registry, path.string().c_str(), PIXEL_SCALE);
+	Map& map = world.registry.get<Map>(map_entity);
+	Map::create_map_physics(world.registry, map_entity, tileset);
+	MapDestruction& destruction = world.registry.get<MapDestruction>(map_entity);
+	Projectile::prewarm_pool(world.registry, 32);
+
+	json.field("name", "map_destruction");
+	json.field("size", MAP_SIZE);
+	json.field("tanks", config.tanks);
+	json.field("static_shapes", map.collision_shapes.size());
+	json.field("destructible_tiles", destruction.destructible_tiles);
+
+	// What a tile change costs without MapDestruction: a new map body with all shapes
+	std::vector<f64> rebuild_ms;
+	std::vector<MapCollisionShape> shapes;
+	for (u32 i = 0; i < config.map_load_repeats; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		shapes.clear();
+		map.get_collision_shapes(tileset, shapes);
+		map.merge_collision_shapes(shapes);
+		entt::entity body_entity = world.registry.create();
+		Physics& physics = world.registry.emplace<Physics>(body_entity, false);
+		for (const MapCollisionShape& shape : shapes)
+			Map::create_physics_shape(physics, shape);
+		world.registry.destroy(body_entity);
+		rebuild_ms.push_back(elapsed_ms(start));
+	}
+	json.key("full_body_rebuild_ms");
+	write_stats(json, rebuild_ms);
+
+	// The tanks shoot the blocks down
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	ScriptedTanks tanks(map, config.seed);
+	tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+	FrameSampler sampler;
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			world.handle_inputs(config.delta_time, &tanks);
+			world.update(config.delta_time);
+		});
+	json.field("destroyed_by_projectiles", destruction.destroyed_tiles);
+	sampler.write(json);
+
+	// Then every remaining block one at a time
+	std::vector<glm::uvec3> remaining;
+	for (u32 layer_index = 0; layer_index < map.layers.size(); layer_index++)
+	{
+		if (!std::holds_alternative<MapGridLayer>(map.layers[layer_index]))
+			continue;
+
+		const MapGridLayer& layer = std::get<MapGridLayer>(map.layers[layer_index]);
+		for (u32 i = 0; i < layer.h_tiles * layer.v_tiles; i++)
+		{
+			if (layer.tile_health[i] != 0)
+				remaining.emplace_back(layer_index, i % layer.h_tiles, i / layer.h_tiles);
+		}
+	}
+	std::shuffle(remaining.begin(), remaining.end(), rng);
+
+	std::vector<f64> destroy_ms;
+	for (const glm::uvec3& tile : remaining)
+	{
+		auto start = std::chrono::steady_clock::now();
+		MapDestruction::damage_tile(world.registry, map_entity, tile.x, tile.y, tile.z, std::numeric_limits<u16>::max());
+		destroy_ms.push_back(elapsed_ms(start));
+	}
+	json.key("tile_destroy_ms");
+	write_stats(json, destroy_ms);
+	json.field("change_log_entries", destruction.change_log.size());
+	json.field("change_log_bytes", destruction.change_log.size() * sizeof(MapTileChange));
+
+	// A second copy of the map replays the change log and has to end up with the same tiles
+	World replay_world;
+	entt::entity replay_entity = Map::create_map_entity(replay_world.registry, path.string().c_str(), PIXEL_SCALE);
+	std::filesystem::remove(path);
+	Map::create_map_physics(replay_world.registry, replay_entity, tileset);
+
+	auto start = std::chrono::steady_clock::now();
+	for (const MapTileChange& change : destruction.change_log)
+		MapDestruction::apply_change(replay_world.registry, replay_entity, change);
+	json.field("replay_ms", elapsed_ms(start));
+
+	Map& replay_map = replay_world.registry.get<Map>(replay_entity);
+	bool replay_matches = true;
+	for (u32 layer_index = 0; layer_index < map.layers.size(); layer_index++)
+	{
+		if (!std::holds_alternative<MapGridLayer>(map.layers[layer_index]))
+			continue;
+
+		const MapGridLayer& layer = std::get<MapGridLayer>(map.layers[layer_index]);
+		const MapGridLayer& replay_layer = std::get<MapGridLayer>(replay_map.layers[layer_index]);
+		replay_matches &= std::equal(layer.tile_ids.get(), layer.tile_ids.get() + layer.h_tiles * layer.v_tiles, replay_layer.tile_ids.get());
+	}
+	json.field("replay_matches", replay_matches);
+}
+
+void run_spatial_hash_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// Every tank asks for the entities around it and its nearest other tanks
+	const static f32 QUERY_RADIUS_TILES = 5.0f;
+	const static u32 NEAREST_COUNT = 4;
+	// The batched queries are split over this many threads
+	const static u32 QUERY_THREADS = 4;
+	// Copies of the tank queries in the threaded batch
+	const static u32 BATCH_REPEATS = 16;
+
+	std::mt19937 rng(config.seed);
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = load_collision_map(world, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+	Projectile::prewarm_pool(world.registry, 32);
+
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	ScriptedTanks tanks(map, config.seed);
+	tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+	ProjectileType type = create_bouncing_projectile_type();
+	for (u32 i = 0; i < config.projectiles; i++)
+		Projectile::create_projectile(world.registry, entt::null, type, ScriptedTanks::get_spawn_point(spawn_points, i, map.tile_size), unit(rng) * 2.0f * MathUtil::PI_32);
+
+	SpatialHash& hash = world.registry.ctx().get<SpatialHash>();
+	f32 radius = QUERY_RADIUS_TILES * map.tile_size;
+
+	json.field("name", "spatial_hash");
+	json.field("tanks", config.tanks);
+	json.field("projectiles", config.projectiles);
+	json.field("cell_size", hash.cell_size);
+
+	std::vector<SpatialRadiusQuery> radius_queries;
+	std::vector<SpatialNearestQuery> nearest_queries;
+	SpatialQueryResults radius_results, nearest_results;
+	std::vector<entt::entity> scan_result;
+	std::vector<std::pair<f32, entt::entity>> scan_distances;
+
+	std::vector<SpatialRadiusQuery> batch_queries;
+	std::vector<SpatialQueryResults> batch_results(QUERY_THREADS);
+
+	std::vector<f64> hash_radius_ms, scan_radius_ms, hash_nearest_ms, scan_nearest_ms, threaded_batch_ms;
+	u64 mismatches = 0;
+
+	FrameSampler sampler;
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			world.handle_inputs(config.delta_time, &tanks);
+			world.update(config.delta_time);
+
+			if (frame < config.warmup_frames)
+				return;
+
+			radius_queries.clear();
+			nearest_queries.clear();
+			for (entt::entity tank : tanks.tanks)
+			{
+				glm::vec2 pos = world.registry.get<Transform>(tank).pos;
+				radius_queries.emplace_back(pos, radius, CATEGORY_TANK | CATEGORY_PROJECTILE);
+				nearest_queries.emplace_back(pos, NEAREST_COUNT, std::numeric_limits<f32>::max(), CATEGORY_TANK, tank);
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			hash.query_radius(radius_queries, radius_results);
+			hash_radius_ms.push_back(elapsed_ms(start));
+
+			start = std::chrono::steady_clock::now();
+			hash.query_nearest(nearest_queries, nearest_results);
+			hash_nearest_ms.push_back(elapsed_ms(start));
+
+			// The same queries by scanning the registry
+			start = std::chrono::steady_clock::now();
+			for (usz i = 0; i < radius_queries.size(); i++)
+			{
+				scan_result.clear();
+				auto scan = [&](entt::entity entity, const Transform& transform)
+					{
+						if (glm::distance(transform.pos, radius_queries[i].center) <= radius)
+							scan_result.push_back(entity);
+					};
+				for (auto [entity, tank, transform] : world.registry.view<Tank, Transform>().each())
+					scan(entity, transform);
+				for (auto [entity, projectile, transform] : world.registry.view<Projectile, Transform>(entt::exclude<Pooled>).each())
+					scan(entity, transform);
+				mismatches += scan_result.size() != radius_results.offsets[i + 1] - radius_results.offsets[i];
+			}
+			scan_radius_ms.push_back(elapsed_ms(start));
+
+			start = std::chrono::steady_clock::now();
+			for (usz i = 0; i < nearest_queries.size(); i++)
+			{
+				scan_distances.clear();
+				for (auto [entity, tank, transform] : world.registry.view<Tank, Transform>().each())
+				{
+					if (entity != nearest_queries[i].ignore)
+						scan_distances.emplace_back(glm::distance(transform.pos, nearest_queries[i].pos), entity);
+				}
+				usz count = std::min<usz>(NEAREST_COUNT, scan_distances.size());
+				std::partial_sort(scan_distances.begin(), scan_distances.begin() + count, scan_distances.end());
+				mismatches += count != nearest_results.offsets[i + 1] - nearest_results.offsets[i] ||
+					(count != 0 && scan_distances[0].second != nearest_results.entities[nearest_results.offsets[i]]);
+			}
+			scan_nearest_ms.push_back(elapsed_ms(start));
+
+			// Batched queries from worker threads, each with its own results
+			batch_queries.clear();
+			for (u32 i = 0; i < BATCH_REPEATS; i++)
+				batch_queries.insert(batch_queries.end(), radius_queries.begin(), radius_queries.end());
+
+			start = std::chrono::steady_clock::now();
+			std::vector<std::thread> threads;
+			usz per_thread = (batch_queries.size() + QUERY_THREADS - 1) / QUERY_THREADS;
+			for (u32 t = 0; t < QUERY_THREADS; t++)
+			{
+				usz begin = std::min(t * per_thread, batch_queries.size());
+				usz end = std::min(begin + per_thread, batch_queries.size());
+				threads.emplace_back([&, t, begin, end]()
+					{
+						hash.query_radius(std::span(batch_queries).subspan(begin, end - begin), batch_results[t]);
+					});
+			}
+			for (std::thread& thread : threads)
+				thread.join();
+			threaded_batch_ms.push_back(elapsed_ms(start));
+		});
+
+	json.key("hash_radius_ms");
+	write_stats(json, hash_radius_ms);
+	json.key("scan_radius_ms");
+	write_stats(json, scan_radius_ms);
+	json.key("hash_nearest_ms");
+	write_stats(json, hash_nearest_ms);
+	json.key("scan_nearest_ms");
+	write_stats(json, scan_nearest_ms);
+	json.field("threaded_batch_queries", (u64)config.tanks * BATCH_REPEATS);
+	json.field("threaded_batch_threads", QUERY_THREADS);
+	json.key("threaded_batch_ms");
+	write_stats(json, threaded_batch_ms);
+	// Ties in the nearest distance can differ in the order
+	json.field("mismatches", mismatches);
+	sampler.write(json);
+}
+
+void run_scheduler_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// View radius of the tank observers in tiles
+	const static f32 OBSERVER_RADIUS_TILES = 12.0f;
+
+	json.field("name", "scheduler");
+	json.field("tanks", config.tanks);
+	json.field("projectiles", config.projectiles);
+	json.field("explosions_per_wave", config.explosions);
+	json.field("worker_threads", ThreadPool::get_shared().get_worker_count());
+
+	json.key("modes");
+	json.begin_array();
+	for (bool parallel : { false, true })
+	{
+		// Same seed for both, so both runs get the same inputs
+		std::mt19937 rng(config.seed);
+		std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+		// A client frame: the tanks and projectiles get their particle emitters
+		World world;
+		ParticleSystem::create_particle_system(world.registry);
+		SystemScheduler& scheduler = world.registry.ctx().get<SystemScheduler>();
+		scheduler.set_thread_pool(parallel ? &ThreadPool::get_shared() : nullptr);
+
+		Tileset tileset(TILESET, PIXEL_SCALE);
+		entt::entity map_entity = load_collision_map(world, tileset);
+		Map& map = world.registry.get<Map>(map_entity);
+		Projectile::prewarm_pool(world.registry, 32);
+		Visibility::create_visibility(world.registry, map_entity, tileset);
+
+		std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+		ScriptedTanks tanks(map, config.seed);
+		tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+		for (entt::entity tank : tanks.tanks)
+			world.registry.emplace<VisibilityObserver>(tank, OBSERVER_RADIUS_TILES * map.tile_size, 0.0f);
+
+		ProjectileType type = create_bouncing_projectile_type();
+		for (u32 i = 0; i < config.projectiles; i++)
+			Projectile::create_projectile(world.registry, entt::null, type, ScriptedTanks::get_spawn_point(spawn_points, i, map.tile_size), unit(rng) * 2.0f * MathUtil::PI_32);
+
+		AssetManager& assets = AssetManager::get_instance();
+		u32 wave_frames = std::max(1u, (u32)(EXPLOSION_INTERVAL / config.delta_time));
+
+		std::vector<f64> update_ms;
+		std::vector<f64> parallelism;
+		std::vector<std::vector<f64>> system_ms(scheduler.get_timings().size());
+
+		FrameSampler sampler;
+		run_frames(config, sampler, world.registry, [&](u32 frame)
+			{
+				if (frame % wave_frames == 0)
+				{
+					for (u32 i = 0; i < config.explosions; i++)
+					{
+						Transform transform{ glm::vec2(unit(rng) * map.world_width, unit(rng) * map.world_height), unit(rng) * 2.0f * MathUtil::PI_32 };
+						ParticleSystem::spawn(world.registry, assets.particle_explosion[i % assets.particle_explosion.size()], transform, 20.0f);
+					}
+				}
+				world.handle_inputs(config.delta_time, &tanks);
+				world.update(config.delta_time);
+
+				if (frame < config.warmup_frames)
+					return;
+
+				update_ms.push_back(scheduler.last_frame_ms);
+				parallelism.push_back(scheduler.last_frame_ms > 0.0 ? scheduler.last_busy_ms / scheduler.last_frame_ms : 0.0);
+				for (usz i = 0; i < system_ms.size(); i++)
+					system_ms[i].push_back(scheduler.get_timings()[i].ms);
+			});
+
+		json.begin_object();
+		json.field("parallel", parallel);
+		json.key("update_ms");
+		write_stats(json, update_ms);
+		// Sum of the system times over the update time
+		json.key("parallelism");
+		write_stats(json, parallelism);
+		json.key("scheduled_systems_ms");
+		json.begin_array();
+		for (usz i = 0; i < system_ms.size(); i++)
+		{
+			json.begin_object();
+			json.field("system", scheduler.get_timings()[i].name);
+			json.key("ms");
+			write_stats(json, std::move(system_ms[i]));
+			json.end_object();
+		}
+		json.end_array();
+		sampler.write(json);
+		json.end_object();
+	}
+	json.end_array();
+}
+
+static LinkConditions get_replication_conditions(u32 latency_frames, const BenchConfig& config)
+{
+	LinkConditions conditions;
+	conditions.latency = latency_frames * config.delta_time;
+	conditions.loss = REPLICATION_LOSS;
+	return conditions;
+}
+
+/// A replication client at the far end of a loopback link
+struct ReplicationLink : NoCopy
+{
+	ReplicationLink(const LinkConditions& conditions, u32 seed)
+		: client(registry), link(conditions, conditions, seed)
+	{
+	}
+
+	entt::registry registry;
+	ReplicationClient client;
+	LoopbackLink link;
+};
+
+void run_replication_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// Per client; the first is practically unlimited
+	const static u32 BUDGETS[] = { 1u << 30, ReplicationSettings().bytes_per_second, 16 * 1024 };
+
+	json.field("name", "replication");
+	json.field("tanks", config.tanks);
+	// At least one, it reports the client side
+	u32 client_count = std::max(config.clients, 1u);
+	json.field("clients", client_count);
+	json.field("latency_frames", REPLICATION_LATENCY_FRAMES);
+	json.field("loss", REPLICATION_LOSS);
+
+	json.key("budgets");
+	json.begin_array();
+	for (u32 budget : BUDGETS)
+	{
+		std::mt19937 rng(config.seed);
+
+		World world;
+		Tileset tileset(TILESET, PIXEL_SCALE);
+		entt::entity map_entity = load_collision_map(world, tileset);
+		Map& map = world.registry.get<Map>(map_entity);
+		Projectile::prewarm_pool(world.registry, 32);
+
+		std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+		ScriptedTanks tanks(map, config.seed);
+		tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+
+		ReplicationSettings settings;
+		settings.tick_rate = std::max(1u, (u32)std::lround(1.0f / config.delta_time));
+		settings.bytes_per_second = budget;
+		settings.world_bounds = { 0.0f, 0.0f, map.world_width, map.world_height };
+		ReplicationServer server(world.registry, settings);
+
+		std::vector<std::unique_ptr<ReplicationLink>> links;
+		for (u32 i = 0; i < client_count; i++)
+		{
+			links.push_back(std::make_unique<ReplicationLink>(get_replication_conditions(REPLICATION_LATENCY_FRAMES, config), config.seed + i));
+			server.add_client();
+		}
+
+		std::vector<f64> encode_ms;
+		std::vector<f64> decode_ms;
+		std::vector<f64> entities;
+		ReplicationStats warm_stats;
+		ByteWriter ack;
+		std::vector<u8> packet;
+
+		FrameSampler sampler;
+		run_frames(config, sampler, world.registry, [&](u32 frame)
+			{
+				bool measure = frame >= config.warmup_frames;
+				if (frame == config.warmup_frames)
+					warm_stats = server.stats;
+
+				world.handle_inputs(config.delta_time, &tanks);
+				world.update(config.delta_time);
+
+				auto start = std::chrono::steady_clock::now();
+				server.update(frame + 1, [&](u32 client, NetChannel channel, const u8* data, usz size)
+					{
+						links[client]->link.send_to_client(channel, data, size);
+					});
+				if (measure)
+				{
+					encode_ms.push_back(elapsed_ms(start));
+					entities.push_back(server.last_tick_entities);
+				}
+
+				start = std::chrono::steady_clock::now();
+				for (u32 i = 0; i < links.size(); i++)
+				{
+					ReplicationLink& link = *links[i];
+					link.link.advance(config.delta_time);
+					while (link.link.receive_on_client(packet))
+						link.client.receive(packet.data(), packet.size());
+					if (link.client.write_ack(ack))
+						link.link.send_to_server(NetChannel::Snapshots, ack.data(), ack.size());
+					while (link.link.receive_on_server(packet))
+						server.receive(i, packet.data(), packet.size());
+				}
+				if (measure)
+					decode_ms.push_back(elapsed_ms(start));
+			});
+
+		const ReplicationStats& stats = server.stats;
+		u64 ticks = stats.ticks - warm_stats.ticks;
+		u64 bytes = stats.snapshot_bytes + stats.event_bytes - warm_stats.snapshot_bytes - warm_stats.event_bytes;
+		u64 entity_ticks = stats.entity_ticks - warm_stats.entity_ticks;
+		u64 snapshots = stats.snapshots_sent - warm_stats.snapshots_sent;
+
+		json.begin_object();
+		json.field("bytes_per_second", budget);
+		json.key("entities");
+		write_stats(json, entities);
+		json.field("bytes_per_tick_per_client", ticks > 0 ? (f64)bytes / (f64)(ticks * client_count) : 0.0);
+		json.field("bytes_per_tick_per_entity", entity_ticks > 0 ? (f64)bytes / (f64)entity_ticks : 0.0);
+		json.field("snapshot_bytes", stats.snapshot_bytes - warm_stats.snapshot_bytes);
+		json.field("event_bytes", stats.event_bytes - warm_stats.event_bytes);
+		json.field("records_per_snapshot", snapshots > 0 ? (f64)(stats.entity_records - warm_stats.entity_records) / (f64)snapshots : 0.0);
+		json.field("deferred_records", stats.deferred_records - warm_stats.deferred_records);
+		json.field("snapshots_skipped", stats.snapshots_skipped - warm_stats.snapshots_skipped);
+		// All clients replicate the same entities; the first one stands for all
+		json.field("client_entities", (u64)links[0]->registry.view<Replicated>().size());
+		json.field("client_snapshots_dropped", links[0]->client.snapshots_dropped);
+		json.key("encode_ms");
+		write_stats(json, encode_ms);
+		json.key("decode_ms");
+		write_stats(json, decode_ms);
+		sampler.write(json);
+		json.end_object();
+	}
+	json.end_array();
+}
+
+void run_prediction_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// One way, in frames
+	const static u32 LATENCIES[] = { 0, 3, 6, 12 };
+
+	json.field("name", "prediction");
+	json.field("tanks", config.tanks);
+	json.field("loss", REPLICATION_LOSS);
+
+	json.key("latencies");
+	json.begin_array();
+	for (u32 latency : LATENCIES)
+	{
+		std::mt19937 rng(config.seed);
+
+		World world;
+		Tileset tileset(TILESET, PIXEL_SCALE);
+		entt::entity map_entity = load_collision_map(world, tileset);
+		Map& map = world.registry.get<Map>(map_entity);
+		Projectile::prewarm_pool(world.registry, 32);
+
+		std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+		ScriptedTanks bots(map, config.seed);
+		bots.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+
+		ReplicationSettings settings;
+		settings.tick_rate = std::max(1u, (u32)std::lround(1.0f / config.delta_time));
+		settings.world_bounds = { 0.0f, 0.0f, map.world_width, map.world_height };
+		ReplicationServer server(world.registry, settings);
+		CommandSources commands{ &bots, &server };
+
+		// The client drives one more tank with scripted inputs of its own
+		entt::entity player_tank = Tank::create_tank(world.registry, TankDesign{ 2, 0, 0, 0 }, ScriptedTanks::get_spawn_point(spawn_points, config.tanks, map.tile_size));
+		world.registry.get<TankController>(player_tank).projectile_type = create_tank_projectile_type();
+		u32 client = server.add_client();
+		server.set_controlled_tank(client, player_tank);
+
+		entt::registry client_registry;
+		ReplicationClient replication(client_registry);
+		ClientPrediction prediction(client_registry);
+		ScriptedTanks player(map, config.seed + 1);
+		LinkConditions conditions = get_replication_conditions(latency, config);
+		LoopbackLink link(conditions, conditions, config.seed);
+
+		std::vector<f64> reconcile_ms;
+		std::vector<f64> errors;
+		PredictionStats warm_stats;
+		u64 checked_snapshots = 0;
+		ByteWriter ack;
+		ByteWriter inputs;
+		std::vector<u8> packet;
+
+		FrameSampler sampler;
+		run_frames(config, sampler, world.registry, [&](u32 frame)
+			{
+				bool measure = frame >= config.warmup_frames;
+				if (frame == config.warmup_frames)
+					warm_stats = prediction.stats;
+
+				while (link.receive_on_server(packet))
+					server.receive(client, packet.data(), packet.size());
+				world.handle_inputs(config.delta_time, &commands);
+				world.update(config.delta_time);
+				server.update(frame + 1, [&](u32, NetChannel channel, const u8* data, usz size)
+					{
+						link.send_to_client(channel, data, size);
+					});
+
+				link.advance(config.delta_time);
+				u64 snapshots = replication.snapshots_received;
+				while (link.receive_on_client(packet))
+					replication.receive(packet.data(), packet.size());
+
+				auto start = std::chrono::steady_clock::now();
+				prediction.reconcile(replication);
+				if (measure)
+				{
+					reconcile_ms.push_back(elapsed_ms(start));
+					if (replication.snapshots_received != snapshots && prediction.get_tank() != entt::null)
+					{
+						errors.push_back(prediction.stats.last_error);
+						checked_snapshots++;
+					}
+				}
+
+				if (prediction.get_tank() != entt::null && player.tanks.empty())
+					player.add_tank(prediction.get_tank());
+				player.write_inputs(client_registry, config.delta_time);
+				prediction.update(replication, config.delta_time);
+				if (prediction.write_inputs(inputs))
+					link.send_to_server(NetChannel::Snapshots, inputs.data(), inputs.size());
+				if (replication.write_ack(ack))
+					link.send_to_server(NetChannel::Snapshots, ack.data(), ack.size());
+			});
+
+		const PredictionStats& stats = prediction.stats;
+		u64 corrections = stats.corrections - warm_stats.corrections;
+
+		json.begin_object();
+		json.field("latency_frames", latency);
+		// How long a client without prediction waits to see its input
+		json.field("round_trip_ms", 2.0 * latency * config.delta_time * 1000.0);
+		json.field("commands", stats.commands - warm_stats.commands);
+		json.field("checked_snapshots", checked_snapshots);
+		json.field("corrections", corrections);
+		json.field("corrections_per_second", (f64)corrections / (config.frames * config.delta_time));
+		json.field("resimulated_per_correction", corrections > 0 ? (f64)(stats.resimulated_commands - warm_stats.resimulated_commands) / (f64)corrections : 0.0);
+		json.key("position_error");
+		write_stats(json, errors);
+		json.key("reconcile_ms");
+		write_stats(json, reconcile_ms);
+		sampler.write(json);
+		json.end_object();
+	}
+	json.end_array();
+}
+
+template<typename T>
+static void write_field_layout(JsonWriter& json, const char* name, const QuantizationBounds& bounds)
+{
+	json.begin_object();
+	json.field("type", name);
+	json.field("bits", Serializer<T>::get_bits(bounds));
+	json.key("fields");
+	json.begin_array();
+	Serializer<T>::for_each_field([&](u32, const auto& field)
+		{
+			json.begin_object();
+			json.field("name", field.name);
+			json.field("bits", field.codec.get_bits(bounds));
+			json.end_object();
+		});
+	json.end_array();
+	json.end_object();
+}
+
+void run_serialization_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	Map map(COLLISION_MAP, PIXEL_SCALE);
+	QuantizationBounds bounds({ 0.0f, 0.0f, map.world_width, map.world_height });
+
+	// Entity states of moving tanks all over the map
+	std::mt19937 rng(config.seed);
+	std::uniform_real_distribution<f32> x(0.0f, map.world_width);
+	std::uniform_real_distribution<f32> y(0.0f, map.world_height);
+	std::uniform_real_distribution<f32> angle(-MathUtil::PI_32, MathUtil::PI_32);
+	std::uniform_real_distribution<f32> speed(-8.0f, 8.0f);
+	std::vector<EntityState> states(std::max(config.tanks, 1u) * SERIALIZED_STATES_PER_TANK);
+	for (u32 i = 0; i < states.size(); i++)
+	{
+		EntityState& state = states[i];
+		state.net_id = i + 1;
+		state.transform = { { x(rng), y(rng) }, angle(rng) };
+		state.velocity = { { speed(rng), speed(rng) }, speed(rng) * 0.5f };
+		state.turret_orientation = angle(rng);
+		state.design = { (u8)(rng() % 4), (u8)(rng() % 8), (u8)(rng() % 8), (u8)(rng() % 4) };
+	}
+
+	json.field("name", "serialization");
+	json.field("states", (u64)states.size());
+	json.field("state_bytes", (u64)sizeof(EntityState));
+	json.key("layout");
+	json.begin_array();
+	write_field_layout<Transform>(json, "Transform", bounds);
+	write_field_layout<Velocity>(json, "Velocity", bounds);
+	write_field_layout<TankDesign>(json, "TankDesign", bounds);
+	write_field_layout<ParticleSpawn>(json, "ParticleSpawn", bounds);
+	json.end_array();
+
+	std::vector<EntityState> decoded(states.size());
+	ByteWriter writer;
+	writer.buffer.reserve(states.size() * sizeof(EntityState));
+	const AngleCodec turret_codec = { 12 };
+
+	// The raw encoding is what the snapshots sent before the bit packing: every field as f32 and bytes
+	auto encode_raw = [&]()
+		{
+			for (const EntityState& state : states)
+			{
+				writer.write(state.transform.pos);
+				writer.write(state.transform.rot);
+				writer.write(state.velocity.linear);
+				writer.write(state.velocity.angular);
+				writer.write(state.turret_orientation);
+				writer.write(state.design);
+			}
+		};
+	auto decode_raw = [&]()
+		{
+			ByteReader reader(writer.data(), writer.size());
+			for (EntityState& state : decoded)
+			{
+				state.transform.pos = reader.read<glm::vec2>();
+				state.transform.rot = reader.read<f32>();
+				state.velocity.linear = reader.read<glm::vec2>();
+				state.velocity.angular = reader.read<f32>();
+				state.turret_orientation = reader.read<f32>();
+				state.design = reader.read<TankDesign>();
+			}
+			return !reader.failed;
+		};
+	auto encode_quantized = [&]()
+		{
+			BitWriter bits(writer);
+			for (const EntityState& state : states)
+			{
+				Serializer<Transform>::write(bits, state.transform, bounds);
+				Serializer<Velocity>::write(bits, state.velocity, bounds);
+				turret_codec.write(bits, state.turret_orientation, bounds);
+				Serializer<TankDesign>::write(bits, state.design, bounds);
+			}
+			bits.flush();
+		};
+	auto decode_quantized = [&]()
+		{
+			BitReader bits(writer.data(), writer.size());
+			for (EntityState& state : decoded)
+			{
+				Serializer<Transform>::read(bits, state.transform, bounds);
+				Serializer<Velocity>::read(bits, state.velocity, bounds);
+				turret_codec.read(bits, state.turret_orientation, bounds);
+				Serializer<TankDesign>::read(bits, state.design, bounds);
+			}
+			return !bits.failed;
+		};
+
+	struct Encoding
+	{
+		const char* name;
+		std::function<void()> encode;
+		std::function<bool()> decode;
+	};
+	const Encoding encodings[] = { { "raw", encode_raw, decode_raw }, { "quantized", encode_quantized, decode_quantized } };
+
+	json.key("encodings");
+	json.begin_array();
+	for (const Encoding& encoding : encodings)
+	{
+		std::vector<f64> encode_ms;
+		std::vector<f64> decode_ms;
+		bool decoded_all = true;
+		for (u32 pass = 0; pass < SERIALIZATION_PASSES; pass++)
+		{
+			writer.clear();
+			auto start = std::chrono::steady_clock::now();
+			encoding.encode();
+			encode_ms.push_back(elapsed_ms(start));
+
+			start = std::chrono::steady_clock::now();
+			decoded_all &= encoding.decode();
+			decode_ms.push_back(elapsed_ms(start));
+		}
+
+		f32 position_error = 0.0f;
+		f32 rotation_error = 0.0f;
+		f32 velocity_error = 0.0f;
+		for (u32 i = 0; i < states.size(); i++)
+		{
+			position_error = std::max(position_error, glm::distance(states[i].transform.pos, decoded[i].transform.pos));
+			rotation_error = std::max(rotation_error, std::abs(MathUtil::normalize_angle_difference(states[i].transform.rot, decoded[i].transform.rot)));
+			velocity_error = std::max(velocity_error, glm::distance(states[i].velocity.linear, decoded[i].velocity.linear));
+		}
+
+		// Throughput in the in-memory size of the states
+		f64 state_bytes = (f64)(states.size() * sizeof(EntityState));
+		std::sort(encode_ms.begin(), encode_ms.end());
+		std::sort(decode_ms.begin(), decode_ms.end());
+
+		json.begin_object();
+		json.field("encoding", encoding.name);
+		json.field("decoded", decoded_all);
+		json.field("bytes_per_entity", (f64)writer.size() / (f64)states.size());
+		json.field("encode_gb_per_second", state_bytes / (encode_ms[encode_ms.size() / 2] * 1e6));
+		json.field("decode_gb_per_second", state_bytes / (decode_ms[decode_ms.size() / 2] * 1e6));
+		json.field("max_position_error", position_error);
+		json.field("max_rotation_error", rotation_error);
+		json.field("max_velocity_error", velocity_error);
+		json.key("encode_ms");
+		write_stats(json, encode_ms);
+		json.key("decode_ms");
+		write_stats(json, decode_ms);
+		json.end_object();
+	}
+	json.end_array();
+}
+
+/// FNV-1a over the replicated states of all clients; equal for two runs with the same seed if the harness is deterministic
+static u64 hash_client_states(const NetHarness& harness)
+{
+	u64 hash = 14695981039346656037ull;
+	auto add = [&](const void* data, usz size)
+		{
+			for (usz i = 0; i < size; i++)
+			{
+				hash ^= static_cast<const u8*>(data)[i];
+				hash *= 1099511628211ull;
+			}
+		};
+	for (const std::unique_ptr<NetHarness::Client>& client : harness.clients)
+	{
+		std::vector<std::pair<u32, Transform>> states;
+		for (auto [entity, replicated, transform] : client->registry.view<Replicated, Transform>().each())
+			states.emplace_back(replicated.net_id, transform);
+		std::sort(states.begin(), states.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+		for (const auto& [net_id, transform] : states)
+		{
+			add(&net_id, sizeof(net_id));
+			add(&transform.pos, sizeof(transform.pos));
+			add(&transform.rot, sizeof(transform.rot));
+		}
+	}
+	return hash;
+}
+
+static void write_link_stats(JsonWriter& json, const LinkStats& stats)
+{
+	json.begin_object();
+	json.field("packets", stats.packets_sent);
+	json.field("bytes", stats.bytes_sent);
+	json.field("lost", stats.packets_lost);
+	json.field("duplicated", stats.packets_duplicated);
+	json.field("dropped", stats.packets_dropped);
+	json.field("reordered", stats.packets_reordered);
+	json.end_object();
+}
+
+void run_loopback_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	struct Conditions
+	{
+		const char* name;
+		LinkConditions to_client;
+		LinkConditions to_server;
+	};
+	std::vector<Conditions> presets(3);
+	presets[0].name = "lan";
+	presets[0].to_client.latency = 0.001;
+	presets[1].name = "lossy";
+	presets[1].to_client.latency = 0.05;
+	presets[1].to_client.jitter = 0.02;
+	presets[1].to_client.loss = 0.05f;
+	presets[1].to_client.duplication = 0.01f;
+	presets[1].to_client.reordering = 0.02f;
+	// Congested downstream: the cap is below what the replication wants to send
+	presets[2].name = "congested";
+	presets[2].to_client = presets[1].to_client;
+	presets[2].to_client.latency = 0.1;
+	presets[2].to_client.bytes_per_second = 16 * 1024;
+	for (Conditions& preset : presets)
+		preset.to_server = preset.to_client;
+
+	u32 client_count = std::max(config.clients, 1u);
+	json.field("name", "loopback");
+	json.field("bots", config.tanks);
+	json.field("clients", client_count);
+
+	json.key("conditions");
+	json.begin_array();
+	for (const Conditions& preset : presets)
+	{
+		std::mt19937 rng(config.seed);
+
+		World world;
+		Tileset tileset(TILESET, PIXEL_SCALE);
+		entt::entity map_entity = load_collision_map(world, tileset);
+		Map& map = world.registry.get<Map>(map_entity);
+		Projectile::prewarm_pool(world.registry, 32);
+
+		std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+		ScriptedTanks bots(map, config.seed);
+		bots.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+
+		NetHarnessSettings settings;
+		settings.clients = client_count;
+		settings.seed = config.seed;
+		settings.to_client = preset.to_client;
+		settings.to_server = preset.to_server;
+		settings.replication.tick_rate = std::max(1u, (u32)std::lround(1.0f / config.delta_time));
+		settings.replication.world_bounds = { 0.0f, 0.0f, map.world_width, map.world_height };
+		settings.projectile_type = create_tank_projectile_type();
+		settings.first_spawn_point = config.tanks;
+		NetHarness harness(world, map, settings);
+
+		std::vector<f64> server_ms;
+		std::vector<f64> clients_ms;
+
+		FrameSampler sampler;
+		run_frames(config, sampler, world.registry, [&](u32 frame)
+			{
+				harness.tick(config.delta_time, &bots);
+				if (frame >= config.warmup_frames)
+				{
+					server_ms.push_back(harness.server_ms);
+					clients_ms.push_back(harness.clients_ms);
+				}
+			});
+
+		u64 corrections = 0;
+		u64 commands = 0;
+		u64 client_entities = 0;
+		u32 connected = 0;
+		for (const std::unique_ptr<NetHarness::Client>& client : harness.clients)
+		{
+			corrections += client->net.prediction.stats.corrections;
+			commands += client->net.prediction.stats.commands;
+			client_entities += client->registry.view<Replicated>().size();
+			connected += client->connected;
+		}
+		u64 server_entities = world.registry.view<Tank>().size();
+		for ([[maybe_unused]] entt::entity projectile : world.registry.view<Projectile>(entt::exclude<Pooled>))
+			server_entities++;
+		f64 seconds = (config.warmup_frames + config.frames) * config.delta_time;
+
+		json.begin_object();
+		json.field("conditions", preset.name);
+		json.field("connected", connected);
+		json.key("to_client");
+		write_link_stats(json, harness.get_to_client_stats());
+		json.key("to_server");
+		write_link_stats(json, harness.get_to_server_stats());
+		json.field("bytes_per_second_per_client", (f64)harness.get_to_client_stats().bytes_sent / seconds / client_count);
+		json.field("server_entities", server_entities);
+		json.field("client_entities_per_client", (f64)client_entities / client_count);
+		json.field("prediction_commands", commands);
+		json.field("prediction_corrections", corrections);
+		json.field("client_state_hash", std::to_string(hash_client_states(harness)));
+		json.key("server_tick_ms");
+		write_stats(json, server_ms);
+		json.key("client_updates_ms");
+		write_stats(json, clients_ms);
+		sampler.write(json);
+		json.end_object();
+	}
+	json.end_array();
+}
+
+void run_interest_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	struct Variant
+	{
+		const char* name;
+		bool interest;
+		u16 snapshot_rate;
+	};
+	const static Variant VARIANTS[] = { { "everything", false, 0 }, { "interest", true, 0 }, { "interest_20hz", true, 20 } };
+
+	json.field("name", "interest");
+	json.field("tanks", config.tanks);
+	u32 client_count = std::max(config.clients, 1u);
+	json.field("clients", client_count);
+
+	json.key("variants");
+	json.begin_array();
+	for (const Variant& variant : VARIANTS)
+	{
+		std::mt19937 rng(config.seed);
+
+		World world;
+		Tileset tileset(TILESET, PIXEL_SCALE);
+		entt::entity map_entity = load_collision_map(world, tileset);
+		Map& map = world.registry.get<Map>(map_entity);
+		Projectile::prewarm_pool(world.registry, 32);
+
+		std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+		ScriptedTanks tanks(map, config.seed);
+		tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+
+		ReplicationSettings settings;
+		settings.tick_rate = std::max(1u, (u32)std::lround(1.0f / config.delta_time));
+		settings.world_bounds = { 0.0f, 0.0f, map.world_width, map.world_height };
+		settings.interest.enabled = variant.interest;
+		ReplicationServer server(world.registry, settings);
+
+		// Every client watches one of the tanks, like a player's camera
+		std::vector<std::unique_ptr<ReplicationLink>> links;
+		for (u32 i = 0; i < client_count; i++)
+		{
+			links.push_back(std::make_unique<ReplicationLink>(get_replication_conditions(REPLICATION_LATENCY_FRAMES, config), config.seed + i));
+			links.back()->client.snapshot_rate = variant.snapshot_rate;
+			server.add_client();
+		}
+		glm::vec2 view_size = settings.interest.default_view_size;
+
+		std::vector<f64> encode_ms;
+		std::vector<f64> client_entities;
+		ReplicationStats warm_stats;
+		ByteWriter ack;
+		std::vector<u8> packet;
+
+		FrameSampler sampler;
+		run_frames(config, sampler, world.registry, [&](u32 frame)
+			{
+				bool measure = frame >= config.warmup_frames;
+				if (frame == config.warmup_frames)
+					warm_stats = server.stats;
+
+				world.handle_inputs(config.delta_time, &tanks);
+				world.update(config.delta_time);
+
+				auto start = std::chrono::steady_clock::now();
+				server.update(frame + 1, [&](u32 client, NetChannel channel, const u8* data, usz size)
+					{
+						links[client]->link.send_to_client(channel, data, size);
+					});
+				if (measure)
+					encode_ms.push_back(elapsed_ms(start));
+
+				f64 entities = 0.0;
+				for (u32 i = 0; i < links.size(); i++)
+				{
+					ReplicationLink& link = *links[i];
+					entt::entity watched = tanks.tanks.empty() ? entt::null : tanks.tanks[i % tanks.tanks.size()];
+					if (world.registry.valid(watched))
+					{
+						glm::vec2 center = world.registry.get<Transform>(watched).pos;
+						link.client.set_view({ center.x - view_size.x * 0.5f, center.y - view_size.y * 0.5f, view_size.x, view_size.y });
+					}
+					link.link.advance(config.delta_time);
+					while (link.link.receive_on_client(packet))
+						link.client.receive(packet.data(), packet.size());
+					if (link.client.write_ack(ack))
+						link.link.send_to_server(NetChannel::Snapshots, ack.data(), ack.size());
+					while (link.link.receive_on_server(packet))
+						server.receive(i, packet.data(), packet.size());
+					entities += (f64)link.registry.view<Replicated>().size();
+				}
+				if (measure)
+					client_entities.push_back(entities / (f64)links.size());
+			});
+
+		const ReplicationStats& stats = server.stats;
+		u64 ticks = stats.ticks - warm_stats.ticks;
+		u64 bytes = stats.snapshot_bytes + stats.event_bytes - warm_stats.snapshot_bytes - warm_stats.event_bytes;
+
+		json.begin_object();
+		json.field("variant", variant.name);
+		json.field("world_entities", (u64)server.last_tick_entities);
+		json.key("client_entities");
+		write_stats(json, client_entities);
+		json.field("bytes_per_tick_per_client", ticks > 0 ? (f64)bytes / (f64)(ticks * client_count) : 0.0);
+		json.field("snapshot_bytes", stats.snapshot_bytes - warm_stats.snapshot_bytes);
+		json.field("event_bytes", stats.event_bytes - warm_stats.event_bytes);
+		json.field("entity_enters", stats.entity_enters - warm_stats.entity_enters);
+		json.field("entity_leaves", stats.entity_leaves - warm_stats.entity_leaves);
+		json.field("deferred_records", stats.deferred_records - warm_stats.deferred_records);
+		json.field("snapshots_throttled", stats.snapshots_throttled - warm_stats.snapshots_throttled);
+		json.field("snapshots_skipped", stats.snapshots_skipped - warm_stats.snapshots_skipped);
+		json.key("encode_ms");
+		write_stats(json, encode_ms);
+		sampler.write(json);
+		json.end_object();
+	}
+	json.end_array();
+}
+
+void run_rewind_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	// How far the queries look back; 0 is the present through the history, the baseline casts against the Box2D bodies
+	const static u32 REWIND_TICKS[] = { 0, 6, 12, 30 };
+	// Rays and overlaps per tank and frame at every depth
+	const static u32 QUERIES_PER_TANK = 4;
+	const static f32 RAY_LENGTH_TILES = 12.0f;
+	const static f32 OVERLAP_RADIUS_TILES = 1.5f;
+
+	std::mt19937 rng(config.seed);
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+	World world;
+	Tileset tileset(TILESET, PIXEL_SCALE);
+	entt::entity map_entity = load_collision_map(world, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+	Projectile::prewarm_pool(world.registry, 32);
+
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	ScriptedTanks tanks(map, config.seed);
+	tanks.create_tanks(world.registry, spawn_points, config.tanks, create_tank_projectile_type());
+
+	const LagCompensation& compensation = world.registry.ctx().get<LagCompensation>();
+	f32 ray_length = RAY_LENGTH_TILES * map.tile_size;
+	f32 overlap_radius = OVERLAP_RADIUS_TILES * map.tile_size;
+
+	json.field("name", "rewind");
+	json.field("tanks", config.tanks);
+	json.field("queries_per_frame", (u64)config.tanks * QUERIES_PER_TANK);
+	json.field("history_ticks", TRANSFORM_HISTORY_SIZE);
+	json.field("history_bytes_per_tank", (u64)sizeof(TransformHistory));
+
+	struct Query
+	{
+		entt::entity shooter;
+		glm::vec2 origin;
+		glm::vec2 translation;
+	};
+	std::vector<Query> queries;
+	std::vector<entt::entity> overlaps;
+
+	const static usz DEPTHS = std::size(REWIND_TICKS);
+	std::vector<f64> baseline_ns;
+	std::vector<std::vector<f64>> raycast_ns(DEPTHS), overlap_ns(DEPTHS);
+	u64 baseline_tank_hits = 0;
+	Array<u64, DEPTHS> tank_hits = {}, map_hits = {}, overlap_tanks = {};
+	u64 query_count = 0;
+
+	FrameSampler sampler;
+	run_frames(config, sampler, world.registry, [&](u32 frame)
+		{
+			world.handle_inputs(config.delta_time, &tanks);
+			world.update(config.delta_time);
+
+			if (frame < config.warmup_frames)
+				return;
+
+			queries.clear();
+			for (entt::entity tank : tanks.tanks)
+			{
+				glm::vec2 pos = world.registry.get<Transform>(tank).pos;
+				for (u32 q = 0; q < QUERIES_PER_TANK; q++)
+					queries.push_back({ tank, pos, MathUtil::rotate(glm::vec2(ray_length, 0.0f), unit(rng) * 2.0f * MathUtil::PI_32) });
+			}
+			query_count += queries.size();
+			f64 per_query = 1e6 / (f64)std::max<usz>(queries.size(), 1);
+
+			// The present against the Box2D bodies of the tanks and the map
+			b2QueryFilter filter = b2DefaultQueryFilter();
+			filter.categoryBits = CATEGORY_PROJECTILE;
+			filter.maskBits = CATEGORY_MAP | CATEGORY_TANK;
+			auto start = std::chrono::steady_clock::now();
+			for (const Query& query : queries)
+			{
+				b2RayResult result = b2World_CastRayClosest(world.physics_world, b2Vec2(query.origin.x, query.origin.y), b2Vec2(query.translation.x, query.translation.y), filter);
+				baseline_tank_hits += result.hit && (b2Shape_GetFilter(result.shapeId).categoryBits & CATEGORY_TANK) != 0;
+			}
+			baseline_ns.push_back(elapsed_ms(start) * per_query);
+
+			for (usz d = 0; d < DEPTHS; d++)
+			{
+				RewindTime time = compensation.clamp({ compensation.get_tick() - std::min(REWIND_TICKS[d], compensation.get_tick()), 0.5f });
+
+				start = std::chrono::steady_clock::now();
+				for (const Query& query : queries)
+				{
+					RewindHit hit;
+					if (compensation.raycast(world.registry, time, query.origin, query.translation, query.shooter, hit))
+					{
+						bool tank = world.registry.all_of<Tank>(hit.entity);
+						tank_hits[d] += tank;
+						map_hits[d] += !tank;
+					}
+				}
+				raycast_ns[d].push_back(elapsed_ms(start) * per_query);
+
+				start = std::chrono::steady_clock::now();
+				for (const Query& query : queries)
+				{
+					overlaps.clear();
+					compensation.overlap_circle(world.registry, time, query.origin + query.translation * 0.5f, overlap_radius, overlaps);
+					overlap_tanks[d] += overlaps.size();
+				}
+				overlap_ns[d].push_back(elapsed_ms(start) * per_query);
+			}
+		});
+
+	json.key("baseline_raycast_ns");
+	write_stats(json, baseline_ns);
+	json.field("baseline_tank_hit_rate", (f64)baseline_tank_hits / (f64)std::max<u64>(query_count, 1));
+	json.key("depths");
+	json.begin_array();
+	for (usz d = 0; d < DEPTHS; d++)
+	{
+		json.begin_object();
+		json.field("rewind_ticks", REWIND_TICKS[d]);
+		json.key("raycast_ns");
+		write_stats(json, raycast_ns[d]);
+		json.key("overlap_ns");
+		write_stats(json, overlap_ns[d]);
+		json.field("tank_hit_rate", (f64)tank_hits[d] / (f64)std::max<u64>(query_count, 1));
+		json.field("map_hit_rate", (f64)map_hits[d] / (f64)std::max<u64>(query_count, 1));
+		json.field("tanks_per_overlap", (f64)overlap_tanks[d] / (f64)std::max<u64>(query_count, 1));
+		json.end_object();
+	}
+	json.end_array();
+	sampler.write(json);
+}
+
+/// One run of the lockstep scenario: N scripted tanks on collision_map.tmx in a World driven by a Lockstep
+struct LockstepRun
+{
+	LockstepRun(const BenchConfig& config)
+		: tileset(TILESET, PIXEL_SCALE), lockstep(world, config.delta_time)
+	{
+		std::mt19937 rng(config.seed);
+		entt::entity map_entity = load_collision_map(world, tileset);
+		Map& map = world.registry.get<Map>(map_entity);
+		Projectile::prewarm_pool(world.registry, 32);
+
+		tanks = std::make_unique<ScriptedTanks>(map, config.seed);
+		tanks->create_tanks(world.registry, ScriptedTanks::find_spawn_points(map, rng), config.tanks, create_tank_projectile_type());
+	}
+
+	World world;
+	Tileset tileset;
+	Lockstep lockstep;
+	std::unique_ptr<ScriptedTanks> tanks;
+};
+
+static void write_divergence(JsonWriter& json, const char* name, const Divergence& divergence)
+{
+	json.key(name);
+	json.begin_object();
+	json.field("diverged", divergence.diverged);
+	if (divergence.diverged)
+	{
+		json.field("tick", divergence.tick);
+		json.field("entity", divergence.entity == entt::null ? -1 : (s64)entt::to_integral(divergence.entity));
+	}
+	json.end_object();
+}
+
+void run_lockstep_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	json.field("name", "lockstep");
+	json.field("tanks", config.tanks);
+	json.field("ticks", config.frames);
+
+	// The reference run; every other run is compared with it
+	LockstepRun reference(config);
+	std::vector<f64> tick_ms, hash_ms;
+	for (u32 i = 0; i < config.frames; i++)
+	{
+		Memory::begin_frame();
+		auto start = std::chrono::steady_clock::now();
+		reference.lockstep.step(reference.tanks.get());
+		tick_ms.push_back(elapsed_ms(start));
+		hash_ms.push_back(reference.lockstep.last_hash_ms);
+	}
+	json.key("tick_ms");
+	write_stats(json, tick_ms);
+	json.key("hash_ms");
+	write_stats(json, hash_ms);
+	json.field("entities", (u64)reference.world.registry.storage<entt::entity>().free_list());
+	json.field("log_bytes_per_tick", (f64)(reference.lockstep.log.ticks.size() * sizeof(TickHash) +
+		reference.lockstep.log.entity_hashes.size() * sizeof(EntityHash)) / (f64)std::max(config.frames, 1u));
+	json.field("commands_per_tick", (f64)reference.lockstep.history.size() / (f64)std::max(config.frames, 1u));
+
+	// The same setup and inputs in a new World
+	LockstepRun repeat(config);
+	for (u32 i = 0; i < config.frames; i++)
+	{
+		Memory::begin_frame();
+		repeat.lockstep.step(repeat.tanks.get());
+	}
+	write_divergence(json, "repeat", StateLog::find_divergence(reference.lockstep.log, repeat.lockstep.log));
+
+	// Only the captured commands, the scripted tanks don't write any inputs
+	LockstepRun replay(config);
+	for (const LockstepCommand& command : reference.lockstep.history)
+		replay.lockstep.submit(command);
+	for (u32 i = 0; i < config.frames; i++)
+	{
+		Memory::begin_frame();
+		replay.lockstep.step();
+	}
+	write_divergence(json, "replay", StateLog::find_divergence(reference.lockstep.log, replay.lockstep.log));
+
+	// A tank nudged by a millimeter halfway through; the divergence should be found in that tick at that tank
+	LockstepRun nudged(config);
+	u32 nudge_tick = config.frames / 2 + 1;
+	entt::entity nudged_tank = nudged.tanks->tanks.empty() ? entt::null : nudged.tanks->tanks[0];
+	for (u32 i = 0; i < config.frames; i++)
+	{
+		Memory::begin_frame();
+		if (nudged.lockstep.get_tick() + 1 == nudge_tick && nudged.world.registry.valid(nudged_tank))
+		{
+			const Transform& transform = nudged.world.registry.get<Transform>(nudged_tank);
+			Transform::set_and_update_physics(nudged.world.registry, nudged_tank, transform.pos + glm::vec2(0.001f, 0.0f), transform.rot);
+		}
+		nudged.lockstep.step(nudged.tanks.get());
+	}
+	json.field("nudge_tick", nudge_tick);
+	json.field("nudged_entity", nudged_tank == entt::null ? -1 : (s64)entt::to_integral(nudged_tank));
+	write_divergence(json, "nudged", StateLog::find_divergence(reference.lockstep.log, nudged.lockstep.log));
+}
+
+void run_snapshot_scenario(const BenchConfig& config, JsonWriter& json)
+{
+	const u32 SAVES = 100;
+	const u32 ROLLBACKS = 100;
+	const u32 MAX_ROLLBACK_TICKS = 8;
+
+	json.field("name", "snapshot");
+	json.field("tanks", config.tanks);
+	json.field("ticks", config.frames);
+
+	LockstepRun run(config);
+	WorldSnapshot rematch;
+	rematch.save(run.world);
+	u64 rematch_hash = StateLog::hash_world(run.world.registry);
+
+	// Half of the run is played, the snapshot is taken there
+	u32 save_tick = config.frames / 2;
+	for (u32 i = 0; i < save_tick; i++)
+	{
+		Memory::begin_frame();
+		run.lockstep.step(run.tanks.get());
+	}
+
+	WorldSnapshot snapshot;
+	std::vector<f64> save_ms;
+	for (u32 i = 0; i < SAVES; i++)
+	{
+		snapshot.save(run.world);
+		save_ms.push_back(snapshot.last_save_ms);
+	}
+	u64 saved_hash = StateLog::hash_world(run.world.registry);
+
+	// The rest of the run is the reference of the resimulation
+	for (u32 i = save_tick; i < config.frames; i++)
+	{
+		Memory::begin_frame();
+		run.lockstep.step(run.tanks.get());
+	}
+	StateLog reference_log = run.lockstep.log;
+	std::vector<LockstepCommand> reference_history = run.lockstep.history;
+
+	// Rollbacks: back to the snapshot, then a few ticks played on. The first one goes back from the end of the run
+	std::vector<f64> restore_ms;
+	u32 hash_mismatches = 0;
+	for (u32 i = 0; i < ROLLBACKS; i++)
+	{
+		Memory::begin_frame();
+		snapshot.restore(run.world);
+		run.lockstep.rewind(save_tick);
+		restore_ms.push_back(snapshot.last_restore_ms);
+		if (StateLog::hash_world(run.world.registry) != saved_hash)
+			hash_mismatches++;
+
+		for (u32 j = 0; j <= i % MAX_ROLLBACK_TICKS; j++)
+		{
+			Memory::begin_frame();
+			run.lockstep.step(run.tanks.get());
+		}
+	}
+
+	json.key("save_ms");
+	write_stats(json, save_ms);
+	json.key("restore_ms");
+	write_stats(json, restore_ms);
+	json.field("hash_mismatches", hash_mismatches);
+	if (hash_mismatches != 0)
+		report_failure("snapshot: " + std::to_string(hash_mismatches) + " of " + std::to_string(ROLLBACKS) + " restores didn't hash equal to the saved state");
+
+	WorldSnapshotStats stats = snapshot.get_stats();
+	json.field("entities", stats.entities);
+	json.field("bodies", stats.bodies);
+	json.field("shapes", stats.shapes);
+	json.field("contacts", stats.contacts);
+	json.field("analytic_projectiles", stats.analytic_projectiles);
+	json.field("snapshot_bytes", (u64)stats.bytes);
+
+	// The second half again from the snapshot with the captured commands, twice. Every restore rebuilds the same Box2D state, so
+	// both resimulations must agree. The original run kept the Box2D caches (warm starting, sleep timers) of its own history, so
+	// the resimulations may diverge from it where it relied on them
+	auto resimulate = [&]()
+		{
+			Memory::begin_frame();
+			snapshot.restore(run.world);
+			run.lockstep.rewind(save_tick);
+			for (const LockstepCommand& command : reference_history)
+			{
+				if (command.tick > save_tick)
+					run.lockstep.submit(command);
+			}
+			for (u32 i = save_tick; i < config.frames; i++)
+			{
+				Memory::begin_frame();
+				run.lockstep.step();
+			}
+		};
+	resimulate();
+	StateLog resimulation_log = run.lockstep.log;
+	write_divergence(json, "resimulation", StateLog::find_divergence(reference_log, resimulation_log));
+	resimulate();
+	Divergence repeated_resimulation = StateLog::find_divergence(resimulation_log, run.lockstep.log);
+	write_divergence(json, "repeated_resimulation", repeated_resimulation);
+	if (repeated_resimulation.diverged)
+		report_failure("snapshot: two resimulations from the snapshot diverged in tick " + std::to_string(repeated_resimulation.tick));
+
+	// Instant rematch: back to the state after the setup
+	Memory::begin_frame();
+	rematch.restore(run.world);
+	run.lockstep.rewind(0);
+	json.field("rematch_restore_ms", rematch.last_restore_ms);
+	bool rematch_hash_matches = StateLog::hash_world(run.world.registry) == rematch_hash;
+	json.field("rematch_hash_matches", rematch_hash_matches);
+	if (!rematch_hash_matches)
+		report_failure("snapshot: the rematch restore didn't hash equal to the state after the setup");
+}
@@ -232,6 +232,7 @@
 	<tile id="76">
 		<image width="128" height="128" source="Blocks/Block_C_02.png" />
 		<collision_box width="0.9" height="0.9" radius="0.04" />
+		<destructible health="3" />
 	</tile>
 	<tile id="77">
 		<image width="256" height="128" source="Blocks/Block_A_01.png" />
@@ -244,14 +245,17 @@
 	<tile id="79">
 		<image width="256" height="128" source="Blocks/Block_B_01.png" />
 		<collision_box width="1.9" height="0.9" radius="0.04" />
+		<destructible health="6" />
 	</tile>
 	<tile id="80">
 		<image width="128" height="128" source="Blocks/Block_B_02.png" />
 		<collision_box width="0.9" height="0.9" radius="0.04" />
+		<destructible health="3" />
 	</tile>
 	<tile id="81">
 		<image width="256" height="128" source="Blocks/Block_C_01.png" />
 		<collision_box width="1.9" height="0.9" radius="0.04" />
+		<destructible health="6" />
 	</tile>
 	<wangsets>
 		<wangset name="wood" type="mixed" tile="-1">
@@ -0,0 +1,223 @@
+#include "AssetManager.h"
+#include "entities/World.h"
+#include "entities/Map.h"
+#include "entities/MapBlob.h"
+#include "entities/MapStreamer.h"
+#include "entities/Projectile.h"
+#include "entities/AnalyticProjectiles.h"
+#include "entities/Tank.h"
+#include "entities/CommandSource.h"
+#include "net/NetServer.h"
+#include "engine/Profiler.h"
+#include "engine/Memory.h"
+
+#include <iostream>
+#include <exception>
+#include <cstring>
+#include <string>
+#include <chrono>
+#include <thread>
+#include <random>
+#include <vector>
+#include <algorithm>
+
+// Maps with more tiles are streamed in chunks around the tanks
+const static u32 STREAMED_MAP_MIN_TILES = 128 * 128;
+
+struct ServerConfig
+{
+	const char* blob = MAPS_PATH "map1.tgmap";
+	const char* map = RESOURCES_PATH "maps/map1.tmx";
+	const char* tileset = RESOURCES_PATH "images/map/Tileset.tsx";
+	u32 bots = 8;
+	u32 tick_rate = 60;
+	/// In seconds of simulated time; 0 runs until the process is stopped
+	f64 duration = 0.0;
+	u32 seed = 1;
+	/// Ticks back to back instead of in real time
+	bool unthrottled = false;
+	u16 port = NET_DEFAULT_PORT;
+	/// Per client
+	u32 bytes_per_second = ReplicationSettings().bytes_per_second;
+};
+
+static void print_usage()
+{
+	std::cerr << "Usage: tankgame_server [options]\n"
+		"  --map <map.tmx> <tileset.tsx> <blob.tgmap>  Map to run; the blob is used if it is up to date\n"
+		"  --bots <n>           Scripted tanks\n"
+		"  --tick-rate <n>      Simulation ticks per second\n"
+		"  --duration <s>       Stops after this much simulated time (default: runs until stopped)\n"
+		"  --seed <n>           Seed of the bot inputs\n"
+		"  --unthrottled        Runs the ticks back to back instead of in real time\n"
+		"  --port <n>           UDP port the clients connect to\n"
+		"  --bandwidth <n>      Bytes per second per client\n";
+}
+
+static void run_server(const ServerConfig& config)
+{
+	Profiler::set_thread_name("main");
+
+	World world;
+
+	Tileset tileset;
+	entt::entity map_entity = MapBlob::load_map_entity(world.registry, config.blob, config.map, config.tileset, PIXEL_SCALE, tileset);
+	Map& map = world.registry.get<Map>(map_entity);
+	bool streamed = map.h_tiles * map.v_tiles >= STREAMED_MAP_MIN_TILES;
+	if (streamed)
+		MapStreamer::create_map_streamer(world.registry, map_entity, tileset);
+	else
+		Map::create_map_physics(world.registry, map_entity, tileset);
+	Projectile::prewarm_pool(world.registry, 32);
+
+	AssetManager::get_instance().preload_assets();
+
+	std::mt19937 rng(config.seed);
+	std::vector<glm::vec2> spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+	ProjectileType projectile_type;
+	projectile_type.max_collisons = 2;
+	ScriptedTanks bots(map, config.seed);
+	bots.create_tanks(world.registry, spawn_points, config.bots, projectile_type);
+
+	NetServerSettings net_settings;
+	net_settings.port = config.port;
+	net_settings.replication.tick_rate = config.tick_rate;
+	net_settings.replication.bytes_per_second = config.bytes_per_second;
+	net_settings.replication.world_bounds = { 0.0f, 0.0f, map.world_width, map.world_height };
+	NetServer net(world.registry, net_settings);
+
+	// Every client drives a tank of its own while it is connected
+	std::vector<entt::entity> player_tanks;
+	u32 players_joined = 0;
+	net.on_connect = [&](u32 client)
+		{
+			TankDesign design{ (u8)(client % 4), (u8)(client % 8), (u8)(client % 8), (u8)(client % 4) };
+			glm::vec2 pos = ScriptedTanks::get_spawn_point(spawn_points, config.bots + players_joined++, map.tile_size);
+			entt::entity tank = Tank::create_tank(world.registry, design, pos);
+			world.registry.get<TankController>(tank).projectile_type = projectile_type;
+			if (client >= player_tanks.size())
+				player_tanks.resize(client + 1, entt::null);
+			player_tanks[client] = tank;
+			net.replication.set_controlled_tank(client, tank);
+		};
+	net.on_disconnect = [&](u32 client)
+		{
+			if (client >= player_tanks.size())
+				return;
+			if (world.registry.valid(player_tanks[client]))
+				world.registry.destroy(player_tanks[client]);
+			player_tanks[client] = entt::null;
+		};
+	CommandSources commands{ &bots, &net.replication };
+
+	std::cout << "Map " << map.h_tiles << "x" << map.v_tiles << (streamed ? " (streamed)" : "") << ", " << config.bots << " bots, "
+		<< config.tick_rate << " ticks per second, port " << config.port << std::endl;
+
+	const f32 delta_time = 1.0f / (f32)config.tick_rate;
+	const u64 tick_count = (u64)(config.duration * config.tick_rate);
+	auto tick_interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<f64>(delta_time));
+	auto next_tick = std::chrono::steady_clock::now();
+
+	// Stats of the last second of simulated time
+	f64 busy_ms = 0.0;
+	f64 max_tick_ms = 0.0;
+	ReplicationStats last_stats = net.replication.stats;
+
+	for (u64 tick = 0; tick_count == 0 || tick < tick_count; tick++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		{
+			PROFILE_ZONE("tick");
+			Memory::begin_frame();
+
+			net.receive();
+			MapStreamer::update_streaming(world.registry, {});
+			world.handle_inputs(delta_time, &commands);
+			world.update(delta_time);
+			net.send((u32)tick + 1);
+		}
+		f64 tick_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+		busy_ms += tick_ms;
+		max_tick_ms = std::max(max_tick_ms, tick_ms);
+
+		if ((tick + 1) % config.tick_rate == 0)
+		{
+			u32 projectiles = (u32)world.registry.view<Projectile>(entt::exclude<Pooled>).size_hint() + world.registry.ctx().get<AnalyticProjectiles>().size();
+			// busy_ms out of the 1000 ms of the ticks, in percent
+			std::cout << "tick " << tick + 1 << ": " << busy_ms / config.tick_rate << " ms avg, " << max_tick_ms << " ms max, "
+				<< busy_ms / 10.0 << "% load, " << projectiles << " projectiles";
+
+			// Replication of the last second, per client
+			const ReplicationStats& stats = net.replication.stats;
+			u32 clients = net.replication.get_client_count();
+			if (clients > 0)
+			{
+				u64 bytes = stats.snapshot_bytes + stats.event_bytes - last_stats.snapshot_bytes - last_stats.event_bytes;
+				u64 entity_ticks = stats.entity_ticks - last_stats.entity_ticks;
+				std::cout << ", " << clients << " clients, " << bytes / clients / config.tick_rate << " bytes per tick, "
+					<< (entity_ticks > 0 ? (f64)bytes / (f64)entity_ticks : 0.0) << " bytes per entity, "
+					<< stats.deferred_records - last_stats.deferred_records << " deferred, "
+					<< stats.snapshots_skipped - last_stats.snapshots_skipped << " skipped";
+			}
+			std::cout << std::endl;
+			last_stats = stats;
+			busy_ms = 0.0;
+			max_tick_ms = 0.0;
+		}
+
+		if (!config.unthrottled)
+		{
+			next_tick += tick_interval;
+			std::this_thread::sleep_until(next_tick);
+		}
+	}
+}
+
+/// Headless server: runs the simulation at a fixed tick rate without a window, GL context or textures.
+/// The tanks are driven by bots (ScriptedTanks); connected clients get the match replicated and a tank to drive (see NetServer)
+int main(int argc, char** argv)
+{
+	ServerConfig config;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		bool has_value = i + 1 < argc;
+
+		if (strcmp(arg, "--map") == 0 && i + 3 < argc)
+		{
+			config.map = argv[++i];
+			config.tileset = argv[++i];
+			config.blob = argv[++i];
+		}
+		else if (strcmp(arg, "--bots") == 0 && has_value)
+			config.bots = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--tick-rate") == 0 && has_value)
+			config.tick_rate = (u32)std::max(1ul, std::stoul(argv[++i]));
+		else if (strcmp(arg, "--duration") == 0 && has_value)
+			config.duration = std::stod(argv[++i]);
+		else if (strcmp(arg, "--seed") == 0 && has_value)
+			config.seed = std::stoul(argv[++i]);
+		else if (strcmp(arg, "--unthrottled") == 0)
+			config.unthrottled = true;
+		else if (strcmp(arg, "--port") == 0 && has_value)
+			config.port = (u16)std::stoul(argv[++i]);
+		else if (strcmp(arg, "--bandwidth") == 0 && has_value)
+			config.bytes_per_second = std::stoul(argv[++i]);
+		else
+		{
+			print_usage();
+			return 1;
+		}
+	}
+
+	try
+	{
+		run_server(config);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "tankgame_server: " << e.what() << std::endl;
+		return 1;
+	}
+}
@@ -4,12 +4,11 @@
 
 const static u32 PIXEL_SCALE = 128;
 
-struct Font;
-struct Texture;
 struct HullData;
 struct TurretData;
-struct ParticleTextures;
+struct ParticleEffect;
 
+/// Assets of the simulation: tank data and particle effects. Textures and fonts are client assets (ClientAssets)
 struct AssetManager : NoCopy
 {
 	static AssetManager& get_instance();
@@ -18,22 +17,36 @@ struct AssetManager : NoCopy
 
 	void preload_assets();
 
-	Asset<Font> font_sans_black;
-	Array<Asset<Texture>, 8> projectile_textures;
-
-	Array2D<Asset<Texture>, 4, 8> hull_textures;
-	Array2D<Asset<Texture>, 4, 8> turret_textures;
-	Array2D<Asset<Texture>, 4, 2> track_textures;
+	/// Calls fn for every particle effect asset
+	template<typename F>
+	void for_each_particle_effect(F&& fn)
+	{
+		for (Asset<ParticleEffect>& effect : particle_exhaust)
+			fn(effect);
+		for (Asset<ParticleEffect>& effect : particle_explosion)
+			fn(effect);
+		fn(particle_flame);
+		for (Asset<ParticleEffect>& effect : particle_flash)
+			fn(effect);
+		for (Asset<ParticleEffect>& effect : particle_impact)
+			fn(effect);
+		fn(particle_smoke);
+	}
+
+	/// Position of the effect in the order of for_each_particle_effect; identifies an effect on the network
+	u32 get_particle_effect_index(const Asset<ParticleEffect>& effect);
+	/// nullptr if there is no effect with this index
+	Asset<ParticleEffect>* get_particle_effect(u32 index);
 
 	Array<Asset<HullData>, 8> hull_data;
 	Array<Asset<TurretData>, 8> turret_data;
 
-	Array<Asset<ParticleTextures>, 2> particle_exhaust;
-	Array<Asset<ParticleTextures>, 4> particle_explosion;
-	Asset<ParticleTextures> particle_flame;
-	Array<Asset<ParticleTextures>, 2> particle_flash;
-	Array<Asset<ParticleTextures>, 2> particle_impact;
-	Asset<ParticleTextures> particle_smoke;
+	Array<Asset<ParticleEffect>, 2> particle_exhaust;
+	Array<Asset<ParticleEffect>, 4> particle_explosion;
+	Asset<ParticleEffect> particle_flame;
+	Array<Asset<ParticleEffect>, 2> particle_flash;
+	Array<Asset<ParticleEffect>, 2> particle_impact;
+	Asset<ParticleEffect> particle_smoke;
 
 	AssetPreloader preloader;
-};
\ No newline at end of file
+};
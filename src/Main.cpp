@@ -7,15 +7,28 @@
 #include "entities/Tank.h"
 #include "entities/Components.h"
 #include "entities/Map.h"
+#include "entities/MapBlob.h"
+#include "entities/MapStreamer.h"
 #include "entities/Projectile.h"
-#include "entities/Particle.h"
+#include "client/WorldRenderer.h"
+#include "client/MapRenderable.h"
+#include "client/PlayerInput.h"
+#include "client/ClientAssets.h"
+#include "net/NetClient.h"
+#include "engine/Profiler.h"
+#include "engine/Memory.h"
 
 #include <iostream>
-#include <sstream>
+#include <charconv>
+#include <cstring>
+#include <memory>
 #include <entt/entt.hpp>
 
 const static f32 CAMERA_MOVE_SPEED = 1.0;
 const static f32 CAMERA_ZOOM_SPEED = 0.1;
+const static char* const PROFILER_CAPTURE_FILE = "tankgame_trace.json";
+// Maps with more tiles are streamed in chunks around the camera and the tanks
+const static u32 STREAMED_MAP_MIN_TILES = 128 * 128;
 
 static void player_control_camera(Window& window, Camera& camera)
 {
@@ -33,22 +46,40 @@ static void player_control_camera(Window& window, Camera& camera)
     camera.update_matrix();
 }
 
-void open_client()
+/// Without a server the client runs its own match with a player tank; connected it drives the tank the server gives it
+struct ClientConfig
 {
+    const char* server = nullptr;
+    u16 port = NET_DEFAULT_PORT;
+};
+
+void open_client(const ClientConfig& config)
+{
+    Profiler::set_thread_name("main");
+
     WindowCreation window_data{ 1280, 720, "TankGame", FullscreenMode::Windowed, true, true };
     Window& window = Window::create_window(window_data);
 
     World world;
+    WorldRenderer renderer(world);
 
     Graphics graphics(window.get_width(), window.get_height(), PIXEL_SCALE);
 
-    auto map_entity = Map::create_map_entity(world.registry, RESOURCES_PATH "maps/map1.tmx", PIXEL_SCALE);
+    // Uses the map blob compiled by mapc unless it is older than the TMX
+    Tileset tileset;
+    auto map_entity = MapBlob::load_map_entity(world.registry, MAPS_PATH "map1.tgmap", RESOURCES_PATH "maps/map1.tmx",
+        RESOURCES_PATH "images/map/Tileset.tsx", PIXEL_SCALE, tileset);
+    TilesetTextures tileset_textures(tileset);
     Map::set_full_screen_camera(world.registry, map_entity, graphics.camera);
     graphics.camera.update_matrix();
 
-    Tileset tileset(RESOURCES_PATH "images/map/Tileset.tsx", PIXEL_SCALE);
-    Map::create_map_renderable(world.registry, map_entity, tileset);
-    Map::create_map_physics(world.registry, map_entity, tileset);
+    Map& map = world.registry.get<Map>(map_entity);
+    if (map.h_tiles * map.v_tiles >= STREAMED_MAP_MIN_TILES)
+        MapStreamer::create_map_streamer(world.registry, map_entity, tileset);
+    else
+        Map::create_map_physics(world.registry, map_entity, tileset);
+    MapRenderable::create_map_renderable(world.registry, map_entity, tileset_textures);
+    Projectile::prewarm_pool(world.registry, 32);
 
     window.set_on_resize([&](u32 width, u32 height)
         {
@@ -56,7 +87,7 @@ void open_client()
             graphics.update_window_dimensions(width, height);
         });
 
-    auto tank_entity = Tank::create_tank(world.registry, TankDesign{ 2, 0, 0, 0 }, glm::vec2(3.0f, 8.0f), true);
+    PlayerCommandSource player_commands(graphics.camera);
 
     ProjectileType projectile_type;
     projectile_type.sprite_type = ProjectileSpriteType::Laser;
@@ -79,34 +110,124 @@ void open_client()
     projectile_type.density = 200;
     projectile_type.particle_type = 0;
     projectile_type.allow_projectile_collision = true;
+    // The shells of the own match need no entity or body. Connected, the server shoots entity projectiles, which are replicated
+    projectile_type.analytic = true;
 
-    world.registry.get<TankPlayerController>(tank_entity).projectile_type = projectile_type;
+    if (!config.server)
+    {
+        auto tank_entity = Tank::create_tank(world.registry, TankDesign{ 2, 0, 0, 0 }, glm::vec2(3.0f, 8.0f));
+        world.registry.emplace<TankPlayerController>(tank_entity);
+        world.registry.get<TankController>(tank_entity).projectile_type = projectile_type;
+    }
 
     AssetManager::get_instance().preload_assets();
+    ClientAssets::get_instance().preload_assets();
+
+    // The server needs to run the same map
+    std::unique_ptr<NetClient> net_client;
+    if (config.server)
+        net_client = std::make_unique<NetClient>(world.registry, config.server, config.port);
+
+    // F8 starts a profiler capture, pressing it again writes the capture to PROFILER_CAPTURE_FILE
+    bool capture_key_was_pressed = false;
 
     while (!window.poll_events())
     {
-		world.handle_inputs(window.get_last_frame_time(), graphics.camera);
+        PROFILE_ZONE("frame");
+        Memory::begin_frame();
+
+        bool capture_key_pressed = window.is_key_pressed(KEY_F8);
+        if (capture_key_pressed && !capture_key_was_pressed)
+        {
+            if (!Profiler::is_capturing())
+            {
+                Profiler::begin_capture();
+            }
+            else
+            {
+                // A capture that can't be written is lost, the game keeps running
+                try
+                {
+                    Profiler::end_capture(PROFILER_CAPTURE_FILE);
+                    std::cout << "Profiler capture written to " << PROFILER_CAPTURE_FILE << std::endl;
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << "Profiler capture failed: " << e.what() << std::endl;
+                }
+            }
+        }
+        capture_key_was_pressed = capture_key_pressed;
+
+        Rect view = graphics.camera.get_bounding_rect();
+        MapStreamer::update_streaming(world.registry, { &view, 1 });
+
+        world.handle_inputs(window.get_last_frame_time(), &player_commands);
+
+        if (net_client)
+        {
+            // Sends the inputs just written and predicts the own tank with them; the server sends what is around the view
+            net_client->replication.set_view(view);
+            if (!net_client->update(window.get_last_frame_time()))
+            {
+                std::cout << "Disconnected from the server" << std::endl;
+                break;
+            }
+            ReplicationClient::extrapolate(world.registry, window.get_last_frame_time());
+
+            // The tank the server gives us follows the window input
+            for (entt::entity entity : world.registry.view<Predicted>(entt::exclude<TankPlayerController>))
+                world.registry.emplace<TankPlayerController>(entity);
+        }
 
         world.update((f32)window.get_last_frame_time());
 
-        world.set_physics_debug_draw_enabled(window.is_key_pressed(KEY_F6));
-        world.render(graphics);
+        renderer.set_physics_debug_draw_enabled(window.is_key_pressed(KEY_F6));
+        renderer.render(graphics);
 
-        std::ostringstream oss;
-        oss << "TankGame " << (1.0 / window.get_last_frame_time());
-        window.set_title(oss.str().c_str());
+        // The title lives in the frame arena, a steady frame doesn't touch the heap
+        char fps[32];
+        std::to_chars_result fps_end = std::to_chars(fps, fps + sizeof(fps), 1.0 / window.get_last_frame_time());
+        ArenaString title("TankGame ", Memory::get_frame_arena());
+        title.append(fps, fps_end.ptr);
+        window.set_title(title.c_str());
 
-        window.swap_buffers();
+        {
+            PROFILE_ZONE("swap buffers");
+            window.swap_buffers();
+        }
     }
 
+    net_client.reset();
     // This will release all asset refs stored inside entities
     world.registry.clear();
 
 	Window::destroy_window();
 }
 
-int main()
+int main(int argc, char** argv)
 {
-    open_client();
+    ClientConfig config;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+            config.server = argv[++i];
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+            config.port = (u16)std::stoul(argv[++i]);
+        else
+        {
+            std::cerr << "Usage: mygame [--connect <host>] [--port <n>]" << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        open_client(config);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "mygame: " << e.what() << std::endl;
+        return 1;
+    }
 }
\ No newline at end of file
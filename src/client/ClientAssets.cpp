@@ -0,0 +1,69 @@
+#include "ClientAssets.h"
+
+#include "ParticleRenderer.h"
+#include "engine/Texture.h"
+#include "engine/Font.h"
+
+static const char* PROJECTILE_NAMES[8] = { "Grenade_Shell.png", "Heavy_Shell.png", "Laser.png", "Light_Shell.png",
+		"Medium_Shell.png", "Plasma.png", "Shotgun_Shells.png", "Sniper_Shell.png" };
+
+template <typename T>
+void load_with_location(std::unique_ptr<T>& data_ptr, const std::string& location)
+{
+	data_ptr = std::make_unique<T>(location.c_str());
+}
+
+ClientAssets& ClientAssets::get_instance()
+{
+	static ClientAssets client_assets;
+	return client_assets;
+}
+
+ClientAssets::ClientAssets()
+{
+	font_sans_black.set(std::string(RESOURCES_PATH "font/SansBlack.ttf"), load_with_location<Font>);
+
+	for (u32 var1 = 0; var1 < 4; var1++)
+	{
+		for (u32 var2 = 0; var2 < 8; var2++)
+		{
+			hull_textures[var1][var2].set(std::string(RESOURCES_PATH "images/tank/hulls_") + std::to_string(var1 + 1) + "/Hull_0" + std::to_string(var2 + 1) + ".png", load_with_location<Texture>);
+			turret_textures[var1][var2].set(std::string(RESOURCES_PATH "images/tank/guns_") + std::to_string(var1 + 1) + "/Gun_0" + std::to_string(var2 + 1) + ".png", load_with_location<Texture>);
+		}
+		for (u32 var2 = 0; var2 < 2; var2++)
+		{
+			static const char* var2_str[2] = { "A", "B" };
+			track_textures[var1][var2].set(std::string(RESOURCES_PATH "images/tank/tracks/Track_") + std::to_string(var1 + 1) + "_" + var2_str[var2] + ".png", load_with_location<Texture>);
+		}
+	}
+
+	for (u32 i = 0; i < projectile_textures.size(); i++)
+	{
+		projectile_textures[i].set(std::string(RESOURCES_PATH "images/projectile/") + PROJECTILE_NAMES[i], load_with_location<Texture>);
+	}
+}
+
+void ClientAssets::preload_assets()
+{
+	preloader.clear();
+
+	// TODO: only load assets that are needed
+	preloader.preload(font_sans_black);
+	preloader.preload_array(projectile_textures);
+
+	AssetManager::get_instance().for_each_particle_effect([this](Asset<ParticleEffect>& effect) { get_particle_textures(effect); });
+}
+
+const ParticleTextures& ClientAssets::get_particle_textures(Asset<ParticleEffect>& effect)
+{
+	for (EffectTextures& entry : particle_textures)
+	{
+		if (entry.effect == &effect)
+			return entry.loaded.get();
+	}
+
+	auto textures = std::make_unique<Asset<ParticleTextures>>(effect.get_location(), ParticleTextures::load_textures);
+	AssetRef<ParticleTextures> loaded = textures->loaded();
+	particle_textures.push_back({ &effect, std::move(textures), std::move(loaded) });
+	return particle_textures.back().loaded.get();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "engine/Asset.h"
+#include "AssetManager.h"
+
+#include <vector>
+#include <memory>
+
+struct Font;
+struct Texture;
+struct ParticleTextures;
+
+/// Assets only a client with a window needs: fonts and textures. The simulation assets are in the AssetManager
+struct ClientAssets : NoCopy
+{
+	static ClientAssets& get_instance();
+
+	ClientAssets();
+
+	void preload_assets();
+
+	/// Textures of the frames of a particle effect of the AssetManager; loaded on first use and kept loaded
+	const ParticleTextures& get_particle_textures(Asset<ParticleEffect>& effect);
+
+	Asset<Font> font_sans_black;
+	Array<Asset<Texture>, 8> projectile_textures;
+
+	Array2D<Asset<Texture>, 4, 8> hull_textures;
+	Array2D<Asset<Texture>, 4, 8> turret_textures;
+	Array2D<Asset<Texture>, 4, 2> track_textures;
+
+private:
+	struct EffectTextures
+	{
+		Asset<ParticleEffect>* effect;
+		std::unique_ptr<Asset<ParticleTextures>> textures;
+		AssetRef<ParticleTextures> loaded;
+	};
+
+	std::vector<EffectTextures> particle_textures;
+
+public:
+	/// Declared last, its references are released before the assets
+	AssetPreloader preloader;
+};
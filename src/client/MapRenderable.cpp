@@ -0,0 +1,245 @@
+#include "MapRenderable.h"
+
+#include "engine/util/MathUtil.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+
+static bool intersects(const Rect& a, const Rect& b)
+{
+	return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+TilesetTextures::TilesetTextures(const Tileset& tileset)
+	: textures(std::make_unique<Asset<Texture>[]>(tileset.asset_count)),
+	image_sizes(std::make_unique<f32[]>(tileset.asset_count)),
+	texture_count(tileset.asset_count)
+{
+	for (u32 i = 0; i < texture_count; i++)
+	{
+		const TilesetTile& tile = tileset.tiles[i];
+		if (!tile.image.empty())
+			textures[i].set(tile.image, &TilesetTextures::load_texture);
+		image_sizes[i] = std::max(tile.tile_width, tile.tile_height);
+	}
+}
+
+void TilesetTextures::load_texture(std::unique_ptr<Texture>& data_ptr, const std::string& location)
+{
+	data_ptr = std::make_unique<Texture>(location.c_str());
+}
+
+MapRenderable::MapRenderable(Map& map, TilesetTextures& textures, bool streamed)
+	: textures(&textures), max_tile_overhang(0.0f)
+{
+	PROFILE_ZONE("MapRenderable::MapRenderable");
+	asset_refs.resize(textures.texture_count);
+
+	if (streamed)
+	{
+		// Any tile can become resident; the textures follow the streamer
+		for (u32 i = 0; i < textures.texture_count; i++)
+			max_tile_overhang = std::max(max_tile_overhang, textures.image_sizes[i] - map.tile_size);
+		return;
+	}
+
+	for (const MapRenderTile& tile : map.render_tiles)
+	{
+		u32 tile_id = (tile.gid & TILE_ID_MASK) - map.first_gid;
+		if (this->asset_refs[tile_id])
+			continue;
+
+		this->asset_refs[tile_id] = std::make_unique<AssetRef<Texture>>(textures.textures[tile_id].loaded());
+		this->max_tile_overhang = std::max(this->max_tile_overhang, textures.image_sizes[tile_id] - map.tile_size);
+	}
+
+	for (auto& variant : map.layers)
+	{
+		if (std::holds_alternative<MapObjectLayer>(variant))
+		{
+			MapObjectLayer& layer = std::get<MapObjectLayer>(variant);
+			for (auto& o : layer.objects)
+			{
+				if (o.gid < map.first_gid)
+					continue;
+				u32 tile_id = (o.gid & TILE_ID_MASK) - map.first_gid;
+
+				if (!this->asset_refs[tile_id])
+					this->asset_refs[tile_id] = std::make_unique<AssetRef<Texture>>(textures.textures[tile_id].loaded());
+			}
+		}
+	}
+}
+
+void MapRenderable::create_map_renderable(entt::registry& registry, entt::entity entity, TilesetTextures& textures)
+{
+	registry.emplace<MapRenderable>(entity, registry.get<Map>(entity), textures, registry.all_of<MapStreamer>(entity));
+}
+
+void MapRenderable::draw_tile(Graphics& graphics, Texture& texture, u32 x, u32 y, u32 gid, f32 tile_size)
+{
+	ImageTransform transform = graphics.create_transform();
+	transform.translate(x * tile_size, (y + 1) * tile_size);
+
+	if (gid & (1 << 29))
+		transform.translate_pixels(0.5f * texture.get_height(), -0.5f * texture.get_width());
+	else
+		transform.translate_pixels(0.5f * texture.get_width(), -0.5f * texture.get_height());
+
+	if (gid & (1 << 30))
+		transform.flip_y();
+	if (gid & (1 << 31))
+		transform.flip_x();
+
+	if (gid & (1 << 29))
+	{
+		transform.flip_y();
+		transform.rotate(-0.5f * MathUtil::PI_32);
+	}
+
+	graphics.draw_image(texture, transform);
+}
+
+void MapRenderable::draw_object(Graphics& graphics, Texture& texture, const MapObject& object)
+{
+	ImageTransform transform = graphics.create_transform();
+	transform.translate(object.x, object.y);
+
+	transform.rotate(object.rotation);
+
+	if (object.gid & (1 << 29))
+		transform.translate_pixels(0.5f * object.height_pixel, -0.5f * object.width_pixel);
+	else
+		transform.translate_pixels(0.5f * object.width_pixel, -0.5f * object.height_pixel);
+
+	if (object.gid & (1 << 30))
+		transform.flip_y();
+	if (object.gid & (1 << 31))
+		transform.flip_x();
+
+	if (object.gid & (1 << 29))
+	{
+		transform.flip_y();
+		transform.rotate(-0.5f * MathUtil::PI_32);
+	}
+
+	transform.scale(object.width_pixel / (f32)texture.get_width(), object.height_pixel / (f32)texture.get_height());
+
+	graphics.draw_image(texture, transform);
+}
+
+void MapRenderable::render_map(entt::registry& registry, Graphics& graphics)
+{
+	Rect camera_rect = graphics.camera.get_bounding_rect();
+
+	for (auto [entity, map, renderable] : registry.view<Map, MapRenderable>().each())
+	{
+		// Textures can reach into the neighbouring tiles
+		f32 overhang = renderable.max_tile_overhang;
+		Rect cull_rect = { camera_rect.x - overhang, camera_rect.y - overhang, camera_rect.width + 2.0f * overhang, camera_rect.height + 2.0f * overhang };
+
+		if (MapStreamer* streamer = registry.try_get<MapStreamer>(entity))
+			renderable.render_streamed(map, *streamer, graphics, cull_rect);
+		else
+			renderable.render_resident(map, graphics, cull_rect);
+	}
+}
+
+void MapRenderable::render_resident(Map& map, Graphics& graphics, const Rect& cull_rect)
+{
+	// Chunks are sorted by layer
+	u32 chunk_index = 0;
+
+	for (u32 layer_index = 0; layer_index < map.layers.size(); layer_index++)
+	{
+		auto& variant = map.layers[layer_index];
+		if (std::holds_alternative<MapGridLayer>(variant))
+		{
+			for (; chunk_index < map.render_chunks.size() && map.render_chunks[chunk_index].layer == layer_index; chunk_index++)
+			{
+				const MapRenderChunk& chunk = map.render_chunks[chunk_index];
+				if (!intersects(chunk.bounds, cull_rect))
+					continue;
+
+				for (u32 i = chunk.first_tile; i < chunk.first_tile + chunk.tile_count; i++)
+				{
+					const MapRenderTile& tile = map.render_tiles[i];
+					u32 tile_id = (tile.gid & TILE_ID_MASK) - map.first_gid;
+					draw_tile(graphics, asset_refs[tile_id]->get(), tile.x, tile.y, tile.gid, map.tile_size);
+				}
+			}
+		}
+		else if (std::holds_alternative<MapObjectLayer>(variant))
+		{
+			MapObjectLayer& layer = std::get<MapObjectLayer>(variant);
+			for (MapObject& o : layer.objects)
+			{
+				if (o.gid < map.first_gid)
+					continue;
+
+				u32 tile_id = (o.gid & TILE_ID_MASK) - map.first_gid;
+				draw_object(graphics, asset_refs[tile_id]->get(), o);
+			}
+		}
+	}
+}
+
+void MapRenderable::update_streamed_textures(const MapStreamer& streamer)
+{
+	for (u32 tile_id = 0; tile_id < textures->texture_count; tile_id++)
+	{
+		bool used = streamer.texture_users[tile_id] != 0;
+		if (used && !asset_refs[tile_id])
+			asset_refs[tile_id] = std::make_unique<AssetRef<Texture>>(textures->textures[tile_id].loaded());
+		else if (!used && asset_refs[tile_id])
+			asset_refs[tile_id].reset();
+	}
+}
+
+void MapRenderable::render_streamed(Map& map, MapStreamer& streamer, Graphics& graphics, const Rect& cull_rect)
+{
+	update_streamed_textures(streamer);
+
+	for (u32 layer_index = 0; layer_index < map.layers.size(); layer_index++)
+	{
+		bool grid_layer = std::holds_alternative<MapGridLayer>(map.layers[layer_index]);
+
+		for (u32 chunk_index : streamer.resident_chunks)
+		{
+			const MapStreamingChunk& chunk = streamer.chunks[chunk_index];
+			if (!intersects(chunk.bounds, cull_rect))
+				continue;
+
+			if (grid_layer)
+			{
+				for (const MapRenderChunk& render_layer : chunk.render_layers)
+				{
+					if (render_layer.layer != layer_index)
+						continue;
+
+					for (u32 i = render_layer.first_tile; i < render_layer.first_tile + render_layer.tile_count; i++)
+					{
+						const MapRenderTile& tile = chunk.render_tiles[i];
+						u32 tile_id = (tile.gid & TILE_ID_MASK) - map.first_gid;
+						draw_tile(graphics, asset_refs[tile_id]->get(), tile.x, tile.y, tile.gid, map.tile_size);
+					}
+				}
+			}
+			else
+			{
+				const MapObjectLayer& layer = std::get<MapObjectLayer>(map.layers[layer_index]);
+				for (auto [object_layer, object_index] : chunk.objects)
+				{
+					if (object_layer != layer_index)
+						continue;
+					const MapObject& o = layer.objects[object_index];
+					if (o.gid < map.first_gid)
+						continue;
+
+					u32 tile_id = (o.gid & TILE_ID_MASK) - map.first_gid;
+					draw_object(graphics, asset_refs[tile_id]->get(), o);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "engine/Asset.h"
+#include "engine/Texture.h"
+#include "engine/Graphics.h"
+#include "entities/Map.h"
+#include "entities/MapStreamer.h"
+
+#include "entt/entt.hpp"
+
+#include <vector>
+#include <memory>
+
+/// The tile textures of a Tileset. A texture is only loaded while a MapRenderable uses it
+/// !!! Must outlive the MapRenderables using it
+struct TilesetTextures : NoCopy
+{
+	TilesetTextures(const Tileset& tileset);
+
+	std::unique_ptr<Asset<Texture>[]> textures;
+	/// Per tile: the larger side of its image in world units
+	std::unique_ptr<f32[]> image_sizes;
+	u32 texture_count;
+
+	static void load_texture(std::unique_ptr<Texture>& data_ptr, const std::string& location);
+};
+
+/// Draws a map entity. For a streamed map (MapStreamer) it draws the resident chunks and holds the textures of the tiles
+/// the streamer has texture users for; otherwise it holds the textures of all tiles in the map
+struct MapRenderable : NoCopy
+{
+	MapRenderable(Map& map, TilesetTextures& textures, bool streamed);
+
+	/// Streamed maps need their MapStreamer before the MapRenderable is added
+	static void create_map_renderable(entt::registry& registry, entt::entity entity, TilesetTextures& textures);
+
+	static void render_map(entt::registry& registry, Graphics& graphics);
+
+	static void draw_tile(Graphics& graphics, Texture& texture, u32 x, u32 y, u32 gid, f32 tile_size);
+	static void draw_object(Graphics& graphics, Texture& texture, const MapObject& object);
+
+private:
+	void render_resident(Map& map, Graphics& graphics, const Rect& cull_rect);
+	void render_streamed(Map& map, MapStreamer& streamer, Graphics& graphics, const Rect& cull_rect);
+	/// Loads the textures the streamer got texture users for and releases the ones without users. Linear in the tile count,
+	/// which is small against the map
+	void update_streamed_textures(const MapStreamer& streamer);
+
+	TilesetTextures* textures;
+	std::vector<std::unique_ptr<AssetRef<Texture>>> asset_refs;
+	/// How far the largest tile texture reaches past its tile; grows the chunk bounds for culling
+	f32 max_tile_overhang;
+};
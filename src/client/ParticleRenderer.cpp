@@ -0,0 +1,48 @@
+#include "ParticleRenderer.h"
+
+#include "ClientAssets.h"
+#include "entities/Particle.h"
+
+ParticleTextures::ParticleTextures(u32 count)
+	: textures(std::make_unique<Texture[]>(count)), texture_count(count)
+{
+}
+
+void ParticleTextures::load_textures(std::unique_ptr<ParticleTextures>& data_ptr, const std::string& location)
+{
+	u32 texture_count = ParticleEffect::find_frames(location);
+	if (texture_count == 0)
+		throw std::runtime_error("No textures found in: " + location);
+
+	data_ptr.reset(new ParticleTextures(texture_count));
+	u32 index = 0;
+	ParticleEffect::find_frames(location, [&](const char* path)
+		{
+			if (index < texture_count)
+				data_ptr->textures[index++].store_buffer(TextureBuffer(path));
+		});
+}
+
+void ParticleRenderer::render_particles(entt::registry& registry, Graphics& graphics)
+{
+	if (!registry.ctx().contains<ParticleSystem>())
+		return;
+
+	ParticleSystem& particles = registry.ctx().get<ParticleSystem>();
+	ClientAssets& assets = ClientAssets::get_instance();
+	for (std::unique_ptr<ParticleSystem::Pool>& pool : particles.pools)
+	{
+		const ParticleTextures& textures = assets.get_particle_textures(*pool->effect);
+		for (u32 i = 0; i < pool->size; i++)
+		{
+			ImageTransform transform = graphics.create_transform();
+			transform.translate(pool->pos_x[i], pool->pos_y[i]);
+			transform.rotate(pool->rot[i]);
+			transform.scale(pool->scale[i]);
+
+			u32 image_index = (u32)pool->animation_time[i];
+			if (image_index < textures.texture_count)
+				graphics.draw_image(textures.textures[image_index], transform);
+		}
+	}
+}
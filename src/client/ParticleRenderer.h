@@ -0,0 +1,26 @@
+#pragma once
+
+#include "engine/Graphics.h"
+#include "engine/Texture.h"
+
+#include "entt/entt.hpp"
+
+#include <memory>
+#include <string>
+
+/// The frames of a ParticleEffect as textures
+struct ParticleTextures
+{
+	ParticleTextures(u32 count);
+
+	std::unique_ptr<Texture[]> textures;
+	u32 texture_count;
+
+	static void load_textures(std::unique_ptr<ParticleTextures>& data_ptr, const std::string& location);
+};
+
+/// Draws the particles of the ParticleSystem in the registry context, if there is one
+struct ParticleRenderer
+{
+	static void render_particles(entt::registry& registry, Graphics& graphics);
+};
@@ -0,0 +1,38 @@
+#include "PlayerInput.h"
+
+#include "engine/Window.h"
+#include "entities/Tank.h"
+
+TankPlayerController::TankPlayerController()
+	: input_user(Window::get_instance().create_input_user()),
+	shoot_key_state(Window::get_instance(), KEY_SPACE)
+{
+}
+
+void TankPlayerController::update_inputs(entt::registry& registry, const Camera& camera)
+{
+	for (auto [entity, player_controller, controller] : registry.view<TankPlayerController, TankController>().each())
+	{
+		InputUser& input_user = player_controller.input_user;
+		TankInput& input = controller.input;
+		input.forwards = input_user.is_key_pressed(KEY_W);
+		input.backwards = input_user.is_key_pressed(KEY_S);
+		input.left = input_user.is_key_pressed(KEY_A);
+		input.right = input_user.is_key_pressed(KEY_D);
+		input.aim_target = camera.to_world_space(input_user.get_cursor_pos());
+
+		player_controller.shoot_key_state.update_state();
+		if (player_controller.shoot_key_state.is_pressed())
+			input.shoot = true;
+	}
+}
+
+PlayerCommandSource::PlayerCommandSource(const Camera& camera)
+	: camera(&camera)
+{
+}
+
+void PlayerCommandSource::write_inputs(entt::registry& registry, f32)
+{
+	TankPlayerController::update_inputs(registry, *camera);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "engine/Input.h"
+#include "engine/Camera.h"
+#include "entities/CommandSource.h"
+
+#include "entt/entt.hpp"
+
+/// Marks a tank as driven by the window input
+struct TankPlayerController
+{
+	TankPlayerController();
+
+	InputUser input_user;
+	KeyState shoot_key_state;
+
+	/// Writes the window input into the TankController of the same entity; the turret aims at the cursor
+	static void update_inputs(entt::registry& registry, const Camera& camera);
+};
+
+/// The CommandSource of the client: the tanks with a TankPlayerController follow the window input
+struct PlayerCommandSource : CommandSource
+{
+	PlayerCommandSource(const Camera& camera);
+
+	void write_inputs(entt::registry& registry, f32 delta_time) override;
+
+	const Camera* camera;
+};
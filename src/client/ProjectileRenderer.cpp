@@ -0,0 +1,42 @@
+#include "ProjectileRenderer.h"
+
+#include "ClientAssets.h"
+#include "entities/Projectile.h"
+#include "entities/AnalyticProjectiles.h"
+#include "entities/EntityPool.h"
+
+#include <array>
+#include <cmath>
+
+void ProjectileRenderer::render_projectiles(entt::registry& registry, Graphics& graphics)
+{
+	ClientAssets& assets = ClientAssets::get_instance();
+	// The projectile textures are preloaded, the references only save the lookups
+	std::array<AssetRef<Texture>, 8> textures = { nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr };
+	auto get_texture = [&](u8 sprite_type) -> const Texture&
+		{
+			if (!textures[sprite_type])
+				textures[sprite_type] = assets.projectile_textures[sprite_type].loaded();
+			return textures[sprite_type].get();
+		};
+
+	for (auto [entity, transform, projectile] : registry.view<Transform, Projectile>(entt::exclude<Pooled>).each())
+	{
+		ImageTransform image_transform = graphics.create_transform();
+		image_transform.translate(transform.pos.x, transform.pos.y);
+		image_transform.scale(projectile.scale, projectile.scale);
+		image_transform.rotate(transform.rot);
+		graphics.draw_image(get_texture(static_cast<u8>(projectile.sprite_type)), image_transform);
+	}
+
+	AnalyticProjectiles& analytic = registry.ctx().get<AnalyticProjectiles>();
+	for (u32 i = 0; i < analytic.size(); i++)
+	{
+		glm::vec2 velocity = analytic.velocities[i];
+		ImageTransform image_transform = graphics.create_transform();
+		image_transform.translate(analytic.positions[i].x, analytic.positions[i].y);
+		image_transform.scale(analytic.scales[i]);
+		image_transform.rotate(std::atan2(velocity.x, -velocity.y));
+		graphics.draw_image(get_texture(analytic.sprite_types[i]), image_transform);
+	}
+}
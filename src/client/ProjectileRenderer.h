@@ -0,0 +1,11 @@
+#pragma once
+
+#include "engine/Graphics.h"
+
+#include "entt/entt.hpp"
+
+/// Draws the projectile entities and the AnalyticProjectiles with the projectile textures of the ClientAssets
+struct ProjectileRenderer
+{
+	static void render_projectiles(entt::registry& registry, Graphics& graphics);
+};
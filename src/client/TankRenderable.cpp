@@ -0,0 +1,132 @@
+#include "TankRenderable.h"
+
+#include "ClientAssets.h"
+#include "entities/Components.h"
+
+#include <cmath>
+
+TankRenderable::TankRenderable(const TankDesign& design)
+	: hull_texture(nullptr),
+	turret_texture(nullptr),
+	track_textures{ nullptr, nullptr },
+	track_animation_1(0.0),
+	track_animation_2(0.0)
+{
+	load_textures(design);
+}
+
+void TankRenderable::load_textures(const TankDesign& design)
+{
+	ClientAssets& assets = ClientAssets::get_instance();
+	hull_texture = assets.hull_textures[design.color][design.hull].loaded();
+	turret_texture = assets.turret_textures[design.color][design.turret].loaded();
+	track_textures[0] = assets.track_textures[design.tracks][0].loaded();
+	track_textures[1] = assets.track_textures[design.tracks][1].loaded();
+}
+
+void TankRenderable::connect(entt::registry& registry)
+{
+	registry.on_construct<Tank>().connect<&TankRenderable::on_construct_tank>();
+	registry.on_update<Tank>().connect<&TankRenderable::on_update_tank>();
+	registry.on_destroy<Tank>().connect<&TankRenderable::on_destroy_tank>();
+
+	for (auto [entity, tank] : registry.view<Tank>(entt::exclude<TankRenderable>).each())
+		registry.emplace<TankRenderable>(entity, tank.design);
+}
+
+void TankRenderable::disconnect(entt::registry& registry)
+{
+	registry.on_construct<Tank>().disconnect<&TankRenderable::on_construct_tank>();
+	registry.on_update<Tank>().disconnect<&TankRenderable::on_update_tank>();
+	registry.on_destroy<Tank>().disconnect<&TankRenderable::on_destroy_tank>();
+}
+
+void TankRenderable::on_construct_tank(entt::registry& registry, entt::entity entity)
+{
+	registry.emplace<TankRenderable>(entity, registry.get<Tank>(entity).design);
+}
+
+void TankRenderable::on_update_tank(entt::registry& registry, entt::entity entity)
+{
+	// Reassigning the same texture keeps it loaded, only the changed parts load
+	if (TankRenderable* renderable = registry.try_get<TankRenderable>(entity))
+		renderable->load_textures(registry.get<Tank>(entity).design);
+}
+
+void TankRenderable::on_destroy_tank(entt::registry& registry, entt::entity entity)
+{
+	registry.remove<TankRenderable>(entity);
+}
+
+void TankRenderable::update_track_animation(entt::registry& registry, f32 frame_time)
+{
+	f32 tank_scale = Tank::get_scale();
+	for (auto [entity, tank, renderable, transform, velocity] : registry.view<Tank, TankRenderable, Transform, Velocity>().each())
+	{
+		// TODO: fix unfortunately
+		f32 speed = glm::dot(velocity.linear, -glm::vec2(std::sin(transform.rot), std::cos(transform.rot)));
+		if (speed == 0 && velocity.angular == 0)
+			continue;
+		 
+		f32 track_1_speed, track_2_speed;
+
+		f32 track_offset = tank.hull_data.get().tracks_off_x * tank.hull_data.get().scale * tank_scale;
+
+		if (velocity.angular != 0)
+		{
+			f32 turn_radius = speed / velocity.angular;
+
+			if (speed != 0)
+			{
+				track_1_speed = speed * (turn_radius - track_offset) / turn_radius;
+				track_2_speed = speed * (turn_radius + track_offset) / turn_radius;
+			}
+			else
+			{
+				track_1_speed = -track_offset * velocity.angular;
+				track_2_speed = track_offset * velocity.angular;
+			}
+		}
+		else
+		{
+			track_1_speed = track_2_speed = speed;
+		}
+		
+		f32 track_step = 20.0f / 256.0f * tank.hull_data.get().tracks_scale * tank_scale;
+
+		renderable.track_animation_1 += track_1_speed / track_step * frame_time;
+		renderable.track_animation_2 += track_2_speed / track_step * frame_time;
+	}
+}
+
+void TankRenderable::render_tanks(entt::registry& registry, Graphics& graphics)
+{
+	f32 tank_scale = Tank::get_scale();
+	for (auto [entity, tank, renderable, transform] : registry.view<Tank, TankRenderable, Transform>().each())
+	{
+		auto hull_transform = graphics.create_transform();
+		hull_transform.translate(transform.pos.x, transform.pos.y);
+		hull_transform.scale(tank_scale * tank.hull_data.get().scale, tank_scale * tank.hull_data.get().scale);
+		hull_transform.rotate(transform.rot);
+
+		auto track_transform = hull_transform;
+		track_transform.scale(tank.hull_data.get().tracks_scale);
+		track_transform.translate(-tank.hull_data.get().tracks_off_x, tank.hull_data.get().tracks_off_y);
+
+		graphics.draw_image(renderable.track_textures[((u32)renderable.track_animation_1) % 2].get(), track_transform);
+		track_transform.translate(2.0f * tank.hull_data.get().tracks_off_x, 0.0f);
+		graphics.draw_image(renderable.track_textures[((u32)renderable.track_animation_2) % 2].get(), track_transform);
+
+		graphics.draw_image(renderable.hull_texture.get(), hull_transform);
+
+		auto turret_transform = graphics.create_transform();
+		turret_transform.translate(transform.pos.x, transform.pos.y);
+		turret_transform.scale(tank_scale * tank.turret_data.get().scale, tank_scale * tank.turret_data.get().scale);
+		turret_transform.rotate(transform.rot);
+		turret_transform.translate(0.0f, tank.hull_data.get().turret_pivot_y);
+		turret_transform.rotate(tank.turret_orientation - transform.rot);
+		turret_transform.translate(0.0f, -tank.turret_data.get().pivot_y);
+
+		graphics.draw_image(renderable.turret_texture.get(), turret_transform);
+	}
+}
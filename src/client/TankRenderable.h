@@ -0,0 +1,33 @@
+#pragma once
+
+#include "engine/Graphics.h"
+#include "engine/Asset.h"
+#include "entities/Tank.h"
+
+#include "entt/entt.hpp"
+
+/// Textures and track animation of a tank. Follows the Tank component through the registry signals: every Tank gets one,
+/// and a changed design (Tank::update_tank_design) reloads the textures
+struct TankRenderable 
+{
+	TankRenderable(const TankDesign& design);
+
+	AssetRef<Texture> hull_texture;
+	AssetRef<Texture> turret_texture;
+	AssetRef<Texture> track_textures[2];
+	f32 track_animation_1, track_animation_2;
+
+	/// Adds a TankRenderable to the existing tanks and to every tank created from now on
+	static void connect(entt::registry& registry);
+	static void disconnect(entt::registry& registry);
+
+	static void update_track_animation(entt::registry& registry, f32 frame_time);
+	static void render_tanks(entt::registry& registry, Graphics& graphics);
+
+private:
+	void load_textures(const TankDesign& design);
+
+	static void on_construct_tank(entt::registry& registry, entt::entity entity);
+	static void on_update_tank(entt::registry& registry, entt::entity entity);
+	static void on_destroy_tank(entt::registry& registry, entt::entity entity);
+};
@@ -0,0 +1,141 @@
+#include "WorldRenderer.h"
+
+#include "TankRenderable.h"
+#include "MapRenderable.h"
+#include "ProjectileRenderer.h"
+#include "ParticleRenderer.h"
+#include "entities/Components.h"
+#include "entities/Particle.h"
+#include "entities/SystemScheduler.h"
+#include "engine/Profiler.h"
+#include "engine/Memory.h"
+
+WorldRenderer::WorldRenderer(World& world)
+	: world(&world)
+{
+	entt::registry& registry = world.registry;
+	TankRenderable::connect(registry);
+	if (!registry.ctx().contains<ParticleSystem>())
+		ParticleSystem::create_particle_system(registry);
+
+	registry.ctx().get<SystemScheduler>().add_system(registry, "TankRenderable::update_track_animation",
+		SystemAccess().read<Tank, Transform, Velocity>().write<TankRenderable>(),
+		[](entt::registry& registry, f32 delta_time) { TankRenderable::update_track_animation(registry, delta_time); });
+}
+
+WorldRenderer::~WorldRenderer()
+{
+	TankRenderable::disconnect(world->registry);
+}
+
+void WorldRenderer::render(Graphics& graphics)
+{
+	PROFILE_ZONE("WorldRenderer::render");
+	entt::registry& registry = world->registry;
+
+	{
+		PROFILE_ZONE("render map");
+		MapRenderable::render_map(registry, graphics);
+	}
+	{
+		PROFILE_ZONE("render tanks");
+		TankRenderable::render_tanks(registry, graphics);
+	}
+	{
+		PROFILE_ZONE("render projectiles");
+		ProjectileRenderer::render_projectiles(registry, graphics);
+	}
+	{
+		PROFILE_ZONE("render particles");
+		ParticleRenderer::render_particles(registry, graphics);
+	}
+
+	if (physics_debug_draw)
+	{
+		PROFILE_ZONE("physics debug draw");
+		Rect camera_box = graphics.camera.get_bounding_rect();
+		physics_debug_draw->drawingBounds = b2AABB(
+			b2Vec2(camera_box.x, camera_box.y),
+			b2Vec2(camera_box.x + camera_box.width, camera_box.y + camera_box.height)
+		);
+		physics_debug_draw->context = (void*)&graphics;
+
+		b2World_Draw(world->physics_world, physics_debug_draw.get());
+	}
+}
+
+static Color color_from_b2_hex(b2HexColor color)
+{
+	f32 r = ((color >> 16) & 0xFF) / 255.0f;
+	f32 g = ((color >> 8) & 0xFF) / 255.0f;
+	f32 b = (color & 0xFF) / 255.0f;
+	return { r, g, b, 1.0f };
+}
+
+void WorldRenderer::set_physics_debug_draw_enabled(bool enabled)
+{
+	if ((physics_debug_draw.get() != nullptr) == enabled)
+		return;
+	if (enabled)
+	{
+		physics_debug_draw = std::make_unique<b2DebugDraw>(b2DefaultDebugDraw());
+		physics_debug_draw->DrawCircleFcn = [](b2Vec2 center, f32 radius, b2HexColor color, void* context)
+			{
+				Graphics* graphics = static_cast<Graphics*>(context);
+				graphics->draw_circle(glm::vec2(center.x, center.y), radius, color_from_b2_hex(color));
+			};
+		physics_debug_draw->DrawPointFcn = [](b2Vec2 p, f32 size, b2HexColor color, void* context)
+			{
+				Graphics* graphics = static_cast<Graphics*>(context);
+				graphics->fill_circle(glm::vec2(p.x, p.y), size * 0.5f, color_from_b2_hex(color));
+			};
+		physics_debug_draw->DrawPolygonFcn = [](const b2Vec2* vertices, s32 vertex_count, b2HexColor color, void* context)
+			{
+				ScratchScope scratch;
+				ArenaVector<glm::vec2> polygon(scratch.allocator<glm::vec2>());
+				polygon.reserve(vertex_count);
+				for (s32 i = 0; i < vertex_count; i++)
+					polygon.emplace_back(vertices[i].x, vertices[i].y);
+				Graphics* graphics = static_cast<Graphics*>(context);
+				graphics->draw_polygon(polygon, color_from_b2_hex(color));
+			};
+		physics_debug_draw->DrawSegmentFcn = [](b2Vec2 p1, b2Vec2 p2, b2HexColor color, void* context)
+			{
+				Graphics* graphics = static_cast<Graphics*>(context);
+				graphics->draw_line({ p1.x, p1.y }, { p2.x, p2.y }, color_from_b2_hex(color));
+			};
+		physics_debug_draw->DrawSolidCircleFcn = [](b2Transform transform, float radius, b2HexColor color, void* context)
+			{
+				Graphics* graphics = static_cast<Graphics*>(context);
+				graphics->fill_circle(glm::vec2(transform.p.x, transform.p.y), radius, color_from_b2_hex(color));
+			};
+		physics_debug_draw->DrawSolidPolygonFcn = [](b2Transform transform, const b2Vec2* vertices, int vertex_count, float radius, b2HexColor color, void* context)
+			{
+				ScratchScope scratch;
+				ArenaVector<glm::vec2> polygon(scratch.allocator<glm::vec2>());
+				polygon.reserve(vertex_count);
+				for (s32 i = 0; i < vertex_count; i++)
+				{
+					polygon.emplace_back(
+						transform.p.x + vertices[i].x * transform.q.c - vertices[i].y * transform.q.s, 
+						transform.p.y + vertices[i].x * transform.q.s + vertices[i].y * transform.q.c);
+				}
+				Graphics* graphics = static_cast<Graphics*>(context);
+				graphics->fill_polygon(polygon, color_from_b2_hex(color));
+			};
+		physics_debug_draw->drawShapes = true;
+		/*
+		* // TODO: maybe implement someday
+		physics_debug_draw->DrawSolidCapsuleFcn = [](b2Vec2 p1, b2Vec2 p2, f32 radius, b2HexColor color, void* context)
+			{
+			};
+		physics_debug_draw->DrawStringFcn = [](b2Vec2 p, const char* s, b2HexColor color, void* context)
+			{
+			};
+		*/
+	}
+	else
+	{
+		physics_debug_draw.reset();
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "engine/Graphics.h"
+#include "entities/World.h"
+
+#include "box2d/box2d.h"
+
+#include <memory>
+
+/// Draws a World and adds what only a client needs to it: the TankRenderables, the ParticleSystem and the track animation system.
+/// The simulation doesn't depend on any of it; the renderables follow the entities through the registry signals.
+/// Create it right after the World, entities created before don't get their particle emitters
+/// !!! Must be destroyed before the World
+struct WorldRenderer : NoCopy
+{
+	WorldRenderer(World& world);
+	~WorldRenderer();
+
+	/// Draws the map, the tanks, the projectiles and the particles, then the physics debug draw
+	void render(Graphics& graphics);
+
+	/// Enables or disables the physics debug draw. The debug is drawn on render(Graphics&) after the entities have been rendered
+	void set_physics_debug_draw_enabled(bool enabled);
+
+private:
+	World* world;
+	std::unique_ptr<b2DebugDraw> physics_debug_draw;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "engine/Types.h"
+#include "engine/Profiler.h"
 
 #include <string>
 #include <functional>
@@ -114,6 +115,8 @@ struct Asset : NoCopy
 		this->loader_fn = loader_fn;
 	}
 
+	const std::string& get_location() const { return location; }
+
 	/// Gets a AssetRef to the asset and loads it if not already loaded
 	AssetRef<T> loaded()
 	{
@@ -137,6 +140,7 @@ private:
 	{
 		if (this->ref_count == 0)
 		{
+			PROFILE_ZONE_DETAIL("asset load", this->location);
 			this->loader_fn(this->data, this->location);
 		}
 		this->ref_count++;
@@ -2,12 +2,12 @@
 
 #include "util/FileUtil.h"
 #include "util/MathUtil.h"
+#include "Profiler.h"
 
 #include "stb_truetype/stb_truetype.h"
 #include "glad/glad.h"
 
 // DeB
-#define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image/stb_image_write.h"
 #include <iostream>
 
@@ -20,6 +20,7 @@ const u32 PADDING = 8;
 Font::Font(const char* file)
 	: fallback_char(nullptr)
 {
+	PROFILE_ZONE_DETAIL("Font::Font", file);
 	u64 file_size;
 	auto file_buffer = FileUtil::load_file(file, file_size);
 
@@ -121,7 +121,7 @@ void send_vertex(Camera& camera, f32 x, f32 y)
 	glVertex2f(transformed.x, transformed.y);
 }
 
-void Graphics::draw_polygon(const std::vector<glm::vec2>& points, const Color& color)
+void Graphics::draw_polygon(std::span<const glm::vec2> points, const Color& color)
 {
 	glColor4f(color.r, color.g, color.b, color.a);
 	glBegin(GL_LINE_LOOP);
@@ -132,7 +132,7 @@ void Graphics::draw_polygon(const std::vector<glm::vec2>& points, const Color& c
 	glEnd();
 }
 
-void Graphics::fill_polygon(const std::vector<glm::vec2>& points, const Color& color)
+void Graphics::fill_polygon(std::span<const glm::vec2> points, const Color& color)
 {
 	glColor4f(color.r, color.g, color.b, color.a);
 	glBegin(GL_POLYGON);
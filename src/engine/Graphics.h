@@ -9,6 +9,8 @@
 
 #include "glm/glm.hpp"
 
+#include <span>
+
 /// Used to translate/scale/rotate images in the world
 struct ImageTransform {
 
@@ -81,8 +83,8 @@ struct Graphics {
 	}
 
 	// OpenGL immediate draws; better used only for debug
-	void draw_polygon(const std::vector<glm::vec2>& points, const Color& color);
-	void fill_polygon(const std::vector<glm::vec2>& points, const Color& color);
+	void draw_polygon(std::span<const glm::vec2> points, const Color& color);
+	void fill_polygon(std::span<const glm::vec2> points, const Color& color);
 	void draw_rect(const Rect& rect, const Color& color);
 	void fill_rect(const Rect& rect, const Color& color);
 	void draw_circle(const glm::vec2& pos, f32 radius, const Color& color);
@@ -0,0 +1,257 @@
+#include "Memory.h"
+
+#include "Profiler.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+const static usz FRAME_ARENA_BLOCK_SIZE = 1 << 20;
+const static usz SCRATCH_ARENA_BLOCK_SIZE = 64 << 10;
+
+#ifdef TANKGAME_PROFILING
+static std::atomic<u64> allocation_count = 0;
+
+void* operator new(usz size)
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new[](usz size)
+{
+	return operator new(size);
+}
+
+void* operator new(usz size, const std::nothrow_t&) noexcept
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](usz size, const std::nothrow_t& tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+// Aligned allocations need their own free on MSVC
+static void* allocate_aligned(usz size, std::align_val_t alignment) noexcept
+{
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	usz align = (usz)alignment;
+#ifdef _MSC_VER
+	return _aligned_malloc(size ? size : 1, align);
+#else
+	// aligned_alloc wants a multiple of the alignment
+	return std::aligned_alloc(align, (std::max<usz>(size, 1) + align - 1) & ~(align - 1));
+#endif
+}
+
+static void free_aligned(void* ptr) noexcept
+{
+#ifdef _MSC_VER
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+
+void* operator new(usz size, std::align_val_t alignment)
+{
+	if (void* ptr = allocate_aligned(size, alignment))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void* operator new[](usz size, std::align_val_t alignment)
+{
+	return operator new(size, alignment);
+}
+
+void* operator new(usz size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return allocate_aligned(size, alignment);
+}
+
+void* operator new[](usz size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	return allocate_aligned(size, alignment);
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, usz) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, usz) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+	free_aligned(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+	free_aligned(ptr);
+}
+
+void operator delete(void* ptr, usz, std::align_val_t) noexcept
+{
+	free_aligned(ptr);
+}
+
+void operator delete[](void* ptr, usz, std::align_val_t) noexcept
+{
+	free_aligned(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	free_aligned(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	free_aligned(ptr);
+}
+#endif
+
+LinearArena::LinearArena(usz block_size)
+	: high_water(0), block_size(block_size), current_block(0), offset(0)
+{
+}
+
+void* LinearArena::allocate(usz size, usz alignment)
+{
+	while (current_block < blocks.size())
+	{
+		Block& block = blocks[current_block];
+		uintptr_t base = (uintptr_t)block.data.get();
+		usz aligned = ((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+		if (aligned + size <= block.size)
+		{
+			offset = aligned + size;
+			high_water = std::max(high_water, get_used());
+			return block.data.get() + aligned;
+		}
+
+		// Blocks after the current one are left over from before a rewind
+		if (current_block + 1 >= blocks.size() || blocks[current_block + 1].size < size + alignment)
+			break;
+		current_block++;
+		offset = 0;
+	}
+
+	usz new_size = std::max(block_size, size + alignment);
+	u32 index = blocks.empty() ? 0 : current_block + 1;
+	blocks.emplace(blocks.begin() + index, std::unique_ptr<u8[]>(new u8[new_size]), new_size);
+	current_block = index;
+	offset = 0;
+	return allocate(size, alignment);
+}
+
+void LinearArena::rewind(Marker marker)
+{
+	if (marker.block == 0 && marker.offset == 0)
+	{
+		reset();
+		return;
+	}
+	current_block = marker.block;
+	offset = marker.offset;
+}
+
+void LinearArena::reset()
+{
+	if (blocks.size() > 1)
+	{
+		usz total = get_capacity();
+		blocks.clear();
+		blocks.emplace_back(std::unique_ptr<u8[]>(new u8[total]), total);
+	}
+	current_block = 0;
+	offset = 0;
+}
+
+usz LinearArena::get_used() const
+{
+	usz used = offset;
+	for (u32 i = 0; i < current_block; i++)
+		used += blocks[i].size;
+	return used;
+}
+
+usz LinearArena::get_capacity() const
+{
+	usz capacity = 0;
+	for (const Block& block : blocks)
+		capacity += block.size;
+	return capacity;
+}
+
+LinearArena& Memory::get_frame_arena()
+{
+	static LinearArena arena(FRAME_ARENA_BLOCK_SIZE);
+	return arena;
+}
+
+LinearArena& Memory::get_scratch_arena()
+{
+	thread_local LinearArena arena(SCRATCH_ARENA_BLOCK_SIZE);
+	return arena;
+}
+
+void Memory::begin_frame()
+{
+	LinearArena& arena = get_frame_arena();
+	PROFILE_COUNTER("frame arena bytes", arena.get_used());
+	arena.reset();
+
+#ifdef TANKGAME_PROFILING
+	// Heap allocations of the frame that just ended
+	static u64 last_allocation_count = 0;
+	u64 count = get_allocation_count();
+	PROFILE_COUNTER("heap allocations", count - last_allocation_count);
+	last_allocation_count = count;
+#endif
+}
+
+u64 Memory::get_allocation_count()
+{
+#ifdef TANKGAME_PROFILING
+	return allocation_count.load(std::memory_order_relaxed);
+#else
+	return 0;
+#endif
+}
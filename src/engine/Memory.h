@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Types.h"
+
+#include <memory>
+#include <vector>
+#include <string>
+
+/// Bump allocator over a list of blocks. Memory is only given back all at once, by reset or by rewinding to a marker.
+/// When more than one block was needed, a reset replaces the blocks by one block of their total size, so once the arena
+/// has grown to the peak usage it doesn't allocate anymore. Not thread safe
+struct LinearArena : NoCopy
+{
+	struct Marker
+	{
+		u32 block;
+		usz offset;
+	};
+
+	LinearArena(usz block_size);
+
+	void* allocate(usz size, usz alignment);
+
+	template<typename T>
+	T* allocate_array(usz count)
+	{
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	/// Frees everything allocated after the marker was taken
+	Marker get_marker() const { return { current_block, offset }; }
+	void rewind(Marker marker);
+	void reset();
+
+	/// Bytes handed out since the last reset, including alignment padding and the unused ends of full blocks
+	usz get_used() const;
+	usz get_capacity() const;
+	/// Highest get_used() since creation
+	usz high_water;
+
+private:
+	struct Block
+	{
+		std::unique_ptr<u8[]> data;
+		usz size;
+	};
+
+	usz block_size;
+	std::vector<Block> blocks;
+	u32 current_block;
+	usz offset;
+};
+
+/// STL allocator on a LinearArena; deallocate does nothing, the memory comes back when the arena is reset or rewound.
+/// Containers using it must not outlive the reset
+template<typename T>
+struct ArenaAllocator
+{
+	using value_type = T;
+
+	ArenaAllocator(LinearArena& arena)
+		: arena(&arena)
+	{
+	}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other)
+		: arena(other.arena)
+	{
+	}
+
+	T* allocate(usz count) { return arena->allocate_array<T>(count); }
+	void deallocate(T*, usz) {}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+
+	LinearArena* arena;
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+/// Transient memory and the global heap allocation counter
+struct Memory
+{
+	/// Memory of the current frame, reset by begin_frame. Only used by the main thread
+	static LinearArena& get_frame_arena();
+	/// Scratch memory of the calling thread; used through a ScratchScope
+	static LinearArena& get_scratch_arena();
+
+	/// Resets the frame arena; called at the start of every frame. Records the frame arena usage and the heap allocations
+	/// of the last frame as profiler counters
+	static void begin_frame();
+
+	/// Calls of the global operator new (all overloads, including the aligned and nothrow ones) since the start of the process, on all threads.
+	/// Only counted when built with TANKGAME_PROFILING, otherwise always 0
+	static u64 get_allocation_count();
+};
+
+/// Everything allocated from the thread's scratch arena while the scope lives is freed at its end. Scopes nest
+struct ScratchScope : NoCopy
+{
+	ScratchScope()
+		: arena(Memory::get_scratch_arena()), marker(arena.get_marker())
+	{
+	}
+
+	~ScratchScope()
+	{
+		arena.rewind(marker);
+	}
+
+	template<typename T>
+	ArenaAllocator<T> allocator() { return ArenaAllocator<T>(arena); }
+
+	LinearArena& arena;
+
+private:
+	LinearArena::Marker marker;
+};
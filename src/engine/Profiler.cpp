@@ -0,0 +1,174 @@
+#include "Profiler.h"
+
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+
+/// Events of a single thread. Shared so the events survive threads that exit during a capture
+struct ProfileThreadBuffer
+{
+	std::mutex mutex;
+	std::vector<ProfileEvent> events;
+	std::string thread_name;
+	u32 thread_id;
+};
+
+std::atomic<bool> Profiler::capturing = false;
+
+static std::mutex buffers_mutex;
+static std::vector<std::shared_ptr<ProfileThreadBuffer>> buffers;
+static u64 capture_start = 0;
+
+static const std::chrono::steady_clock::time_point clock_epoch = std::chrono::steady_clock::now();
+
+static ProfileThreadBuffer& get_thread_buffer()
+{
+	thread_local std::shared_ptr<ProfileThreadBuffer> thread_buffer;
+	if (!thread_buffer)
+	{
+		thread_buffer = std::make_shared<ProfileThreadBuffer>();
+		thread_buffer->events.reserve(1 << 14);
+
+		std::lock_guard lock(buffers_mutex);
+		thread_buffer->thread_id = (u32)buffers.size() + 1;
+		buffers.push_back(thread_buffer);
+	}
+	return *thread_buffer;
+}
+
+/// Writes a JSON string literal
+static void write_json_string(std::ofstream& file, std::string_view string)
+{
+	file << '"';
+	for (char c : string)
+	{
+		if (c == '"' || c == '\\')
+			file << '\\' << c;
+		else if ((u8)c < 0x20)
+			file << ' ';
+		else
+			file << c;
+	}
+	file << '"';
+}
+
+void Profiler::begin_capture()
+{
+	std::lock_guard lock(buffers_mutex);
+	for (auto& buffer : buffers)
+	{
+		std::lock_guard buffer_lock(buffer->mutex);
+		buffer->events.clear();
+	}
+	capture_start = now();
+	capturing.store(true, std::memory_order_relaxed);
+}
+
+void Profiler::end_capture(const char* file_name)
+{
+	capturing.store(false, std::memory_order_relaxed);
+
+	std::ofstream file(file_name);
+	if (!file)
+		throw std::runtime_error("Failed to open file: " + std::string(file_name));
+
+	file.setf(std::ios::fixed);
+	file.precision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	bool first = true;
+	auto separate = [&]()
+		{
+			if (!first)
+				file << ",\n";
+			first = false;
+		};
+
+	std::lock_guard lock(buffers_mutex);
+	for (auto& buffer : buffers)
+	{
+		std::lock_guard buffer_lock(buffer->mutex);
+
+		if (!buffer->thread_name.empty())
+		{
+			separate();
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->thread_id << ",\"args\":{\"name\":";
+			write_json_string(file, buffer->thread_name);
+			file << "}}";
+		}
+
+		for (ProfileEvent& event : buffer->events)
+		{
+			if (event.start < capture_start)
+				continue;
+
+			separate();
+			file << "{\"name\":";
+			write_json_string(file, event.name);
+			file << ",\"pid\":1,\"tid\":" << buffer->thread_id << ",\"ts\":" << (event.start - capture_start) * 0.001;
+			if (event.is_counter)
+			{
+				file << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+			}
+			else
+			{
+				file << ",\"ph\":\"X\",\"dur\":" << event.duration * 0.001;
+				if (!event.detail.empty())
+				{
+					file << ",\"args\":{\"detail\":";
+					write_json_string(file, event.detail);
+					file << "}";
+				}
+				file << "}";
+			}
+		}
+		buffer->events.clear();
+	}
+
+	file << "]}\n";
+}
+
+void Profiler::consume_events(const std::function<void(u32 thread_id, const ProfileEvent& event)>& fn)
+{
+	std::lock_guard lock(buffers_mutex);
+	for (auto& buffer : buffers)
+	{
+		std::lock_guard buffer_lock(buffer->mutex);
+		for (ProfileEvent& event : buffer->events)
+		{
+			if (event.start >= capture_start)
+				fn(buffer->thread_id, event);
+		}
+		buffer->events.clear();
+	}
+}
+
+void Profiler::set_thread_name(const char* name)
+{
+	ProfileThreadBuffer& buffer = get_thread_buffer();
+	std::lock_guard lock(buffer.mutex);
+	buffer.thread_name = name;
+}
+
+u64 Profiler::now()
+{
+	// + 1 so a valid time stamp is never 0
+	return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - clock_epoch).count() + 1;
+}
+
+void Profiler::record_zone(const char* name, std::string_view detail, u64 start, u64 end)
+{
+	ProfileThreadBuffer& buffer = get_thread_buffer();
+	std::lock_guard lock(buffer.mutex);
+	buffer.events.emplace_back(name, std::string(detail), start, end - start, 0.0, false);
+}
+
+void Profiler::record_counter(const char* name, f64 value)
+{
+	ProfileThreadBuffer& buffer = get_thread_buffer();
+	std::lock_guard lock(buffer.mutex);
+	buffer.events.emplace_back(name, std::string(), now(), 0, value, true);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Types.h"
+
+#include <string>
+#include <string_view>
+#include <atomic>
+#include <functional>
+
+/// A recorded zone (duration) or counter sample; times are Profiler::now() nanoseconds
+struct ProfileEvent
+{
+	const char* name;
+	std::string detail;
+	u64 start;
+	u64 duration;
+	f64 value;
+	bool is_counter;
+};
+
+/// Hierarchical instrumentation profiler. Zones and counters are recorded into per-thread buffers while a capture runs
+/// and exported in the Chrome trace JSON format (opens in Perfetto or chrome://tracing).
+/// Zones nest by time, so the hierarchy is visible per thread without tracking parents.
+/// When no capture runs, a zone costs one relaxed atomic load. Building without TANKGAME_PROFILING removes all zones.
+struct Profiler
+{
+	/// Clears old data and starts recording
+	static void begin_capture();
+	/// Stops recording and writes all recorded events to a Chrome trace JSON file; throws exception on error
+	static void end_capture(const char* file_name);
+
+	static bool is_capturing() { return capturing.load(std::memory_order_relaxed); }
+
+	/// Passes all events recorded so far to fn (with the trace thread id) and removes them; the capture keeps running.
+	/// Used to aggregate zones in process (e.g. the benchmarks) instead of writing a trace file
+	static void consume_events(const std::function<void(u32 thread_id, const ProfileEvent& event)>& fn);
+
+	/// Names the calling thread in the trace
+	static void set_thread_name(const char* name);
+
+	static u64 now();
+	static void record_zone(const char* name, std::string_view detail, u64 start, u64 end);
+	static void record_counter(const char* name, f64 value);
+
+private:
+	static std::atomic<bool> capturing;
+};
+
+/// Records a zone from construction to destruction; use the PROFILE_ZONE macros
+struct ProfileZone : NoCopy
+{
+	ProfileZone(const char* name)
+		: name(name), detail(), start(Profiler::is_capturing() ? Profiler::now() : 0)
+	{
+	}
+
+	ProfileZone(const char* name, std::string_view detail)
+		: name(name), detail(detail), start(Profiler::is_capturing() ? Profiler::now() : 0)
+	{
+	}
+
+	~ProfileZone()
+	{
+		if (start != 0 && Profiler::is_capturing())
+			Profiler::record_zone(name, detail, start, Profiler::now());
+	}
+
+private:
+	const char* name;
+	std::string_view detail;
+	u64 start;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef TANKGAME_PROFILING
+/// Profiles the rest of the scope; name needs to be a string literal
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+/// Like PROFILE_ZONE with an extra detail string (e.g. a file name); detail needs to outlive the scope
+#define PROFILE_ZONE_DETAIL(name, detail) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name, detail)
+/// Records a counter sample (e.g. entity counts) at the current time
+#define PROFILE_COUNTER(name, value) do { if (Profiler::is_capturing()) Profiler::record_counter(name, (f64)(value)); } while (0)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_ZONE_DETAIL(name, detail)
+#define PROFILE_COUNTER(name, value)
+#endif
@@ -0,0 +1,3 @@
+// Here rather than in the client, the benchmarks use stbi_zlib_compress without a window
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image/stb_image_write.h"
@@ -0,0 +1,132 @@
+#include "ThreadPool.h"
+
+#include "Profiler.h"
+
+#include <string>
+#include <utility>
+
+const static u32 INITIAL_JOB_CAPACITY = 256;
+
+ThreadPool::ThreadPool(u32 worker_count)
+	: waiting(0), stopping(false), jobs(INITIAL_JOB_CAPACITY), job_head(0), job_count(0)
+{
+	workers.reserve(worker_count);
+	for (u32 i = 0; i < worker_count; i++)
+		workers.emplace_back(&ThreadPool::worker_main, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	job_condition.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+ThreadPool& ThreadPool::get_shared()
+{
+	static ThreadPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+	return pool;
+}
+
+void ThreadPool::submit(TaskGroup& group, std::function<void()> job)
+{
+	group.pending.fetch_add(1, std::memory_order_relaxed);
+	{
+		std::lock_guard lock(mutex);
+		push_job({ &group, std::move(job) });
+		if (waiting > 0)
+			wait_condition.notify_all();
+	}
+	job_condition.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+	std::unique_lock lock(mutex);
+	while (group.pending.load(std::memory_order_acquire) != 0)
+	{
+		if (job_count == 0)
+		{
+			waiting++;
+			wait_condition.wait(lock, [&]() { return group.pending.load(std::memory_order_acquire) == 0 || job_count > 0; });
+			waiting--;
+			continue;
+		}
+
+		Job job = pop_job();
+		lock.unlock();
+		run_job(job);
+		lock.lock();
+	}
+
+	if (group.exception)
+		std::rethrow_exception(std::exchange(group.exception, nullptr));
+}
+
+void ThreadPool::push_job(Job job)
+{
+	if (job_count == jobs.size())
+	{
+		std::vector<Job> grown(jobs.size() * 2);
+		for (u32 i = 0; i < job_count; i++)
+			grown[i] = std::move(jobs[(job_head + i) % jobs.size()]);
+		jobs = std::move(grown);
+		job_head = 0;
+	}
+	jobs[(job_head + job_count) % jobs.size()] = std::move(job);
+	job_count++;
+}
+
+ThreadPool::Job ThreadPool::pop_job()
+{
+	Job job = std::move(jobs[job_head]);
+	jobs[job_head].fn = nullptr;
+	job_head = (job_head + 1) % jobs.size();
+	job_count--;
+	return job;
+}
+
+void ThreadPool::run_job(Job& job)
+{
+	try
+	{
+		job.fn();
+	}
+	catch (...)
+	{
+		std::lock_guard lock(mutex);
+		if (!job.group->exception)
+			job.group->exception = std::current_exception();
+	}
+
+	if (job.group->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		// Taking the lock orders the wake up after the check of a thread that is about to wait
+		std::lock_guard lock(mutex);
+		if (waiting > 0)
+			wait_condition.notify_all();
+	}
+}
+
+void ThreadPool::worker_main(u32 index)
+{
+	std::string name = "Worker " + std::to_string(index);
+	Profiler::set_thread_name(name.c_str());
+
+	std::unique_lock lock(mutex);
+	while (true)
+	{
+		job_condition.wait(lock, [this]() { return stopping || job_count > 0; });
+		if (job_count == 0)
+			return;
+
+		Job job = pop_job();
+		lock.unlock();
+		run_job(job);
+		lock.lock();
+	}
+}
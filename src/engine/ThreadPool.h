@@ -0,0 +1,100 @@
+#pragma once
+
+#include "Types.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/// Jobs submitted together; wait on it to know when all of them have finished
+struct TaskGroup : NoCopy
+{
+	std::atomic<u32> pending = 0;
+	/// First exception thrown by a job of the group, rethrown by ThreadPool::wait; guarded by the mutex of the pool
+	std::exception_ptr exception;
+};
+
+/// Fixed set of worker threads running jobs from one shared queue.
+/// A thread waiting for a task group runs queued jobs itself until the group is done, so jobs may submit and wait for
+/// other jobs (e.g. a parallel_for inside a job) without deadlocking. A pool without workers runs every job on the waiting thread
+struct ThreadPool : NoCopy
+{
+	ThreadPool(u32 worker_count);
+	~ThreadPool();
+
+	/// Pool shared by the whole process with one worker less than the hardware threads (the main thread takes part while waiting)
+	static ThreadPool& get_shared();
+
+	void submit(TaskGroup& group, std::function<void()> job);
+	/// Runs queued jobs (of any group) until all jobs of the group have finished. A job that throws still counts as finished;
+	/// the first exception of the group is rethrown here once all its jobs are done
+	void wait(TaskGroup& group);
+
+	/// Calls fn(begin, end) for the index ranges [0, count) split into chunks of chunk_size; returns when all chunks are done,
+	/// then rethrows the first exception of a chunk. A range of a single chunk runs directly on the calling thread
+	template<typename F>
+	void parallel_for(u32 count, u32 chunk_size, F&& fn)
+	{
+		chunk_size = std::max(chunk_size, 1u);
+		if (count <= chunk_size || workers.empty())
+		{
+			if (count > 0)
+				fn(0u, count);
+			return;
+		}
+
+		TaskGroup group;
+		for (u32 begin = chunk_size; begin < count; begin += chunk_size)
+		{
+			u32 end = std::min(begin + chunk_size, count);
+			submit(group, [&fn, begin, end]() { fn(begin, end); });
+		}
+		// The other chunks reference fn and the group, so they have to finish even if this one throws
+		std::exception_ptr exception;
+		try
+		{
+			fn(0u, chunk_size);
+		}
+		catch (...)
+		{
+			exception = std::current_exception();
+		}
+		wait(group);
+		if (exception)
+			std::rethrow_exception(exception);
+	}
+
+	u32 get_worker_count() const { return (u32)workers.size(); }
+
+private:
+	struct Job
+	{
+		TaskGroup* group;
+		std::function<void()> fn;
+	};
+
+	void push_job(Job job);
+	Job pop_job();
+
+	void worker_main(u32 index);
+	/// Runs the job, keeps its exception in the group and wakes the waiters once the group is done
+	void run_job(Job& job);
+
+	std::mutex mutex;
+	/// Workers sleep on this until there is a job
+	std::condition_variable job_condition;
+	/// Waiting threads sleep on this until there is a job or a group finished
+	std::condition_variable wait_condition;
+	u32 waiting;
+	bool stopping;
+	/// Ring buffer of the queued jobs; only grows, so a steady state doesn't allocate
+	std::vector<Job> jobs;
+	u32 job_head;
+	u32 job_count;
+	std::vector<std::thread> workers;
+};
@@ -0,0 +1,268 @@
+#include "AnalyticProjectiles.h"
+
+#include "CollisionCategory.h"
+#include "MapDestruction.h"
+#include "Particle.h"
+#include "Tank.h"
+#include "CommandBuffer.h"
+#include "Lockstep.h"
+#include "AssetManager.h"
+#include "engine/util/MathUtil.h"
+
+const static u8 FLAG_FIX_VELOCITY = 1 << 0;
+
+// The shooter is ignored while the projectile leaves the barrel
+const static f32 SHOOTER_IGNORE_TIME = 0.1f;
+// Max bounces resolved per projectile in a single update
+const static u32 MAX_CASTS_PER_UPDATE = 4;
+// Pulls the projectile back from the hit surface so the next cast does not start inside it
+const static f32 SURFACE_OFFSET = 0.005f;
+
+struct CastContext
+{
+	b2BodyId ignore_body;
+	bool hit;
+	b2ShapeId shape;
+	glm::vec2 point;
+	glm::vec2 normal;
+	f32 fraction;
+};
+
+/// Closest hit ray/shape cast callback which skips the ignored body
+static float closest_cast_callback(b2ShapeId shape, b2Vec2 point, b2Vec2 normal, float fraction, void* context)
+{
+	CastContext* cast = static_cast<CastContext*>(context);
+	if (B2_IS_NON_NULL(cast->ignore_body) && B2_ID_EQUALS(b2Shape_GetBody(shape), cast->ignore_body))
+		return -1.0f;
+
+	cast->hit = true;
+	cast->shape = shape;
+	cast->point = { point.x, point.y };
+	cast->normal = { normal.x, normal.y };
+	cast->fraction = fraction;
+	return fraction;
+}
+
+AnalyticProjectiles::AnalyticProjectiles(b2WorldId physics_world)
+	: physics_world(physics_world), next_id(1)
+{
+}
+
+void AnalyticProjectiles::add_impact_listener(ProjectileImpactListener listener)
+{
+	impact_listeners.push_back(std::move(listener));
+}
+
+void AnalyticProjectiles::clear()
+{
+	ids.clear();
+	positions.clear();
+	velocities.clear();
+	shooters.clear();
+	speeds.clear();
+	radii.clear();
+	masses.clear();
+	restitutions.clear();
+	scales.clear();
+	ages.clear();
+	collisions_left.clear();
+	tile_damages.clear();
+	sprite_types.clear();
+	particle_types.clear();
+	flags.clear();
+}
+
+void AnalyticProjectiles::copy_projectiles(const AnalyticProjectiles& other)
+{
+	next_id = other.next_id;
+	ids.assign(other.ids.begin(), other.ids.end());
+	positions.assign(other.positions.begin(), other.positions.end());
+	velocities.assign(other.velocities.begin(), other.velocities.end());
+	shooters.assign(other.shooters.begin(), other.shooters.end());
+	speeds.assign(other.speeds.begin(), other.speeds.end());
+	radii.assign(other.radii.begin(), other.radii.end());
+	masses.assign(other.masses.begin(), other.masses.end());
+	restitutions.assign(other.restitutions.begin(), other.restitutions.end());
+	scales.assign(other.scales.begin(), other.scales.end());
+	ages.assign(other.ages.begin(), other.ages.end());
+	collisions_left.assign(other.collisions_left.begin(), other.collisions_left.end());
+	tile_damages.assign(other.tile_damages.begin(), other.tile_damages.end());
+	sprite_types.assign(other.sprite_types.begin(), other.sprite_types.end());
+	particle_types.assign(other.particle_types.begin(), other.particle_types.end());
+	flags.assign(other.flags.begin(), other.flags.end());
+}
+
+void AnalyticProjectiles::hash(StateHash& hash) const
+{
+	hash.add(size());
+	hash.add(next_id);
+	for (u32 i = 0; i < size(); i++)
+	{
+		hash.add(ids[i]);
+		hash.add(positions[i]);
+		hash.add(velocities[i]);
+		hash.add(shooters[i]);
+		hash.add(speeds[i]);
+		hash.add(ages[i]);
+		hash.add((u32)collisions_left[i] | (u32)flags[i] << 16);
+	}
+}
+
+void AnalyticProjectiles::remove(u32 index)
+{
+	// Swap with the last element to keep the arrays packed
+	auto swap_pop = [index](auto& vector)
+		{
+			vector[index] = vector.back();
+			vector.pop_back();
+		};
+
+	swap_pop(ids);
+	swap_pop(positions);
+	swap_pop(velocities);
+	swap_pop(shooters);
+	swap_pop(speeds);
+	swap_pop(radii);
+	swap_pop(masses);
+	swap_pop(restitutions);
+	swap_pop(scales);
+	swap_pop(ages);
+	swap_pop(collisions_left);
+	swap_pop(tile_damages);
+	swap_pop(sprite_types);
+	swap_pop(particle_types);
+	swap_pop(flags);
+}
+
+u32 AnalyticProjectiles::spawn(entt::registry& registry, entt::entity shooter_entity, const ProjectileType& type, glm::vec2 pos, f32 rot)
+{
+	AnalyticProjectiles& projectiles = registry.ctx().get<AnalyticProjectiles>();
+
+	glm::vec2 hitbox = Projectile::get_hitbox(type);
+
+	u32 id = projectiles.next_id++;
+	projectiles.ids.push_back(id);
+	projectiles.positions.push_back(pos);
+	projectiles.velocities.push_back(MathUtil::rotate({ 0.0f, -type.velocity }, rot));
+	projectiles.shooters.push_back(shooter_entity);
+	projectiles.speeds.push_back(type.velocity);
+	projectiles.radii.push_back(hitbox.x * 0.5f);
+	projectiles.masses.push_back(hitbox.x * hitbox.y * type.density);
+	projectiles.restitutions.push_back(type.restitution);
+	projectiles.scales.push_back(type.scale);
+	projectiles.ages.push_back(0.0f);
+	projectiles.collisions_left.push_back(type.max_collisons);
+	projectiles.tile_damages.push_back(type.tile_damage);
+	projectiles.sprite_types.push_back(static_cast<u8>(type.sprite_type));
+	projectiles.particle_types.push_back(type.particle_type);
+	projectiles.flags.push_back(type.fix_velocity ? FLAG_FIX_VELOCITY : 0);
+	return id;
+}
+
+void AnalyticProjectiles::update_projectiles(entt::registry& registry, f32 delta_time)
+{
+	AnalyticProjectiles& projectiles = registry.ctx().get<AnalyticProjectiles>();
+	bool particles = ParticleSystem::is_active(registry);
+
+	b2QueryFilter filter = b2DefaultQueryFilter();
+	filter.categoryBits = CATEGORY_PROJECTILE;
+	filter.maskBits = CATEGORY_MAP | CATEGORY_TANK;
+
+	u32 i = 0;
+	while (i < projectiles.size())
+	{
+		glm::vec2& pos = projectiles.positions[i];
+		glm::vec2& velocity = projectiles.velocities[i];
+		f32 radius = projectiles.radii[i];
+
+		CastContext cast;
+		cast.ignore_body = b2_nullBodyId;
+		if (projectiles.ages[i] < SHOOTER_IGNORE_TIME && registry.valid(projectiles.shooters[i]) && registry.all_of<Physics>(projectiles.shooters[i]))
+			cast.ignore_body = registry.get<Physics>(projectiles.shooters[i]).body;
+
+		projectiles.ages[i] += delta_time;
+
+		f32 remaining_time = delta_time;
+		glm::vec2 move = velocity * remaining_time;
+		bool destroyed = false;
+
+		for (u32 cast_index = 0; cast_index < MAX_CASTS_PER_UPDATE; cast_index++)
+		{
+			cast.hit = false;
+			if (radius > 0.0f)
+			{
+				b2Vec2 center = b2Vec2(pos.x, pos.y);
+				b2ShapeProxy proxy = b2MakeProxy(&center, 1, radius);
+				b2World_CastShape(projectiles.physics_world, &proxy, b2Vec2(move.x, move.y), filter, closest_cast_callback, &cast);
+			}
+			else
+			{
+				b2World_CastRay(projectiles.physics_world, b2Vec2(pos.x, pos.y), b2Vec2(move.x, move.y), filter, closest_cast_callback, &cast);
+			}
+
+			if (!cast.hit)
+			{
+				pos += move;
+				break;
+			}
+
+			glm::vec2 old_velocity = velocity;
+			pos += move * cast.fraction + cast.normal * SURFACE_OFFSET;
+
+			entt::entity other = Physics::get_entity(b2Shape_GetBody(cast.shape));
+			for (auto& listener : projectiles.impact_listeners)
+				listener(registry, projectiles.ids[i], projectiles.shooters[i], other, cast.point, cast.normal);
+			MapDestruction::on_projectile_hit(registry, other, cast.point, projectiles.tile_damages[i]);
+			if (particles)
+			{
+				// The emitters belong to the particle update, which may run concurrently
+				registry.ctx().get<CommandBuffer>().invoke(other, [](entt::registry& registry, entt::entity other)
+					{
+						Tank::trigger_hit_particles(registry, other);
+					});
+			}
+
+			if (projectiles.collisions_left[i] == 0)
+			{
+				b2BodyId body = b2Shape_GetBody(cast.shape);
+				if (b2Body_GetType(body) == b2_dynamicBody)
+				{
+					glm::vec2 impulse = old_velocity * projectiles.masses[i];
+					b2Body_ApplyLinearImpulse(body, b2Vec2(impulse.x, impulse.y), b2Vec2(cast.point.x, cast.point.y), true);
+				}
+
+				if (particles)
+				{
+					f32 rot = std::atan2(old_velocity.x, -old_velocity.y);
+					ParticleSystem::spawn(registry, AssetManager::get_instance().particle_impact[projectiles.particle_types[i]], Transform{ cast.point, rot }, 10.0f, 0.5f);
+				}
+				destroyed = true;
+				break;
+			}
+			projectiles.collisions_left[i]--;
+
+			// Reflect on the surface normal, restitution only scales the normal part
+			f32 normal_speed = glm::dot(velocity, cast.normal);
+			if (normal_speed < 0.0f)
+				velocity -= (1.0f + projectiles.restitutions[i]) * normal_speed * cast.normal;
+			if ((projectiles.flags[i] & FLAG_FIX_VELOCITY) && glm::dot(velocity, velocity) > 0.0f)
+				velocity = glm::normalize(velocity) * projectiles.speeds[i];
+
+			b2BodyId body = b2Shape_GetBody(cast.shape);
+			if (b2Body_GetType(body) == b2_dynamicBody)
+			{
+				glm::vec2 impulse = (old_velocity - velocity) * projectiles.masses[i];
+				b2Body_ApplyLinearImpulse(body, b2Vec2(impulse.x, impulse.y), b2Vec2(cast.point.x, cast.point.y), true);
+			}
+
+			// Continue the remaining part of the move in the new direction
+			remaining_time *= 1.0f - cast.fraction;
+			move = velocity * remaining_time;
+		}
+
+		if (destroyed)
+			projectiles.remove(i);
+		else
+			i++;
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Projectile.h"
+
+#include "entt/entt.hpp"
+#include "box2d/box2d.h"
+#include "glm/glm.hpp"
+
+#include <vector>
+#include <functional>
+
+struct StateHash;
+
+/// Analytic projectiles have no entity; projectile is the id spawn returned for it
+using ProjectileImpactListener = std::function<void(entt::registry&, u32 projectile, entt::entity shooter_entity, entt::entity other_entity, glm::vec2 pos, glm::vec2 normal)>;
+
+/// Packed (SoA) storage for non-physical projectiles (ProjectileType::analytic).
+/// These have no entity or Box2D body; they are advanced by swept casts against the physics world
+/// and bounce analytically using max_collisons and restitution.
+/// One instance lives in the registry context of every World.
+struct AnalyticProjectiles : NoCopy
+{
+	AnalyticProjectiles(b2WorldId physics_world);
+
+	/// Registers a listener that is invoked for every impact (bounce or final hit). The listeners run inside the update system,
+	/// concurrently with other systems; changes to other entities need to go through the CommandBuffer
+	void add_impact_listener(ProjectileImpactListener listener);
+
+	u32 size() const { return (u32)positions.size(); }
+	const std::vector<glm::vec2>& get_positions() const { return positions; }
+	const std::vector<glm::vec2>& get_velocities() const { return velocities; }
+	void clear();
+	/// Replaces the projectiles by copies of the projectiles of other; the listeners stay. Keeps the memory, so copies between
+	/// the same instances stop allocating once they have held the most projectiles (see WorldSnapshot)
+	void copy_projectiles(const AnalyticProjectiles& other);
+	/// Adds the state of every projectile (see StateLog)
+	void hash(StateHash& hash) const;
+
+	/// Spawns a projectile in the AnalyticProjectiles of the registry context; returns its id, unique within the World
+	static u32 spawn(entt::registry& registry, entt::entity shooter_entity, const ProjectileType& type, glm::vec2 pos, f32 rot);
+	static void update_projectiles(entt::registry& registry, f32 delta_time);
+
+private:
+	friend struct ProjectileRenderer;
+	friend struct World;
+
+	void remove(u32 index);
+
+	b2WorldId physics_world;
+	std::vector<ProjectileImpactListener> impact_listeners;
+
+	u32 next_id;
+	std::vector<u32> ids;
+	std::vector<glm::vec2> positions;
+	std::vector<glm::vec2> velocities;
+	std::vector<entt::entity> shooters;
+	std::vector<f32> speeds;
+	std::vector<f32> radii;
+	std::vector<f32> masses;
+	std::vector<f32> restitutions;
+	std::vector<f32> scales;
+	std::vector<f32> ages;
+	std::vector<u16> collisions_left;
+	std::vector<u16> tile_damages;
+	std::vector<u8> sprite_types;
+	std::vector<u8> particle_types;
+	std::vector<u8> flags;
+};
@@ -0,0 +1,56 @@
+#include "CommandBuffer.h"
+
+#include <algorithm>
+
+void CommandBuffer::record(CommandType type, entt::entity entity, std::function<void(entt::registry&, entt::entity)> apply)
+{
+	std::lock_guard lock(mutex);
+	commands.emplace_back(type, entity, std::move(apply), (u32)commands.size());
+}
+
+void CommandBuffer::flush(entt::registry& registry)
+{
+	while (true)
+	{
+		{
+			std::lock_guard lock(mutex);
+			if (commands.empty())
+				return;
+			std::swap(commands, applying);
+		}
+
+		// The sequence keeps the record order like a stable sort would, without the temporary buffer stable_sort allocates
+		std::sort(applying.begin(), applying.end(), [](const Command& a, const Command& b)
+			{
+				if (a.type != b.type)
+					return a.type < b.type;
+				if (a.entity != b.entity)
+					return entt::to_integral(a.entity) < entt::to_integral(b.entity);
+				return a.sequence < b.sequence;
+			});
+
+		for (Command& command : applying)
+		{
+			switch (command.type)
+			{
+			case CommandType::Create:
+				command.apply(registry, registry.create());
+				break;
+			case CommandType::Modify:
+				if (registry.valid(command.entity))
+					command.apply(registry, command.entity);
+				break;
+			case CommandType::Invoke:
+				if (command.entity == entt::null || registry.valid(command.entity))
+					command.apply(registry, command.entity);
+				break;
+			case CommandType::Destroy:
+				if (registry.valid(command.entity))
+					registry.destroy(command.entity);
+				break;
+			}
+		}
+
+		applying.clear();
+	}
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "engine/Types.h"
+
+#include "entt/entt.hpp"
+
+#include <vector>
+#include <functional>
+#include <mutex>
+
+enum class CommandType : u8
+{
+	Create = 0,
+	Modify = 1,
+	Invoke = 2,
+	Destroy = 3
+};
+
+struct Command
+{
+	CommandType type;
+	entt::entity entity;
+	std::function<void(entt::registry&, entt::entity)> apply;
+	/// Record order within the batch
+	u32 sequence;
+};
+
+/// Records structural changes (create, destroy, emplace, remove) made by systems and contact callbacks.
+/// The changes are applied in one batch at the sync points of World::update, so no change ever invalidates a running iteration.
+/// The batch is sorted by command type (creates first, destroys last) and then by entity; the record order is kept otherwise.
+/// Recording is thread safe. One instance lives in the registry context of every World.
+struct CommandBuffer : NoCopy
+{
+	/// Creates an entity on apply and passes it to init to emplace its components
+	void create(std::function<void(entt::registry&, entt::entity)> init)
+	{
+		record(CommandType::Create, entt::null, std::move(init));
+	}
+
+	/// Emplaces (or replaces) a component on apply; skipped if the entity was destroyed in between
+	template<typename T, typename... Args>
+	void emplace(entt::entity entity, Args&&... args)
+	{
+		record(CommandType::Modify, entity, [...args = std::forward<Args>(args)](entt::registry& registry, entt::entity entity)
+			{
+				registry.emplace_or_replace<T>(entity, args...);
+			});
+	}
+
+	template<typename... Types>
+	void remove(entt::entity entity)
+	{
+		record(CommandType::Modify, entity, [](entt::registry& registry, entt::entity entity)
+			{
+				registry.remove<Types...>(entity);
+			});
+	}
+
+	/// Calls fn on apply if the entity is still valid. Used for changes that go through other systems (e.g. pools)
+	void invoke(entt::entity entity, std::function<void(entt::registry&, entt::entity)> fn)
+	{
+		record(CommandType::Invoke, entity, std::move(fn));
+	}
+
+	/// Calls fn on apply (e.g. spawns that need to run outside of an iteration)
+	void invoke(std::function<void(entt::registry&)> fn)
+	{
+		record(CommandType::Invoke, entt::null, [fn = std::move(fn)](entt::registry& registry, entt::entity) { fn(registry); });
+	}
+
+	/// Destroys the entity on apply; destroying an entity multiple times is allowed
+	void destroy(entt::entity entity)
+	{
+		record(CommandType::Destroy, entity, nullptr);
+	}
+
+	/// Applies all recorded commands. Commands recorded while applying are applied in the same call
+	void flush(entt::registry& registry);
+
+	/// Commands recorded and not applied yet; may be called while other threads record
+	usz size() const
+	{
+		std::lock_guard lock(mutex);
+		return commands.size();
+	}
+
+private:
+	void record(CommandType type, entt::entity entity, std::function<void(entt::registry&, entt::entity)> apply);
+
+	mutable std::mutex mutex;
+	std::vector<Command> commands;
+	std::vector<Command> applying;
+};
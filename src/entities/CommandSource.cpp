@@ -0,0 +1,104 @@
+#include "CommandSource.h"
+
+#include "Map.h"
+#include "Tank.h"
+
+#include <algorithm>
+
+CommandSources::CommandSources(std::initializer_list<CommandSource*> sources)
+	: sources(sources)
+{
+}
+
+void CommandSources::write_inputs(entt::registry& registry, f32 delta_time)
+{
+	for (CommandSource* source : sources)
+		source->write_inputs(registry, delta_time);
+}
+
+ScriptedTanks::ScriptedTanks(const Map& map, u32 seed)
+	: world_size(map.world_width, map.world_height), tile_size(map.tile_size), rng(seed)
+{
+}
+
+void ScriptedTanks::create_tanks(entt::registry& registry, const std::vector<glm::vec2>& spawn_points, u32 count, const ProjectileType& projectile_type)
+{
+	for (u32 i = 0; i < count; i++)
+	{
+		TankDesign design{ (u8)(i % 4), (u8)(i % 8), (u8)(i % 8), (u8)(i % 4) };
+		entt::entity tank = Tank::create_tank(registry, design, get_spawn_point(spawn_points, i, tile_size));
+		registry.get<TankController>(tank).projectile_type = projectile_type;
+		add_tank(tank);
+	}
+}
+
+void ScriptedTanks::add_tank(entt::entity tank)
+{
+	tanks.push_back(tank);
+	input_timers.push_back(0.0f);
+}
+
+void ScriptedTanks::write_inputs(entt::registry& registry, f32 delta_time)
+{
+	std::uniform_real_distribution<f32> unit(0.0f, 1.0f);
+
+	for (u32 i = 0; i < tanks.size(); i++)
+	{
+		TankController* controller = registry.valid(tanks[i]) ? registry.try_get<TankController>(tanks[i]) : nullptr;
+		if (!controller)
+			continue;
+		TankInput& input = controller->input;
+
+		input_timers[i] -= delta_time;
+		if (input_timers[i] <= 0.0f)
+		{
+			input_timers[i] = input_interval * (1.0f + unit(rng));
+			f32 drive = unit(rng);
+			f32 turn = unit(rng);
+			input.forwards = drive < 0.6f;
+			input.backwards = drive > 0.85f;
+			input.left = turn < 0.25f;
+			input.right = turn > 0.75f;
+			input.aim_target = glm::vec2(unit(rng) * world_size.x, unit(rng) * world_size.y);
+		}
+		input.shoot = unit(rng) < shots_per_second * delta_time;
+	}
+}
+
+std::vector<glm::vec2> ScriptedTanks::find_spawn_points(const Map& map, std::mt19937& rng)
+{
+	std::vector<glm::vec2> points;
+	for (u32 y = 1; y + 1 < map.v_tiles; y++)
+	{
+		for (u32 x = 1; x + 1 < map.h_tiles; x++)
+		{
+			bool empty = true;
+			for (auto& variant : map.layers)
+			{
+				if (!std::holds_alternative<MapGridLayer>(variant))
+					continue;
+
+				const MapGridLayer& layer = std::get<MapGridLayer>(variant);
+				for (u32 ny = y - 1; ny <= y + 1; ny++)
+				{
+					for (u32 nx = x - 1; nx <= x + 1; nx++)
+						empty &= layer.tile_ids[ny * layer.h_tiles + nx] == 0;
+				}
+			}
+			if (empty)
+				points.emplace_back((x + 0.5f) * map.tile_size, (y + 0.5f) * map.tile_size);
+		}
+	}
+
+	std::shuffle(points.begin(), points.end(), rng);
+	if (points.empty())
+		points.emplace_back(map.world_width * 0.5f, map.world_height * 0.5f);
+	return points;
+}
+
+glm::vec2 ScriptedTanks::get_spawn_point(const std::vector<glm::vec2>& points, u32 i, f32 tile_size)
+{
+	u32 round = i / (u32)points.size();
+	glm::vec2 offset = glm::vec2((f32)(round % 3) - 1.0f, (f32)(round / 3 % 3) - 1.0f) * 0.3f * tile_size;
+	return points[i % points.size()] + offset;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "engine/Types.h"
+
+#include "entt/entt.hpp"
+#include "glm/glm.hpp"
+
+#include <vector>
+#include <random>
+#include <initializer_list>
+
+struct Map;
+struct ProjectileType;
+
+/// Writes the TankInput of the tanks it controls, right before the tanks are driven (see World::handle_inputs).
+/// The client reads the window input, bots and benchmarks script it, a server applies the commands of its players
+struct CommandSource
+{
+	virtual ~CommandSource() = default;
+
+	virtual void write_inputs(entt::registry& registry, f32 delta_time) = 0;
+};
+
+/// Several command sources driving different tanks, written in order
+struct CommandSources : CommandSource
+{
+	CommandSources(std::initializer_list<CommandSource*> sources);
+
+	void write_inputs(entt::registry& registry, f32 delta_time) override;
+
+	std::vector<CommandSource*> sources;
+};
+
+/// Tanks driving, turning, aiming and shooting with random inputs. The inputs only depend on the seed and the delta times
+struct ScriptedTanks : CommandSource
+{
+	/// Aim targets are picked anywhere on the map
+	ScriptedTanks(const Map& map, u32 seed);
+
+	/// Creates count tanks of varying designs; the i-th spawns at get_spawn_point(spawn_points, i)
+	void create_tanks(entt::registry& registry, const std::vector<glm::vec2>& spawn_points, u32 count, const ProjectileType& projectile_type);
+	/// Scripts an existing tank
+	void add_tank(entt::entity tank);
+
+	/// Tanks that were destroyed are skipped
+	void write_inputs(entt::registry& registry, f32 delta_time) override;
+
+	/// Tile centers that are empty in all grid layers together with their 8 neighbours, in random order
+	static std::vector<glm::vec2> find_spawn_points(const Map& map, std::mt19937& rng);
+	/// Gets the i-th spawn point; points are reused with a small offset once all are taken
+	static glm::vec2 get_spawn_point(const std::vector<glm::vec2>& points, u32 i, f32 tile_size);
+
+	/// A new driving input is picked after this many seconds (+ up to the same again at random)
+	f32 input_interval = 1.0f;
+	f32 shots_per_second = 1.0f;
+
+	std::vector<entt::entity> tanks;
+
+private:
+	glm::vec2 world_size;
+	f32 tile_size;
+	std::mt19937 rng;
+	std::vector<f32> input_timers;
+};
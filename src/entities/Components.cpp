@@ -1,13 +1,20 @@
 #include "Components.h"
 
+#include "EntityPool.h"
+
 Physics::Physics(bool dynamic)
 	: dynamic(dynamic), body(b2_nullBodyId)
 {
 }
 
-void Physics::create_polygon_shape(const b2ShapeDef& shape_def, const b2Polygon& polygon)
+b2ShapeId Physics::create_polygon_shape(const b2ShapeDef& shape_def, const b2Polygon& polygon)
+{
+	return b2CreatePolygonShape(body, &shape_def, &polygon);
+}
+
+b2ShapeId Physics::create_circle_shape(const b2ShapeDef& shape_def, const b2Circle& circle)
 {
-	b2CreatePolygonShape(body, &shape_def, &polygon);
+	return b2CreateCircleShape(body, &shape_def, &circle);
 }
 
 void Physics::create_box_shape(const b2ShapeDef& shape_def, f32 width, f32 height, f32 radius)
@@ -72,7 +79,7 @@ bool Physics::is_in_contact(entt::registry& registry, entt::entity e1, entt::ent
 
 void Physics::update_components(entt::registry& registry)
 {
-	for (auto [entity, physics, transform] : registry.view<Physics, Transform>().each())
+	for (auto [entity, physics, transform] : registry.view<Physics, Transform>(entt::exclude<Pooled>).each())
 	{
 		auto pos = b2Body_GetPosition(physics.body);
 		transform.pos.x = pos.x;
@@ -80,7 +87,7 @@ void Physics::update_components(entt::registry& registry)
 		transform.rot = b2Rot_GetAngle(b2Body_GetRotation(physics.body));
 	}
 
-	for (auto [entity, physics, velocity] : registry.view<Physics, Velocity>().each())
+	for (auto [entity, physics, velocity] : registry.view<Physics, Velocity>(entt::exclude<Pooled>).each())
 	{
 		auto linear = b2Body_GetLinearVelocity(physics.body);
 		velocity.linear.x = linear.x;
@@ -124,15 +131,6 @@ void Velocity::set_and_update_physics(entt::registry& registry, entt::entity ent
 	b2Body_SetAngularVelocity(physics.body, ang);
 }
 
-void SimpleSpriteRenderable::render(Graphics& graphics, Transform& transform)
-{
-	auto image_transform = graphics.create_transform();
-	image_transform.translate(transform.pos.x, transform.pos.y);
-	image_transform.scale(scale, scale);
-	image_transform.rotate(transform.rot);
-	graphics.draw_image(texture.get(), image_transform);
-}
-
 void Physics::on_create_physics(entt::registry& registry, b2WorldId world, entt::entity entity)
 {
 	Physics& physics = registry.get<Physics>(entity);
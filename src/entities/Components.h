@@ -1,7 +1,6 @@
 #pragma once
 
 #include "engine/Types.h"
-#include "engine/Graphics.h"
 #include "engine/Asset.h"
 
 #include "entt/entt.hpp"
@@ -13,7 +12,8 @@ struct Physics
 {
 	Physics(bool dynamic);
 
-	void create_polygon_shape(const b2ShapeDef& shape_def, const b2Polygon& polygon);
+	b2ShapeId create_polygon_shape(const b2ShapeDef& shape_def, const b2Polygon& polygon);
+	b2ShapeId create_circle_shape(const b2ShapeDef& shape_def, const b2Circle& circle);
 	void create_box_shape(const b2ShapeDef& shape_def, f32 width, f32 height, f32 radius = 0.0f);
 
 	bool dynamic;
@@ -52,10 +52,3 @@ struct Velocity
 	static void set_and_update_physics(entt::registry& registry, entt::entity entity, glm::vec2 lin, f32 ang);
 };
 
-struct SimpleSpriteRenderable
-{
-	AssetRef<Texture> texture;
-	f32 scale;
-
-	void render(Graphics& graphics, Transform& transform);
-};
\ No newline at end of file
@@ -0,0 +1,36 @@
+#include "EntityPool.h"
+
+entt::entity EntityPool::acquire(entt::registry& registry, bool& recycled)
+{
+	active++;
+
+	if (free_entities.empty())
+	{
+		created++;
+		recycled = false;
+		return registry.create();
+	}
+
+	entt::entity entity = free_entities.back();
+	free_entities.pop_back();
+	registry.remove<Pooled>(entity);
+
+	this->recycled++;
+	recycled = true;
+	return entity;
+}
+
+void EntityPool::release(entt::registry& registry, entt::entity entity)
+{
+	assert(!registry.all_of<Pooled>(entity)); // released twice
+
+	registry.emplace<Pooled>(entity);
+	free_entities.push_back(entity);
+	active--;
+	released++;
+}
+
+EntityPoolStats EntityPool::get_stats() const
+{
+	return { active, (u32)free_entities.size(), created, recycled, released };
+}
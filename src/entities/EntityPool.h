@@ -0,0 +1,51 @@
+#pragma once
+
+#include "engine/Types.h"
+
+#include "entt/entt.hpp"
+
+#include <vector>
+
+/// Tag component for entities that are parked in an EntityPool. Systems exclude these from their views
+struct Pooled
+{
+};
+
+/// Occupancy and allocation counters of an EntityPool
+struct EntityPoolStats
+{
+	u32 active;
+	u32 pooled;
+	u64 created;
+	u64 recycled;
+	u64 released;
+};
+
+/// Recycles the entities of a short-lived archetype instead of destroying them.
+/// Released entities keep all their components (and Box2D bodies) and are tagged Pooled until they are acquired again.
+/// Once the pool is warm, steady-state spawning creates no entities, bodies or shapes.
+struct EntityPool : NoCopy
+{
+	/// Gets an entity from the pool. If the pool is empty a new entity is created and recycled is set to false,
+	/// then the caller needs to emplace all components of the archetype.
+	entt::entity acquire(entt::registry& registry, bool& recycled);
+	/// Parks the entity in the pool. The caller should disable everything the Pooled tag doesn't cover (e.g. bodies)
+	void release(entt::registry& registry, entt::entity entity);
+
+	EntityPoolStats get_stats() const;
+
+private:
+	friend struct WorldSnapshot;
+
+	std::vector<entt::entity> free_entities;
+	u32 active = 0;
+	u64 created = 0;
+	u64 recycled = 0;
+	u64 released = 0;
+};
+
+/// The pools of all pooled archetypes of a World; stored in the registry context
+struct EntityPools : NoCopy
+{
+	EntityPool projectiles;
+};
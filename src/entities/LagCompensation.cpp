@@ -0,0 +1,188 @@
+#include "LagCompensation.h"
+
+#include "Tank.h"
+#include "SpatialHash.h"
+#include "CollisionCategory.h"
+#include "engine/util/MathUtil.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+/// Slab test in the space of the box. False if the ray misses the box, starts inside it or hits it beyond max_fraction
+static bool raycast_box(const Transform& box, glm::vec2 half_size, glm::vec2 origin, glm::vec2 translation, f32 max_fraction, f32& fraction, glm::vec2& normal)
+{
+	glm::vec2 local_origin = MathUtil::rotate(origin - box.pos, -box.rot);
+	glm::vec2 local_translation = MathUtil::rotate(translation, -box.rot);
+
+	f32 enter = 0.0f;
+	f32 exit = max_fraction;
+	s32 axis = -1;
+	f32 side = 0.0f;
+	for (s32 a = 0; a < 2; a++)
+	{
+		if (std::abs(local_translation[a]) < 1e-9f)
+		{
+			if (std::abs(local_origin[a]) > half_size[a])
+				return false;
+			continue;
+		}
+
+		f32 near = (-half_size[a] - local_origin[a]) / local_translation[a];
+		f32 far = (half_size[a] - local_origin[a]) / local_translation[a];
+		f32 near_side = -1.0f;
+		if (near > far)
+		{
+			std::swap(near, far);
+			near_side = 1.0f;
+		}
+		if (near > enter)
+		{
+			enter = near;
+			axis = a;
+			side = near_side;
+		}
+		exit = std::min(exit, far);
+		if (enter > exit)
+			return false;
+	}
+	// No slab entered after the origin: the origin is inside
+	if (axis < 0)
+		return false;
+
+	glm::vec2 local_normal(0.0f);
+	local_normal[axis] = side;
+	normal = MathUtil::rotate(local_normal, box.rot);
+	fraction = enter;
+	return true;
+}
+
+bool TransformHistory::get_transform(RewindTime time, Transform& transform) const
+{
+	if (count == 0 || time.tick > newest_tick || newest_tick - time.tick >= count)
+		return false;
+
+	const Transform& from = transforms[time.tick % TRANSFORM_HISTORY_SIZE];
+	if (time.alpha <= 0.0f || time.tick == newest_tick)
+	{
+		transform = from;
+		return true;
+	}
+	const Transform& to = transforms[(time.tick + 1) % TRANSFORM_HISTORY_SIZE];
+	transform.pos = glm::mix(from.pos, to.pos, time.alpha);
+	transform.rot = from.rot + MathUtil::normalize_angle_difference(from.rot, to.rot) * time.alpha;
+	return true;
+}
+
+LagCompensation::LagCompensation(b2WorldId physics_world)
+	: physics_world(physics_world), tick(0)
+{
+	max_moves.fill(0.0f);
+}
+
+void LagCompensation::record(entt::registry& registry)
+{
+	PROFILE_ZONE("LagCompensation::record");
+	LagCompensation& compensation = registry.ctx().get<LagCompensation>();
+	u32 tick = ++compensation.tick;
+
+	f32 max_move = 0.0f;
+	for (auto [entity, transform, history] : registry.view<Transform, TransformHistory>().each())
+	{
+		// Only consecutive ticks can be interpolated; an entity that missed a tick starts over
+		if (history.count > 0 && history.newest_tick + 1 == tick)
+			max_move = std::max(max_move, glm::distance(transform.pos, history.transforms[history.newest_tick % TRANSFORM_HISTORY_SIZE].pos));
+		else
+			history.count = 0;
+
+		history.transforms[tick % TRANSFORM_HISTORY_SIZE] = transform;
+		history.newest_tick = tick;
+		history.count = std::min(history.count + 1, TRANSFORM_HISTORY_SIZE);
+	}
+	compensation.max_moves[tick % TRANSFORM_HISTORY_SIZE] = max_move;
+}
+
+RewindTime LagCompensation::clamp(RewindTime time) const
+{
+	if (tick == 0)
+		return { 0, 0.0f };
+	u32 oldest = tick >= TRANSFORM_HISTORY_SIZE ? tick - TRANSFORM_HISTORY_SIZE + 1 : 1;
+	if (time.tick < oldest)
+		return { oldest, 0.0f };
+	if (time.tick >= tick)
+		return { tick, 0.0f };
+	return { time.tick, std::clamp(time.alpha, 0.0f, 1.0f) };
+}
+
+f32 LagCompensation::get_max_displacement(u32 from_tick) const
+{
+	f32 displacement = 0.0f;
+	for (u32 t = std::max(from_tick + 1, tick >= TRANSFORM_HISTORY_SIZE ? tick - TRANSFORM_HISTORY_SIZE + 1 : 1); t <= tick; t++)
+		displacement += max_moves[t % TRANSFORM_HISTORY_SIZE];
+	return displacement;
+}
+
+bool LagCompensation::raycast(const entt::registry& registry, RewindTime time, glm::vec2 origin, glm::vec2 translation, entt::entity ignore, RewindHit& hit) const
+{
+	// The map as it is now; tanks aren't in the filter, their bodies are where they are now
+	b2QueryFilter filter = b2DefaultQueryFilter();
+	filter.categoryBits = CATEGORY_PROJECTILE;
+	filter.maskBits = CATEGORY_MAP;
+	b2RayResult result = b2World_CastRayClosest(physics_world, b2Vec2(origin.x, origin.y), b2Vec2(translation.x, translation.y), filter);
+	bool found = result.hit;
+	hit.fraction = 1.0f;
+	if (found)
+		hit = { Physics::get_entity(b2Shape_GetBody(result.shapeId)), { result.point.x, result.point.y }, { result.normal.x, result.normal.y }, result.fraction };
+
+	glm::vec2 half_size = Tank::get_hull_size() * 0.5f;
+	f32 reach = get_max_displacement(time.tick) + glm::length(half_size);
+	glm::vec2 end = origin + translation * hit.fraction;
+	glm::vec2 min = glm::min(origin, end) - reach;
+	glm::vec2 max = glm::max(origin, end) + reach;
+
+	thread_local std::vector<entt::entity> candidates;
+	candidates.clear();
+	registry.ctx().get<SpatialHash>().query_rect({ min.x, min.y, max.x - min.x, max.y - min.y }, CATEGORY_TANK, candidates);
+
+	for (entt::entity entity : candidates)
+	{
+		const TransformHistory* history = registry.try_get<TransformHistory>(entity);
+		Transform transform;
+		if (entity == ignore || !history || !history->get_transform(time, transform))
+			continue;
+
+		f32 fraction;
+		glm::vec2 normal;
+		if (raycast_box(transform, half_size, origin, translation, hit.fraction, fraction, normal) && (!found || fraction < hit.fraction))
+		{
+			hit = { entity, origin + translation * fraction, normal, fraction };
+			found = true;
+		}
+	}
+	return found;
+}
+
+void LagCompensation::overlap_circle(const entt::registry& registry, RewindTime time, glm::vec2 center, f32 radius, std::vector<entt::entity>& result) const
+{
+	glm::vec2 half_size = Tank::get_hull_size() * 0.5f;
+	f32 reach = get_max_displacement(time.tick) + glm::length(half_size) + radius;
+
+	thread_local std::vector<entt::entity> candidates;
+	candidates.clear();
+	registry.ctx().get<SpatialHash>().query_rect({ center.x - reach, center.y - reach, 2.0f * reach, 2.0f * reach }, CATEGORY_TANK, candidates);
+
+	for (entt::entity entity : candidates)
+	{
+		const TransformHistory* history = registry.try_get<TransformHistory>(entity);
+		Transform transform;
+		if (!history || !history->get_transform(time, transform))
+			continue;
+
+		// Closest point of the box to the center, in the space of the box
+		glm::vec2 local = MathUtil::rotate(center - transform.pos, -transform.rot);
+		glm::vec2 closest = glm::clamp(local, -half_size, half_size);
+		glm::vec2 offset = local - closest;
+		if (glm::dot(offset, offset) <= radius * radius)
+			result.push_back(entity);
+	}
+}
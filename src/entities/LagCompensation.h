@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Components.h"
+
+#include "entt/entt.hpp"
+#include "box2d/box2d.h"
+#include "glm/glm.hpp"
+
+#include <vector>
+
+/// Ticks of Transforms every tank keeps; a second at 60 Hz, more than any latency worth compensating
+const static u32 TRANSFORM_HISTORY_SIZE = 64;
+
+/// A point in the past: a tick and the way from it to the next tick in [0, 1]
+struct RewindTime
+{
+	u32 tick;
+	f32 alpha = 0.0f;
+};
+
+/// The Transforms of the last TRANSFORM_HISTORY_SIZE ticks by tick % TRANSFORM_HISTORY_SIZE, recorded by LagCompensation::record.
+/// Every tank has one
+struct TransformHistory
+{
+	/// Interpolated between the tick and the next one; false if the entity has no record of the tick
+	bool get_transform(RewindTime time, Transform& transform) const;
+
+	Array<Transform, TRANSFORM_HISTORY_SIZE> transforms;
+	u32 newest_tick = 0;
+	/// Consecutive ticks recorded up to newest_tick, at most TRANSFORM_HISTORY_SIZE
+	u32 count = 0;
+};
+
+struct RewindHit
+{
+	entt::entity entity;
+	glm::vec2 point;
+	glm::vec2 normal;
+	/// Of the translation
+	f32 fraction;
+};
+
+/// Hit detection against the tanks as they were at an earlier tick, e.g. the tick a client saw when it shot (lag compensation).
+/// Tanks are tested as their hull boxes at the interpolated Transform of that time, the map as it is now. Candidates come from
+/// the SpatialHash around the query, widened by how far any tank moved since. Queries don't touch the Box2D bodies and may run
+/// on any number of threads at once while record doesn't run. Tanks destroyed since aren't hit.
+/// One instance lives in the registry context of every World. Ticks count the World updates from 1, like the ticks of the server
+struct LagCompensation : NoCopy
+{
+	LagCompensation(b2WorldId physics_world);
+
+	/// Records the Transforms of the tick; a World system after the physics step
+	static void record(entt::registry& registry);
+
+	/// Newest recorded tick, 0 before the first update
+	u32 get_tick() const { return tick; }
+	/// The time moved into the recorded ticks
+	RewindTime clamp(RewindTime time) const;
+
+	/// Closest hit of the ray from origin along translation. Tanks that contain the origin and the ignored entity are skipped
+	bool raycast(const entt::registry& registry, RewindTime time, glm::vec2 origin, glm::vec2 translation, entt::entity ignore, RewindHit& hit) const;
+	/// Appends the tanks whose hull overlapped the circle
+	void overlap_circle(const entt::registry& registry, RewindTime time, glm::vec2 center, f32 radius, std::vector<entt::entity>& result) const;
+
+private:
+	friend struct World;
+	friend struct WorldSnapshot;
+
+	/// Bound of how far any tank moved from the tick until now
+	f32 get_max_displacement(u32 from_tick) const;
+
+	b2WorldId physics_world;
+	u32 tick;
+	/// Farthest any tank moved in a tick, by tick % TRANSFORM_HISTORY_SIZE
+	Array<f32, TRANSFORM_HISTORY_SIZE> max_moves;
+};
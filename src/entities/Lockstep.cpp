@@ -0,0 +1,272 @@
+#include "Lockstep.h"
+
+#include "World.h"
+#include "Components.h"
+#include "EntityPool.h"
+#include "Projectile.h"
+#include "AnalyticProjectiles.h"
+#include "MapDestruction.h"
+#include "Navigation.h"
+#include "SystemScheduler.h"
+
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+
+/// Mixed in before the values of a component, so a missing component doesn't look like the next one
+enum class HashedComponent : u8
+{
+	Body = 1,
+	Transform,
+	Velocity,
+	Tank,
+	TankController,
+	Projectile,
+	Pooled,
+	NavAgent,
+	MapDestruction
+};
+
+static void add_input(StateHash& hash, const TankInput& input)
+{
+	hash.add((u32)input.forwards | (u32)input.backwards << 1 | (u32)input.left << 2 | (u32)input.right << 3 | (u32)input.shoot << 4);
+	hash.add(input.aim_target);
+}
+
+static u64 hash_entity(const entt::registry& registry, entt::entity entity)
+{
+	StateHash hash(entt::to_integral(entity));
+
+	if (const Physics* physics = registry.try_get<Physics>(entity))
+	{
+		hash.add(HashedComponent::Body);
+		b2Transform transform = b2Body_GetTransform(physics->body);
+		b2Vec2 linear_velocity = b2Body_GetLinearVelocity(physics->body);
+		hash.add(glm::vec2(transform.p.x, transform.p.y));
+		hash.add(glm::vec2(transform.q.c, transform.q.s));
+		hash.add(glm::vec2(linear_velocity.x, linear_velocity.y));
+		hash.add(b2Body_GetAngularVelocity(physics->body));
+		hash.add((u32)b2Body_IsAwake(physics->body) | (u32)b2Body_IsEnabled(physics->body) << 1);
+	}
+	if (const Transform* transform = registry.try_get<Transform>(entity))
+	{
+		hash.add(HashedComponent::Transform);
+		hash.add(transform->pos);
+		hash.add(transform->rot);
+	}
+	if (const Velocity* velocity = registry.try_get<Velocity>(entity))
+	{
+		hash.add(HashedComponent::Velocity);
+		hash.add(velocity->linear);
+		hash.add(velocity->angular);
+	}
+	if (const Tank* tank = registry.try_get<Tank>(entity))
+	{
+		hash.add(HashedComponent::Tank);
+		hash.add(tank->id);
+		hash.add(tank->turret_orientation);
+		hash.add(tank->shoot_barrel_index);
+		hash.add((u32)tank->design.color | (u32)tank->design.hull << 8 | (u32)tank->design.turret << 16 | (u32)tank->design.tracks << 24);
+	}
+	if (const TankController* controller = registry.try_get<TankController>(entity))
+	{
+		hash.add(HashedComponent::TankController);
+		add_input(hash, controller->input);
+		hash.add(controller->rel_turret_rotation);
+	}
+	if (const Projectile* projectile = registry.try_get<Projectile>(entity))
+	{
+		hash.add(HashedComponent::Projectile);
+		hash.add(projectile->shooter_entity);
+		hash.add((u32)projectile->just_spawned | (u32)projectile->in_tank_spawn << 1);
+		hash.add((u32)projectile->collision_count | (u32)projectile->max_collisions << 16);
+	}
+	if (registry.all_of<Pooled>(entity))
+		hash.add(HashedComponent::Pooled);
+	if (const NavAgent* agent = registry.try_get<NavAgent>(entity))
+	{
+		hash.add(HashedComponent::NavAgent);
+		hash.add(agent->goal);
+		hash.add(agent->mode);
+		hash.add(agent->status);
+		hash.add(agent->queued);
+		hash.add(agent->path_index);
+		for (glm::vec2 point : agent->path)
+			hash.add(point);
+	}
+	if (const MapDestruction* destruction = registry.try_get<MapDestruction>(entity))
+	{
+		hash.add(HashedComponent::MapDestruction);
+		hash.add(destruction->destroyed_tiles);
+		for (const MapTileChange& change : destruction->change_log)
+		{
+			hash.add(change.gid);
+			hash.add((u64)change.x | (u64)change.y << 16 | (u64)change.health << 32 | (u64)change.layer << 48);
+		}
+	}
+	return hash.get();
+}
+
+u64 StateHash::get() const
+{
+	// Finalizer of MurmurHash3, every bit of the input affects every bit of the output
+	u64 h = value;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+u64 StateLog::hash_world(const entt::registry& registry, std::vector<EntityHash>* entity_hashes)
+{
+	PROFILE_ZONE("StateLog::hash_world");
+
+	// The order of the entity storage depends on the order of creation and destruction; sorted it only depends on the entities
+	thread_local std::vector<entt::entity> entities;
+	entities.clear();
+	for (auto [entity] : registry.storage<entt::entity>()->each())
+		entities.push_back(entity);
+	std::sort(entities.begin(), entities.end());
+
+	StateHash hash;
+	for (entt::entity entity : entities)
+	{
+		u64 entity_hash = hash_entity(registry, entity);
+		hash.add(entity_hash);
+		if (entity_hashes)
+			entity_hashes->push_back({ entity, entity_hash });
+	}
+
+	if (const AnalyticProjectiles* projectiles = registry.ctx().find<AnalyticProjectiles>())
+		projectiles->hash(hash);
+	return hash.get();
+}
+
+void StateLog::record(const entt::registry& registry, u32 tick)
+{
+	u32 begin = (u32)entity_hashes.size();
+	u64 hash = hash_world(registry, keep_entity_hashes ? &entity_hashes : nullptr);
+	ticks.push_back({ tick, hash, begin, (u32)entity_hashes.size() });
+}
+
+void StateLog::clear()
+{
+	ticks.clear();
+	entity_hashes.clear();
+}
+
+Divergence StateLog::find_divergence(const StateLog& a, const StateLog& b)
+{
+	usz i = 0;
+	usz k = 0;
+	while (i < a.ticks.size() && k < b.ticks.size())
+	{
+		const TickHash& tick_a = a.ticks[i];
+		const TickHash& tick_b = b.ticks[k];
+		if (tick_a.tick != tick_b.tick)
+		{
+			tick_a.tick < tick_b.tick ? i++ : k++;
+			continue;
+		}
+		i++;
+		k++;
+		if (tick_a.hash == tick_b.hash)
+			continue;
+
+		// Both sorted by entity; the first entity with another hash or in only one of the runs
+		Divergence divergence{ true, tick_a.tick, entt::null };
+		if (!a.keep_entity_hashes || !b.keep_entity_hashes)
+			return divergence;
+		u32 ea = tick_a.entities_begin;
+		u32 eb = tick_b.entities_begin;
+		while (ea < tick_a.entities_end || eb < tick_b.entities_end)
+		{
+			if (ea == tick_a.entities_end || (eb < tick_b.entities_end && b.entity_hashes[eb].entity < a.entity_hashes[ea].entity))
+			{
+				divergence.entity = b.entity_hashes[eb].entity;
+				break;
+			}
+			if (eb == tick_b.entities_end || a.entity_hashes[ea].entity < b.entity_hashes[eb].entity || a.entity_hashes[ea].hash != b.entity_hashes[eb].hash)
+			{
+				divergence.entity = a.entity_hashes[ea].entity;
+				break;
+			}
+			ea++;
+			eb++;
+		}
+		return divergence;
+	}
+	return {};
+}
+
+Lockstep::Lockstep(World& world, f32 tick_time)
+	: world(world), tick_time(tick_time), last_hash_ms(0.0), source(nullptr), tick(0)
+{
+	world.registry.ctx().get<SystemScheduler>().set_thread_pool(nullptr);
+}
+
+void Lockstep::submit(const LockstepCommand& command)
+{
+	if (command.tick <= tick)
+		throw std::runtime_error("Lockstep command for tick " + std::to_string(command.tick) + " which already ran");
+
+	// After the commands of the same tick, so the later one is applied last
+	auto position = std::upper_bound(pending.begin(), pending.end(), command.tick, [](u32 tick, const LockstepCommand& c) { return tick < c.tick; });
+	pending.insert(position, command);
+}
+
+void Lockstep::step(CommandSource* source)
+{
+	PROFILE_ZONE("Lockstep::step");
+
+	tick++;
+	this->source = source;
+	world.handle_inputs(tick_time, this);
+	this->source = nullptr;
+	world.update(tick_time);
+
+	auto start = std::chrono::steady_clock::now();
+	log.record(world.registry, tick);
+	last_hash_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void Lockstep::rewind(u32 tick)
+{
+	if (tick > this->tick)
+		throw std::runtime_error("Lockstep rewind to tick " + std::to_string(tick) + " which didn't run yet");
+	this->tick = tick;
+
+	auto later_command = std::upper_bound(history.begin(), history.end(), tick, [](u32 tick, const LockstepCommand& c) { return tick < c.tick; });
+	history.erase(later_command, history.end());
+
+	auto later_tick = std::upper_bound(log.ticks.begin(), log.ticks.end(), tick, [](u32 tick, const TickHash& t) { return tick < t.tick; });
+	if (later_tick != log.ticks.end())
+		log.entity_hashes.resize(later_tick->entities_begin);
+	log.ticks.erase(later_tick, log.ticks.end());
+}
+
+void Lockstep::write_inputs(entt::registry& registry, f32 delta_time)
+{
+	if (source)
+		source->write_inputs(registry, delta_time);
+
+	usz applied = 0;
+	for (; applied < pending.size() && pending[applied].tick <= tick; applied++)
+	{
+		const LockstepCommand& command = pending[applied];
+		if (TankController* controller = registry.try_get<TankController>(command.tank))
+			controller->input = command.input;
+	}
+	pending.erase(pending.begin(), pending.begin() + applied);
+
+	// The inputs of this tick, however they were written; sorted so the history doesn't depend on the storage order
+	usz first = history.size();
+	for (auto [entity, controller] : registry.view<TankController>().each())
+		history.push_back({ tick, entity, controller.input });
+	std::sort(history.begin() + first, history.end(), [](const LockstepCommand& a, const LockstepCommand& b) { return a.tank < b.tank; });
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "CommandSource.h"
+#include "Tank.h"
+
+#include "engine/Types.h"
+
+#include "entt/entt.hpp"
+#include "glm/glm.hpp"
+
+#include <vector>
+#include <bit>
+#include <type_traits>
+
+struct World;
+
+/// Fast 64 bit hash of simulation state, fed value by value in a fixed order (never whole structs, their padding is undefined).
+/// Floats are hashed by their bits: two runs only agree if they computed bit identical results
+struct StateHash
+{
+	StateHash(u64 seed = 0) : value(seed) {}
+
+	template<typename T>
+	void add(T value)
+	{
+		static_assert(std::is_arithmetic_v<T> || std::is_enum_v<T>);
+		if constexpr (std::is_same_v<T, f32>)
+			add_word(std::bit_cast<u32>(value));
+		else if constexpr (std::is_same_v<T, f64>)
+			add_word(std::bit_cast<u64>(value));
+		else
+			add_word((u64)value);
+	}
+
+	void add(glm::vec2 value)
+	{
+		add_word((u64)std::bit_cast<u32>(value.x) << 32 | std::bit_cast<u32>(value.y));
+	}
+
+	void add(entt::entity entity)
+	{
+		add_word(entt::to_integral(entity));
+	}
+
+	void add_word(u64 word)
+	{
+		value = (std::rotl(value, 5) ^ word) * 0x517CC1B727220A95ull;
+	}
+
+	/// The words mixed into the 64 bits
+	u64 get() const;
+
+private:
+	u64 value;
+};
+
+struct EntityHash
+{
+	entt::entity entity;
+	u64 hash;
+};
+
+/// Hash of the world after a tick; its entity hashes are entity_hashes[entities_begin] to entity_hashes[entities_end]
+struct TickHash
+{
+	u32 tick;
+	u64 hash;
+	u32 entities_begin;
+	u32 entities_end;
+};
+
+/// Where two runs disagreed first
+struct Divergence
+{
+	bool diverged = false;
+	u32 tick = 0;
+	/// Lowest entity that differs or only exists in one run; entt::null if the entity hashes weren't kept or only the
+	/// World resources differ (analytic projectiles)
+	entt::entity entity = entt::null;
+};
+
+/// The state hashes of the ticks of a run
+struct StateLog
+{
+	/// Hashes the registry of a World: the Box2D body and the gameplay components of every entity and the gameplay resources.
+	/// Derived state that is rebuilt from these (spatial hash, visibility, particles, history of the lag compensation) isn't part
+	/// of it. entity_hashes (if not nullptr) gets the hash of every entity, sorted by entity
+	static u64 hash_world(const entt::registry& registry, std::vector<EntityHash>* entity_hashes = nullptr);
+
+	void record(const entt::registry& registry, u32 tick);
+	void clear();
+
+	/// Compares the ticks both logs recorded, in order
+	static Divergence find_divergence(const StateLog& a, const StateLog& b);
+
+	/// Costs memory per entity and tick but finds the entity of a divergence
+	bool keep_entity_hashes = true;
+	std::vector<TickHash> ticks;
+	std::vector<EntityHash> entity_hashes;
+};
+
+/// The TankInput of a tank for one tick
+struct LockstepCommand
+{
+	u32 tick;
+	entt::entity tank;
+	TankInput input;
+};
+
+/// Deterministic mode of a World for replays, desync detection and lockstep peers: identical setups fed with identical commands
+/// compute bit identical ticks. The World runs fixed ticks, its systems run one after the other in registration order (systems
+/// that run in parallel record structural commands in an order that depends on the timing) and the tank inputs come in as
+/// commands of a tick. The inputs written by a command source are captured as commands too, so the history of a run replays
+/// it on a World with the same setup. Tanks are named by their entity, which is the same in runs that created the same entities.
+/// Every tick ends with its state hash in the log.
+/// Floats are only the same across builds compiled with TANKGAME_STRICT_FLOAT and the same math library
+struct Lockstep : CommandSource, NoCopy
+{
+	Lockstep(World& world, f32 tick_time = 1.0f / 60.0f);
+
+	/// Queues the input of a tank for a tick that hasn't run yet; a later command of the same tank and tick replaces it
+	void submit(const LockstepCommand& command);
+
+	/// Runs the next tick: writes the inputs of the source (if any), applies the queued commands of the tick, handles the inputs,
+	/// updates the World and hashes it
+	void step(CommandSource* source = nullptr);
+
+	/// Called by step; applies the commands of the tick being run and captures the inputs of all tanks into the history
+	void write_inputs(entt::registry& registry, f32 delta_time) override;
+
+	/// Goes back to the end of an earlier tick, after the World was restored to it (see WorldSnapshot). The history and the log of
+	/// the later ticks are dropped; queued commands stay, commands for the dropped ticks can be submitted again
+	void rewind(u32 tick);
+
+	/// Ticks run so far; the next step runs tick get_tick() + 1
+	u32 get_tick() const { return tick; }
+
+	World& world;
+	const f32 tick_time;
+	/// The inputs of every tank in every tick run so far, by tick
+	std::vector<LockstepCommand> history;
+	StateLog log;
+	f64 last_hash_ms;
+
+private:
+	/// Sorted by tick, in submission order within a tick
+	std::vector<LockstepCommand> pending;
+	CommandSource* source;
+	u32 tick;
+};
@@ -1,22 +1,250 @@
 #include "Map.h"
 
 #include "CollisionCategory.h"
+#include "MapDestruction.h"
 #include "engine/util/MathUtil.h"
+#include "engine/Profiler.h"
 
 #include "pugixml.hpp"
+#include "stb_image/stb_image.h"
 
 #include <stdexcept>
 #include <string>
-#include <ranges>
-#include <sstream>
+#include <string_view>
+#include <array>
+#include <charconv>
+#include <vector>
 #include <iostream>
+#include <limits>
+#include <algorithm>
 
-const u32 TILE_ID_MASK = ~(0b1111 << 28);
+
+/// Maps base64 characters to their 6 bit values, 0xFF for all other characters
+static constexpr std::array<u8, 256> BASE64_VALUES = []()
+	{
+		std::array<u8, 256> values;
+		values.fill(0xFF);
+		const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+		for (u32 i = 0; i < 64; i++)
+			values[(u8)alphabet[i]] = (u8)i;
+		return values;
+	}();
+
+/// Reads comma separated gids straight out of the text in a single pass
+static void parse_csv_tiles(std::string_view text, u32* tile_ids, u32 tile_count, const char* location)
+{
+	const char* it = text.data();
+	const char* end = text.data() + text.size();
+	u32 i = 0;
+
+	while (true)
+	{
+		while (it != end && (*it == ',' || *it == ' ' || *it == '\n' || *it == '\r' || *it == '\t'))
+			it++;
+		if (it == end)
+			break;
+
+		if (i == tile_count)
+			throw std::runtime_error("Too many tiles in layer data of map xml: " + std::string(location));
+
+		auto [next, error] = std::from_chars(it, end, tile_ids[i]);
+		if (error != std::errc())
+			throw std::runtime_error("Invalid tile in layer data of map xml: " + std::string(location));
+		it = next;
+		i++;
+	}
+
+	if (i != tile_count)
+		throw std::runtime_error("Too few tiles in layer data of map xml: " + std::string(location));
+}
+
+/// Decodes base64 text; whitespace is skipped and decoding stops at the padding
+static void decode_base64(std::string_view text, std::vector<u8>& bytes, const char* location)
+{
+	bytes.clear();
+	bytes.reserve(text.size() / 4 * 3);
+
+	u32 buffer = 0;
+	u32 bits = 0;
+	for (char c : text)
+	{
+		u8 value = BASE64_VALUES[(u8)c];
+		if (value == 0xFF)
+		{
+			if (c == '=')
+				break;
+			if (c == ' ' || c == '\n' || c == '\r' || c == '\t')
+				continue;
+			throw std::runtime_error("Invalid base64 layer data in map xml: " + std::string(location));
+		}
+
+		buffer = (buffer << 6) | value;
+		bits += 6;
+		if (bits >= 8)
+		{
+			bits -= 8;
+			bytes.push_back((u8)(buffer >> bits));
+		}
+	}
+}
+
+/// Gets the raw deflate data of a gzip member (RFC 1952)
+static std::string_view get_gzip_deflate_data(const std::vector<u8>& bytes, const char* location)
+{
+	const u8 FLAG_HCRC = 1 << 1;
+	const u8 FLAG_EXTRA = 1 << 2;
+	const u8 FLAG_NAME = 1 << 3;
+	const u8 FLAG_COMMENT = 1 << 4;
+
+	// 10 byte header and 8 byte trailer (crc32, size)
+	if (bytes.size() < 18 || bytes[0] != 0x1F || bytes[1] != 0x8B || bytes[2] != 8)
+		throw std::runtime_error("Invalid gzip layer data in map xml: " + std::string(location));
+
+	u8 flags = bytes[3];
+	usz pos = 10;
+	if (flags & FLAG_EXTRA)
+		pos += 2 + (bytes[pos] | (bytes[pos + 1] << 8));
+	if (flags & FLAG_NAME)
+		while (pos < bytes.size() && bytes[pos++] != 0);
+	if (flags & FLAG_COMMENT)
+		while (pos < bytes.size() && bytes[pos++] != 0);
+	if (flags & FLAG_HCRC)
+		pos += 2;
+
+	if (pos + 8 > bytes.size())
+		throw std::runtime_error("Invalid gzip layer data in map xml: " + std::string(location));
+
+	return std::string_view((const char*)bytes.data() + pos, bytes.size() - pos - 8);
+}
+
+/// Parses the deprecated XML layer format (one <tile gid=""/> element per tile)
+static void parse_xml_tiles(pugi::xml_node data, u32* tile_ids, u32 tile_count, const char* location)
+{
+	u32 i = 0;
+	for (pugi::xml_node tile : data.children("tile"))
+	{
+		if (i == tile_count)
+			throw std::runtime_error("Too many tiles in layer data of map xml: " + std::string(location));
+		tile_ids[i++] = tile.attribute("gid").as_uint();
+	}
+
+	if (i != tile_count)
+		throw std::runtime_error("Too few tiles in layer data of map xml: " + std::string(location));
+}
+
+/// Parses the tile gids of a layer (or chunk) in any of Tiled's encodings: csv, base64, base64 + zlib and base64 + gzip
+static void parse_tile_data(std::string_view text, std::string_view encoding, std::string_view compression, u32* tile_ids, u32 tile_count, const char* location)
+{
+	if (encoding == "csv")
+	{
+		parse_csv_tiles(text, tile_ids, tile_count, location);
+		return;
+	}
+	if (encoding != "base64")
+		throw std::runtime_error("Unsupported layer encoding \"" + std::string(encoding) + "\" in map xml: " + std::string(location));
+
+	// Reused between layers, loading doesn't allocate per layer
+	thread_local std::vector<u8> decoded;
+	thread_local std::vector<u8> inflated;
+	decode_base64(text, decoded, location);
+
+	usz byte_count = (usz)tile_count * 4;
+	const u8* bytes = decoded.data();
+
+	if (!compression.empty())
+	{
+		inflated.resize(byte_count);
+		int inflated_size;
+		if (compression == "zlib")
+		{
+			inflated_size = stbi_zlib_decode_buffer((char*)inflated.data(), (int)byte_count, (const char*)decoded.data(), (int)decoded.size());
+		}
+		else if (compression == "gzip")
+		{
+			std::string_view deflate_data = get_gzip_deflate_data(decoded, location);
+			inflated_size = stbi_zlib_decode_noheader_buffer((char*)inflated.data(), (int)byte_count, deflate_data.data(), (int)deflate_data.size());
+		}
+		else
+		{
+			throw std::runtime_error("Unsupported layer compression \"" + std::string(compression) + "\" in map xml: " + std::string(location));
+		}
+
+		if (inflated_size != (int)byte_count)
+			throw std::runtime_error("Invalid compressed layer data in map xml: " + std::string(location));
+		bytes = inflated.data();
+	}
+	else if (decoded.size() != byte_count)
+	{
+		throw std::runtime_error("Invalid base64 layer data size in map xml: " + std::string(location));
+	}
+
+	// gids are stored as little endian u32
+	for (u32 i = 0; i < tile_count; i++)
+	{
+		const u8* gid = bytes + (usz)i * 4;
+		tile_ids[i] = (u32)gid[0] | ((u32)gid[1] << 8) | ((u32)gid[2] << 16) | ((u32)gid[3] << 24);
+	}
+}
+
+/// Gets the tile bounds of all layer chunks of an infinite map
+static void get_infinite_map_bounds(pugi::xml_node map_element, s32& origin_x, s32& origin_y, u32& width, u32& height, const char* location)
+{
+	s32 min_x = std::numeric_limits<s32>::max(), min_y = std::numeric_limits<s32>::max();
+	s32 max_x = std::numeric_limits<s32>::min(), max_y = std::numeric_limits<s32>::min();
+
+	for (pugi::xml_node layer : map_element.children("layer"))
+	{
+		for (pugi::xml_node chunk : layer.child("data").children("chunk"))
+		{
+			s32 x = chunk.attribute("x").as_int();
+			s32 y = chunk.attribute("y").as_int();
+			min_x = std::min(min_x, x);
+			min_y = std::min(min_y, y);
+			max_x = std::max(max_x, x + chunk.attribute("width").as_int());
+			max_y = std::max(max_y, y + chunk.attribute("height").as_int());
+		}
+	}
+
+	if (min_x >= max_x || min_y >= max_y)
+		throw std::runtime_error("Infinite map without chunks in map xml: " + std::string(location));
+
+	origin_x = min_x;
+	origin_y = min_y;
+	width = (u32)(max_x - min_x);
+	height = (u32)(max_y - min_y);
+}
+
+/// Parses the chunks of an infinite map layer into the layer grid, which starts at the origin tile
+static void parse_chunk_tiles(pugi::xml_node data, MapGridLayer& layer, s32 origin_x, s32 origin_y, const char* location)
+{
+	thread_local std::vector<u32> chunk_tiles;
+
+	std::string_view encoding = data.attribute("encoding").value();
+	std::string_view compression = data.attribute("compression").value();
+
+	for (pugi::xml_node chunk : data.children("chunk"))
+	{
+		u32 w = chunk.attribute("width").as_uint();
+		u32 h = chunk.attribute("height").as_uint();
+		u32 x = (u32)(chunk.attribute("x").as_int() - origin_x);
+		u32 y = (u32)(chunk.attribute("y").as_int() - origin_y);
+
+		chunk_tiles.resize((usz)w * h);
+		if (encoding.empty())
+			parse_xml_tiles(chunk, chunk_tiles.data(), w * h, location);
+		else
+			parse_tile_data(chunk.text().get(), encoding, compression, chunk_tiles.data(), w * h, location);
+
+		for (u32 row = 0; row < h; row++)
+			std::copy_n(chunk_tiles.data() + (usz)row * w, w, layer.tile_ids.get() + (usz)(y + row) * layer.h_tiles + x);
+	}
+}
 
 MapGridLayer::MapGridLayer(u32 h_tiles, u32 v_tiles)
 	: h_tiles(h_tiles), 
 	v_tiles(v_tiles), 
-	tile_ids(std::make_unique<u32[]>(h_tiles * v_tiles))
+	tile_ids(std::make_unique<u32[]>(h_tiles * v_tiles)),
+	tile_health(std::make_unique<u16[]>(h_tiles * v_tiles))
 {
 }
 
@@ -24,6 +252,7 @@ MapGridLayer::MapGridLayer(u32 h_tiles, u32 v_tiles)
 Map::Map(const char* location, u32 pixel_scale)
 	: first_gid(1)
 {
+	PROFILE_ZONE_DETAIL("Map::Map", location);
 	f32 rec_pixel_scale = 1.0f / (f32)pixel_scale;
 
 	pugi::xml_document doc;
@@ -47,6 +276,15 @@ Map::Map(const char* location, u32 pixel_scale)
 	if (tile_width != tile_height || tile_width == -1)
 		throw std::runtime_error("Invalid tile width or height in map xml: " + std::string(location));
 
+	// Infinite maps store their layers in chunks at arbitrary (also negative) tile positions.
+	// The map covers the bounds of all chunks and is moved so that the bounds start at 0
+	bool infinite = map_element.attribute("infinite").as_bool();
+	s32 origin_x = 0, origin_y = 0;
+	if (infinite)
+		get_infinite_map_bounds(map_element, origin_x, origin_y, width, height, location);
+	f32 object_offset_x = -origin_x * (f32)tile_width * rec_pixel_scale;
+	f32 object_offset_y = -origin_y * (f32)tile_width * rec_pixel_scale;
+
 	for (pugi::xml_node& child : map_element.children())
 	{
 		if (strcmp(child.name(), "tileset") == 0)
@@ -55,6 +293,15 @@ Map::Map(const char* location, u32 pixel_scale)
 		} 
 		else if (strcmp(child.name(), "layer") == 0)
 		{
+			pugi::xml_node data = child.child("data");
+
+			if (infinite)
+			{
+				MapGridLayer& layer = std::get<MapGridLayer>(this->layers.emplace_back(MapGridLayer(width, height)));
+				parse_chunk_tiles(data, layer, origin_x, origin_y, location);
+				continue;
+			}
+
 			u32 id = child.attribute("id").as_uint();
 			u32 w = child.attribute("width").as_uint();
 			u32 h = child.attribute("height").as_uint();
@@ -64,33 +311,16 @@ Map::Map(const char* location, u32 pixel_scale)
 				continue;
 			}
 
-			pugi::xml_node data = child.child("data");
-			std::string text = data.text().as_string();
-
 			MapGridLayer& layer = std::get<MapGridLayer>(this->layers.emplace_back(MapGridLayer(w, h)));
 
-			u32 x, y = 0;
-
-			std::istringstream line_stream(text);
-			std::string line;
-			
-			while (std::getline(line_stream, line, '\n'))
+			if (data.attribute("encoding").empty())
 			{
-				if (line.empty())
-					continue;
-
-				x = 0;
-				std::istringstream word_stream(line);
-				std::string word;
-
-				while (std::getline(word_stream, word, ',')) {
-					if (word.empty()) 
-						continue;
-					u32 gid = std::stoul(word);
-					layer.tile_ids[y * w + x] = gid;
-					x++;
-				}
-				y++;
+				parse_xml_tiles(data, layer.tile_ids.get(), w * h, location);
+			}
+			else
+			{
+				// The text points into the parsed document buffer, nothing is copied
+				parse_tile_data(data.text().get(), data.attribute("encoding").value(), data.attribute("compression").value(), layer.tile_ids.get(), w * h, location);
 			}
 		}
 		else if (strcmp(child.name(), "objectgroup") == 0)
@@ -103,8 +333,8 @@ Map::Map(const char* location, u32 pixel_scale)
 				{
 					layer.objects.emplace_back(
 						object.attribute("gid").as_uint(),
-						object.attribute("x").as_float() * rec_pixel_scale,
-						object.attribute("y").as_float() * rec_pixel_scale,
+						object.attribute("x").as_float() * rec_pixel_scale + object_offset_x,
+						object.attribute("y").as_float() * rec_pixel_scale + object_offset_y,
 						object.attribute("width").as_float(),
 						object.attribute("height").as_float(),
 						object.attribute("rotation").as_float());
@@ -118,6 +348,49 @@ Map::Map(const char* location, u32 pixel_scale)
 	this->tile_size = tile_width * rec_pixel_scale;
 	this->world_width = h_tiles * this->tile_size;
 	this->world_height = v_tiles * this->tile_size;
+
+	build_render_chunks();
+}
+
+void Map::build_render_chunks()
+{
+	render_chunks.clear();
+	render_tiles.clear();
+
+	for (u32 layer_index = 0; layer_index < layers.size(); layer_index++)
+	{
+		if (!std::holds_alternative<MapGridLayer>(layers[layer_index]))
+			continue;
+
+		MapGridLayer& layer = std::get<MapGridLayer>(layers[layer_index]);
+		for (u32 chunk_y = 0; chunk_y < layer.v_tiles; chunk_y += RENDER_CHUNK_SIZE)
+		{
+			for (u32 chunk_x = 0; chunk_x < layer.h_tiles; chunk_x += RENDER_CHUNK_SIZE)
+			{
+				u32 end_x = std::min(chunk_x + RENDER_CHUNK_SIZE, layer.h_tiles);
+				u32 end_y = std::min(chunk_y + RENDER_CHUNK_SIZE, layer.v_tiles);
+
+				MapRenderChunk chunk;
+				chunk.bounds = { chunk_x * tile_size, chunk_y * tile_size, (end_x - chunk_x) * tile_size, (end_y - chunk_y) * tile_size };
+				chunk.layer = layer_index;
+				chunk.first_tile = (u32)render_tiles.size();
+
+				for (u32 y = chunk_y; y < end_y; y++)
+				{
+					for (u32 x = chunk_x; x < end_x; x++)
+					{
+						u32 gid = layer.tile_ids[y * layer.h_tiles + x];
+						if (gid >= first_gid)
+							render_tiles.emplace_back((u16)x, (u16)y, gid);
+					}
+				}
+
+				chunk.tile_count = (u32)render_tiles.size() - chunk.first_tile;
+				if (chunk.tile_count != 0)
+					render_chunks.push_back(chunk);
+			}
+		}
+	}
 }
 
 void Map::set_full_screen_camera(entt::registry& registry, entt::entity entity, Camera& camera)
@@ -139,99 +412,305 @@ entt::entity Map::create_map_entity(entt::registry& registry, const char* map_lo
 	return entity;
 }
 
-void Map::create_map_renderable(entt::registry& registry, entt::entity entity, Tileset& tileset)
-{
-	registry.emplace<MapRenderable>(entity, registry.get<Map>(entity), tileset);
-}
+// Tolerance for comparing box and cell edges
+const static f32 COLLISION_MERGE_EPSILON = 1e-4f;
 
-void add_collision_objects(Physics& physics, TilesetTile& tile, f32 x, f32 y, bool flip_diag, f32 rot)
+/// Grid tiles pass grid_cell: their shapes remember the cell they are centered in, so merging can span the inset between tiles
+static void add_collision_objects(std::vector<MapCollisionShape>& shapes, const TilesetTile& tile, f32 x, f32 y, bool flip_diag, f32 rot, bool grid_cell)
 {
+	glm::vec2 center;
+	glm::vec2 cell_half_size;
+	if (flip_diag)
+	{
+		center = { x + tile.tile_height * 0.5f, y + tile.tile_width * 0.5f - 1 };
+		cell_half_size = { tile.tile_height * 0.5f, tile.tile_width * 0.5f };
+	}
+	else
+	{
+		center = { x + tile.tile_width * 0.5f, y + tile.tile_height * 0.5f };
+		cell_half_size = { tile.tile_width * 0.5f, tile.tile_height * 0.5f };
+	}
+	if (!grid_cell)
+		cell_half_size = glm::vec2(0.0f);
+
 	for (auto& collision_variant : tile.collision_objects)
 	{
 		if (std::holds_alternative<CollisionBox>(collision_variant))
 		{
-			CollisionBox& box = std::get<CollisionBox>(collision_variant);
-			b2Polygon polygon;
-			if (flip_diag)
-			{
-				f32 cx = x + tile.tile_height * 0.5f;
-				f32 cy = y + tile.tile_width * 0.5f - 1;
-				polygon = b2MakeOffsetBox(box.height * 0.5f, box.width * 0.5f, b2Vec2(cx, cy), b2MakeRot(rot));
-			}
-			else
-			{
-				f32 cx = x + tile.tile_width * 0.5f;
-				f32 cy = y + tile.tile_height * 0.5f;
-				polygon = b2MakeOffsetBox(box.width * 0.5f, box.height * 0.5f, b2Vec2(cx, cy), b2MakeRot(rot));
-			}
-			b2ShapeDef shape_def = b2DefaultShapeDef();
-			shape_def.filter.categoryBits = CATEGORY_MAP;
-			physics.create_polygon_shape(shape_def, polygon);
+			const CollisionBox& box = std::get<CollisionBox>(collision_variant);
+			glm::vec2 half_size = flip_diag ? glm::vec2(box.height * 0.5f, box.width * 0.5f) : glm::vec2(box.width * 0.5f, box.height * 0.5f);
+			shapes.emplace_back(MapCollisionShapeType::Box, center, half_size, rot, 0.0f, cell_half_size);
+		}
+		else
+		{
+			const CollisionCircle& circle = std::get<CollisionCircle>(collision_variant);
+			shapes.emplace_back(MapCollisionShapeType::Circle, center, glm::vec2(0.0f), rot, circle.radius, cell_half_size);
 		}
 	}
 }
 
-void Map::create_map_physics(entt::registry& registry, entt::entity entity, Tileset& tileset)
+/// A box with the cell it is centered in; boxes off the grid are their own cell
+struct MergeBox
 {
-	Map& map = registry.get<Map>(entity);
-	Physics& physics = registry.emplace<Physics>(entity, false);
+	glm::vec2 cell_min, cell_max;
+	/// Distance from the cell edges to the box edges
+	glm::vec2 inset;
+	f32 radius;
+};
+
+/// Merges boxes along one axis: boxes with the same cell extent on the other axis, the same inset and the same radius whose
+/// cells overlap or touch become one box
+static void merge_boxes_along_axis(std::vector<MergeBox>& boxes, u32 axis)
+{
+	if (boxes.empty())
+		return;
 
-	static const f32 HALF_BORDER_WIDTH = 0.2f;
+	u32 other = 1 - axis;
+	auto equal = [](f32 a, f32 b) { return std::abs(a - b) <= COLLISION_MERGE_EPSILON; };
 
-	f32 half_width = map.world_width * 0.5f;
-	f32 half_height = map.world_height * 0.5f;
-	b2Polygon p1 = b2MakeOffsetBox(half_width, HALF_BORDER_WIDTH, b2Vec2(half_width, 0.0f), b2Rot_identity);
-	b2Polygon p2 = b2MakeOffsetBox(half_width, HALF_BORDER_WIDTH, b2Vec2(half_width, map.world_height), b2Rot_identity);
-	b2Polygon p3 = b2MakeOffsetBox(HALF_BORDER_WIDTH, half_height, b2Vec2(0.0f, half_height), b2Rot_identity);
-	b2Polygon p4 = b2MakeOffsetBox(HALF_BORDER_WIDTH, half_height, b2Vec2(map.world_width, half_height), b2Rot_identity);
-	b2ShapeDef shape_def = b2DefaultShapeDef();
-	shape_def.filter.categoryBits = CATEGORY_MAP;
+	std::sort(boxes.begin(), boxes.end(), [&](const MergeBox& a, const MergeBox& b)
+		{
+			if (!equal(a.cell_min[other], b.cell_min[other]))
+				return a.cell_min[other] < b.cell_min[other];
+			if (!equal(a.cell_max[other], b.cell_max[other]))
+				return a.cell_max[other] < b.cell_max[other];
+			if (!equal(a.inset.x, b.inset.x))
+				return a.inset.x < b.inset.x;
+			if (!equal(a.inset.y, b.inset.y))
+				return a.inset.y < b.inset.y;
+			if (!equal(a.radius, b.radius))
+				return a.radius < b.radius;
+			return a.cell_min[axis] < b.cell_min[axis];
+		});
+
+	usz merged_count = 0;
+	for (usz i = 1; i < boxes.size(); i++)
+	{
+		MergeBox& current = boxes[merged_count];
+		const MergeBox& next = boxes[i];
 
-	physics.create_polygon_shape(shape_def, p1);
-	physics.create_polygon_shape(shape_def, p2);
-	physics.create_polygon_shape(shape_def, p3);
-	physics.create_polygon_shape(shape_def, p4);
+		if (equal(current.cell_min[other], next.cell_min[other]) && equal(current.cell_max[other], next.cell_max[other]) &&
+			equal(current.inset.x, next.inset.x) && equal(current.inset.y, next.inset.y) && equal(current.radius, next.radius) &&
+			next.cell_min[axis] <= current.cell_max[axis] + COLLISION_MERGE_EPSILON)
+		{
+			current.cell_max[axis] = std::max(current.cell_max[axis], next.cell_max[axis]);
+		}
+		else
+		{
+			boxes[++merged_count] = next;
+		}
+	}
+	boxes.resize(merged_count + 1);
+}
 
-	for (auto& variant : map.layers)
+/// Greedily merges the axis aligned boxes: first into horizontal runs, then runs of the same width into rectangles. Merged
+/// boxes cover their cells minus the inset, so walls of neighbouring tiles become one box without seams.
+/// Rotated boxes and circles are kept as they are
+static void merge_collision_boxes(std::vector<MapCollisionShape>& shapes)
+{
+	std::vector<MergeBox> boxes;
+	usz kept_count = 0;
+	for (const MapCollisionShape& shape : shapes)
 	{
-		if (std::holds_alternative<MapGridLayer>(variant))
+		if (shape.type == MapCollisionShapeType::Box && shape.rotation == 0.0f)
 		{
-			MapGridLayer& layer = std::get<MapGridLayer>(variant);
-			for (u32 y = 0; y < layer.v_tiles; y++)
-			{
-				for (u32 x = 0; x < layer.h_tiles; x++)
-				{
-					u32 gid = layer.tile_ids[y * layer.h_tiles + x];
-					if (gid < map.first_gid)
-						continue;
-					u32 tile_id = (gid & TILE_ID_MASK) - map.first_gid;
-
-					add_collision_objects(physics, tileset.tiles[tile_id], x, y, gid & (1 << 29), 0.0f);
-				}
-			}
+			glm::vec2 cell_half_size = shape.cell_half_size == glm::vec2(0.0f) ? shape.half_size : shape.cell_half_size;
+			boxes.emplace_back(shape.center - cell_half_size, shape.center + cell_half_size, cell_half_size - shape.half_size, shape.radius);
 		}
-		else if (std::holds_alternative<MapObjectLayer>(variant))
+		else
 		{
-			MapObjectLayer& layer = std::get<MapObjectLayer>(variant);
-			for (auto& o : layer.objects)
+			shapes[kept_count++] = shape;
+		}
+	}
+	shapes.resize(kept_count);
+
+	merge_boxes_along_axis(boxes, 0);
+	merge_boxes_along_axis(boxes, 1);
+
+	for (const MergeBox& box : boxes)
+	{
+		glm::vec2 cell_half_size = (box.cell_max - box.cell_min) * 0.5f;
+		shapes.emplace_back(MapCollisionShapeType::Box, (box.cell_min + box.cell_max) * 0.5f, cell_half_size - box.inset, 0.0f, box.radius,
+			cell_half_size);
+	}
+}
+
+void Map::add_border_collision_shapes(std::vector<MapCollisionShape>& shapes) const
+{
+	static const f32 HALF_BORDER_WIDTH = 0.2f;
+
+	f32 half_width = world_width * 0.5f;
+	f32 half_height = world_height * 0.5f;
+	shapes.emplace_back(MapCollisionShapeType::Box, glm::vec2(half_width, 0.0f), glm::vec2(half_width, HALF_BORDER_WIDTH), 0.0f, 0.0f);
+	shapes.emplace_back(MapCollisionShapeType::Box, glm::vec2(half_width, world_height), glm::vec2(half_width, HALF_BORDER_WIDTH), 0.0f, 0.0f);
+	shapes.emplace_back(MapCollisionShapeType::Box, glm::vec2(0.0f, half_height), glm::vec2(HALF_BORDER_WIDTH, half_height), 0.0f, 0.0f);
+	shapes.emplace_back(MapCollisionShapeType::Box, glm::vec2(world_width, half_height), glm::vec2(HALF_BORDER_WIDTH, half_height), 0.0f, 0.0f);
+}
+
+void Map::add_tile_collision_shapes(const Tileset& tileset, u32 begin_x, u32 begin_y, u32 end_x, u32 end_y, std::vector<MapCollisionShape>& shapes,
+	bool include_destructible) const
+{
+	for (auto& variant : layers)
+	{
+		if (!std::holds_alternative<MapGridLayer>(variant))
+			continue;
+
+		const MapGridLayer& layer = std::get<MapGridLayer>(variant);
+		for (u32 y = begin_y; y < std::min(end_y, layer.v_tiles); y++)
+		{
+			for (u32 x = begin_x; x < std::min(end_x, layer.h_tiles); x++)
 			{
-				if (o.gid < map.first_gid)
+				u32 gid = layer.tile_ids[y * layer.h_tiles + x];
+				if (gid < first_gid)
+					continue;
+				u32 tile_id = (gid & TILE_ID_MASK) - first_gid;
+				if (!include_destructible && tileset.tiles[tile_id].health != 0)
 					continue;
-				u32 tile_id = (o.gid & TILE_ID_MASK) - map.first_gid;
 
-				add_collision_objects(physics, tileset.tiles[tile_id], o.x, o.y, o.gid & (1 << 29), o.rotation);
+				add_collision_objects(shapes, tileset.tiles[tile_id], x, y, gid & (1 << 29), 0.0f, true);
 			}
 		}
 	}
 }
 
-void load_texture(std::unique_ptr<Texture>& data_ptr, const std::string location)
+void Map::add_layer_tile_collision_shapes(const Tileset& tileset, const MapGridLayer& layer, u32 x, u32 y, std::vector<MapCollisionShape>& shapes) const
 {
-	data_ptr = std::make_unique<Texture>(location.c_str());
+	u32 gid = layer.tile_ids[y * layer.h_tiles + x];
+	if (gid < first_gid)
+		return;
+	u32 tile_id = (gid & TILE_ID_MASK) - first_gid;
+
+	add_collision_objects(shapes, tileset.tiles[tile_id], x, y, gid & (1 << 29), 0.0f, true);
+}
+
+void Map::add_object_collision_shapes(const Tileset& tileset, const MapObject& object, std::vector<MapCollisionShape>& shapes) const
+{
+	if (object.gid < first_gid)
+		return;
+	u32 tile_id = (object.gid & TILE_ID_MASK) - first_gid;
+
+	add_collision_objects(shapes, tileset.tiles[tile_id], object.x, object.y, object.gid & (1 << 29), object.rotation, false);
+}
+
+void Map::merge_collision_shapes(std::vector<MapCollisionShape>& shapes) const
+{
+	merge_collision_boxes(shapes);
+}
+
+void Map::get_collision_shapes(const Tileset& tileset, std::vector<MapCollisionShape>& shapes, bool include_destructible) const
+{
+	add_border_collision_shapes(shapes);
+	add_tile_collision_shapes(tileset, 0, 0, h_tiles, v_tiles, shapes, include_destructible);
+	for (auto& variant : layers)
+	{
+		if (std::holds_alternative<MapObjectLayer>(variant))
+		{
+			for (const MapObject& o : std::get<MapObjectLayer>(variant).objects)
+				add_object_collision_shapes(tileset, o, shapes);
+		}
+	}
+}
+
+void Map::compute_collision_shapes(const Tileset& tileset, bool merge)
+{
+	collision_shapes.clear();
+	get_collision_shapes(tileset, collision_shapes, false);
+
+	unmerged_collision_shape_count = (u32)collision_shapes.size();
+	if (merge)
+		merge_collision_shapes(collision_shapes);
+}
+
+b2ShapeId Map::create_physics_shape(Physics& physics, const MapCollisionShape& shape, u32 index)
+{
+	b2ShapeDef shape_def = b2DefaultShapeDef();
+	shape_def.filter.categoryBits = CATEGORY_MAP;
+	shape_def.userData = reinterpret_cast<void*>((usz)index);
+
+	if (shape.type == MapCollisionShapeType::Box)
+	{
+		b2Polygon polygon = b2MakeOffsetRoundedBox(shape.half_size.x, shape.half_size.y, b2Vec2(shape.center.x, shape.center.y), b2MakeRot(shape.rotation), shape.radius);
+		return physics.create_polygon_shape(shape_def, polygon);
+	}
+	else
+	{
+		b2Circle circle = { b2Vec2(shape.center.x, shape.center.y), shape.radius };
+		return physics.create_circle_shape(shape_def, circle);
+	}
+}
+
+void Map::create_map_physics(entt::registry& registry, entt::entity entity, Tileset& tileset)
+{
+	PROFILE_ZONE("Map::create_map_physics");
+	Map& map = registry.get<Map>(entity);
+	Physics& physics = registry.emplace<Physics>(entity, false);
+
+	if (map.collision_shapes.empty())
+		map.compute_collision_shapes(tileset);
+
+	for (u32 i = 0; i < map.collision_shapes.size(); i++)
+		create_physics_shape(physics, map.collision_shapes[i], i);
+
+	registry.emplace<MapDestruction>(entity, map, physics, tileset);
+}
+
+MapRenderChunk* Map::find_render_chunk(u32 layer_index, u32 x, u32 y)
+{
+	// Chunks are sorted by layer, then by rows and columns of chunks
+	glm::vec2 center = (glm::vec2(x, y) + 0.5f) * tile_size;
+	auto it = std::partition_point(render_chunks.begin(), render_chunks.end(), [&](const MapRenderChunk& chunk)
+		{
+			if (chunk.layer != layer_index)
+				return chunk.layer < layer_index;
+			if (chunk.bounds.y + chunk.bounds.height <= center.y)
+				return true;
+			return chunk.bounds.y <= center.y && chunk.bounds.x + chunk.bounds.width <= center.x;
+		});
+	if (it == render_chunks.end() || it->layer != layer_index)
+		return nullptr;
+	return &*it;
+}
+
+void Map::remove_render_tile(u32 layer_index, u32 x, u32 y)
+{
+	MapRenderChunk* chunk = find_render_chunk(layer_index, x, y);
+	if (!chunk)
+		return;
+
+	auto begin = render_tiles.begin() + chunk->first_tile;
+	auto end = begin + chunk->tile_count;
+	auto tile = std::find_if(begin, end, [&](const MapRenderTile& tile) { return tile.x == x && tile.y == y; });
+	if (tile == end)
+		return;
+
+	// Leaves an unused tile at the end of the chunk range
+	std::move(tile + 1, end, tile);
+	chunk->tile_count--;
+}
+
+void Map::add_render_tile(u32 layer_index, u32 x, u32 y, u32 gid)
+{
+	MapRenderChunk* chunk = find_render_chunk(layer_index, x, y);
+	if (!chunk)
+		return;
+
+	// The tiles are in rows; the tile goes into the unused tile its removal left at the end of the range
+	auto begin = render_tiles.begin() + chunk->first_tile;
+	auto end = begin + chunk->tile_count;
+	[[maybe_unused]] u32 range_end = chunk + 1 != render_chunks.data() + render_chunks.size() ? (chunk + 1)->first_tile : (u32)render_tiles.size();
+	assert(chunk->first_tile + chunk->tile_count < range_end); // only removed tiles come back
+	auto tile = std::find_if(begin, end, [&](const MapRenderTile& tile) { return tile.y > y || (tile.y == y && tile.x >= x); });
+	if (tile != end && tile->x == x && tile->y == y)
+		return;
+
+	std::move_backward(tile, end, end + 1);
+	*tile = { (u16)x, (u16)y, gid };
+	chunk->tile_count++;
 }
 
 Tileset::Tileset(const char* location, u32 pixel_scale)
 {
+	PROFILE_ZONE_DETAIL("Tileset::Tileset", location);
 	f32 rec_pixel_scale = 1.0f / (f32) pixel_scale;
 
 	pugi::xml_document doc;
@@ -272,7 +751,7 @@ Tileset::Tileset(const char* location, u32 pixel_scale)
 					std::string source = tile_child.attribute("source").as_string();
 					u32 width = tile_child.attribute("width").as_uint();
 					u32 height = tile_child.attribute("height").as_uint();
-					this->tiles[id].asset.set(path + source, &load_texture);
+					this->tiles[id].image = path + source;
 					this->tiles[id].tile_width = width * rec_pixel_scale;
 					this->tiles[id].tile_height = height * rec_pixel_scale;
 				}
@@ -291,129 +770,11 @@ Tileset::Tileset(const char* location, u32 pixel_scale)
 						CollisionCircle(tile_child.attribute("radius").as_float() * world_grid_size)
 					);
 				}
-			}
-		}
-	}
-}
-
-MapRenderable::MapRenderable(Map& map, Tileset& tileset)
-{
-	asset_refs.resize(tileset.asset_count);
-
-	for (auto& variant : map.layers)
-	{
-		if (std::holds_alternative<MapGridLayer>(variant))
-		{
-			MapGridLayer& layer = std::get<MapGridLayer>(variant);
-			for (u32 i = 0; i < layer.v_tiles * layer.h_tiles; i++)
-			{
-				u32 gid = layer.tile_ids[i];
-				if (gid < map.first_gid)
-					continue;
-				u32 tile_id = (gid & TILE_ID_MASK) - map.first_gid;
-
-				if (!this->asset_refs[tile_id])
-					this->asset_refs[tile_id] = std::make_unique<AssetRef<Texture>>(std::move(tileset.tiles[tile_id].asset.loaded()));
-			}
-		}
-		else if (std::holds_alternative<MapObjectLayer>(variant))
-		{
-			MapObjectLayer& layer = std::get<MapObjectLayer>(variant);
-			for (auto& o : layer.objects)
-			{
-				if (o.gid < map.first_gid)
-					continue;
-				u32 tile_id = (o.gid & TILE_ID_MASK) - map.first_gid;
-
-				if (!this->asset_refs[tile_id])
-					this->asset_refs[tile_id] = std::make_unique<AssetRef<Texture>>(std::move(tileset.tiles[tile_id].asset.loaded()));
-			}
-		}
-	}
-}
-
-void MapRenderable::render_map(entt::registry& registry, Graphics& graphics)
-{
-	for (auto [entity, map, renderable] : registry.view<Map, MapRenderable>().each())
-	{
-		for (auto& variant : map.layers)
-		{
-			if (std::holds_alternative<MapGridLayer>(variant))
-			{
-				MapGridLayer& layer = std::get<MapGridLayer>(variant);
-				for (u32 y = 0; y < layer.v_tiles; y++)
-				{
-					for (u32 x = 0; x < layer.h_tiles; x++)
-					{
-						u32 index = y * layer.h_tiles + x;
-						u32 gid = layer.tile_ids[index];
-
-						if (gid < map.first_gid)
-							continue;
-
-						u32 tile_id = (gid & TILE_ID_MASK) - map.first_gid;
-						Texture& texture = renderable.asset_refs[tile_id]->get();
-
-						ImageTransform transform = graphics.create_transform();
-						transform.translate(x * map.tile_size, (y + 1) * map.tile_size);
-
-						if (gid & (1 << 29))
-							transform.translate_pixels(0.5f * texture.get_height(), -0.5f * texture.get_width());
-						else
-							transform.translate_pixels(0.5f * texture.get_width(), -0.5f * texture.get_height());
-
-						if (gid & (1 << 30))
-							transform.flip_y();
-						if (gid & (1 << 31))
-							transform.flip_x();
-
-						if (gid & (1 << 29))
-						{
-							transform.flip_y();
-							transform.rotate(-0.5f * MathUtil::PI_32);
-						}
-
-						graphics.draw_image(texture, transform);
-					}
-				}
-			}
-			else if (std::holds_alternative<MapObjectLayer>(variant))
-			{
-				MapObjectLayer& layer = std::get<MapObjectLayer>(variant);
-				for (MapObject& o : layer.objects)
+				else if (strcmp(tile_child.name(), "destructible") == 0)
 				{
-					if (o.gid < map.first_gid)
-						continue;
-
-					u32 tile_id = (o.gid & TILE_ID_MASK) - map.first_gid;
-					Texture& texture = renderable.asset_refs[tile_id]->get();
-
-					ImageTransform transform = graphics.create_transform();
-					transform.translate(o.x, o.y);
-
-					transform.rotate(o.rotation);
-
-					if (o.gid & (1 << 29))
-						transform.translate_pixels(0.5f * o.height_pixel, -0.5f * o.width_pixel);
-					else
-						transform.translate_pixels(0.5f * o.width_pixel, -0.5f * o.height_pixel);
-
-					if (o.gid & (1 << 30))
-						transform.flip_y();
-					if (o.gid & (1 << 31))
-						transform.flip_x();
-
-					if (o.gid & (1 << 29))
-					{
-						transform.flip_y();
-						transform.rotate(-0.5f * MathUtil::PI_32);
-					}
-
-					transform.scale(o.width_pixel / (f32)texture.get_width(), o.height_pixel / (f32)texture.get_height());
-
-					graphics.draw_image(texture, transform);
+					this->tiles[id].health = (u16)std::min(tile_child.attribute("health").as_uint(1), 0xFFFFu);
 				}
 			}
 		}
 	}
-}
\ No newline at end of file
+}
@@ -1,10 +1,7 @@
 #pragma once
 
 #include "engine/Types.h"
-#include "engine/Asset.h"
-#include "engine/Texture.h"
-#include "engine/Mesh.h"
-#include "engine/Graphics.h"
+#include "engine/Camera.h"
 #include "Components.h"
 
 #include "entt/entt.hpp"
@@ -12,12 +9,17 @@
 #include <vector>
 #include <variant>
 
+/// Masks the flip flags out of a gid
+const u32 TILE_ID_MASK = ~(0b1111 << 28);
+
 struct MapGridLayer : NoCopy
 {
 	MapGridLayer(u32 h_tiles, u32 v_tiles);
 
 	u32 h_tiles, v_tiles;
 	std::unique_ptr<u32[]> tile_ids;
+	/// Remaining health of the destructible tiles; 0 for indestructible and empty tiles (set by MapDestruction)
+	std::unique_ptr<u16[]> tile_health;
 };
 
 struct MapObject
@@ -43,31 +45,76 @@ struct CollisionCircle
 
 struct TilesetTile : NoCopy
 {
-	Asset<Texture> asset;
+	/// Location of the tile image; the client loads it as a texture (TilesetTextures)
+	std::string image;
 	f32 tile_width;
 	f32 tile_height;
+	/// Health of destructible tiles (destructible element); 0 for indestructible tiles
+	u16 health = 0;
 	std::vector<std::variant<CollisionBox, CollisionCircle>> collision_objects;
 };
 
 struct Tileset : NoCopy
 {
+	/// Empty tileset; filled by MapBlob::load or assigned later
+	Tileset() = default;
 	Tileset(const char* location, u32 pixel_scale);
 
 private:
 	std::unique_ptr<TilesetTile[]> tiles;
-	u32 asset_count;
+	u32 asset_count = 0;
 
-	friend struct MapRenderable;
+	friend struct TilesetTextures;
 	friend struct Map;
+	friend struct MapBlob;
+	friend struct MapStreamer;
+	friend struct MapDestruction;
+};
+
+enum class MapCollisionShapeType : u32
+{
+	Box = 0,
+	Circle = 1
+};
+
+/// A shape of the static map body in world space
+struct MapCollisionShape
+{
+	MapCollisionShapeType type;
+	glm::vec2 center;
+	glm::vec2 half_size;
+	f32 rotation;
+	f32 radius;
+	/// Half size of the grid cell the shape is centered in; zero for shapes that aren't placed on the grid (objects, borders)
+	glm::vec2 cell_half_size = glm::vec2(0.0f);
+};
+
+/// The non-empty tiles of one grid layer inside a square of RENDER_CHUNK_SIZE tiles. Rendering skips chunks outside of the camera
+struct MapRenderChunk
+{
+	/// World bounds of the chunk tiles (without the overhang of textures larger than a tile)
+	Rect bounds;
+	u32 layer;
+	u32 first_tile;
+	u32 tile_count;
+};
+
+struct MapRenderTile
+{
+	u16 x, y;
+	u32 gid;
 };
 
 struct Map : NoCopy
 {
 	Map(const char* location, u32 pixel_scale);
 
+	/// Side length of a render chunk in tiles
+	static const u32 RENDER_CHUNK_SIZE = 16;
+
 	static void set_full_screen_camera(entt::registry& registry, entt::entity entity, Camera& camera);
 	static entt::entity create_map_entity(entt::registry& registry, const char* map_location, u32 pixel_scale);
-	static void create_map_renderable(entt::registry& registry, entt::entity entity, Tileset& tileset);
+	/// Creates the static map body and the MapDestruction with the shapes of the destructible tiles
 	static void create_map_physics(entt::registry& registry, entt::entity entity, Tileset& tileset);
 
 	u32 h_tiles, v_tiles;
@@ -75,17 +122,47 @@ struct Map : NoCopy
 	f32 world_width, world_height;
 	u32 first_gid;
 	std::vector<std::variant<MapGridLayer, MapObjectLayer>> layers;
-};
 
-struct MapRenderable : NoCopy
-{
-	MapRenderable(Map& map, Tileset& tileset);
+	/// Computes the static collision shapes from the tiles and objects, without the destructible tiles (see MapDestruction).
+	/// With merge, the axis aligned boxes of neighbouring grid cells with the same inset are greedily merged into maximal
+	/// rectangles that span the gaps between the tile boxes (fewer broadphase proxies and no ghost collisions at the tile seams).
+	/// Boxes off the grid only merge with boxes they touch
+	void compute_collision_shapes(const Tileset& tileset, bool merge = true);
+
+	/// Adds the unmerged collision shapes of the whole map
+	void get_collision_shapes(const Tileset& tileset, std::vector<MapCollisionShape>& shapes, bool include_destructible = true) const;
+	/// Adds the boxes around the map
+	void add_border_collision_shapes(std::vector<MapCollisionShape>& shapes) const;
+	/// Adds the collision shapes of the grid layer tiles in [begin, end)
+	void add_tile_collision_shapes(const Tileset& tileset, u32 begin_x, u32 begin_y, u32 end_x, u32 end_y, std::vector<MapCollisionShape>& shapes,
+		bool include_destructible = true) const;
+	/// Adds the collision shapes of one tile of the grid layer
+	void add_layer_tile_collision_shapes(const Tileset& tileset, const MapGridLayer& layer, u32 x, u32 y, std::vector<MapCollisionShape>& shapes) const;
+	void add_object_collision_shapes(const Tileset& tileset, const MapObject& object, std::vector<MapCollisionShape>& shapes) const;
+	/// Merges the axis aligned boxes of the shapes (see compute_collision_shapes); circles and rotated boxes are kept
+	void merge_collision_shapes(std::vector<MapCollisionShape>& shapes) const;
+
+	/// The index is kept as the shape user data; shapes of the map body are numbered (see MapDestruction::get_shape_index)
+	static b2ShapeId create_physics_shape(Physics& physics, const MapCollisionShape& shape, u32 index = 0);
+
+	/// Removes the tile from its render chunk; the order of the other tiles is kept
+	void remove_render_tile(u32 layer_index, u32 x, u32 y);
+	/// Puts a removed tile back into its render chunk, at the place build_render_chunks gave it
+	void add_render_tile(u32 layer_index, u32 x, u32 y, u32 gid);
+
+	/// Computed on the first create_map_physics call, or precompiled (see MapBlob)
+	std::vector<MapCollisionShape> collision_shapes;
+	/// Number of collision shapes before merging
+	u32 unmerged_collision_shape_count = 0;
+	std::vector<MapRenderChunk> render_chunks;
+	std::vector<MapRenderTile> render_tiles;
 
-	static void render_map(entt::registry& registry, Graphics& graphics);
+private:
+	Map() = default;
 
-	friend MapGridLayer;
-	friend MapObjectLayer;
+	void build_render_chunks();
+	/// The render chunk of the layer containing the tile; nullptr if the chunk had no tiles
+	MapRenderChunk* find_render_chunk(u32 layer_index, u32 x, u32 y);
 
-private:
-	std::vector<std::unique_ptr<AssetRef<Texture>>> asset_refs;
+	friend struct MapBlob;
 };
\ No newline at end of file
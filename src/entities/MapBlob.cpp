@@ -0,0 +1,430 @@
+#include "MapBlob.h"
+
+#include "engine/Profiler.h"
+#include "engine/util/FileUtil.h"
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+
+// The sections are stored in the native layout; blobs are only portable between little endian machines
+static_assert(std::endian::native == std::endian::little);
+
+const static char BLOB_MAGIC[8] = { 'T', 'G', 'M', 'A', 'P', 'B', 'L', 'B' };
+
+struct MapBlobHeader
+{
+	char magic[8];
+	u32 version;
+	u32 pixel_scale;
+	u64 map_source_size;
+	s64 map_source_time;
+	u64 tileset_source_size;
+	s64 tileset_source_time;
+	u32 h_tiles, v_tiles;
+	f32 tile_size;
+	f32 world_width, world_height;
+	u32 first_gid;
+	u32 layer_count;
+	u32 tile_count;
+	u32 tile_collision_object_count;
+	u32 collision_shape_count;
+	u32 render_chunk_count;
+	u32 render_tile_count;
+	u32 string_bytes;
+	u32 unmerged_collision_shape_count;
+};
+
+enum class MapBlobLayerType : u32
+{
+	Grid = 0,
+	Object = 1
+};
+
+/// Followed by h_tiles * v_tiles gids for grid layers or object_count MapObjects for object layers
+struct MapBlobLayer
+{
+	MapBlobLayerType type;
+	u32 h_tiles, v_tiles;
+	u32 object_count;
+};
+
+struct MapBlobTile
+{
+	f32 tile_width, tile_height;
+	/// Texture path relative to the blob directory in the string section; empty for tiles without image
+	u32 path_offset, path_length;
+	u32 first_collision_object, collision_object_count;
+	u32 health;
+};
+
+struct MapBlobCollisionObject
+{
+	MapCollisionShapeType type;
+	f32 width, height, radius;
+};
+
+static_assert(sizeof(MapBlobHeader) % 8 == 0);
+static_assert(std::is_trivially_copyable_v<MapObject> && std::is_trivially_copyable_v<MapCollisionShape>);
+static_assert(std::is_trivially_copyable_v<MapRenderChunk> && std::is_trivially_copyable_v<MapRenderTile>);
+
+/// Appends sections to the blob buffer
+struct BlobWriter
+{
+	template<typename T>
+	void write(const T* data, usz count)
+	{
+		const u8* bytes = reinterpret_cast<const u8*>(data);
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T) * count);
+	}
+
+	template<typename T>
+	void write(const T& value)
+	{
+		write(&value, 1);
+	}
+
+	std::vector<u8> buffer;
+};
+
+/// Copies sections out of the blob buffer; throws exception when reading past the end
+struct BlobReader
+{
+	template<typename T>
+	void read(T* data, usz count)
+	{
+		usz bytes = sizeof(T) * count;
+		if (bytes > size - pos)
+			throw std::runtime_error("Truncated map blob: " + std::string(location));
+		std::memcpy(data, buffer + pos, bytes);
+		pos += bytes;
+	}
+
+	template<typename T>
+	T read()
+	{
+		T value;
+		read(&value, 1);
+		return value;
+	}
+
+	/// Throws unless count values fit into the rest of the blob; checked before a count of the blob sizes a container
+	template<typename T>
+	void check_count(u64 count) const
+	{
+		if (count > (size - pos) / sizeof(T))
+			throw std::runtime_error("Truncated map blob: " + std::string(location));
+	}
+
+	const u8* buffer;
+	usz size;
+	usz pos;
+	const char* location;
+};
+
+/// Empty, or a tile of the tileset with any flip bits
+static bool is_valid_gid(u32 gid, u32 first_gid, u32 tile_count)
+{
+	if (gid < first_gid)
+		return true;
+	u32 tile_id = gid & TILE_ID_MASK;
+	return tile_id >= first_gid && tile_id - first_gid < tile_count;
+}
+
+/// Gets the size and the last write time of a file; returns false if the file doesn't exist
+static bool get_source_stamp(const char* location, u64& size, s64& time)
+{
+	std::error_code error;
+	size = std::filesystem::file_size(location, error);
+	if (error)
+		return false;
+	time = std::filesystem::last_write_time(location, error).time_since_epoch().count();
+	return !error;
+}
+
+Map MapBlob::compile(const char* map_location, const char* tileset_location, const char* blob_location, u32 pixel_scale)
+{
+	Map map(map_location, pixel_scale);
+	Tileset tileset(tileset_location, pixel_scale);
+	map.compute_collision_shapes(tileset);
+
+	MapBlobHeader header = {};
+	std::memcpy(header.magic, BLOB_MAGIC, sizeof(BLOB_MAGIC));
+	header.version = VERSION;
+	header.pixel_scale = pixel_scale;
+	if (!get_source_stamp(map_location, header.map_source_size, header.map_source_time))
+		throw std::runtime_error("Failed to read file: " + std::string(map_location));
+	if (!get_source_stamp(tileset_location, header.tileset_source_size, header.tileset_source_time))
+		throw std::runtime_error("Failed to read file: " + std::string(tileset_location));
+	header.h_tiles = map.h_tiles;
+	header.v_tiles = map.v_tiles;
+	header.tile_size = map.tile_size;
+	header.world_width = map.world_width;
+	header.world_height = map.world_height;
+	header.first_gid = map.first_gid;
+	header.layer_count = (u32)map.layers.size();
+	header.tile_count = tileset.asset_count;
+	header.collision_shape_count = (u32)map.collision_shapes.size();
+	header.unmerged_collision_shape_count = map.unmerged_collision_shape_count;
+	header.render_chunk_count = (u32)map.render_chunks.size();
+	header.render_tile_count = (u32)map.render_tiles.size();
+
+	BlobWriter writer;
+
+	for (auto& variant : map.layers)
+	{
+		if (std::holds_alternative<MapGridLayer>(variant))
+		{
+			MapGridLayer& layer = std::get<MapGridLayer>(variant);
+			writer.write(MapBlobLayer{ MapBlobLayerType::Grid, layer.h_tiles, layer.v_tiles, 0 });
+			writer.write(layer.tile_ids.get(), (usz)layer.h_tiles * layer.v_tiles);
+		}
+		else
+		{
+			MapObjectLayer& layer = std::get<MapObjectLayer>(variant);
+			writer.write(MapBlobLayer{ MapBlobLayerType::Object, 0, 0, (u32)layer.objects.size() });
+			writer.write(layer.objects.data(), layer.objects.size());
+		}
+	}
+
+	std::filesystem::path blob_directory = std::filesystem::absolute(blob_location).parent_path();
+	std::string strings;
+	std::vector<MapBlobCollisionObject> collision_objects;
+
+	for (u32 i = 0; i < tileset.asset_count; i++)
+	{
+		TilesetTile& tile = tileset.tiles[i];
+
+		std::string path;
+		if (!tile.image.empty())
+		{
+			std::error_code error;
+			std::filesystem::path relative = std::filesystem::relative(tile.image, blob_directory, error);
+			path = error || relative.empty() ? tile.image : relative.generic_string();
+		}
+
+		writer.write(MapBlobTile{ tile.tile_width, tile.tile_height, (u32)strings.size(), (u32)path.size(), (u32)collision_objects.size(), (u32)tile.collision_objects.size(), tile.health });
+		strings += path;
+
+		for (auto& collision_variant : tile.collision_objects)
+		{
+			if (std::holds_alternative<CollisionBox>(collision_variant))
+			{
+				CollisionBox& box = std::get<CollisionBox>(collision_variant);
+				collision_objects.emplace_back(MapCollisionShapeType::Box, box.width, box.height, box.radius);
+			}
+			else
+			{
+				CollisionCircle& circle = std::get<CollisionCircle>(collision_variant);
+				collision_objects.emplace_back(MapCollisionShapeType::Circle, 0.0f, 0.0f, circle.radius);
+			}
+		}
+	}
+
+	writer.write(collision_objects.data(), collision_objects.size());
+	writer.write(map.collision_shapes.data(), map.collision_shapes.size());
+	writer.write(map.render_chunks.data(), map.render_chunks.size());
+	writer.write(map.render_tiles.data(), map.render_tiles.size());
+	writer.write(strings.data(), strings.size());
+
+	header.tile_collision_object_count = (u32)collision_objects.size();
+	header.string_bytes = (u32)strings.size();
+
+	std::ofstream file(blob_location, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("Failed to open file: " + std::string(blob_location));
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(writer.buffer.data()), writer.buffer.size());
+	if (!file)
+		throw std::runtime_error("Failed to write file: " + std::string(blob_location));
+
+	return map;
+}
+
+bool MapBlob::is_up_to_date(const char* blob_location, const char* map_location, const char* tileset_location, u32 pixel_scale)
+{
+	std::ifstream file(blob_location, std::ios::binary);
+	if (!file)
+		return false;
+
+	MapBlobHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		return false;
+
+	if (std::memcmp(header.magic, BLOB_MAGIC, sizeof(BLOB_MAGIC)) != 0 || header.version != VERSION || header.pixel_scale != pixel_scale)
+		return false;
+
+	u64 map_size, tileset_size;
+	s64 map_time, tileset_time;
+	if (!get_source_stamp(map_location, map_size, map_time) || !get_source_stamp(tileset_location, tileset_size, tileset_time))
+		return false;
+
+	return map_size == header.map_source_size && map_time == header.map_source_time &&
+		tileset_size == header.tileset_source_size && tileset_time == header.tileset_source_time;
+}
+
+entt::entity MapBlob::load_map_entity(entt::registry& registry, const char* blob_location, Tileset& tileset)
+{
+	PROFILE_ZONE_DETAIL("MapBlob::load_map_entity", blob_location);
+
+	u64 file_size;
+	std::unique_ptr<u8[]> buffer = FileUtil::load_file(blob_location, file_size);
+	BlobReader reader{ buffer.get(), (usz)file_size, 0, blob_location };
+
+	MapBlobHeader header = reader.read<MapBlobHeader>();
+	if (std::memcmp(header.magic, BLOB_MAGIC, sizeof(BLOB_MAGIC)) != 0)
+		throw std::runtime_error("Not a map blob: " + std::string(blob_location));
+	if (header.version != VERSION)
+		throw std::runtime_error("Outdated map blob version: " + std::string(blob_location));
+
+	Map map;
+	map.h_tiles = header.h_tiles;
+	map.v_tiles = header.v_tiles;
+	map.tile_size = header.tile_size;
+	map.world_width = header.world_width;
+	map.world_height = header.world_height;
+	map.first_gid = header.first_gid;
+
+	auto invalid = [&](const char* what)
+		{
+			return std::runtime_error("Invalid " + std::string(what) + " in map blob: " + std::string(blob_location));
+		};
+
+	// The grid layers are indexed with the map size; the render tiles store their position in 16 bits
+	if (header.h_tiles > UINT16_MAX || header.v_tiles > UINT16_MAX)
+		throw invalid("map size");
+
+	reader.check_count<MapBlobLayer>(header.layer_count);
+	map.layers.reserve(header.layer_count);
+	for (u32 i = 0; i < header.layer_count; i++)
+	{
+		MapBlobLayer blob_layer = reader.read<MapBlobLayer>();
+		if (blob_layer.type == MapBlobLayerType::Grid)
+		{
+			if (blob_layer.h_tiles != header.h_tiles || blob_layer.v_tiles != header.v_tiles)
+				throw invalid("layer size");
+			reader.check_count<u32>((u64)blob_layer.h_tiles * blob_layer.v_tiles);
+			MapGridLayer& layer = std::get<MapGridLayer>(map.layers.emplace_back(MapGridLayer(blob_layer.h_tiles, blob_layer.v_tiles)));
+			reader.read(layer.tile_ids.get(), (usz)blob_layer.h_tiles * blob_layer.v_tiles);
+			for (u32 j = 0; j < blob_layer.h_tiles * blob_layer.v_tiles; j++)
+			{
+				if (!is_valid_gid(layer.tile_ids[j], header.first_gid, header.tile_count))
+					throw invalid("tile");
+			}
+		}
+		else if (blob_layer.type == MapBlobLayerType::Object)
+		{
+			reader.check_count<MapObject>(blob_layer.object_count);
+			MapObjectLayer& layer = std::get<MapObjectLayer>(map.layers.emplace_back(MapObjectLayer()));
+			layer.objects.resize(blob_layer.object_count);
+			reader.read(layer.objects.data(), blob_layer.object_count);
+			for (const MapObject& object : layer.objects)
+			{
+				if (!is_valid_gid(object.gid, header.first_gid, header.tile_count))
+					throw invalid("object");
+			}
+		}
+		else
+		{
+			throw invalid("layer type");
+		}
+	}
+
+	reader.check_count<MapBlobTile>(header.tile_count);
+	std::vector<MapBlobTile> tiles(header.tile_count);
+	reader.read(tiles.data(), tiles.size());
+	reader.check_count<MapBlobCollisionObject>(header.tile_collision_object_count);
+	std::vector<MapBlobCollisionObject> collision_objects(header.tile_collision_object_count);
+	reader.read(collision_objects.data(), collision_objects.size());
+
+	reader.check_count<MapCollisionShape>(header.collision_shape_count);
+	map.collision_shapes.resize(header.collision_shape_count);
+	map.unmerged_collision_shape_count = header.unmerged_collision_shape_count;
+	reader.read(map.collision_shapes.data(), map.collision_shapes.size());
+	reader.check_count<MapRenderChunk>(header.render_chunk_count);
+	map.render_chunks.resize(header.render_chunk_count);
+	reader.read(map.render_chunks.data(), map.render_chunks.size());
+	reader.check_count<MapRenderTile>(header.render_tile_count);
+	map.render_tiles.resize(header.render_tile_count);
+	reader.read(map.render_tiles.data(), map.render_tiles.size());
+
+	for (const MapRenderChunk& chunk : map.render_chunks)
+	{
+		if (chunk.layer >= map.layers.size() || !std::holds_alternative<MapGridLayer>(map.layers[chunk.layer]) ||
+			(u64)chunk.first_tile + chunk.tile_count > map.render_tiles.size())
+			throw invalid("render chunk");
+	}
+	for (const MapRenderTile& tile : map.render_tiles)
+	{
+		if (tile.x >= header.h_tiles || tile.y >= header.v_tiles || !is_valid_gid(tile.gid, header.first_gid, header.tile_count))
+			throw invalid("render tile");
+	}
+
+	if (header.string_bytes > file_size - reader.pos)
+		throw std::runtime_error("Truncated map blob: " + std::string(blob_location));
+	const char* strings = reinterpret_cast<const char*>(buffer.get() + reader.pos);
+
+	std::string blob_directory = std::filesystem::absolute(blob_location).parent_path().generic_string() + "/";
+
+	tileset.asset_count = header.tile_count;
+	tileset.tiles = std::make_unique<TilesetTile[]>(header.tile_count);
+	for (u32 i = 0; i < header.tile_count; i++)
+	{
+		const MapBlobTile& blob_tile = tiles[i];
+		TilesetTile& tile = tileset.tiles[i];
+		tile.tile_width = blob_tile.tile_width;
+		tile.tile_height = blob_tile.tile_height;
+		tile.health = (u16)blob_tile.health;
+
+		if (blob_tile.path_length != 0)
+		{
+			if ((u64)blob_tile.path_offset + blob_tile.path_length > header.string_bytes)
+				throw std::runtime_error("Invalid texture path in map blob: " + std::string(blob_location));
+
+			std::string_view path(strings + blob_tile.path_offset, blob_tile.path_length);
+			if (std::filesystem::path(path).is_absolute())
+				tile.image = std::string(path);
+			else
+				tile.image = blob_directory + std::string(path);
+		}
+
+		if ((u64)blob_tile.first_collision_object + blob_tile.collision_object_count > collision_objects.size())
+			throw std::runtime_error("Invalid collision objects in map blob: " + std::string(blob_location));
+
+		for (u32 j = 0; j < blob_tile.collision_object_count; j++)
+		{
+			const MapBlobCollisionObject& object = collision_objects[blob_tile.first_collision_object + j];
+			if (object.type == MapCollisionShapeType::Box)
+				tile.collision_objects.emplace_back(CollisionBox(object.width, object.height, object.radius));
+			else
+				tile.collision_objects.emplace_back(CollisionCircle(object.radius));
+		}
+	}
+
+	entt::entity entity = registry.create();
+	registry.emplace<Map>(entity, std::move(map));
+	return entity;
+}
+
+entt::entity MapBlob::load_map_entity(entt::registry& registry, const char* blob_location, const char* map_location, const char* tileset_location, u32 pixel_scale, Tileset& tileset)
+{
+	if (is_up_to_date(blob_location, map_location, tileset_location, pixel_scale))
+	{
+		try
+		{
+			return load_map_entity(registry, blob_location, tileset);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "Failed to load map blob, loading the TMX instead: " << e.what() << std::endl;
+		}
+	}
+
+	tileset = Tileset(tileset_location, pixel_scale);
+	return Map::create_map_entity(registry, map_location, pixel_scale);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "Map.h"
+
+#include "entt/entt.hpp"
+
+/// Compiled binary map: a TMX map and its TSX tileset with the tile grids, object layers, collision shapes,
+/// render chunks and the texture list in one versioned file (compiled by the mapc tool).
+/// Loading reads the file in one go and copies the sections out; there is no XML or string parsing.
+/// The blob stores the sizes and modification times of its sources so stale blobs can fall back to the TMX.
+struct MapBlob
+{
+	/// Increment on every change of the binary layout
+	static const u32 VERSION = 4;
+
+	/// Compiles the TMX map with its TSX tileset into a blob and returns the map for inspection; throws exception on error
+	static Map compile(const char* map_location, const char* tileset_location, const char* blob_location, u32 pixel_scale);
+
+	/// Checks that the blob exists, has the current version and pixel scale and was compiled from the current sources
+	static bool is_up_to_date(const char* blob_location, const char* map_location, const char* tileset_location, u32 pixel_scale);
+
+	/// Creates the map entity and fills the tileset from the blob; throws exception on error, also for counts that don't fit
+	/// into the file and tile ids that aren't in the tileset
+	static entt::entity load_map_entity(entt::registry& registry, const char* blob_location, Tileset& tileset);
+
+	/// Loads the blob if it is up to date, otherwise the TMX map and the TSX tileset
+	static entt::entity load_map_entity(entt::registry& registry, const char* blob_location, const char* map_location, const char* tileset_location, u32 pixel_scale, Tileset& tileset);
+};
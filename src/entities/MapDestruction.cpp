@@ -0,0 +1,216 @@
+#include "MapDestruction.h"
+
+#include "CommandBuffer.h"
+#include "engine/Profiler.h"
+
+#include <cmath>
+#include <limits>
+
+// Projectile hits further than this from the closest shape (in tiles) damage nothing
+const static f32 MAX_HIT_DISTANCE = 0.25f;
+
+/// Distance from pos to the shape; 0 inside. The rounding of boxes is ignored
+static f32 get_shape_distance(const MapCollisionShape& shape, glm::vec2 pos)
+{
+	glm::vec2 offset = pos - shape.center;
+	if (shape.type == MapCollisionShapeType::Circle)
+		return std::max(glm::length(offset) - shape.radius, 0.0f);
+
+	f32 s = std::sin(shape.rotation);
+	f32 c = std::cos(shape.rotation);
+	glm::vec2 local = { c * offset.x + s * offset.y, -s * offset.x + c * offset.y };
+	return glm::length(glm::max(glm::abs(local) - shape.half_size, glm::vec2(0.0f)));
+}
+
+MapDestruction::MapDestruction(Map& map, Physics& physics, const Tileset& tileset)
+	: destructible_tiles(0), destroyed_tiles(0), h_tiles(map.h_tiles), v_tiles(map.v_tiles), search_tiles(0),
+	first_shape_index((u32)map.collision_shapes.size())
+{
+	PROFILE_ZONE("MapDestruction::MapDestruction");
+
+	for (u32 layer_index = 0; layer_index < map.layers.size(); layer_index++)
+	{
+		if (!std::holds_alternative<MapGridLayer>(map.layers[layer_index]))
+			continue;
+		grid_layers.push_back(layer_index);
+
+		MapGridLayer& layer = std::get<MapGridLayer>(map.layers[layer_index]);
+		for (u32 y = 0; y < layer.v_tiles; y++)
+		{
+			for (u32 x = 0; x < layer.h_tiles; x++)
+			{
+				u32 index = y * layer.h_tiles + x;
+				u32 gid = layer.tile_ids[index];
+				layer.tile_health[index] = gid < map.first_gid ? 0 : tileset.tiles[(gid & TILE_ID_MASK) - map.first_gid].health;
+				if (layer.tile_health[index] == 0)
+					continue;
+
+				TileShapes tile = { (u32)shapes.size(), 0 };
+				usz first_geometry = shape_geometry.size();
+				map.add_layer_tile_collision_shapes(tileset, layer, x, y, shape_geometry);
+
+				glm::vec2 tile_center = (glm::vec2(x, y) + 0.5f) * map.tile_size;
+				for (usz i = first_geometry; i < shape_geometry.size(); i++)
+				{
+					const MapCollisionShape& shape = shape_geometry[i];
+					shapes.push_back(Map::create_physics_shape(physics, shape, first_shape_index + (u32)shapes.size()));
+
+					f32 bound = shape.type == MapCollisionShapeType::Circle ? shape.radius : glm::length(shape.half_size);
+					f32 reach = (glm::distance(shape.center, tile_center) + bound) / map.tile_size - 0.5f;
+					search_tiles = std::max(search_tiles, (s32)std::ceil(reach));
+				}
+				tile.shape_count = (u32)shapes.size() - tile.first_shape;
+
+				tile_shapes.emplace(get_tile_key(layer_index, x, y), tile);
+				destructible_tiles++;
+			}
+		}
+	}
+}
+
+bool MapDestruction::damage_tile_at(entt::registry& registry, entt::entity map_entity, glm::vec2 pos, u16 damage)
+{
+	Map& map = registry.get<Map>(map_entity);
+	MapDestruction& destruction = registry.get<MapDestruction>(map_entity);
+
+	s32 tile_x = (s32)std::floor(pos.x / map.tile_size);
+	s32 tile_y = (s32)std::floor(pos.y / map.tile_size);
+	s32 range = destruction.search_tiles + 1;
+
+	f32 closest = MAX_HIT_DISTANCE * map.tile_size;
+	u32 closest_layer = 0;
+	glm::ivec2 closest_tile(-1);
+	for (u32 layer_index : destruction.grid_layers)
+	{
+		for (s32 y = std::max(tile_y - range, 0); y <= std::min(tile_y + range, (s32)destruction.v_tiles - 1); y++)
+		{
+			for (s32 x = std::max(tile_x - range, 0); x <= std::min(tile_x + range, (s32)destruction.h_tiles - 1); x++)
+			{
+				auto it = destruction.tile_shapes.find(destruction.get_tile_key(layer_index, x, y));
+				if (it == destruction.tile_shapes.end())
+					continue;
+
+				const TileShapes& tile = it->second;
+				for (u32 i = tile.first_shape; i < tile.first_shape + tile.shape_count; i++)
+				{
+					f32 distance = get_shape_distance(destruction.shape_geometry[i], pos);
+					if (distance <= closest)
+					{
+						closest = distance;
+						closest_layer = layer_index;
+						closest_tile = { x, y };
+					}
+				}
+			}
+		}
+	}
+
+	if (closest_tile.x < 0)
+		return false;
+
+	damage_tile(registry, map_entity, closest_layer, closest_tile.x, closest_tile.y, damage);
+	return true;
+}
+
+void MapDestruction::damage_tile(entt::registry& registry, entt::entity map_entity, u32 layer_index, u32 x, u32 y, u16 damage)
+{
+	Map& map = registry.get<Map>(map_entity);
+	MapGridLayer& layer = std::get<MapGridLayer>(map.layers[layer_index]);
+	u32 index = y * layer.h_tiles + x;
+
+	u16 health = layer.tile_health[index];
+	if (health == 0 || damage == 0)
+		return;
+
+	health = damage >= health ? 0 : health - damage;
+	u32 gid = health == 0 ? 0 : layer.tile_ids[index];
+	registry.get<MapDestruction>(map_entity).set_tile(map, layer_index, x, y, gid, health);
+}
+
+void MapDestruction::apply_change(entt::registry& registry, entt::entity map_entity, const MapTileChange& change)
+{
+	Map& map = registry.get<Map>(map_entity);
+	registry.get<MapDestruction>(map_entity).set_tile(map, change.layer, change.x, change.y, change.gid, change.health);
+}
+
+void MapDestruction::set_tile(Map& map, u32 layer_index, u32 x, u32 y, u32 gid, u16 health)
+{
+	MapGridLayer& layer = std::get<MapGridLayer>(map.layers[layer_index]);
+	u32 index = y * layer.h_tiles + x;
+
+	bool destroyed = layer.tile_ids[index] >= map.first_gid && gid < map.first_gid;
+	previous_states.emplace_back(layer.tile_ids[index], (u16)x, (u16)y, layer.tile_health[index], (u16)layer_index);
+	layer.tile_ids[index] = gid;
+	layer.tile_health[index] = health;
+	change_log.emplace_back(gid, (u16)x, (u16)y, health, (u16)layer_index);
+
+	if (!destroyed)
+		return;
+
+	PROFILE_ZONE("MapDestruction destroy tile");
+	auto it = tile_shapes.find(get_tile_key(layer_index, x, y));
+	if (it != tile_shapes.end())
+	{
+		for (u32 i = it->second.first_shape; i < it->second.first_shape + it->second.shape_count; i++)
+		{
+			// The map body is static, there is no mass to update
+			b2DestroyShape(shapes[i], false);
+			shapes[i] = b2_nullShapeId;
+		}
+		destroyed_tile_shapes.insert(*it);
+		tile_shapes.erase(it);
+	}
+
+	map.remove_render_tile(layer_index, x, y);
+	destroyed_tiles++;
+}
+
+void MapDestruction::rewind(entt::registry& registry, entt::entity map_entity, u32 change_count)
+{
+	auto [map, destruction, physics] = registry.get<Map, MapDestruction, Physics>(map_entity);
+
+	// Newest first, every change is undone into the state it replaced
+	while (destruction.change_log.size() > change_count)
+	{
+		destruction.restore_tile(map, physics, destruction.previous_states.back());
+		destruction.change_log.pop_back();
+		destruction.previous_states.pop_back();
+	}
+}
+
+void MapDestruction::restore_tile(Map& map, Physics& physics, const MapTileChange& state)
+{
+	MapGridLayer& layer = std::get<MapGridLayer>(map.layers[state.layer]);
+	u32 index = state.y * layer.h_tiles + state.x;
+
+	bool rebuilt = layer.tile_ids[index] < map.first_gid && state.gid >= map.first_gid;
+	layer.tile_ids[index] = state.gid;
+	layer.tile_health[index] = state.health;
+
+	if (!rebuilt)
+		return;
+
+	auto it = destroyed_tile_shapes.find(get_tile_key(state.layer, state.x, state.y));
+	if (it != destroyed_tile_shapes.end())
+	{
+		for (u32 i = it->second.first_shape; i < it->second.first_shape + it->second.shape_count; i++)
+			shapes[i] = Map::create_physics_shape(physics, shape_geometry[i], first_shape_index + i);
+		tile_shapes.insert(*it);
+		destroyed_tile_shapes.erase(it);
+	}
+
+	map.add_render_tile(state.layer, state.x, state.y, state.gid);
+	destroyed_tiles--;
+}
+
+void MapDestruction::on_projectile_hit(entt::registry& registry, entt::entity other, glm::vec2 pos, u16 damage)
+{
+	if (damage == 0 || !registry.all_of<MapDestruction>(other))
+		return;
+
+	// The contact callbacks run during the contact dispatch, shapes are only destroyed at the sync point
+	registry.ctx().get<CommandBuffer>().invoke(other, [pos, damage](entt::registry& registry, entt::entity map_entity)
+		{
+			damage_tile_at(registry, map_entity, pos, damage);
+		});
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Map.h"
+
+#include "entt/entt.hpp"
+#include "box2d/box2d.h"
+
+#include <vector>
+#include <unordered_map>
+
+/// New state of a grid layer tile. A change holds the whole tile state, so applying it doesn't depend on the damage that caused it
+struct MapTileChange
+{
+	u32 gid;
+	u16 x, y;
+	u16 health;
+	u16 layer;
+};
+
+/// Destructible grid layer tiles of the map, the tiles whose tileset tile has health. Their collision shapes are kept out of the
+/// merged static shapes and created per tile on the map body, so destroying a tile only removes its own shapes and its render tile.
+/// Every change is appended to the change log: replication clients apply the changes of the server with apply_change, Navigation and
+/// Visibility recompute the area of the destroyed tiles.
+/// Created by Map::create_map_physics; streamed maps keep their destructible tiles static
+struct MapDestruction : NoCopy
+{
+	MapDestruction(Map& map, Physics& physics, const Tileset& tileset);
+
+	/// Damages the destructible tile with the shape closest to pos, if it is closer than a quarter tile; returns false if there is none
+	static bool damage_tile_at(entt::registry& registry, entt::entity map_entity, glm::vec2 pos, u16 damage);
+	/// Destroys the tile once its health is used up
+	static void damage_tile(entt::registry& registry, entt::entity map_entity, u32 layer_index, u32 x, u32 y, u16 damage);
+	/// Applies a change from the log of another MapDestruction of the same map; the changes must be applied in log order
+	static void apply_change(entt::registry& registry, entt::entity map_entity, const MapTileChange& change);
+
+	/// Records the damage of a projectile hit on other, applied at the next command flush. Does nothing if other has no MapDestruction
+	static void on_projectile_hit(entt::registry& registry, entt::entity other, glm::vec2 pos, u16 damage);
+
+	/// Undoes the changes after the first change_count of the log and removes them from it; destroyed tiles get new shapes and
+	/// their render tiles back. Used to restore a WorldSnapshot
+	static void rewind(entt::registry& registry, entt::entity map_entity, u32 change_count);
+
+	/// Index of a shape of the map body, kept in its user data: the static shapes in Map::collision_shapes order, then the
+	/// destructible tile shapes. Unlike the shape ids, the index doesn't depend on the order the tiles were destroyed and rewound
+	static u32 get_shape_index(b2ShapeId shape) { return (u32)reinterpret_cast<usz>(b2Shape_GetUserData(shape)); }
+
+	/// Grows for the lifetime of the map (unless rewound); consumers keep the index of the next change to apply
+	std::vector<MapTileChange> change_log;
+	u32 destructible_tiles;
+	u32 destroyed_tiles;
+
+private:
+	friend struct WorldSnapshot;
+
+	struct TileShapes
+	{
+		u32 first_shape;
+		u32 shape_count;
+	};
+
+	u32 get_tile_key(u32 layer_index, u32 x, u32 y) const { return (layer_index * v_tiles + y) * h_tiles + x; }
+	void set_tile(Map& map, u32 layer_index, u32 x, u32 y, u32 gid, u16 health);
+	/// Sets the tile back to an earlier state
+	void restore_tile(Map& map, Physics& physics, const MapTileChange& state);
+
+	u32 h_tiles, v_tiles;
+	/// Shapes can reach this many tiles past their tile
+	s32 search_tiles;
+	/// Shape index of shapes[0]
+	u32 first_shape_index;
+	std::vector<u32> grid_layers;
+	/// Destructible tiles that still have shapes
+	std::unordered_map<u32, TileShapes> tile_shapes;
+	/// Destroyed tiles, kept to create their shapes again when rewound
+	std::unordered_map<u32, TileShapes> destroyed_tile_shapes;
+	std::vector<b2ShapeId> shapes;
+	std::vector<MapCollisionShape> shape_geometry;
+	/// The state of the tile before each change of the log
+	std::vector<MapTileChange> previous_states;
+};
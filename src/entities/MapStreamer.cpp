@@ -0,0 +1,257 @@
+#include "MapStreamer.h"
+
+#include "Tank.h"
+#include "Projectile.h"
+#include "AnalyticProjectiles.h"
+#include "EntityPool.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Default load and unload distances in chunks
+const static f32 LOAD_DISTANCE_CHUNKS = 0.5f;
+const static f32 UNLOAD_DISTANCE_CHUNKS = 1.5f;
+// Projectiles keep the chunks along the way they fly in this many seconds loaded, so they don't pass through walls that
+// aren't loaded yet
+const static f32 PROJECTILE_LOOKAHEAD_TIME = 0.5f;
+
+static Rect grow_rect(const Rect& rect, f32 distance)
+{
+	return { rect.x - distance, rect.y - distance, rect.width + 2.0f * distance, rect.height + 2.0f * distance };
+}
+
+static Rect get_flight_rect(glm::vec2 pos, glm::vec2 velocity)
+{
+	glm::vec2 end = pos + velocity * PROJECTILE_LOOKAHEAD_TIME;
+	glm::vec2 min = glm::min(pos, end);
+	glm::vec2 max = glm::max(pos, end);
+	return { min.x, min.y, max.x - min.x, max.y - min.y };
+}
+
+MapStreamer::MapStreamer(Map& map, Tileset& tileset)
+	: tileset(&tileset),
+	h_chunks((map.h_tiles + CHUNK_SIZE - 1) / CHUNK_SIZE),
+	v_chunks((map.v_tiles + CHUNK_SIZE - 1) / CHUNK_SIZE),
+	chunk_world_size(CHUNK_SIZE * map.tile_size),
+	update_index(0),
+	chunk_loads(0), chunk_unloads(0),
+	resident_shapes(0), resident_render_tiles(0), resident_textures(0)
+{
+	PROFILE_ZONE("MapStreamer::MapStreamer");
+	load_distance = LOAD_DISTANCE_CHUNKS * chunk_world_size;
+	unload_distance = UNLOAD_DISTANCE_CHUNKS * chunk_world_size;
+
+	chunks.resize((usz)h_chunks * v_chunks);
+	for (u32 chunk_y = 0; chunk_y < v_chunks; chunk_y++)
+	{
+		for (u32 chunk_x = 0; chunk_x < h_chunks; chunk_x++)
+		{
+			u32 end_x = std::min((chunk_x + 1) * CHUNK_SIZE, map.h_tiles);
+			u32 end_y = std::min((chunk_y + 1) * CHUNK_SIZE, map.v_tiles);
+			chunks[chunk_y * h_chunks + chunk_x].bounds = {
+				chunk_x * chunk_world_size, chunk_y * chunk_world_size,
+				(end_x - chunk_x * CHUNK_SIZE) * map.tile_size, (end_y - chunk_y * CHUNK_SIZE) * map.tile_size };
+		}
+	}
+
+	for (u32 layer_index = 0; layer_index < map.layers.size(); layer_index++)
+	{
+		if (!std::holds_alternative<MapObjectLayer>(map.layers[layer_index]))
+			continue;
+
+		const MapObjectLayer& layer = std::get<MapObjectLayer>(map.layers[layer_index]);
+		for (u32 i = 0; i < layer.objects.size(); i++)
+		{
+			const MapObject& o = layer.objects[i];
+			u32 chunk_x = (u32)std::clamp(o.x / chunk_world_size, 0.0f, (f32)(h_chunks - 1));
+			u32 chunk_y = (u32)std::clamp(o.y / chunk_world_size, 0.0f, (f32)(v_chunks - 1));
+			chunks[chunk_y * h_chunks + chunk_x].objects.emplace_back(layer_index, i);
+		}
+	}
+
+	texture_users.resize(tileset.asset_count);
+}
+
+void MapStreamer::create_map_streamer(entt::registry& registry, entt::entity entity, Tileset& tileset)
+{
+	Map& map = registry.get<Map>(entity);
+	Physics& physics = registry.emplace<Physics>(entity, false);
+
+	std::vector<MapCollisionShape> border_shapes;
+	map.add_border_collision_shapes(border_shapes);
+	for (const MapCollisionShape& shape : border_shapes)
+		Map::create_physics_shape(physics, shape);
+
+	registry.emplace<MapStreamer>(entity, map, tileset);
+}
+
+template<typename F>
+void MapStreamer::for_each_chunk_in_rect(const Rect& rect, F&& fn)
+{
+	if (chunks.empty())
+		return;
+
+	f32 rec_chunk_size = 1.0f / chunk_world_size;
+	s32 begin_x = std::max((s32)std::floor(rect.x * rec_chunk_size), 0);
+	s32 begin_y = std::max((s32)std::floor(rect.y * rec_chunk_size), 0);
+	s32 end_x = std::min((s32)std::floor((rect.x + rect.width) * rec_chunk_size), (s32)h_chunks - 1);
+	s32 end_y = std::min((s32)std::floor((rect.y + rect.height) * rec_chunk_size), (s32)v_chunks - 1);
+
+	for (s32 y = begin_y; y <= end_y; y++)
+	{
+		for (s32 x = begin_x; x <= end_x; x++)
+			fn((u32)y * h_chunks + (u32)x);
+	}
+}
+
+void MapStreamer::load_chunk(Map& map, Physics& physics, u32 chunk_index)
+{
+	PROFILE_ZONE("MapStreamer::load_chunk");
+	MapStreamingChunk& chunk = chunks[chunk_index];
+	u32 begin_x = (chunk_index % h_chunks) * CHUNK_SIZE;
+	u32 begin_y = (chunk_index / h_chunks) * CHUNK_SIZE;
+	u32 end_x = std::min(begin_x + CHUNK_SIZE, map.h_tiles);
+	u32 end_y = std::min(begin_y + CHUNK_SIZE, map.v_tiles);
+
+	// Collision shapes are merged within the chunk only, so they never reach into another chunk
+	shape_scratch.clear();
+	map.add_tile_collision_shapes(*tileset, begin_x, begin_y, end_x, end_y, shape_scratch);
+	for (auto [layer_index, object_index] : chunk.objects)
+		map.add_object_collision_shapes(*tileset, std::get<MapObjectLayer>(map.layers[layer_index]).objects[object_index], shape_scratch);
+	map.merge_collision_shapes(shape_scratch);
+
+	for (const MapCollisionShape& shape : shape_scratch)
+		chunk.shapes.push_back(Map::create_physics_shape(physics, shape));
+
+	for (u32 layer_index = 0; layer_index < map.layers.size(); layer_index++)
+	{
+		if (!std::holds_alternative<MapGridLayer>(map.layers[layer_index]))
+			continue;
+
+		const MapGridLayer& layer = std::get<MapGridLayer>(map.layers[layer_index]);
+		MapRenderChunk render_layer = { chunk.bounds, layer_index, (u32)chunk.render_tiles.size(), 0 };
+		for (u32 y = begin_y; y < std::min(end_y, layer.v_tiles); y++)
+		{
+			for (u32 x = begin_x; x < std::min(end_x, layer.h_tiles); x++)
+			{
+				u32 gid = layer.tile_ids[y * layer.h_tiles + x];
+				if (gid < map.first_gid)
+					continue;
+
+				chunk.render_tiles.emplace_back((u16)x, (u16)y, gid);
+				chunk.tile_ids.push_back((gid & TILE_ID_MASK) - map.first_gid);
+			}
+		}
+
+		render_layer.tile_count = (u32)chunk.render_tiles.size() - render_layer.first_tile;
+		if (render_layer.tile_count != 0)
+			chunk.render_layers.push_back(render_layer);
+	}
+
+	for (auto [layer_index, object_index] : chunk.objects)
+	{
+		const MapObject& o = std::get<MapObjectLayer>(map.layers[layer_index]).objects[object_index];
+		if (o.gid >= map.first_gid)
+			chunk.tile_ids.push_back((o.gid & TILE_ID_MASK) - map.first_gid);
+	}
+
+	std::sort(chunk.tile_ids.begin(), chunk.tile_ids.end());
+	chunk.tile_ids.erase(std::unique(chunk.tile_ids.begin(), chunk.tile_ids.end()), chunk.tile_ids.end());
+	for (u32 tile_id : chunk.tile_ids)
+	{
+		if (texture_users[tile_id]++ == 0)
+			resident_textures++;
+	}
+
+	chunk.resident = true;
+	resident_chunks.push_back(chunk_index);
+	resident_shapes += (u32)chunk.shapes.size();
+	resident_render_tiles += (u32)chunk.render_tiles.size();
+	chunk_loads++;
+}
+
+void MapStreamer::unload_chunk(u32 chunk_index)
+{
+	PROFILE_ZONE("MapStreamer::unload_chunk");
+	MapStreamingChunk& chunk = chunks[chunk_index];
+
+	for (b2ShapeId shape : chunk.shapes)
+		b2DestroyShape(shape, false);
+
+	for (u32 tile_id : chunk.tile_ids)
+	{
+		if (--texture_users[tile_id] == 0)
+			resident_textures--;
+	}
+
+	resident_shapes -= (u32)chunk.shapes.size();
+	resident_render_tiles -= (u32)chunk.render_tiles.size();
+	chunk_unloads++;
+
+	// Release the memory, the chunk may not be needed again for a long time
+	chunk.shapes = {};
+	chunk.render_layers = {};
+	chunk.render_tiles = {};
+	chunk.tile_ids = {};
+	chunk.resident = false;
+}
+
+void MapStreamer::update_streaming(entt::registry& registry, std::span<const Rect> views)
+{
+	PROFILE_ZONE("MapStreamer::update_streaming");
+
+	for (auto [entity, map, physics, streamer] : registry.view<Map, Physics, MapStreamer>().each())
+	{
+		streamer.interest_rects.assign(views.begin(), views.end());
+		for (auto [tank_entity, controller, transform] : registry.view<TankController, Transform>().each())
+			streamer.interest_rects.push_back({ transform.pos.x, transform.pos.y, 0.0f, 0.0f });
+		for (auto [projectile_entity, projectile, transform, velocity] : registry.view<Projectile, Transform, Velocity>(entt::exclude<Pooled>).each())
+			streamer.interest_rects.push_back(get_flight_rect(transform.pos, velocity.linear));
+		if (const AnalyticProjectiles* analytic = registry.ctx().find<AnalyticProjectiles>())
+		{
+			for (u32 i = 0; i < analytic->size(); i++)
+				streamer.interest_rects.push_back(get_flight_rect(analytic->get_positions()[i], analytic->get_velocities()[i]));
+		}
+
+		u32 update = ++streamer.update_index;
+		for (const Rect& rect : streamer.interest_rects)
+		{
+			streamer.for_each_chunk_in_rect(grow_rect(rect, streamer.unload_distance), [&](u32 chunk_index)
+				{
+					streamer.chunks[chunk_index].keep_update = update;
+				});
+		}
+
+		for (usz i = 0; i < streamer.resident_chunks.size();)
+		{
+			u32 chunk_index = streamer.resident_chunks[i];
+			if (streamer.chunks[chunk_index].keep_update == update)
+			{
+				i++;
+				continue;
+			}
+
+			streamer.unload_chunk(chunk_index);
+			streamer.resident_chunks[i] = streamer.resident_chunks.back();
+			streamer.resident_chunks.pop_back();
+		}
+
+		for (const Rect& rect : streamer.interest_rects)
+		{
+			streamer.for_each_chunk_in_rect(grow_rect(rect, streamer.load_distance), [&](u32 chunk_index)
+				{
+					if (!streamer.chunks[chunk_index].resident)
+						streamer.load_chunk(map, physics, chunk_index);
+				});
+		}
+
+		PROFILE_COUNTER("resident map chunks", streamer.resident_chunks.size());
+		PROFILE_COUNTER("resident map shapes", streamer.resident_shapes);
+	}
+}
+
+MapStreamingStats MapStreamer::get_stats() const
+{
+	return { (u32)chunks.size(), (u32)resident_chunks.size(), resident_shapes, resident_render_tiles, resident_textures, chunk_loads, chunk_unloads };
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Map.h"
+
+#include "entt/entt.hpp"
+#include "box2d/box2d.h"
+
+#include <vector>
+#include <span>
+
+/// A square of CHUNK_SIZE tiles of a streamed map
+struct MapStreamingChunk
+{
+	/// World bounds of the chunk tiles
+	Rect bounds;
+	/// Objects whose position lies in the chunk, as (layer index, object index)
+	std::vector<std::pair<u32, u32>> objects;
+
+	bool resident = false;
+	/// Last update in which the chunk was within the unload distance of a view or tank
+	u32 keep_update = 0;
+
+	// Only filled while resident
+	std::vector<b2ShapeId> shapes;
+	/// Per grid layer ranges into render_tiles
+	std::vector<MapRenderChunk> render_layers;
+	std::vector<MapRenderTile> render_tiles;
+	/// Distinct tile ids used by the chunk; each counts as a texture user
+	std::vector<u32> tile_ids;
+};
+
+struct MapStreamingStats
+{
+	u32 chunks;
+	u32 resident_chunks;
+	u32 resident_shapes;
+	u32 resident_render_tiles;
+	/// Distinct tile textures used by the resident chunks
+	u32 resident_textures;
+	u64 chunk_loads;
+	u64 chunk_unloads;
+};
+
+/// Replaces the up front map physics and render tiles for maps too large to keep resident.
+/// The map is split into chunks of CHUNK_SIZE tiles whose collision shapes and render tiles are created when a view or a tank
+/// comes within load_distance and released once all are further away than unload_distance. The client keeps the textures of the
+/// tiles with texture users loaded (MapRenderable).
+/// The gap between both distances (hysteresis) keeps chunks on a border from loading and unloading every frame.
+/// The work per update only depends on the number of views, tanks and resident chunks, not on the size of the map.
+/// The tile ids of the grid layers stay resident, they are the source of the chunks
+/// !!! The tileset must outlive the MapStreamer
+struct MapStreamer : NoCopy
+{
+	MapStreamer(Map& map, Tileset& tileset);
+
+	/// Side length of a chunk in tiles
+	static const u32 CHUNK_SIZE = Map::RENDER_CHUNK_SIZE;
+
+	/// Creates the static map body with the border shapes and the MapStreamer; no chunk is loaded until update_streaming
+	static void create_map_streamer(entt::registry& registry, entt::entity entity, Tileset& tileset);
+
+	/// Loads the chunks near the views (camera bounding rects), the tanks and the way the projectiles fly and unloads the chunks
+	/// that got far enough away
+	static void update_streaming(entt::registry& registry, std::span<const Rect> views);
+
+	MapStreamingStats get_stats() const;
+
+	/// In world units around the views, tanks and projectiles
+	f32 load_distance;
+	f32 unload_distance;
+
+private:
+	friend struct MapRenderable;
+
+	void load_chunk(Map& map, Physics& physics, u32 chunk_index);
+	void unload_chunk(u32 chunk_index);
+
+	/// Calls fn(chunk_index) for every chunk intersecting the rect
+	template<typename F>
+	void for_each_chunk_in_rect(const Rect& rect, F&& fn);
+
+	Tileset* tileset;
+	u32 h_chunks, v_chunks;
+	f32 chunk_world_size;
+	std::vector<MapStreamingChunk> chunks;
+	std::vector<u32> resident_chunks;
+
+	/// Per tile id: the resident chunks using it
+	std::vector<u32> texture_users;
+
+	u32 update_index;
+	u64 chunk_loads, chunk_unloads;
+	u32 resident_shapes, resident_render_tiles, resident_textures;
+
+	/// Reused between updates and loads
+	std::vector<Rect> interest_rects;
+	std::vector<MapCollisionShape> shape_scratch;
+};
@@ -0,0 +1,882 @@
+#include "Navigation.h"
+
+#include "Components.h"
+#include "MapDestruction.h"
+#include "Tank.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+const static u32 UNREACHED = std::numeric_limits<u32>::max();
+// Costs of a straight and a diagonal step between cells
+const static u32 STRAIGHT_COST = 10;
+const static u32 DIAGONAL_COST = 14;
+// Entrances between clusters at least this long get a transition at both ends instead of one in the middle
+const static u32 LONG_ENTRANCE_LENGTH = 6;
+// Starts and goals inside blocked cells (e.g. a tank pushed against a wall) are moved up to this many cells
+const static u32 MAX_START_CORRECTION = 2 * NavGrid::CELLS_PER_TILE;
+// Waypoints checked ahead for line of sight when smoothing a path
+const static u32 SMOOTHING_LOOKAHEAD = 64;
+// Most recently used flow fields that are kept. Fields the agents used in the update are kept on top, so the
+// cache grows with the number of goals in use and fields still being built aren't evicted
+const static usz MAX_FLOW_FIELDS = 8;
+const static u32 DEFAULT_CELLS_PER_UPDATE = 20000;
+// Agents stop within this distance of the goal and advance to the next waypoint within WAYPOINT_DISTANCE, in world units
+const static f32 ARRIVE_DISTANCE = 0.5f;
+const static f32 WAYPOINT_DISTANCE = 0.4f;
+// Agents only drive forwards while their heading is within 60 degrees of the direction to the next waypoint
+const static f32 DRIVE_MIN_ALIGNMENT = 0.5f;
+const static f32 STEER_DEADZONE = 0.1f;
+
+const static s32 NEIGHBOUR_X[8] = { 1, -1, 0, 0, 1, 1, -1, -1 };
+const static s32 NEIGHBOUR_Y[8] = { 0, 0, 1, -1, 1, -1, 1, -1 };
+
+static u32 get_heuristic(glm::ivec2 a, glm::ivec2 b)
+{
+	u32 dx = (u32)std::abs(a.x - b.x);
+	u32 dy = (u32)std::abs(a.y - b.y);
+	return STRAIGHT_COST * std::max(dx, dy) + (DIAGONAL_COST - STRAIGHT_COST) * std::min(dx, dy);
+}
+
+/// Checks that the step to the neighbour stays on passable cells inside the bounds (x, y, end x, end y) and doesn't cut corners
+static bool can_step(const NavGrid& grid, glm::ivec2 cell, u32 neighbour, const glm::ivec4& bounds)
+{
+	s32 x = cell.x + NEIGHBOUR_X[neighbour];
+	s32 y = cell.y + NEIGHBOUR_Y[neighbour];
+	if (x < bounds.x || y < bounds.y || x >= bounds.z || y >= bounds.w || !grid.is_passable(x, y))
+		return false;
+
+	return neighbour < 4 || (grid.is_passable(x, cell.y) && grid.is_passable(cell.x, y));
+}
+
+static glm::ivec4 get_cluster_bounds(const NavGrid& grid, u32 cluster, u32 h_clusters)
+{
+	s32 x = (s32)((cluster % h_clusters) * NavHierarchy::CLUSTER_SIZE);
+	s32 y = (s32)((cluster / h_clusters) * NavHierarchy::CLUSTER_SIZE);
+	return { x, y, std::min(x + (s32)NavHierarchy::CLUSTER_SIZE, (s32)grid.width), std::min(y + (s32)NavHierarchy::CLUSTER_SIZE, (s32)grid.height) };
+}
+
+/// A* over the cells inside the bounds. Writes the path cells from start to goal if path is set
+static bool search_cells(const NavGrid& grid, NavSearch& search, glm::ivec2 start, glm::ivec2 goal, const glm::ivec4& bounds, u32& cost, std::vector<u32>* path)
+{
+	usz cell_count = (usz)grid.width * grid.height;
+	if (search.cost.size() != cell_count)
+	{
+		search.cost.assign(cell_count, 0);
+		search.parent.assign(cell_count, 0);
+		search.visited.assign(cell_count, 0);
+		search.closed.assign(cell_count, 0);
+		search.generation = 0;
+	}
+	if (++search.generation == 0)
+	{
+		std::fill(search.visited.begin(), search.visited.end(), 0);
+		std::fill(search.closed.begin(), search.closed.end(), 0);
+		search.generation = 1;
+	}
+	u32 generation = search.generation;
+
+	u32 start_index = start.y * grid.width + start.x;
+	u32 goal_index = goal.y * grid.width + goal.x;
+	search.open.clear();
+	search.cost[start_index] = 0;
+	search.parent[start_index] = start_index;
+	search.visited[start_index] = generation;
+	search.open.emplace_back(get_heuristic(start, goal), start_index);
+
+	while (!search.open.empty())
+	{
+		std::pop_heap(search.open.begin(), search.open.end(), std::greater<>());
+		u32 index = search.open.back().second;
+		search.open.pop_back();
+
+		if (search.closed[index] == generation)
+			continue;
+		search.closed[index] = generation;
+		search.expanded++;
+
+		if (index == goal_index)
+		{
+			cost = search.cost[index];
+			if (path)
+			{
+				path->clear();
+				for (u32 i = index; ; i = search.parent[i])
+				{
+					path->push_back(i);
+					if (i == start_index)
+						break;
+				}
+				std::reverse(path->begin(), path->end());
+			}
+			return true;
+		}
+
+		glm::ivec2 cell = { (s32)(index % grid.width), (s32)(index / grid.width) };
+		for (u32 n = 0; n < 8; n++)
+		{
+			if (!can_step(grid, cell, n, bounds))
+				continue;
+
+			glm::ivec2 next = { cell.x + NEIGHBOUR_X[n], cell.y + NEIGHBOUR_Y[n] };
+			u32 next_index = next.y * grid.width + next.x;
+			if (search.closed[next_index] == generation)
+				continue;
+
+			u32 next_cost = search.cost[index] + (n < 4 ? STRAIGHT_COST : DIAGONAL_COST);
+			if (search.visited[next_index] != generation || next_cost < search.cost[next_index])
+			{
+				search.visited[next_index] = generation;
+				search.cost[next_index] = next_cost;
+				search.parent[next_index] = index;
+				search.open.emplace_back(next_cost + get_heuristic(next, goal), next_index);
+				std::push_heap(search.open.begin(), search.open.end(), std::greater<>());
+			}
+		}
+	}
+	return false;
+}
+
+NavGrid::NavGrid(const Map& map, const Tileset& tileset, f32 agent_radius)
+	: width(map.h_tiles * CELLS_PER_TILE),
+	height(map.v_tiles * CELLS_PER_TILE),
+	cell_size(map.tile_size / CELLS_PER_TILE),
+	agent_radius(agent_radius),
+	blocked((usz)width * height, 0)
+{
+	PROFILE_ZONE("NavGrid::NavGrid");
+
+	std::vector<MapCollisionShape> shapes;
+	map.get_collision_shapes(tileset, shapes);
+	block_cells(shapes, glm::ivec2(0), glm::ivec2(width - 1, height - 1));
+}
+
+void NavGrid::update_tiles(const Map& map, const Tileset& tileset, glm::ivec2 begin, glm::ivec2 end)
+{
+	PROFILE_ZONE("NavGrid::update_tiles");
+
+	s32 margin_cells = (s32)std::ceil(agent_radius / cell_size);
+	glm::ivec2 min_cell = glm::max(begin * (s32)CELLS_PER_TILE - margin_cells, glm::ivec2(0));
+	glm::ivec2 max_cell = glm::min(end * (s32)CELLS_PER_TILE + margin_cells - 1, glm::ivec2(width - 1, height - 1));
+	for (s32 y = min_cell.y; y <= max_cell.y; y++)
+		std::fill(blocked.begin() + y * width + min_cell.x, blocked.begin() + y * width + max_cell.x + 1, 0);
+
+	// Tile shapes can reach a tile past their own tile
+	s32 margin_tiles = margin_cells / (s32)CELLS_PER_TILE + 2;
+	glm::ivec2 shape_begin = glm::max(begin - margin_tiles, glm::ivec2(0));
+	glm::ivec2 shape_end = glm::min(end + margin_tiles, glm::ivec2(map.h_tiles, map.v_tiles));
+
+	std::vector<MapCollisionShape> shapes;
+	map.add_border_collision_shapes(shapes);
+	map.add_tile_collision_shapes(tileset, shape_begin.x, shape_begin.y, shape_end.x, shape_end.y, shapes);
+	for (auto& variant : map.layers)
+	{
+		if (std::holds_alternative<MapObjectLayer>(variant))
+		{
+			for (const MapObject& o : std::get<MapObjectLayer>(variant).objects)
+				map.add_object_collision_shapes(tileset, o, shapes);
+		}
+	}
+	block_cells(shapes, min_cell, max_cell);
+}
+
+void NavGrid::block_cells(const std::vector<MapCollisionShape>& shapes, glm::ivec2 min_cell, glm::ivec2 max_cell)
+{
+	for (const MapCollisionShape& shape : shapes)
+	{
+		// Bounding circle of the shape grown by the agent radius
+		f32 reach = (shape.type == MapCollisionShapeType::Box ? glm::length(shape.half_size) : shape.radius) + agent_radius;
+		glm::ivec2 shape_min_cell = glm::max(to_cell(shape.center - reach), min_cell);
+		glm::ivec2 shape_max_cell = glm::min(to_cell(shape.center + reach), max_cell);
+
+		f32 s = std::sin(-shape.rotation);
+		f32 c = std::cos(-shape.rotation);
+		for (s32 y = shape_min_cell.y; y <= shape_max_cell.y; y++)
+		{
+			for (s32 x = shape_min_cell.x; x <= shape_max_cell.x; x++)
+			{
+				glm::vec2 offset = to_world({ x, y }) - shape.center;
+				f32 distance;
+				if (shape.type == MapCollisionShapeType::Box)
+				{
+					glm::vec2 local = { c * offset.x - s * offset.y, s * offset.x + c * offset.y };
+					distance = glm::length(glm::max(glm::abs(local) - shape.half_size, glm::vec2(0.0f)));
+				}
+				else
+				{
+					distance = glm::length(offset) - shape.radius;
+				}
+
+				if (distance < agent_radius)
+					blocked[y * width + x] = 1;
+			}
+		}
+	}
+}
+
+glm::ivec2 NavGrid::to_cell(glm::vec2 pos) const
+{
+	return glm::ivec2(glm::floor(pos / cell_size));
+}
+
+glm::vec2 NavGrid::to_world(glm::ivec2 cell) const
+{
+	return (glm::vec2(cell) + 0.5f) * cell_size;
+}
+
+bool NavGrid::find_nearest_passable(glm::ivec2& cell, u32 max_distance) const
+{
+	if (is_passable(cell.x, cell.y))
+		return true;
+
+	for (s32 distance = 1; distance <= (s32)max_distance; distance++)
+	{
+		for (s32 dy = -distance; dy <= distance; dy++)
+		{
+			// Only the ring at the distance
+			s32 step = (dy == -distance || dy == distance) ? 1 : 2 * distance;
+			for (s32 dx = -distance; dx <= distance; dx += step)
+			{
+				if (is_passable(cell.x + dx, cell.y + dy))
+				{
+					cell += glm::ivec2(dx, dy);
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+bool NavGrid::has_line_of_sight(glm::ivec2 from, glm::ivec2 to) const
+{
+	// Visits every cell the line touches; through an exact corner both side cells must be free
+	s32 dx = std::abs(to.x - from.x);
+	s32 dy = std::abs(to.y - from.y);
+	s32 step_x = to.x > from.x ? 1 : -1;
+	s32 step_y = to.y > from.y ? 1 : -1;
+	s32 error = dx - dy;
+	glm::ivec2 cell = from;
+
+	for (s32 n = 1 + dx + dy; n > 0; n--)
+	{
+		if (!is_passable(cell.x, cell.y))
+			return false;
+
+		if (error > 0)
+		{
+			cell.x += step_x;
+			error -= 2 * dy;
+		}
+		else if (error < 0)
+		{
+			cell.y += step_y;
+			error += 2 * dx;
+		}
+		else
+		{
+			if (n > 1 && (!is_passable(cell.x + step_x, cell.y) || !is_passable(cell.x, cell.y + step_y)))
+				return false;
+			cell += glm::ivec2(step_x, step_y);
+			error += 2 * dx - 2 * dy;
+			n--;
+		}
+	}
+	return true;
+}
+
+NavHierarchy::NavHierarchy(const NavGrid& grid)
+	: h_clusters((grid.width + CLUSTER_SIZE - 1) / CLUSTER_SIZE),
+	v_clusters((grid.height + CLUSTER_SIZE - 1) / CLUSTER_SIZE),
+	cluster_nodes((usz)h_clusters * v_clusters)
+{
+	PROFILE_ZONE("NavHierarchy::NavHierarchy");
+
+	for (u32 cluster_y = 0; cluster_y < v_clusters; cluster_y++)
+	{
+		for (u32 cluster_x = 0; cluster_x < h_clusters; cluster_x++)
+		{
+			s32 size = (s32)CLUSTER_SIZE;
+			s32 x = (s32)cluster_x * size;
+			s32 y = (s32)cluster_y * size;
+			if (cluster_x + 1 < h_clusters)
+				add_entrances(grid, { x + size - 1, y }, { 0, 1 }, { 1, 0 }, (u32)std::min(size, (s32)grid.height - y));
+			if (cluster_y + 1 < v_clusters)
+				add_entrances(grid, { x, y + size - 1 }, { 1, 0 }, { 0, 1 }, (u32)std::min(size, (s32)grid.width - x));
+		}
+	}
+
+	// Connect the nodes inside every cluster
+	NavSearch search;
+	for (u32 cluster = 0; cluster < cluster_nodes.size(); cluster++)
+	{
+		glm::ivec4 bounds = get_cluster_bounds(grid, cluster, h_clusters);
+		const std::vector<u32>& cluster_node_indices = cluster_nodes[cluster];
+		for (usz i = 0; i < cluster_node_indices.size(); i++)
+		{
+			for (usz j = i + 1; j < cluster_node_indices.size(); j++)
+			{
+				u32 a = cluster_node_indices[i];
+				u32 b = cluster_node_indices[j];
+				u32 cost;
+				if (search_cells(grid, search, nodes[a].cell, nodes[b].cell, bounds, cost, nullptr))
+				{
+					nodes[a].edges.emplace_back(b, cost);
+					nodes[b].edges.emplace_back(a, cost);
+				}
+			}
+		}
+	}
+	node_by_cell = {};
+}
+
+u32 NavHierarchy::get_or_add_node(glm::ivec2 cell, u32 grid_width)
+{
+	auto [it, inserted] = node_by_cell.try_emplace(cell.y * grid_width + cell.x, (u32)nodes.size());
+	if (inserted)
+	{
+		nodes.emplace_back(cell, get_cluster(cell), std::vector<Edge>());
+		cluster_nodes[nodes.back().cluster].push_back(it->second);
+	}
+	return it->second;
+}
+
+void NavHierarchy::add_transition(glm::ivec2 a, glm::ivec2 b, u32 grid_width)
+{
+	u32 node_a = get_or_add_node(a, grid_width);
+	u32 node_b = get_or_add_node(b, grid_width);
+	nodes[node_a].edges.emplace_back(node_b, STRAIGHT_COST);
+	nodes[node_b].edges.emplace_back(node_a, STRAIGHT_COST);
+}
+
+void NavHierarchy::add_entrances(const NavGrid& grid, glm::ivec2 border_start, glm::ivec2 step, glm::ivec2 across, u32 length)
+{
+	// Entrances are the runs of cells that are free on both sides of the border
+	u32 run_start = 0;
+	for (u32 i = 0; i <= length; i++)
+	{
+		glm::ivec2 cell = border_start + step * (s32)i;
+		bool free = i < length && grid.is_passable(cell.x, cell.y) && grid.is_passable(cell.x + across.x, cell.y + across.y);
+		if (free)
+			continue;
+
+		u32 run_length = i - run_start;
+		if (run_length >= LONG_ENTRANCE_LENGTH)
+		{
+			glm::ivec2 first = border_start + step * (s32)run_start;
+			glm::ivec2 last = border_start + step * (s32)(i - 1);
+			add_transition(first, first + across, grid.width);
+			add_transition(last, last + across, grid.width);
+		}
+		else if (run_length > 0)
+		{
+			glm::ivec2 middle = border_start + step * (s32)(run_start + run_length / 2);
+			add_transition(middle, middle + across, grid.width);
+		}
+		run_start = i + 1;
+	}
+}
+
+NavFlowField::NavFlowField(const NavGrid& grid, glm::ivec2 goal)
+	: goal(goal),
+	complete(false),
+	last_used(0),
+	cost((usz)grid.width * grid.height, UNREACHED)
+{
+	if (!grid.is_passable(goal.x, goal.y))
+	{
+		complete = true;
+		return;
+	}
+
+	u32 goal_index = goal.y * grid.width + goal.x;
+	cost[goal_index] = 0;
+	open.emplace_back(0, goal_index);
+}
+
+u32 NavFlowField::build(const NavGrid& grid, u32 budget)
+{
+	PROFILE_ZONE("NavFlowField::build");
+	glm::ivec4 bounds = { 0, 0, (s32)grid.width, (s32)grid.height };
+
+	u32 expanded = 0;
+	while (!open.empty() && expanded < budget)
+	{
+		std::pop_heap(open.begin(), open.end(), std::greater<>());
+		auto [index_cost, index] = open.back();
+		open.pop_back();
+
+		if (index_cost > cost[index])
+			continue;
+		expanded++;
+
+		glm::ivec2 cell = { (s32)(index % grid.width), (s32)(index / grid.width) };
+		for (u32 n = 0; n < 8; n++)
+		{
+			if (!can_step(grid, cell, n, bounds))
+				continue;
+
+			u32 next_index = (cell.y + NEIGHBOUR_Y[n]) * grid.width + cell.x + NEIGHBOUR_X[n];
+			u32 next_cost = index_cost + (n < 4 ? STRAIGHT_COST : DIAGONAL_COST);
+			if (next_cost < cost[next_index])
+			{
+				cost[next_index] = next_cost;
+				open.emplace_back(next_cost, next_index);
+				std::push_heap(open.begin(), open.end(), std::greater<>());
+			}
+		}
+	}
+
+	if (open.empty())
+	{
+		complete = true;
+		open = {};
+	}
+	return expanded;
+}
+
+glm::vec2 NavFlowField::get_direction(const NavGrid& grid, glm::ivec2 cell) const
+{
+	if (!grid.is_passable(cell.x, cell.y))
+		return glm::vec2(0.0f);
+
+	glm::ivec4 bounds = { 0, 0, (s32)grid.width, (s32)grid.height };
+	u32 best_cost = cost[cell.y * grid.width + cell.x];
+	s32 best_neighbour = -1;
+	for (u32 n = 0; n < 8; n++)
+	{
+		if (!can_step(grid, cell, n, bounds))
+			continue;
+
+		u32 next_cost = cost[(cell.y + NEIGHBOUR_Y[n]) * grid.width + cell.x + NEIGHBOUR_X[n]];
+		if (next_cost < best_cost)
+		{
+			best_cost = next_cost;
+			best_neighbour = (s32)n;
+		}
+	}
+
+	if (best_neighbour < 0)
+		return glm::vec2(0.0f);
+	return glm::normalize(glm::vec2((f32)NEIGHBOUR_X[best_neighbour], (f32)NEIGHBOUR_Y[best_neighbour]));
+}
+
+NavAgent::NavAgent(glm::vec2 goal, NavAgentMode mode)
+	: goal(goal), mode(mode), status(NavAgentStatus::Pending), queued(false), path(), path_index(0)
+{
+}
+
+void NavAgent::set_goal(glm::vec2 goal)
+{
+	this->goal = goal;
+	this->status = NavAgentStatus::Pending;
+	this->path.clear();
+	this->path_index = 0;
+}
+
+Navigation::Navigation(const Map& map, const Tileset& tileset, f32 agent_radius)
+	: cells_per_update(DEFAULT_CELLS_PER_UPDATE),
+	grid(map, tileset, agent_radius),
+	hierarchy(grid),
+	tileset(&tileset),
+	next_tile_change(0),
+	update_index(0)
+{
+}
+
+void Navigation::create_navigation(entt::registry& registry, entt::entity map_entity, const Tileset& tileset)
+{
+	PROFILE_ZONE("Navigation::create_navigation");
+	registry.ctx().emplace<Navigation>(registry.get<Map>(map_entity), tileset, get_tank_agent_radius());
+}
+
+f32 Navigation::get_tank_agent_radius()
+{
+	return Tank::get_hull_size().x * 0.5f;
+}
+
+bool Navigation::find_start_and_goal(glm::vec2 start, glm::vec2 goal, glm::ivec2& start_cell, glm::ivec2& goal_cell) const
+{
+	start_cell = grid.to_cell(start);
+	goal_cell = grid.to_cell(goal);
+	return grid.find_nearest_passable(start_cell, MAX_START_CORRECTION) && grid.find_nearest_passable(goal_cell, MAX_START_CORRECTION);
+}
+
+bool Navigation::append_cell_path(glm::ivec2 from, glm::ivec2 to, glm::ivec4 bounds)
+{
+	u32 cost;
+	if (!search_cells(grid, search, from, to, bounds, cost, &segment))
+		return false;
+
+	// The first cell is the last one of the previous segment
+	usz skip = cell_path.empty() ? 0 : 1;
+	cell_path.insert(cell_path.end(), segment.begin() + std::min(skip, segment.size()), segment.end());
+	return true;
+}
+
+bool Navigation::find_abstract_path(glm::ivec2 start_cell, glm::ivec2 goal_cell, std::vector<glm::ivec2>& waypoints)
+{
+	u32 start_cluster = hierarchy.get_cluster(start_cell);
+	u32 goal_cluster = hierarchy.get_cluster(goal_cell);
+
+	// Connect the start and the goal to the nodes of their clusters
+	start_edges.clear();
+	goal_edges.clear();
+	glm::ivec4 start_bounds = get_cluster_bounds(grid, start_cluster, hierarchy.h_clusters);
+	glm::ivec4 goal_bounds = get_cluster_bounds(grid, goal_cluster, hierarchy.h_clusters);
+	for (u32 node : hierarchy.cluster_nodes[start_cluster])
+	{
+		u32 cost;
+		if (search_cells(grid, search, start_cell, hierarchy.nodes[node].cell, start_bounds, cost, nullptr))
+			start_edges.emplace_back(node, cost);
+	}
+	for (u32 node : hierarchy.cluster_nodes[goal_cluster])
+	{
+		u32 cost;
+		if (search_cells(grid, search, hierarchy.nodes[node].cell, goal_cell, goal_bounds, cost, nullptr))
+			goal_edges.emplace_back(node, cost);
+	}
+	if (start_edges.empty() || goal_edges.empty())
+		return false;
+
+	// The start and goal nodes follow the hierarchy nodes
+	u32 start_node = (u32)hierarchy.nodes.size();
+	u32 goal_node = start_node + 1;
+	auto get_cell = [&](u32 node) { return node == start_node ? start_cell : (node == goal_node ? goal_cell : hierarchy.nodes[node].cell); };
+
+	abstract_cost.assign(goal_node + 1, UNREACHED);
+	abstract_parent.assign(goal_node + 1, start_node);
+	abstract_closed.assign(goal_node + 1, 0);
+	search.open.clear();
+	abstract_cost[start_node] = 0;
+	search.open.emplace_back(get_heuristic(start_cell, goal_cell), start_node);
+
+	auto relax = [&](u32 from, u32 to, u32 edge_cost)
+		{
+			u32 cost = abstract_cost[from] + edge_cost;
+			if (abstract_closed[to] || cost >= abstract_cost[to])
+				return;
+			abstract_cost[to] = cost;
+			abstract_parent[to] = from;
+			search.open.emplace_back(cost + get_heuristic(get_cell(to), goal_cell), to);
+			std::push_heap(search.open.begin(), search.open.end(), std::greater<>());
+		};
+
+	while (!search.open.empty())
+	{
+		std::pop_heap(search.open.begin(), search.open.end(), std::greater<>());
+		u32 node = search.open.back().second;
+		search.open.pop_back();
+
+		if (abstract_closed[node])
+			continue;
+		abstract_closed[node] = 1;
+		search.expanded++;
+
+		if (node == goal_node)
+		{
+			waypoints.clear();
+			for (u32 i = goal_node; ; i = abstract_parent[i])
+			{
+				waypoints.push_back(get_cell(i));
+				if (i == start_node)
+					break;
+			}
+			std::reverse(waypoints.begin(), waypoints.end());
+			return true;
+		}
+
+		if (node == start_node)
+		{
+			for (const NavHierarchy::Edge& edge : start_edges)
+				relax(node, edge.to, edge.cost);
+			continue;
+		}
+
+		for (const NavHierarchy::Edge& edge : hierarchy.nodes[node].edges)
+			relax(node, edge.to, edge.cost);
+		for (const NavHierarchy::Edge& edge : goal_edges)
+		{
+			if (edge.to == node)
+				relax(node, goal_node, edge.cost);
+		}
+	}
+	return false;
+}
+
+void Navigation::smooth_path(const std::vector<u32>& cells, std::vector<glm::vec2>& path) const
+{
+	path.clear();
+	auto get_cell = [&](usz i) { return glm::ivec2((s32)(cells[i] % grid.width), (s32)(cells[i] / grid.width)); };
+
+	// Skips the waypoints that can be reached in a straight line
+	usz last = cells.size() - 1;
+	usz i = 0;
+	while (i < last)
+	{
+		usz next = i + 1;
+		usz lookahead_end = std::min(last, i + SMOOTHING_LOOKAHEAD);
+		while (next < lookahead_end && grid.has_line_of_sight(get_cell(i), get_cell(next + 1)))
+			next++;
+
+		path.push_back(grid.to_world(get_cell(next)));
+		i = next;
+	}
+}
+
+bool Navigation::find_path(glm::vec2 start, glm::vec2 goal, std::vector<glm::vec2>& path)
+{
+	PROFILE_ZONE("Navigation::find_path");
+	path.clear();
+
+	glm::ivec2 start_cell, goal_cell;
+	if (!find_start_and_goal(start, goal, start_cell, goal_cell))
+		return false;
+
+	cell_path.clear();
+	u32 start_cluster = hierarchy.get_cluster(start_cell);
+	bool found = start_cluster == hierarchy.get_cluster(goal_cell) &&
+		append_cell_path(start_cell, goal_cell, get_cluster_bounds(grid, start_cluster, hierarchy.h_clusters));
+
+	if (!found)
+	{
+		if (!find_abstract_path(start_cell, goal_cell, waypoints))
+			return false;
+
+		// Refine: consecutive waypoints in one cluster are connected inside the cluster, the others are neighbouring border cells
+		for (usz i = 0; i + 1 < waypoints.size(); i++)
+		{
+			u32 cluster = hierarchy.get_cluster(waypoints[i]);
+			if (cluster == hierarchy.get_cluster(waypoints[i + 1]))
+			{
+				if (!append_cell_path(waypoints[i], waypoints[i + 1], get_cluster_bounds(grid, cluster, hierarchy.h_clusters)))
+					return false;
+			}
+			else
+			{
+				if (cell_path.empty())
+					cell_path.push_back(waypoints[i].y * grid.width + waypoints[i].x);
+				cell_path.push_back(waypoints[i + 1].y * grid.width + waypoints[i + 1].x);
+			}
+		}
+	}
+
+	smooth_path(cell_path, path);
+	return true;
+}
+
+bool Navigation::find_grid_path(glm::vec2 start, glm::vec2 goal, std::vector<glm::vec2>& path)
+{
+	PROFILE_ZONE("Navigation::find_grid_path");
+	path.clear();
+
+	glm::ivec2 start_cell, goal_cell;
+	if (!find_start_and_goal(start, goal, start_cell, goal_cell))
+		return false;
+
+	cell_path.clear();
+	if (!append_cell_path(start_cell, goal_cell, { 0, 0, (s32)grid.width, (s32)grid.height }))
+		return false;
+
+	smooth_path(cell_path, path);
+	return true;
+}
+
+NavFlowField& Navigation::get_flow_field(glm::vec2 goal)
+{
+	glm::ivec2 goal_cell = grid.to_cell(goal);
+	grid.find_nearest_passable(goal_cell, MAX_START_CORRECTION);
+	goal_cell = glm::clamp(goal_cell, glm::ivec2(0), glm::ivec2(grid.width - 1, grid.height - 1));
+	u32 key = goal_cell.y * grid.width + goal_cell.x;
+
+	auto it = flow_fields.find(key);
+	if (it == flow_fields.end())
+		it = flow_fields.emplace(key, std::make_unique<NavFlowField>(grid, goal_cell)).first;
+
+	it->second->last_used = update_index;
+	return *it->second;
+}
+
+void Navigation::evict_flow_fields()
+{
+	while (flow_fields.size() > MAX_FLOW_FIELDS)
+	{
+		auto oldest = std::min_element(flow_fields.begin(), flow_fields.end(), [](const auto& a, const auto& b) { return a.second->last_used < b.second->last_used; });
+		if (oldest->second->last_used == update_index)
+			break;
+		flow_fields.erase(oldest);
+	}
+}
+
+bool Navigation::apply_tile_changes(entt::registry& registry)
+{
+	auto maps = registry.view<Map, MapDestruction>();
+	if (maps.begin() == maps.end())
+		return false;
+	auto [map, destruction] = maps.get(*maps.begin());
+	u32 change_count = (u32)destruction.change_log.size();
+	if (change_count == next_tile_change)
+		return false;
+
+	PROFILE_ZONE("Navigation::apply_tile_changes");
+	bool changed = false;
+	if (change_count < next_tile_change)
+	{
+		// Rewound (see WorldSnapshot), which tiles came back isn't known anymore
+		grid.update_tiles(map, *tileset, glm::ivec2(0), glm::ivec2(map.h_tiles, map.v_tiles));
+		changed = true;
+	}
+	else
+	{
+		for (u32 i = next_tile_change; i < change_count; i++)
+		{
+			// Damage alone doesn't change the shapes
+			const MapTileChange& change = destruction.change_log[i];
+			if (change.gid >= map.first_gid)
+				continue;
+			glm::ivec2 tile = { change.x, change.y };
+			grid.update_tiles(map, *tileset, tile, tile + 1);
+			changed = true;
+		}
+	}
+	next_tile_change = change_count;
+	if (!changed)
+		return false;
+
+	hierarchy = NavHierarchy(grid);
+	flow_fields.clear();
+	return true;
+}
+
+static void steer_tank(TankInput& input, const Transform& transform, glm::vec2 direction)
+{
+	glm::vec2 forward_dir = { std::sin(transform.rot), -std::cos(transform.rot) };
+	f32 cross = forward_dir.x * direction.y - forward_dir.y * direction.x;
+	f32 alignment = glm::dot(forward_dir, direction);
+
+	input.forwards = alignment > DRIVE_MIN_ALIGNMENT;
+	input.right = cross > STEER_DEADZONE || (alignment < 0.0f && cross >= 0.0f);
+	input.left = cross < -STEER_DEADZONE || (alignment < 0.0f && cross < 0.0f);
+}
+
+void Navigation::update_agents(entt::registry& registry, f32 delta_time)
+{
+	if (!registry.ctx().contains<Navigation>())
+		return;
+
+	PROFILE_ZONE("Navigation::update_agents");
+	Navigation& navigation = registry.ctx().get<Navigation>();
+	navigation.update_index++;
+	navigation.search.expanded = 0;
+
+	auto agents = registry.view<NavAgent, Transform>();
+	if (navigation.apply_tile_changes(registry))
+	{
+		// A destroyed wall may open a way. Destroying only frees cells, so the paths of moving agents stay passable
+		// (a rewind restores the agents along with the map)
+		for (auto [entity, agent, transform] : agents.each())
+		{
+			if (agent.mode == NavAgentMode::Path && agent.status == NavAgentStatus::Unreachable)
+				agent.set_goal(agent.goal);
+		}
+	}
+	for (auto [entity, agent, transform] : agents.each())
+	{
+		if (agent.mode == NavAgentMode::Path && agent.status == NavAgentStatus::Pending && !agent.queued)
+		{
+			agent.queued = true;
+			navigation.queue.push_back(entity);
+		}
+	}
+
+	// Path queries in request order until the budget is used up
+	usz answered = 0;
+	{
+		PROFILE_ZONE("path queries");
+		while (answered < navigation.queue.size() && (answered == 0 || navigation.search.expanded < navigation.cells_per_update))
+		{
+			entt::entity entity = navigation.queue[answered++];
+			if (!registry.valid(entity) || !agents.contains(entity))
+				continue;
+
+			auto [agent, transform] = agents.get(entity);
+			agent.queued = false;
+			if (agent.mode != NavAgentMode::Path || agent.status != NavAgentStatus::Pending)
+				continue;
+
+			bool found = navigation.find_path(transform.pos, agent.goal, agent.path);
+			agent.path_index = 0;
+			agent.status = found ? NavAgentStatus::Moving : NavAgentStatus::Unreachable;
+		}
+		navigation.queue.erase(navigation.queue.begin(), navigation.queue.begin() + answered);
+	}
+
+	// Flow fields get the rest of the budget, but at least a quarter so they finish while queries are queued
+	{
+		PROFILE_ZONE("flow fields");
+		u32 used = navigation.search.expanded;
+		u32 flow_budget = std::max(navigation.cells_per_update > used ? navigation.cells_per_update - used : 0, navigation.cells_per_update / 4);
+		for (auto [entity, agent, transform] : agents.each())
+		{
+			if (agent.mode != NavAgentMode::FlowField)
+				continue;
+
+			NavFlowField& field = navigation.get_flow_field(agent.goal);
+			if (!field.complete && flow_budget > 0)
+				flow_budget -= std::min(flow_budget, field.build(navigation.grid, flow_budget));
+		}
+	}
+
+	for (auto [entity, agent, transform, controller] : registry.view<NavAgent, Transform, TankController>().each())
+	{
+		TankInput& input = controller.input;
+		input.forwards = input.backwards = input.left = input.right = false;
+
+		if (agent.status == NavAgentStatus::Arrived || agent.status == NavAgentStatus::Unreachable)
+			continue;
+
+		if (glm::distance(transform.pos, agent.goal) < ARRIVE_DISTANCE)
+		{
+			agent.status = NavAgentStatus::Arrived;
+			continue;
+		}
+
+		glm::vec2 direction(0.0f);
+		if (agent.mode == NavAgentMode::Path)
+		{
+			if (agent.status != NavAgentStatus::Moving)
+				continue;
+
+			while (agent.path_index < agent.path.size() && glm::distance(transform.pos, agent.path[agent.path_index]) < WAYPOINT_DISTANCE)
+				agent.path_index++;
+			glm::vec2 target = agent.path_index < agent.path.size() ? agent.path[agent.path_index] : agent.goal;
+			direction = glm::normalize(target - transform.pos);
+		}
+		else
+		{
+			NavFlowField& field = navigation.get_flow_field(agent.goal);
+			if (!field.complete)
+				continue;
+
+			glm::ivec2 cell = navigation.grid.to_cell(transform.pos);
+			bool inside = navigation.grid.is_passable(cell.x, cell.y);
+			if (inside && field.cost[cell.y * navigation.grid.width + cell.x] == UNREACHED)
+			{
+				agent.status = NavAgentStatus::Unreachable;
+				continue;
+			}
+
+			agent.status = NavAgentStatus::Moving;
+			direction = field.get_direction(navigation.grid, cell);
+			// In the goal cell or pushed into a blocked cell
+			if (direction == glm::vec2(0.0f))
+				direction = glm::normalize(agent.goal - transform.pos);
+		}
+
+		steer_tank(input, transform, direction);
+	}
+
+	navigation.evict_flow_fields();
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include "Map.h"
+
+#include "entt/entt.hpp"
+#include "glm/glm.hpp"
+
+#include <vector>
+#include <unordered_map>
+
+/// Passability of the map in cells of 1 / CELLS_PER_TILE tiles. A cell is blocked if its center is closer than
+/// the agent radius to a map collision shape, so paths over free cells keep the agent clear of the walls.
+/// The shapes aren't merged, so a cell only depends on the tiles around it
+struct NavGrid : NoCopy
+{
+	NavGrid(const Map& map, const Tileset& tileset, f32 agent_radius);
+
+	/// Recomputes the cells the tiles in [begin, end) can block, after they changed (see MapDestruction)
+	void update_tiles(const Map& map, const Tileset& tileset, glm::ivec2 begin, glm::ivec2 end);
+
+	static const u32 CELLS_PER_TILE = 4;
+
+	bool is_passable(s32 x, s32 y) const
+	{
+		return x >= 0 && y >= 0 && x < (s32)width && y < (s32)height && !blocked[y * width + x];
+	}
+
+	glm::ivec2 to_cell(glm::vec2 pos) const;
+	glm::vec2 to_world(glm::ivec2 cell) const;
+
+	/// Moves the cell to the closest passable cell within max_distance cells; returns false if there is none
+	bool find_nearest_passable(glm::ivec2& cell, u32 max_distance) const;
+
+	/// Checks that all cells touched by the line between the cell centers are passable
+	bool has_line_of_sight(glm::ivec2 from, glm::ivec2 to) const;
+
+	u32 width, height;
+	f32 cell_size;
+	f32 agent_radius;
+	std::vector<u8> blocked;
+
+private:
+	/// Blocks the cells in [min_cell, max_cell] the shapes are too close to
+	void block_cells(const std::vector<MapCollisionShape>& shapes, glm::ivec2 min_cell, glm::ivec2 max_cell);
+};
+
+/// Reusable state of a cell A* search; cells are marked with a search generation so nothing is cleared between searches
+struct NavSearch : NoCopy
+{
+	std::vector<u32> cost;
+	std::vector<u32> parent;
+	std::vector<u32> visited;
+	std::vector<u32> closed;
+	std::vector<std::pair<u32, u32>> open;
+	u32 generation = 0;
+	/// Cells expanded since the last reset by the caller; used as the work budget
+	u32 expanded = 0;
+};
+
+/// Abstract graph of the grid for hierarchical A* (HPA*): the grid is split into square clusters, neighbouring clusters
+/// are connected through transition nodes on their shared border and the nodes of a cluster are connected with the
+/// cost of the shortest path between them inside the cluster
+struct NavHierarchy : NoCopy
+{
+	NavHierarchy(const NavGrid& grid);
+
+	/// Side length of a cluster in cells
+	static const u32 CLUSTER_SIZE = 16;
+
+	struct Edge
+	{
+		u32 to;
+		u32 cost;
+	};
+
+	struct Node
+	{
+		glm::ivec2 cell;
+		u32 cluster;
+		std::vector<Edge> edges;
+	};
+
+	u32 get_cluster(glm::ivec2 cell) const { return (cell.y / CLUSTER_SIZE) * h_clusters + cell.x / CLUSTER_SIZE; }
+
+	u32 h_clusters, v_clusters;
+	std::vector<Node> nodes;
+	std::vector<std::vector<u32>> cluster_nodes;
+
+private:
+	u32 get_or_add_node(glm::ivec2 cell, u32 grid_width);
+	void add_transition(glm::ivec2 a, glm::ivec2 b, u32 grid_width);
+	void add_entrances(const NavGrid& grid, glm::ivec2 border_start, glm::ivec2 step, glm::ivec2 across, u32 length);
+
+	std::unordered_map<u32, u32> node_by_cell;
+};
+
+/// Integrated cost from every cell to a goal cell (Dijkstra), built incrementally over several updates.
+/// Any number of agents heading to the goal follow the descending cost without an own search
+struct NavFlowField : NoCopy
+{
+	NavFlowField(const NavGrid& grid, glm::ivec2 goal);
+
+	/// Expands up to budget cells; returns the number of expanded cells
+	u32 build(const NavGrid& grid, u32 budget);
+
+	/// Direction to the neighbour cell with the lowest cost; zero if the cell is unreachable or the goal
+	glm::vec2 get_direction(const NavGrid& grid, glm::ivec2 cell) const;
+
+	glm::ivec2 goal;
+	bool complete;
+	u32 last_used;
+	std::vector<u32> cost;
+
+private:
+	std::vector<std::pair<u32, u32>> open;
+};
+
+enum class NavAgentMode : u8
+{
+	/// Own hierarchical A* path
+	Path = 0,
+	/// Shared flow field of the goal; for many agents heading to the same goal
+	FlowField = 1
+};
+
+enum class NavAgentStatus : u8
+{
+	Pending = 0,
+	Moving = 1,
+	Arrived = 2,
+	Unreachable = 3
+};
+
+/// Drives the TankController input of the entity to the goal. Path queries and flow field builds are amortized over updates
+struct NavAgent
+{
+	NavAgent(glm::vec2 goal, NavAgentMode mode = NavAgentMode::Path);
+
+	void set_goal(glm::vec2 goal);
+
+	glm::vec2 goal;
+	NavAgentMode mode;
+	NavAgentStatus status;
+	bool queued;
+	std::vector<glm::vec2> path;
+	u32 path_index;
+};
+
+/// Navigation of the map; one instance lives in the registry context once created with create_navigation.
+/// Follows the MapDestruction change log: the cells around destroyed tiles are recomputed at the next update_agents,
+/// which also rebuilds the hierarchy and drops the flow fields
+struct Navigation : NoCopy
+{
+	Navigation(const Map& map, const Tileset& tileset, f32 agent_radius);
+
+	/// Navigation for tanks (see get_tank_agent_radius) in the registry context
+	static void create_navigation(entt::registry& registry, entt::entity map_entity, const Tileset& tileset);
+
+	/// Tanks mostly drive along the path, so the clearance is half the hull width
+	static f32 get_tank_agent_radius();
+
+	/// Hierarchical A* path as smoothed world waypoints (excluding the start); returns false if the goal is unreachable
+	bool find_path(glm::vec2 start, glm::vec2 goal, std::vector<glm::vec2>& path);
+	/// Plain A* over the whole grid; the reference for find_path
+	bool find_grid_path(glm::vec2 start, glm::vec2 goal, std::vector<glm::vec2>& path);
+
+	/// Gets the cached flow field to the goal cell or starts building it (see update_agents)
+	NavFlowField& get_flow_field(glm::vec2 goal);
+
+	/// Answers queued path queries and builds flow fields until the budget is used up, then steers the agents
+	static void update_agents(entt::registry& registry, f32 delta_time);
+
+	/// Cells expanded per update by path queries and flow field builds; at least one query is answered per update
+	u32 cells_per_update;
+
+	NavGrid grid;
+	NavHierarchy hierarchy;
+
+private:
+	friend struct WorldSnapshot;
+
+	bool find_start_and_goal(glm::vec2 start, glm::vec2 goal, glm::ivec2& start_cell, glm::ivec2& goal_cell) const;
+	/// Abstract A* over the hierarchy nodes with the start and goal connected to the nodes of their clusters
+	bool find_abstract_path(glm::ivec2 start_cell, glm::ivec2 goal_cell, std::vector<glm::ivec2>& waypoints);
+	/// Appends the cells of a path inside the bounds to cell_path
+	bool append_cell_path(glm::ivec2 from, glm::ivec2 to, glm::ivec4 bounds);
+	void smooth_path(const std::vector<u32>& cells, std::vector<glm::vec2>& path) const;
+	/// Drops the least recently used flow fields beyond MAX_FLOW_FIELDS that weren't used in this update
+	void evict_flow_fields();
+	/// Updates the grid for the changes of the map since next_tile_change; returns true if tiles were destroyed or rewound
+	bool apply_tile_changes(entt::registry& registry);
+
+	const Tileset* tileset;
+	/// Index of the next change of the MapDestruction change log
+	u32 next_tile_change;
+
+	NavSearch search;
+	std::vector<u32> cell_path;
+	std::vector<u32> segment;
+	std::vector<glm::ivec2> waypoints;
+	std::vector<u32> abstract_cost;
+	std::vector<u32> abstract_parent;
+	std::vector<u8> abstract_closed;
+	std::vector<NavHierarchy::Edge> start_edges;
+	std::vector<NavHierarchy::Edge> goal_edges;
+	std::unordered_map<u32, std::unique_ptr<NavFlowField>> flow_fields;
+	std::vector<entt::entity> queue;
+	u32 update_index;
+};
@@ -1,76 +1,331 @@
 #include "Particle.h"
 
+#include "EntityPool.h"
+#include "SystemScheduler.h"
+#include "engine/Memory.h"
+#include "engine/Profiler.h"
+#include "engine/util/MathUtil.h"
+
 #include <filesystem>
+#include <charconv>
+#include <algorithm>
+#include <cmath>
+
+static const u32 MAX_FRAMES = 256;
+// Particles per job of the parallel update; smaller pools are advanced on the calling thread
+static const u32 PARTICLE_CHUNK_SIZE = 4096;
+
+void ParticleEffect::load_effect(std::unique_ptr<ParticleEffect>& data_ptr, const std::string& location)
+{
+	u32 frame_count = find_frames(location);
+	if (frame_count == 0)
+		throw std::runtime_error("No textures found in: " + location);
+
+	data_ptr.reset(new ParticleEffect{ frame_count });
+}
+
+u32 ParticleEffect::find_frames(const std::string& location, const std::function<void(const char* path)>& on_frame)
+{
+	// All frame paths are built in one scratch string: the location prefix stays, only the file name is replaced
+	ScratchScope scratch;
+	ArenaString frame_location(location, scratch.allocator<char>());
+	frame_location += '/';
+	usz prefix_length = frame_location.size();
+
+	u32 frame_count = 0;
+	for (; frame_count < MAX_FRAMES; frame_count++)
+	{
+		char number[16];
+		std::to_chars_result number_end = std::to_chars(number, number + sizeof(number), frame_count + 1);
+		frame_location.resize(prefix_length);
+		frame_location.append(number, number_end.ptr);
+		frame_location += ".png";
+
+		if (!std::filesystem::exists(std::string_view(frame_location)))
+			break;
+		if (on_frame)
+			on_frame(frame_location.c_str());
+	}
+	return frame_count;
+}
 
-static const u32 MAX_TEXTURES = 256;
+u32 ParticleEmitters::add(const ParticleEmitter& emitter)
+{
+	if (count == MAX_EMITTERS)
+		throw std::runtime_error("Too many particle emitters on one entity");
+	emitters[count] = emitter;
+	return count++;
+}
+
+void ParticleEmitters::trigger(u32 index)
+{
+	emitters[index].pending_bursts++;
+}
 
-ParticleTextures::ParticleTextures(u32 count)
-	: textures(std::make_unique<Texture[]>(count)), texture_count(count)
+void ParticleEmitters::trigger(entt::registry& registry, entt::entity entity, u32 index)
 {
+	if (ParticleEmitters* emitters = registry.try_get<ParticleEmitters>(entity))
+		emitters->trigger(index);
+	if (ParticleEvents* events = registry.ctx().find<ParticleEvents>())
+		events->record_trigger(entity, index);
 }
 
+ParticleSystem::Pool::Pool(Asset<ParticleEffect>& effect, u32 capacity)
+	: effect(&effect), loaded_effect(effect.loaded()), frame_count(loaded_effect.get().frame_count), size(0),
+	pos_x(new f32[capacity]), pos_y(new f32[capacity]),
+	velocity_x(new f32[capacity]), velocity_y(new f32[capacity]),
+	rot(new f32[capacity]), angular_velocity(new f32[capacity]),
+	scale(new f32[capacity]),
+	frames_per_second(new f32[capacity]),
+	animation_time(new f32[capacity])
+{
+}
 
-Particle::Particle(Asset<ParticleTextures>& asset, f32 scale, f32 frames_per_second)
-	: textures_asset(asset.loaded()), scale(scale), frames_per_second(frames_per_second), animation_time(0.0f)
+void ParticleSystem::Pool::add(const ParticleSpawn& spawn)
 {
+	pos_x[size] = spawn.pos.x;
+	pos_y[size] = spawn.pos.y;
+	velocity_x[size] = spawn.velocity.x;
+	velocity_y[size] = spawn.velocity.y;
+	rot[size] = spawn.rot;
+	angular_velocity[size] = spawn.angular_velocity;
+	scale[size] = spawn.scale;
+	frames_per_second[size] = spawn.frames_per_second;
+	animation_time[size] = 0.0f;
+	size++;
 }
 
-entt::entity Particle::create(entt::registry& registry, Asset<ParticleTextures>& asset, Transform transform, f32 frames_per_second, f32 scale)
+void ParticleSystem::Pool::advance(u32 begin, u32 end, f32 delta_time)
 {
-	entt::entity entity = registry.create();
-	registry.emplace<Transform>(entity, transform);
-	registry.emplace<Particle>(entity, asset, scale, frames_per_second);
+	// One loop per array pair without branches, so the compiler vectorizes them
+	f32* __restrict px = pos_x.get();
+	f32* __restrict py = pos_y.get();
+	const f32* __restrict vx = velocity_x.get();
+	const f32* __restrict vy = velocity_y.get();
+	for (u32 i = begin; i < end; i++)
+		px[i] += vx[i] * delta_time;
+	for (u32 i = begin; i < end; i++)
+		py[i] += vy[i] * delta_time;
+
+	f32* __restrict r = rot.get();
+	const f32* __restrict av = angular_velocity.get();
+	for (u32 i = begin; i < end; i++)
+		r[i] += av[i] * delta_time;
 
-	return entity;
+	f32* __restrict t = animation_time.get();
+	const f32* __restrict fps = frames_per_second.get();
+	for (u32 i = begin; i < end; i++)
+		t[i] += fps[i] * delta_time;
 }
 
-void Particle::load_textures(std::unique_ptr<ParticleTextures>& data_ptr, const std::string& location)
+void ParticleSystem::Pool::remove_finished()
 {
-	u32 texture_count = 0;
-	for (; texture_count < MAX_TEXTURES; texture_count++)
+	f32 end_time = (f32)frame_count;
+	u32 kept = 0;
+	for (u32 i = 0; i < size; i++)
 	{
-		std::string texture_location = location + "/" + std::to_string(texture_count + 1) + ".png";
-		if (!std::filesystem::exists(texture_location))
-			break;
+		if (animation_time[i] >= end_time)
+			continue;
+
+		if (kept != i)
+		{
+			pos_x[kept] = pos_x[i];
+			pos_y[kept] = pos_y[i];
+			velocity_x[kept] = velocity_x[i];
+			velocity_y[kept] = velocity_y[i];
+			rot[kept] = rot[i];
+			angular_velocity[kept] = angular_velocity[i];
+			scale[kept] = scale[i];
+			frames_per_second[kept] = frames_per_second[i];
+			animation_time[kept] = animation_time[i];
+		}
+		kept++;
 	}
+	size = kept;
+}
 
-	if (texture_count == 0)
-		throw std::runtime_error("No textures found in: " + location);
+ParticleSystem::ParticleSystem(u32 pool_capacity)
+	: pool_capacity(pool_capacity), spawned(0), dropped(0), random_state(0x9E3779B9u)
+{
+}
+
+void ParticleSystem::create_particle_system(entt::registry& registry, u32 pool_capacity)
+{
+	registry.ctx().emplace<ParticleSystem>(pool_capacity);
+}
+
+void ParticleSystem::spawn(entt::registry& registry, Asset<ParticleEffect>& effect, Transform transform, f32 frames_per_second, f32 scale, glm::vec2 velocity)
+{
+	ParticleSpawn spawn = { transform.pos, transform.rot, scale, frames_per_second, velocity, 0.0f };
+	if (ParticleSystem* particles = registry.ctx().find<ParticleSystem>())
+		particles->spawn(effect, spawn);
+	if (ParticleEvents* events = registry.ctx().find<ParticleEvents>())
+		events->record_spawn(effect, spawn);
+}
 
-	data_ptr.reset(new ParticleTextures(texture_count));
+bool ParticleSystem::is_active(const entt::registry& registry)
+{
+	return registry.ctx().contains<ParticleSystem>() || registry.ctx().contains<ParticleEvents>();
+}
 
-	for (u32 i = 0; i < texture_count; i++)
+void ParticleSystem::spawn(Asset<ParticleEffect>& effect, const ParticleSpawn& spawn)
+{
+	std::lock_guard lock(queue_mutex);
+	queue.emplace_back(&effect, spawn);
+}
+
+ParticleSystem::Pool& ParticleSystem::get_pool(Asset<ParticleEffect>& effect)
+{
+	for (std::unique_ptr<Pool>& pool : pools)
 	{
-		std::string texture_location = location + "/" + std::to_string(i + 1) + ".png";
-		data_ptr->textures[i].store_buffer(TextureBuffer(texture_location.c_str()));
+		if (pool->effect == &effect)
+			return *pool;
 	}
+
+	PROFILE_ZONE("ParticleSystem create pool");
+	pools.push_back(std::make_unique<Pool>(effect, pool_capacity));
+	return *pools.back();
+}
+
+f32 ParticleSystem::random_signed()
+{
+	// xorshift32; the particles only need to look random
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return (f32)(random_state >> 8) * (2.0f / (f32)(1 << 24)) - 1.0f;
 }
 
-void Particle::update_animations(entt::registry& registry, f32 delta_time)
+void ParticleSystem::add_queued()
 {
-	for (auto [entity, particle] : registry.view<Particle>().each())
 	{
-		particle.animation_time += particle.frames_per_second * delta_time;
-		if ((u32)particle.animation_time >= particle.textures_asset.get().texture_count)
+		std::lock_guard lock(queue_mutex);
+		std::swap(queue, adding);
+	}
+
+	for (const QueuedSpawn& queued : adding)
+	{
+		Pool& pool = get_pool(*queued.effect);
+		if (pool.size == pool_capacity)
 		{
-			registry.destroy(entity);
+			dropped++;
+			continue;
 		}
+		pool.add(queued.spawn);
+		spawned++;
 	}
+	adding.clear();
 }
 
-void Particle::render_particles(entt::registry& registry, Graphics& graphics)
+void ParticleSystem::run_emitters(entt::registry& registry, f32 delta_time)
 {
-	for (auto [entity, particle_transform, particle] : registry.view<Transform, Particle>().each())
+	for (auto [entity, emitters, transform] : registry.view<ParticleEmitters, Transform>(entt::exclude<Pooled>).each())
 	{
-		ImageTransform transform = graphics.create_transform();
-		transform.translate(particle_transform.pos.x, particle_transform.pos.y);
-		transform.rotate(particle_transform.rot);
-		transform.scale(particle.scale);
+		const Velocity* entity_velocity = registry.try_get<Velocity>(entity);
+		f32 speed = entity_velocity ? glm::length(entity_velocity->linear) : 0.0f;
 
-		u32 image_index = (u32)particle.animation_time;
-		if (image_index < particle.textures_asset.get().texture_count)
+		for (u32 i = 0; i < emitters.count; i++)
 		{
-			graphics.draw_image(particle.textures_asset.get().textures[image_index], transform);
+			ParticleEmitter& emitter = emitters.emitters[i];
+			if (!emitter.enabled)
+			{
+				emitter.pending_bursts = 0;
+				continue;
+			}
+
+			u32 count = 0;
+			if (emitter.mode == ParticleEmitterMode::Burst)
+			{
+				count = emitter.pending_bursts * (u32)emitter.rate;
+				emitter.pending_bursts = 0;
+			}
+			else
+			{
+				f32 rate = emitter.rate;
+				if (emitter.full_rate_speed > 0.0f)
+					rate *= std::min(speed / emitter.full_rate_speed, 1.0f);
+				emitter.accumulator += rate * delta_time;
+				count = (u32)emitter.accumulator;
+				emitter.accumulator -= (f32)count;
+			}
+			if (count == 0)
+				continue;
+
+			Pool& pool = get_pool(*emitter.effect);
+			glm::vec2 pos = transform.pos + MathUtil::rotate(emitter.offset, transform.rot);
+			u32 added = std::min(count, pool_capacity - pool.size);
+			for (u32 j = 0; j < added; j++)
+			{
+				f32 angle = transform.rot + emitter.spread * random_signed();
+				glm::vec2 velocity = MathUtil::rotate(emitter.velocity, angle);
+				pool.add({ pos, transform.rot + emitter.rot, emitter.scale, emitter.frames_per_second, velocity, 0.0f });
+			}
+			spawned += added;
+			dropped += count - added;
 		}
 	}
-}
\ No newline at end of file
+}
+
+void ParticleSystem::update_particles(entt::registry& registry, f32 delta_time)
+{
+	if (!registry.ctx().contains<ParticleSystem>())
+		return;
+
+	ParticleSystem& particles = registry.ctx().get<ParticleSystem>();
+	ThreadPool* thread_pool = registry.ctx().contains<SystemScheduler>() ? registry.ctx().get<SystemScheduler>().get_thread_pool() : nullptr;
+
+	particles.add_queued();
+	particles.run_emitters(registry, delta_time);
+
+	for (std::unique_ptr<Pool>& pool : particles.pools)
+	{
+		if (thread_pool)
+			thread_pool->parallel_for(pool->size, PARTICLE_CHUNK_SIZE, [&](u32 begin, u32 end) { pool->advance(begin, end, delta_time); });
+		else
+			pool->advance(0, pool->size, delta_time);
+		pool->remove_finished();
+	}
+
+	PROFILE_COUNTER("particles", particles.size());
+	PROFILE_COUNTER("particles dropped", particles.dropped);
+}
+
+u32 ParticleSystem::size() const
+{
+	u32 size = 0;
+	for (const std::unique_ptr<Pool>& pool : pools)
+		size += pool->size;
+	return size;
+}
+
+void ParticleSystem::clear()
+{
+	{
+		std::lock_guard lock(queue_mutex);
+		queue.clear();
+	}
+	for (std::unique_ptr<Pool>& pool : pools)
+		pool->size = 0;
+}
+
+void ParticleEvents::record_spawn(Asset<ParticleEffect>& effect, const ParticleSpawn& spawn)
+{
+	std::lock_guard lock(mutex);
+	spawns.emplace_back(&effect, spawn);
+}
+
+void ParticleEvents::record_trigger(entt::entity entity, u32 emitter)
+{
+	std::lock_guard lock(mutex);
+	triggers.emplace_back(entity, emitter);
+}
+
+void ParticleEvents::take(std::vector<Spawn>& spawns_out, std::vector<Trigger>& triggers_out)
+{
+	spawns_out.clear();
+	triggers_out.clear();
+	std::lock_guard lock(mutex);
+	// Swapping keeps the capacity of both sides, steady recording doesn't allocate
+	std::swap(spawns, spawns_out);
+	std::swap(triggers, triggers_out);
+}
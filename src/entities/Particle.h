@@ -4,26 +4,183 @@
 #include "engine/Asset.h"
 #include "entt/entt.hpp"
 
-struct ParticleTextures
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+/// A flipbook animation stored as the numbered images 1.png, 2.png, ... in a directory. The simulation only needs the frame count;
+/// the client loads the images as ParticleTextures
+struct ParticleEffect
 {
-	ParticleTextures(u32 count);
+	u32 frame_count;
+
+	static void load_effect(std::unique_ptr<ParticleEffect>& data_ptr, const std::string& location);
+	/// Returns the number of frames in the effect directory and calls on_frame with the path of each frame in order
+	static u32 find_frames(const std::string& location, const std::function<void(const char* path)>& on_frame = nullptr);
+};
 
-	std::unique_ptr<Texture[]> textures;
-	u32 texture_count;
+/// Initial state of a particle. A particle lives until its animation played once
+struct ParticleSpawn
+{
+	glm::vec2 pos;
+	f32 rot;
+	f32 scale;
+	f32 frames_per_second;
+	glm::vec2 velocity;
+	f32 angular_velocity;
 };
 
-struct Particle
+enum class ParticleEmitterMode : u8
 {
-	Particle(Asset<ParticleTextures>& asset, f32 scale, f32 frames_per_second);
+	/// Emits rate particles at once every time the emitter is triggered
+	Burst = 0,
+	/// Emits rate particles per second
+	Continuous = 1
+};
 
-	AssetRef<ParticleTextures> textures_asset;
+/// Emits particles relative to the Transform of its entity. Offset, velocity and rotation are local to the entity
+struct ParticleEmitter
+{
+	Asset<ParticleEffect>* effect;
+	ParticleEmitterMode mode;
+	f32 rate;
+	glm::vec2 offset;
+	glm::vec2 velocity;
+	/// Random angle (radians) up to this much either way is added to the velocity direction
+	f32 spread;
+	f32 rot;
 	f32 scale;
 	f32 frames_per_second;
-	f32 animation_time;
+	/// Continuous emitters scale the rate with the speed of the entity (Velocity) up to this speed; 0 always emits at the full rate
+	f32 full_rate_speed = 0.0f;
+	bool enabled = true;
+
+	// Managed by the ParticleSystem
+	f32 accumulator = 0.0f;
+	u32 pending_bursts = 0;
+};
+
+/// Particle emitters of an entity. Emitters of pooled entities are paused
+struct ParticleEmitters
+{
+	const static u32 MAX_EMITTERS = 4;
+
+	/// Returns the index of the emitter
+	u32 add(const ParticleEmitter& emitter);
+	/// Emits a burst at the next update
+	void trigger(u32 index);
+	/// Triggers the emitter of the entity if it has emitters and records the trigger in the ParticleEvents (if any)
+	static void trigger(entt::registry& registry, entt::entity entity, u32 index);
+
+	Array<ParticleEmitter, MAX_EMITTERS> emitters;
+	u32 count = 0;
+};
+
+/// All particles of a World, in one pool per effect. A pool stores its particles as structure of arrays and holds
+/// the only reference to the effect, so spawning a particle is a few stores and the update loops are plain loops over float arrays.
+/// Every pool has a fixed capacity; spawns into a full pool are dropped and counted.
+/// Spawning is thread safe: spawns are queued and join the pools at the next update.
+/// Particles are visual only: the ParticleSystem is created by whoever renders the World (the client, benchmarks); without one
+/// spawns are ignored and emitters are not added
+struct ParticleSystem : NoCopy
+{
+	ParticleSystem(u32 pool_capacity);
+
+	/// Creates the ParticleSystem in the registry context
+	static void create_particle_system(entt::registry& registry, u32 pool_capacity = DEFAULT_POOL_CAPACITY);
+
+	/// Queues a particle of the ParticleSystem in the registry context, if there is one, and records it in the ParticleEvents (if any)
+	static void spawn(entt::registry& registry, Asset<ParticleEffect>& effect, Transform transform, f32 frames_per_second, f32 scale = 1.0f, glm::vec2 velocity = glm::vec2(0.0f));
+	void spawn(Asset<ParticleEffect>& effect, const ParticleSpawn& spawn);
+
+	/// Adds the queued particles, runs the emitters and advances all particles; particles whose animation ended are removed
+	static void update_particles(entt::registry& registry, f32 delta_time);
 
-	static entt::entity create(entt::registry& registry, Asset<ParticleTextures>& asset, Transform transform, f32 frames_per_second, f32 scale = 1.0f);
-	static void load_textures(std::unique_ptr<ParticleTextures>& data_ptr, const std::string& location);
-	static void update_animations(entt::registry& registry, f32 delta_time);
-	static void render_particles(entt::registry& registry, Graphics& graphics);
+	/// Whether spawns and triggers have any effect: the registry context has a ParticleSystem or records ParticleEvents
+	static bool is_active(const entt::registry& registry);
 
-};
\ No newline at end of file
+	/// Live particles of all pools
+	u32 size() const;
+	void clear();
+
+	u32 pool_capacity;
+	u64 spawned;
+	u64 dropped;
+
+	const static u32 DEFAULT_POOL_CAPACITY = 16384;
+
+private:
+	friend struct ParticleRenderer;
+
+	struct Pool : NoCopy
+	{
+		Pool(Asset<ParticleEffect>& effect, u32 capacity);
+
+		void add(const ParticleSpawn& spawn);
+		/// Advances the particles [begin, end)
+		void advance(u32 begin, u32 end, f32 delta_time);
+		/// Removes the particles whose animation ended; keeps the order of the others
+		void remove_finished();
+
+		Asset<ParticleEffect>* effect;
+		AssetRef<ParticleEffect> loaded_effect;
+		u32 frame_count;
+		u32 size;
+
+		std::unique_ptr<f32[]> pos_x, pos_y;
+		std::unique_ptr<f32[]> velocity_x, velocity_y;
+		std::unique_ptr<f32[]> rot, angular_velocity;
+		std::unique_ptr<f32[]> scale;
+		std::unique_ptr<f32[]> frames_per_second;
+		std::unique_ptr<f32[]> animation_time;
+	};
+
+	struct QueuedSpawn
+	{
+		Asset<ParticleEffect>* effect;
+		ParticleSpawn spawn;
+	};
+
+	Pool& get_pool(Asset<ParticleEffect>& effect);
+	void add_queued();
+	void run_emitters(entt::registry& registry, f32 delta_time);
+	/// Random value in [-1, 1]
+	f32 random_signed();
+
+	std::vector<std::unique_ptr<Pool>> pools;
+
+	std::mutex queue_mutex;
+	std::vector<QueuedSpawn> queue;
+	std::vector<QueuedSpawn> adding;
+
+	u32 random_state;
+};
+
+/// The one-shot particles and emitter triggers of the simulation, recorded while the registry context has one.
+/// A server has no ParticleSystem; it records the events and replicates them to the clients, which replay them into theirs.
+/// Recording is thread safe
+struct ParticleEvents : NoCopy
+{
+	struct Spawn
+	{
+		Asset<ParticleEffect>* effect;
+		ParticleSpawn spawn;
+	};
+
+	struct Trigger
+	{
+		entt::entity entity;
+		u32 emitter;
+	};
+
+	void record_spawn(Asset<ParticleEffect>& effect, const ParticleSpawn& spawn);
+	void record_trigger(entt::entity entity, u32 emitter);
+	/// Moves the recorded events into the vectors (which are cleared first)
+	void take(std::vector<Spawn>& spawns_out, std::vector<Trigger>& triggers_out);
+
+private:
+	std::mutex mutex;
+	std::vector<Spawn> spawns;
+	std::vector<Trigger> triggers;
+};
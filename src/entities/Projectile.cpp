@@ -1,10 +1,14 @@
 #include "Projectile.h"
 
 #include "CollisionCategory.h"
+#include "MapDestruction.h"
 #include "Particle.h"
+#include "Tank.h"
+#include "SpatialHash.h"
+#include "EntityPool.h"
+#include "CommandBuffer.h"
 #include "AssetManager.h"
 #include "engine/util/MathUtil.h"
-#include <stack>
 
 const static glm::vec2 PROJECTILE_HITBOXES[8] =
 {
@@ -18,24 +22,17 @@ const static glm::vec2 PROJECTILE_HITBOXES[8] =
 	{ 0.08f, 0.4f }
 };
 
-static std::stack<entt::entity> remove_projectiles;
-
 Projectile::Projectile(entt::entity entity, entt::entity shooter_entity, const ProjectileType& type)
 	: entity(entity), shooter_entity(shooter_entity), fix_orientation(type.fix_orientation), max_collisions(type.max_collisons), collision_count(0), 
-	just_spawned(true), in_tank_spawn(false), fix_velocity(type.fix_velocity), initial_velocity(type.velocity), particle_type(type.particle_type)
+	just_spawned(true), in_tank_spawn(false), fix_velocity(type.fix_velocity), initial_velocity(type.velocity), tile_damage(type.tile_damage), particle_type(type.particle_type),
+	sprite_type(type.sprite_type), scale(type.scale)
 {
 }
 
 entt::entity Projectile::create_projectile(entt::registry& registry, entt::entity shooter_entity, const ProjectileType& type, glm::vec2 pos, f32 rot)
 {
-	u8 type_index = static_cast<u8>(type.sprite_type);
-
 	glm::vec2 velocity = MathUtil::rotate({ 0.0f, -type.velocity }, rot);
 
-	entt::entity entity = registry.create();
-	registry.emplace<Transform>(entity, pos, rot);
-	registry.emplace<Velocity>(entity, velocity, 0.0f);
-
 	b2ShapeDef shape_def = b2DefaultShapeDef();
 	shape_def.density = type.density;
 	shape_def.material.friction = 0.3f;
@@ -45,36 +42,83 @@ entt::entity Projectile::create_projectile(entt::registry& registry, entt::entit
 	if (!type.allow_projectile_collision)
 		shape_def.filter.maskBits &= ~CATEGORY_PROJECTILE;
 
-	b2Polygon hitbox = b2MakeBox(PROJECTILE_HITBOXES[type_index].x * type.scale * 0.5f, PROJECTILE_HITBOXES[type_index].y * type.scale * 0.5f);
-	b2ShapeCastInput input = { 0 };
+	glm::vec2 hitbox_size = get_hitbox(type);
+	b2Polygon hitbox = b2MakeBox(hitbox_size.x * 0.5f, hitbox_size.y * 0.5f);
+
+	bool recycled;
+	entt::entity entity = registry.ctx().get<EntityPools>().projectiles.acquire(registry, recycled);
+	if (registry.ctx().contains<ParticleSystem>())
+		add_smoke_trail(registry, entity, type);
+
+	if (recycled)
+	{
+		// Reset the components in place and reuse the disabled body with its shape
+		registry.get<Transform>(entity) = { pos, rot };
+		registry.get<Velocity>(entity) = { velocity, 0.0f };
+		registry.get<Projectile>(entity) = Projectile(entity, shooter_entity, type);
+
+		Physics& physics = registry.get<Physics>(entity);
+		b2ShapeId shape;
+		b2Body_GetShapes(physics.body, &shape, 1);
+		b2Shape_SetPolygon(shape, &hitbox);
+		b2Shape_SetDensity(shape, shape_def.density, false);
+		b2Shape_SetRestitution(shape, shape_def.material.restitution);
+		b2Shape_SetFilter(shape, shape_def.filter);
+
+		b2Body_SetTransform(physics.body, b2Vec2(pos.x, pos.y), b2MakeRot(rot));
+		b2Body_SetLinearVelocity(physics.body, b2Vec2(velocity.x, velocity.y));
+		b2Body_SetAngularVelocity(physics.body, 0.0f);
+		b2Body_Enable(physics.body);
+		b2Body_ApplyMassFromShapes(physics.body);
+		return entity;
+	}
+
+	registry.emplace<Transform>(entity, pos, rot);
+	registry.emplace<Velocity>(entity, velocity, 0.0f);
+	registry.emplace<SpatialHashed>(entity, CATEGORY_PROJECTILE);
 
 	Physics& physics = registry.emplace<Physics>(entity, true);
 	physics.create_polygon_shape(shape_def, hitbox);
 	b2Body_SetBullet(physics.body, true);
 	b2Body_SetAngularDamping(physics.body, 0.2f);
 
-	// registry.emplace<ProjectileRenderable>(entity, assets.projectile_textures[type_index].loaded(), type.scale);
-	Projectile& projectile = registry.emplace<Projectile>(entity, entity, shooter_entity, type);
+	registry.emplace<Projectile>(entity, entity, shooter_entity, type);
 
 	return entity;
 }
 
-void Projectile::create_projectile_renderable(entt::registry& registry, entt::entity projectile, const ProjectileType& type)
+void Projectile::release_projectile(entt::registry& registry, entt::entity projectile)
 {
-	registry.emplace<ProjectileRenderable>(projectile, AssetManager::get_instance().projectile_textures[static_cast<usz>(type.sprite_type)].loaded(), type.scale);
+	b2Body_Disable(registry.get<Physics>(projectile).body);
+	registry.remove<ParticleEmitters>(projectile);
+	registry.ctx().get<EntityPools>().projectiles.release(registry, projectile);
 }
 
-void Projectile::update_projectiles(entt::registry& registry)
+void Projectile::prewarm_pool(entt::registry& registry, u32 count)
 {
-	while (!remove_projectiles.empty())
-	{
-		entt::entity projectile = remove_projectiles.top();
-		remove_projectiles.pop();
+	std::vector<entt::entity> entities;
+	entities.reserve(count);
+	for (u32 i = 0; i < count; i++)
+		entities.push_back(create_projectile(registry, entt::null, ProjectileType(), glm::vec2(0.0f), 0.0f));
+	for (entt::entity entity : entities)
+		release_projectile(registry, entity);
+}
 
-		registry.destroy(projectile);
-	}
+glm::vec2 Projectile::get_hitbox(const ProjectileType& type)
+{
+	return PROJECTILE_HITBOXES[static_cast<u8>(type.sprite_type)] * type.scale;
+}
+
+void Projectile::add_smoke_trail(entt::registry& registry, entt::entity projectile, const ProjectileType& type)
+{
+	ParticleEmitters& emitters = registry.emplace_or_replace<ParticleEmitters>(projectile);
+	emitters.add({ &AssetManager::get_instance().particle_smoke, ParticleEmitterMode::Continuous, 30.0f,
+		{ 0.0f, get_hitbox(type).y * 0.5f }, glm::vec2(0.0f), 0.0f, 0.0f, 0.15f * type.scale, 20.0f });
+}
 
-	for (auto [entity, projectile, transform, velocity] : registry.view<Projectile, Transform, Velocity>().each())
+void Projectile::update_projectiles(entt::registry& registry)
+{
+	for (auto [entity, projectile, transform, velocity] : registry.view<Projectile, Transform, Velocity>(entt::exclude<Pooled>).each())
 	{
 		projectile.just_spawned = false;
 		if (projectile.fix_orientation)
@@ -101,16 +145,22 @@ void Projectile::on_collision_begin(entt::registry& registry, entt::entity proje
 	}
 	else
 	{
+		MapDestruction::on_projectile_hit(registry, other, pos, projectile.tile_damage);
+
+		Tank::trigger_hit_particles(registry, other);
+
 		projectile.collision_count++;
 		if (projectile.collision_count > projectile.max_collisions)
 		{
-			remove_projectiles.push(projectile_entity);
-
-			if (registry.all_of<ProjectileRenderable>(projectile_entity))
-			{
-				f32 rot = registry.get<Transform>(projectile_entity).rot;
-				Particle::create(registry, AssetManager::get_instance().particle_impact[projectile.particle_type], Transform { pos, rot }, 10.0f, 0.5f);
-			}
+			registry.ctx().get<CommandBuffer>().invoke(projectile_entity, [](entt::registry& registry, entt::entity projectile)
+				{
+					// A projectile can be queued by several contacts in the same step
+					if (!registry.all_of<Pooled>(projectile))
+						release_projectile(registry, projectile);
+				});
+
+			f32 rot = registry.get<Transform>(projectile_entity).rot;
+			ParticleSystem::spawn(registry, AssetManager::get_instance().particle_impact[projectile.particle_type], Transform { pos, rot }, 10.0f, 0.5f);
 		}
 	}
 }
@@ -126,12 +176,4 @@ void Projectile::on_collision_end(entt::registry& registry, entt::entity project
 			return;
 		}
 	}
-}
-
-void ProjectileRenderable::render_projectiles(entt::registry& registry, Graphics& graphics)
-{
-	for (auto [entity, transform, renderable] : registry.view<Transform, ProjectileRenderable>().each())
-	{
-		renderable.render(graphics, transform);
-	}
 }
\ No newline at end of file
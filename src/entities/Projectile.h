@@ -25,10 +25,14 @@ struct ProjectileType
 	f32 density = 1000;
 	f32 scale = 1.0f;
 	u16 max_collisons = 0;
+	/// Damage to destructible map tiles per hit (see MapDestruction)
+	u16 tile_damage = 1;
 	u8 particle_type = 0;
 	bool fix_orientation = false;
 	bool fix_velocity = true;
 	bool allow_projectile_collision = true;
+	/// Non-physical rounds have no entity or body and are simulated by casts (see AnalyticProjectiles)
+	bool analytic = false;
 };
 
 struct Projectile
@@ -44,17 +48,21 @@ struct Projectile
 	bool in_tank_spawn;
 	u16 max_collisions;
 	u16 collision_count;
+	u16 tile_damage;
 	u8 particle_type;
+	ProjectileSpriteType sprite_type;
+	f32 scale;
 
 	static entt::entity create_projectile(entt::registry& registry, entt::entity shooter_entity, const ProjectileType& type, glm::vec2 pos, f32 rot);
-	static void create_projectile_renderable(entt::registry& registry, entt::entity projectile, const ProjectileType& type);
+	/// Returns the projectile to the projectile pool; its body is disabled until the entity is reused
+	static void release_projectile(entt::registry& registry, entt::entity projectile);
+	/// Fills the projectile pool so the first shots don't create bodies
+	static void prewarm_pool(entt::registry& registry, u32 count);
+	static glm::vec2 get_hitbox(const ProjectileType& type);
+	/// Smoke trail behind the projectile; added to every projectile if the World has a ParticleSystem
+	static void add_smoke_trail(entt::registry& registry, entt::entity projectile, const ProjectileType& type);
 
 	static void update_projectiles(entt::registry& registry);
 	static void on_collision_begin(entt::registry&, entt::entity projectile, entt::entity other, glm::vec2 pos, glm::vec2 normal);
 	static void on_collision_end(entt::registry&, entt::entity projectile, entt::entity other);
-};
-
-struct ProjectileRenderable : SimpleSpriteRenderable
-{
-	static void render_projectiles(entt::registry& registry, Graphics& graphics);
 };
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include "SpatialHash.h"
+
+#include "Components.h"
+#include "EntityPool.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+
+const static u32 INVALID_BUCKET = ~0u;
+
+SpatialHashed::SpatialHashed(u64 category)
+	: category(category), cell(0), bucket(INVALID_BUCKET), slot(0)
+{
+}
+
+void SpatialQueryResults::clear()
+{
+	offsets.clear();
+	entities.clear();
+}
+
+SpatialHash::SpatialHash(f32 cell_size)
+	: cell_size(cell_size), rec_cell_size(1.0f / cell_size), entity_count(0), min_cell(0), max_cell(-1)
+{
+}
+
+void SpatialHash::create_spatial_hash(entt::registry& registry, f32 cell_size)
+{
+	registry.ctx().emplace<SpatialHash>(cell_size);
+	registry.on_destroy<SpatialHashed>().connect<&SpatialHash::on_destroy_hashed>();
+	registry.on_construct<Pooled>().connect<&SpatialHash::on_construct_pooled>();
+}
+
+glm::ivec2 SpatialHash::get_cell(glm::vec2 pos) const
+{
+	return glm::ivec2(glm::floor(pos * rec_cell_size));
+}
+
+glm::ivec2 SpatialHash::get_bounded_cell(glm::vec2 pos) const
+{
+	return glm::ivec2(glm::clamp(glm::floor(pos * rec_cell_size), glm::vec2(min_cell), glm::vec2(max_cell)));
+}
+
+const std::vector<SpatialHash::Entry>* SpatialHash::find_bucket(glm::ivec2 cell) const
+{
+	auto it = bucket_by_cell.find(get_cell_key(cell));
+	return it == bucket_by_cell.end() ? nullptr : &buckets[it->second];
+}
+
+void SpatialHash::insert(entt::entity entity, SpatialHashed& hashed, glm::vec2 pos)
+{
+	glm::ivec2 cell = get_cell(pos);
+	auto [it, inserted] = bucket_by_cell.try_emplace(get_cell_key(cell), (u32)buckets.size());
+	if (inserted)
+		buckets.emplace_back();
+
+	std::vector<Entry>& bucket = buckets[it->second];
+	hashed.cell = cell;
+	hashed.bucket = it->second;
+	hashed.slot = (u32)bucket.size();
+	bucket.emplace_back(pos, hashed.category, entity);
+
+	entity_count++;
+	if (max_cell.x < min_cell.x)
+	{
+		min_cell = cell;
+		max_cell = cell;
+	}
+	min_cell = glm::min(min_cell, cell);
+	max_cell = glm::max(max_cell, cell);
+}
+
+void SpatialHash::remove(entt::registry& registry, SpatialHashed& hashed)
+{
+	// Swap with the last entry to keep the bucket packed
+	std::vector<Entry>& bucket = buckets[hashed.bucket];
+	if (hashed.slot + 1 != bucket.size())
+	{
+		bucket[hashed.slot] = bucket.back();
+		registry.get<SpatialHashed>(bucket[hashed.slot].entity).slot = hashed.slot;
+	}
+	bucket.pop_back();
+
+	hashed.bucket = INVALID_BUCKET;
+	entity_count--;
+}
+
+void SpatialHash::on_destroy_hashed(entt::registry& registry, entt::entity entity)
+{
+	SpatialHashed& hashed = registry.get<SpatialHashed>(entity);
+	if (hashed.bucket != INVALID_BUCKET)
+		registry.ctx().get<SpatialHash>().remove(registry, hashed);
+}
+
+void SpatialHash::on_construct_pooled(entt::registry& registry, entt::entity entity)
+{
+	SpatialHashed* hashed = registry.try_get<SpatialHashed>(entity);
+	if (hashed && hashed->bucket != INVALID_BUCKET)
+		registry.ctx().get<SpatialHash>().remove(registry, *hashed);
+}
+
+void SpatialHash::update(entt::registry& registry)
+{
+	SpatialHash& hash = registry.ctx().get<SpatialHash>();
+	u32 moved = 0;
+
+	for (auto [entity, hashed, transform] : registry.view<SpatialHashed, Transform>(entt::exclude<Pooled>).each())
+	{
+		if (hashed.bucket == INVALID_BUCKET)
+		{
+			hash.insert(entity, hashed, transform.pos);
+			continue;
+		}
+
+		if (hash.get_cell(transform.pos) == hashed.cell)
+		{
+			Entry& entry = hash.buckets[hashed.bucket][hashed.slot];
+			entry.pos = transform.pos;
+			entry.category = hashed.category;
+			continue;
+		}
+
+		hash.remove(registry, hashed);
+		hash.insert(entity, hashed, transform.pos);
+		moved++;
+	}
+
+	PROFILE_COUNTER("spatial hash entities", hash.entity_count);
+	PROFILE_COUNTER("spatial hash cell changes", moved);
+}
+
+void SpatialHash::query_radius(glm::vec2 center, f32 radius, u64 category_mask, std::vector<entt::entity>& result) const
+{
+	if (entity_count == 0)
+		return;
+
+	glm::ivec2 begin = get_bounded_cell(center - radius);
+	glm::ivec2 end = get_bounded_cell(center + radius);
+	f32 radius_sq = radius * radius;
+
+	for (s32 y = begin.y; y <= end.y; y++)
+	{
+		for (s32 x = begin.x; x <= end.x; x++)
+		{
+			const std::vector<Entry>* bucket = find_bucket({ x, y });
+			if (!bucket)
+				continue;
+
+			for (const Entry& entry : *bucket)
+			{
+				glm::vec2 offset = entry.pos - center;
+				if ((entry.category & category_mask) && glm::dot(offset, offset) <= radius_sq)
+					result.push_back(entry.entity);
+			}
+		}
+	}
+}
+
+void SpatialHash::query_rect(const Rect& rect, u64 category_mask, std::vector<entt::entity>& result) const
+{
+	glm::vec2 min = { rect.x, rect.y };
+	glm::vec2 max = { rect.x + rect.width, rect.y + rect.height };
+	if (entity_count == 0)
+		return;
+
+	glm::ivec2 begin = get_bounded_cell(min);
+	glm::ivec2 end = get_bounded_cell(max);
+
+	for (s32 y = begin.y; y <= end.y; y++)
+	{
+		for (s32 x = begin.x; x <= end.x; x++)
+		{
+			const std::vector<Entry>* bucket = find_bucket({ x, y });
+			if (!bucket)
+				continue;
+
+			for (const Entry& entry : *bucket)
+			{
+				if ((entry.category & category_mask) && entry.pos.x >= min.x && entry.pos.y >= min.y && entry.pos.x <= max.x && entry.pos.y <= max.y)
+					result.push_back(entry.entity);
+			}
+		}
+	}
+}
+
+void SpatialHash::query_nearest(glm::vec2 pos, u32 count, f32 max_radius, u64 category_mask, std::vector<entt::entity>& result, entt::entity ignore) const
+{
+	if (count == 0 || entity_count == 0)
+		return;
+
+	thread_local std::vector<std::pair<f32, entt::entity>> candidates;
+	candidates.clear();
+
+	glm::ivec2 center = get_cell(pos);
+	f32 max_radius_sq = max_radius * max_radius;
+	s32 max_ring = std::max({ center.x - min_cell.x, max_cell.x - center.x, center.y - min_cell.y, max_cell.y - center.y });
+	// Clamped in floats: an unbounded query (FLT_MAX or infinite radius) doesn't fit into an s32
+	f32 radius_rings = std::ceil(max_radius * rec_cell_size) + 1.0f;
+	if (radius_rings < (f32)max_ring)
+		max_ring = (s32)radius_rings;
+
+	auto visit_cell = [&](glm::ivec2 cell)
+		{
+			const std::vector<Entry>* bucket = find_bucket(cell);
+			if (!bucket)
+				return;
+
+			for (const Entry& entry : *bucket)
+			{
+				glm::vec2 offset = entry.pos - pos;
+				f32 distance_sq = glm::dot(offset, offset);
+				if ((entry.category & category_mask) && entry.entity != ignore && distance_sq <= max_radius_sq)
+					candidates.emplace_back(distance_sq, entry.entity);
+			}
+		};
+
+	// Rings of cells around the center cell. After ring r everything closer than r cells has been visited
+	for (s32 ring = 0; ring <= max_ring; ring++)
+	{
+		for (s32 y = -ring; y <= ring; y++)
+		{
+			if (y == -ring || y == ring)
+			{
+				for (s32 x = -ring; x <= ring; x++)
+					visit_cell(center + glm::ivec2(x, y));
+			}
+			else
+			{
+				visit_cell(center + glm::ivec2(-ring, y));
+				visit_cell(center + glm::ivec2(ring, y));
+			}
+		}
+
+		if (candidates.size() >= count)
+		{
+			std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end());
+			f32 covered = ring * cell_size;
+			if (candidates[count - 1].first <= covered * covered)
+				break;
+		}
+	}
+
+	usz result_count = std::min<usz>(count, candidates.size());
+	std::partial_sort(candidates.begin(), candidates.begin() + result_count, candidates.end());
+	for (usz i = 0; i < result_count; i++)
+		result.push_back(candidates[i].second);
+}
+
+void SpatialHash::query_radius(std::span<const SpatialRadiusQuery> queries, SpatialQueryResults& results) const
+{
+	PROFILE_ZONE("SpatialHash::query_radius");
+	results.clear();
+	results.offsets.push_back(0);
+	for (const SpatialRadiusQuery& query : queries)
+	{
+		query_radius(query.center, query.radius, query.category_mask, results.entities);
+		results.offsets.push_back((u32)results.entities.size());
+	}
+}
+
+void SpatialHash::query_nearest(std::span<const SpatialNearestQuery> queries, SpatialQueryResults& results) const
+{
+	PROFILE_ZONE("SpatialHash::query_nearest");
+	results.clear();
+	results.offsets.push_back(0);
+	for (const SpatialNearestQuery& query : queries)
+	{
+		query_nearest(query.pos, query.count, query.max_radius, query.category_mask, results.entities, query.ignore);
+		results.offsets.push_back((u32)results.entities.size());
+	}
+}
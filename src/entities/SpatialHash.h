@@ -0,0 +1,112 @@
+#pragma once
+
+#include "engine/Types.h"
+#include "CollisionCategory.h"
+
+#include "entt/entt.hpp"
+#include "glm/glm.hpp"
+
+#include <vector>
+#include <span>
+#include <unordered_map>
+
+/// Puts the entity into the SpatialHash at its Transform position. Pooled entities are taken out until they are acquired again
+struct SpatialHashed
+{
+	SpatialHashed(u64 category);
+
+	/// CollisionCategory bits matched against the category mask of the queries
+	u64 category;
+
+	// Managed by the SpatialHash
+	glm::ivec2 cell;
+	u32 bucket;
+	u32 slot;
+};
+
+struct SpatialRadiusQuery
+{
+	glm::vec2 center;
+	f32 radius;
+	u64 category_mask;
+};
+
+struct SpatialNearestQuery
+{
+	glm::vec2 pos;
+	u32 count;
+	f32 max_radius;
+	u64 category_mask;
+	/// Not part of the result, e.g. the entity asking
+	entt::entity ignore = entt::null;
+};
+
+/// Results of a batch: the entities of query i are entities[offsets[i]] to entities[offsets[i + 1]]
+struct SpatialQueryResults
+{
+	void clear();
+
+	std::vector<u32> offsets;
+	std::vector<entt::entity> entities;
+};
+
+/// Uniform spatial hash over the Transform positions of the SpatialHashed entities, independent of Box2D.
+/// Only entities that crossed into another cell are moved between cells on update; the others just get their position refreshed.
+/// The cells are hashed, so the grid has no bounds. One instance lives in the registry context of every World.
+/// The queries are const and may run on any number of threads at once (each with its own result) while update doesn't run
+struct SpatialHash : NoCopy
+{
+	SpatialHash(f32 cell_size);
+
+	/// Creates the SpatialHash in the registry context and connects it to the SpatialHashed and Pooled construction
+	static void create_spatial_hash(entt::registry& registry, f32 cell_size = 4.0f);
+
+	/// Inserts new entities and moves the entities that changed the cell
+	static void update(entt::registry& registry);
+
+	// The queries only find SpatialHashed entities: analytic projectiles have no entity and aren't in the hash, callers that
+	// need them look through the AnalyticProjectiles of the registry context
+
+	/// Appends the entities within the radius around center
+	void query_radius(glm::vec2 center, f32 radius, u64 category_mask, std::vector<entt::entity>& result) const;
+	/// Appends the entities inside the rect
+	void query_rect(const Rect& rect, u64 category_mask, std::vector<entt::entity>& result) const;
+	/// Appends up to count entities within max_radius around pos, closest first
+	void query_nearest(glm::vec2 pos, u32 count, f32 max_radius, u64 category_mask, std::vector<entt::entity>& result, entt::entity ignore = entt::null) const;
+
+	/// Batches replace the results
+	void query_radius(std::span<const SpatialRadiusQuery> queries, SpatialQueryResults& results) const;
+	void query_nearest(std::span<const SpatialNearestQuery> queries, SpatialQueryResults& results) const;
+
+	u32 size() const { return entity_count; }
+
+	const f32 cell_size;
+
+private:
+	struct Entry
+	{
+		glm::vec2 pos;
+		u64 category;
+		entt::entity entity;
+	};
+
+	glm::ivec2 get_cell(glm::vec2 pos) const;
+	/// The cell clamped to min_cell and max_cell in floats, so huge or infinite query bounds don't overflow the cell coordinates
+	glm::ivec2 get_bounded_cell(glm::vec2 pos) const;
+	static u64 get_cell_key(glm::ivec2 cell) { return ((u64)(u32)cell.x << 32) | (u32)cell.y; }
+	const std::vector<Entry>* find_bucket(glm::ivec2 cell) const;
+
+	void insert(entt::entity entity, SpatialHashed& hashed, glm::vec2 pos);
+	void remove(entt::registry& registry, SpatialHashed& hashed);
+
+	static void on_destroy_hashed(entt::registry& registry, entt::entity entity);
+	static void on_construct_pooled(entt::registry& registry, entt::entity entity);
+
+	f32 rec_cell_size;
+	/// Buckets of cells that got empty are kept for reuse
+	std::unordered_map<u64, u32> bucket_by_cell;
+	std::vector<std::vector<Entry>> buckets;
+	u32 entity_count;
+	/// Cells that ever had entities lie inside; bounds the search of query_nearest
+	glm::ivec2 min_cell, max_cell;
+};
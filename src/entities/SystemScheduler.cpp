@@ -0,0 +1,182 @@
+#include "SystemScheduler.h"
+
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+SystemAccess SystemAccess::exclusive()
+{
+	SystemAccess access;
+	access.is_exclusive = true;
+	return access;
+}
+
+static bool overlaps(const std::vector<entt::id_type>& a, const std::vector<entt::id_type>& b)
+{
+	for (entt::id_type id : a)
+	{
+		if (std::find(b.begin(), b.end(), id) != b.end())
+			return true;
+	}
+	return false;
+}
+
+bool SystemAccess::conflicts(const SystemAccess& other) const
+{
+	return is_exclusive || other.is_exclusive
+		|| overlaps(writes, other.reads) || overlaps(writes, other.writes) || overlaps(reads, other.writes);
+}
+
+SystemScheduler::SystemScheduler()
+	: last_frame_ms(0.0), last_busy_ms(0.0), remaining_size(0), thread_pool(&ThreadPool::get_shared()),
+	frame_registry(nullptr), frame_delta_time(0.0f), frame_group(nullptr), failed(false)
+{
+}
+
+u32 SystemScheduler::add_system(entt::registry& registry, const char* name, SystemAccess access, SystemFunction fn)
+{
+	for (auto create_storages : access.storage_creators)
+		create_storages(registry);
+
+	systems.emplace_back(name, std::move(access), std::move(fn), true);
+	timings.emplace_back(name, 0.0);
+	return (u32)systems.size() - 1;
+}
+
+void SystemScheduler::set_system_enabled(u32 system, bool enabled)
+{
+	if (system >= systems.size())
+		throw std::runtime_error("Invalid system id " + std::to_string(system));
+	systems[system].enabled = enabled;
+}
+
+void SystemScheduler::build_graph()
+{
+	if (remaining_size < systems.size())
+	{
+		remaining = std::make_unique<std::atomic<u32>[]>(systems.size());
+		remaining_size = (u32)systems.size();
+	}
+
+	for (u32 i = 0; i < systems.size(); i++)
+	{
+		systems[i].dependents.clear();
+		remaining[i].store(0, std::memory_order_relaxed);
+	}
+
+	for (u32 i = 0; i < systems.size(); i++)
+	{
+		if (!systems[i].enabled)
+			continue;
+		for (u32 j = 0; j < i; j++)
+		{
+			if (systems[j].enabled && systems[i].access.conflicts(systems[j].access))
+			{
+				systems[j].dependents.push_back(i);
+				remaining[i].fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+	}
+}
+
+void SystemScheduler::execute(entt::registry& registry, f32 delta_time, u32 index)
+{
+	System& system = systems[index];
+	PROFILE_ZONE(system.name);
+
+	u64 start = Profiler::now();
+	system.fn(registry, delta_time);
+	timings[index].ms = (Profiler::now() - start) * 1e-6;
+}
+
+void SystemScheduler::run_system(u32 index)
+{
+	while (true)
+	{
+		// After a failure the remaining systems are skipped but still released, so the frame ends
+		if (!failed.load(std::memory_order_relaxed))
+		{
+			try
+			{
+				execute(*frame_registry, frame_delta_time, index);
+			}
+			catch (...)
+			{
+				std::lock_guard lock(error_mutex);
+				if (!error)
+					error = std::current_exception();
+				failed.store(true, std::memory_order_relaxed);
+			}
+		}
+
+		// Continue with the first dependent that got ready, the others go to the pool
+		u32 next = ~0u;
+		for (u32 dependent : systems[index].dependents)
+		{
+			if (remaining[dependent].fetch_sub(1, std::memory_order_acq_rel) != 1)
+				continue;
+
+			if (next == ~0u)
+				next = dependent;
+			else
+				thread_pool->submit(*frame_group, [this, dependent]() { run_system(dependent); });
+		}
+
+		if (next == ~0u)
+			return;
+		index = next;
+	}
+}
+
+void SystemScheduler::run(entt::registry& registry, f32 delta_time)
+{
+	u64 start = Profiler::now();
+	for (SystemTiming& timing : timings)
+		timing.ms = 0.0;
+
+	if (!thread_pool)
+	{
+		for (u32 i = 0; i < systems.size(); i++)
+		{
+			if (systems[i].enabled)
+				execute(registry, delta_time, i);
+		}
+	}
+	else
+	{
+		build_graph();
+
+		// Collected before submitting anything, a running root could already release later systems
+		roots.clear();
+		for (u32 i = 0; i < systems.size(); i++)
+		{
+			if (systems[i].enabled && remaining[i].load(std::memory_order_relaxed) == 0)
+				roots.push_back(i);
+		}
+
+		// The jobs only capture the system index, small enough for std::function to store it without allocating
+		TaskGroup group;
+		frame_registry = &registry;
+		frame_delta_time = delta_time;
+		frame_group = &group;
+		for (u32 root : roots)
+			thread_pool->submit(group, [this, root]() { run_system(root); });
+		thread_pool->wait(group);
+		frame_group = nullptr;
+
+		if (error)
+		{
+			std::exception_ptr rethrown = error;
+			error = nullptr;
+			failed.store(false, std::memory_order_relaxed);
+			std::rethrow_exception(rethrown);
+		}
+	}
+
+	last_frame_ms = (Profiler::now() - start) * 1e-6;
+	last_busy_ms = 0.0;
+	for (const SystemTiming& timing : timings)
+		last_busy_ms += timing.ms;
+}
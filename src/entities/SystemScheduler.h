@@ -0,0 +1,163 @@
+#pragma once
+
+#include "engine/Types.h"
+#include "engine/ThreadPool.h"
+
+#include "entt/entt.hpp"
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <atomic>
+
+/// The components and resources a system reads and writes. Two systems conflict if one writes what the other reads or writes;
+/// conflicting systems run in registration order, all others may run at the same time
+struct SystemAccess
+{
+	/// Conflicts with every other system, e.g. the physics step or the command flushes
+	static SystemAccess exclusive();
+
+	template<typename... Types>
+	SystemAccess& read()
+	{
+		(reads.push_back(entt::type_hash<Types>::value()), ...);
+		storage_creators.push_back(&create_storages<Types...>);
+		return *this;
+	}
+
+	template<typename... Types>
+	SystemAccess& write()
+	{
+		(writes.push_back(entt::type_hash<Types>::value()), ...);
+		storage_creators.push_back(&create_storages<Types...>);
+		return *this;
+	}
+
+	/// Data outside of the component storages, e.g. registry context objects or the Box2D world (b2WorldId)
+	template<typename... Types>
+	SystemAccess& read_resource()
+	{
+		(reads.push_back(entt::type_hash<Types>::value()), ...);
+		return *this;
+	}
+
+	template<typename... Types>
+	SystemAccess& write_resource()
+	{
+		(writes.push_back(entt::type_hash<Types>::value()), ...);
+		return *this;
+	}
+
+	bool conflicts(const SystemAccess& other) const;
+
+	std::vector<entt::id_type> reads;
+	std::vector<entt::id_type> writes;
+	bool is_exclusive = false;
+
+private:
+	friend struct SystemScheduler;
+
+	/// Views create missing storages, which isn't thread safe. The storages are created when the system is added instead
+	template<typename... Types>
+	static void create_storages(entt::registry& registry)
+	{
+		(registry.storage<Types>(), ...);
+	}
+
+	std::vector<void(*)(entt::registry&)> storage_creators;
+};
+
+using SystemFunction = std::function<void(entt::registry&, f32 delta_time)>;
+
+struct SystemTiming
+{
+	const char* name;
+	/// 0 if the system is disabled
+	f64 ms;
+};
+
+/// Runs the systems of a frame on a thread pool. The dependency graph is built from the declared access of the enabled systems
+/// every frame; a system is started once all conflicting systems registered before it have finished.
+/// Each system records a profiler zone with its name and its time of the last frame
+struct SystemScheduler : NoCopy
+{
+	SystemScheduler();
+
+	/// name needs to be a string literal (it names the profiler zone); returns the id of the system
+	u32 add_system(entt::registry& registry, const char* name, SystemAccess access, SystemFunction fn);
+	void set_system_enabled(u32 system, bool enabled);
+
+	/// Runs all enabled systems once and returns when they have finished. If a system throws, the systems that didn't start yet
+	/// are skipped and the first exception is rethrown here
+	void run(entt::registry& registry, f32 delta_time);
+
+	/// nullptr runs the systems one after the other in registration order on the calling thread
+	void set_thread_pool(ThreadPool* pool) { thread_pool = pool; }
+	ThreadPool* get_thread_pool() const { return thread_pool; }
+
+	/// Per system in registration order, from the last run
+	const std::vector<SystemTiming>& get_timings() const { return timings; }
+	/// Wall time of the last run and the sum of its system times; busy / frame is the average parallelism
+	f64 last_frame_ms;
+	f64 last_busy_ms;
+
+private:
+	struct System
+	{
+		const char* name;
+		SystemAccess access;
+		SystemFunction fn;
+		bool enabled;
+		/// Systems that wait for this one in the current frame
+		std::vector<u32> dependents;
+	};
+
+	void build_graph();
+	/// Runs the system and then the dependents that became ready; all but one of those are submitted to the pool
+	void run_system(u32 index);
+	void execute(entt::registry& registry, f32 delta_time, u32 index);
+
+	std::vector<System> systems;
+	std::vector<SystemTiming> timings;
+	/// Unfinished dependencies per system in the current frame
+	std::unique_ptr<std::atomic<u32>[]> remaining;
+	u32 remaining_size;
+	/// Systems without dependencies in the current frame
+	std::vector<u32> roots;
+	ThreadPool* thread_pool;
+
+	/// State of the run in progress, shared by its jobs
+	entt::registry* frame_registry;
+	f32 frame_delta_time;
+	TaskGroup* frame_group;
+
+	std::mutex error_mutex;
+	std::exception_ptr error;
+	std::atomic<bool> failed;
+};
+
+/// Calls fn(entity) for the entities of the view in chunks of its leading storage on the thread pool (or serially without one).
+/// fn may only change the components of its own entity; structural changes go through the CommandBuffer
+template<typename View, typename F>
+void parallel_for_each(ThreadPool* pool, const View& view, u32 chunk_size, F&& fn)
+{
+	const auto* storage = view.handle();
+	if (!pool || !storage)
+	{
+		for (entt::entity entity : view)
+			fn(entity);
+		return;
+	}
+
+	const entt::entity* entities = storage->data();
+	pool->parallel_for((u32)storage->size(), chunk_size, [&](u32 begin, u32 end)
+		{
+			for (u32 i = begin; i < end; i++)
+			{
+				if (view.contains(entities[i]))
+					fn(entities[i]);
+			}
+		});
+}
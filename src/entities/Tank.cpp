@@ -2,14 +2,17 @@
 
 #include "CollisionCategory.h"
 #include "World.h"
+#include "CommandBuffer.h"
 #include "Components.h"
 #include "Projectile.h"
+#include "AnalyticProjectiles.h"
 #include "Particle.h"
+#include "SpatialHash.h"
+#include "LagCompensation.h"
 #include "AssetManager.h"
 
 #include "engine/util/MathUtil.h"
 #include "engine/util/StringUtil.h"
-#include "engine/Window.h"
 
 #include <cmath>
 #include <fstream>
@@ -71,8 +74,6 @@ void TurretData::load_from_file(std::unique_ptr<TurretData>& data_ptr, const cha
 	}
 }
 
-static u32 id_generator = 1;
-
 Tank::Tank(u32 id, entt::entity entity, const TankDesign& design)
 	: id(id), entity(entity), design(design), turret_orientation(0.0f), shoot_barrel_index(0),
 	hull_data(AssetManager::get_instance().hull_data[design.hull].loaded()),
@@ -98,287 +99,227 @@ glm::vec2 Tank::get_shoot_point(entt::registry& registry)
 entt::entity Tank::shoot_projectile(entt::registry& registry, const ProjectileType& type)
 {
 	glm::vec2 shoot_point = get_shoot_point(registry);
-	entt::entity projectile = Projectile::create_projectile(registry, entity, type, shoot_point, turret_orientation);
-	if (registry.all_of<TankRenderable>(entity))
-	{
-		Projectile::create_projectile_renderable(registry, projectile, type);
+	ParticleSystem::spawn(registry, AssetManager::get_instance().particle_flash[type.particle_type], { shoot_point, turret_orientation }, 10.0f, 0.5f);
 
-		Particle::create(registry, AssetManager::get_instance().particle_flash[type.particle_type], { shoot_point, turret_orientation }, 10.0f, 0.5f);
+	if (type.analytic)
+	{
+		AnalyticProjectiles::spawn(registry, entity, type, shoot_point, turret_orientation);
+		return entt::null;
 	}
-	return entity;
+
+	return Projectile::create_projectile(registry, entity, type, shoot_point, turret_orientation);
 }
 
-entt::entity Tank::create_tank(entt::registry& registry, const TankDesign& design, glm::vec2 pos, bool player_control)
+entt::entity Tank::create_tank(entt::registry& registry, const TankDesign& design, glm::vec2 pos)
 {
 	entt::entity entity = registry.create();
-	registry.emplace<Tank>(entity, id_generator++, entity, design);
+	registry.emplace<Tank>(entity, registry.ctx().emplace<TankIds>().next++, entity, design);
 	registry.emplace<Transform>(entity, pos, 0.0f);
 	registry.emplace<Velocity>(entity);
-	registry.emplace<TankRenderable>(entity, design);
+	registry.emplace<SpatialHashed>(entity, CATEGORY_TANK);
+	if (registry.ctx().contains<ParticleSystem>())
+		add_particle_emitters(registry, entity);
+	if (registry.ctx().contains<LagCompensation>())
+		registry.emplace<TransformHistory>(entity);
 	b2ShapeDef shape_def = b2DefaultShapeDef();
 	shape_def.density = 868.0;
 	shape_def.material.friction = 0.3f;
 	shape_def.filter.categoryBits = CATEGORY_TANK;
-	registry.emplace<Physics>(entity, true).create_box_shape(shape_def, 1.32f * TANK_SCALE, 1.88f * TANK_SCALE);
-	if (player_control)
-		registry.emplace<TankPlayerController>(entity, TankMovementSettings{ 2.0f, 2.0f, 8.0f, glm::radians(80.0f), glm::radians(200.0f), 5.0f });
+	glm::vec2 hull_size = get_hull_size();
+	registry.emplace<Physics>(entity, true).create_box_shape(shape_def, hull_size.x, hull_size.y);
+	registry.emplace<TankController>(entity, TankMovementSettings{ 2.0f, 2.0f, 8.0f, glm::radians(80.0f), glm::radians(200.0f), 5.0f });
 	return entity;
 }
 
-void Tank::update_tank_design(entt::registry& registry, entt::entity tank_entity, const TankDesign& new_design)
+void Tank::add_particle_emitters(entt::registry& registry, entt::entity tank_entity)
 {
-	Tank& tank = registry.get<Tank>(tank_entity);
-	TankRenderable* renderable = nullptr;
-		
-	bool load_hull_texture = false;
-	bool load_turret_texture = false;
-	bool load_track_texture = false;
-
-	if (tank.design.color != new_design.color)
-	{
-		load_hull_texture = true;
-		load_turret_texture = true;
-	}
-
-	if (tank.design.hull != new_design.hull)
-	{
-		tank.hull_data = AssetManager::get_instance().hull_data[new_design.hull].loaded();
-		load_hull_texture = true;
-	}
-
-	if (tank.design.turret != new_design.turret)
-	{
-		tank.turret_data = AssetManager::get_instance().turret_data[new_design.turret].loaded();
-		load_turret_texture = true;
-	}
-
-	if (tank.design.tracks != new_design.tracks)
-		load_track_texture = true;
-
-	if (registry.all_of<TankRenderable>(tank_entity))
-	{
-		TankRenderable& renderable = registry.get<TankRenderable>(tank_entity);
-		if (load_hull_texture)
-			renderable.hull_texture = AssetManager::get_instance().hull_textures[new_design.color][new_design.hull].loaded();
-		if (load_turret_texture)
-			renderable.turret_texture = AssetManager::get_instance().turret_textures[new_design.color][new_design.turret].loaded();
-		if (load_track_texture)
-		{
-			renderable.track_textures[0] = AssetManager::get_instance().track_textures[new_design.tracks][0].loaded();
-			renderable.track_textures[1] = AssetManager::get_instance().track_textures[new_design.tracks][1].loaded();
-		}
-	}
-
-	tank.design = new_design;
+	AssetManager& assets = AssetManager::get_instance();
+	const TankDesign& design = registry.get<Tank>(tank_entity).design;
+	glm::vec2 rear(0.0f, get_hull_size().y * 0.5f);
+
+	// Indices match EXHAUST_EMITTER, SMOKE_EMITTER and FLAME_EMITTER
+	ParticleEmitters& emitters = registry.emplace<ParticleEmitters>(tank_entity);
+	emitters.add({ &assets.particle_exhaust[design.hull % assets.particle_exhaust.size()], ParticleEmitterMode::Continuous, 12.0f,
+		rear, { 0.0f, 0.6f }, glm::radians(15.0f), 0.0f, 0.4f, 12.0f, 2.0f });
+	emitters.add({ &assets.particle_smoke, ParticleEmitterMode::Burst, 6.0f,
+		glm::vec2(0.0f), { 0.0f, 0.8f }, MathUtil::PI_32, 0.0f, 0.6f, 10.0f });
+	emitters.add({ &assets.particle_flame, ParticleEmitterMode::Burst, 1.0f,
+		glm::vec2(0.0f), glm::vec2(0.0f), 0.0f, 0.0f, 0.5f, 12.0f });
 }
 
-
-f32 Tank::get_scale()
+void Tank::trigger_hit_particles(entt::registry& registry, entt::entity entity)
 {
-	return TANK_SCALE;
+	if (!registry.all_of<Tank>(entity))
+		return;
+	ParticleEmitters::trigger(registry, entity, SMOKE_EMITTER);
+	ParticleEmitters::trigger(registry, entity, FLAME_EMITTER);
 }
 
-TankRenderable::TankRenderable(const TankDesign& design)
-	: hull_texture(AssetManager::get_instance().hull_textures[design.color][design.hull].loaded()),
-	turret_texture(AssetManager::get_instance().turret_textures[design.color][design.turret].loaded()),
-	track_textures{ AssetManager::get_instance().track_textures[design.tracks][0].loaded(), AssetManager::get_instance().track_textures[design.tracks][1].loaded() },
-	turret_rotation(0.0),
-	track_animation_1(0.0),
-	track_animation_2(0.0)
+void Tank::update_tank_design(entt::registry& registry, entt::entity tank_entity, const TankDesign& new_design)
 {
+	registry.patch<Tank>(tank_entity, [&](Tank& tank)
+		{
+			if (tank.design.hull != new_design.hull)
+				tank.hull_data = AssetManager::get_instance().hull_data[new_design.hull].loaded();
+			if (tank.design.turret != new_design.turret)
+				tank.turret_data = AssetManager::get_instance().turret_data[new_design.turret].loaded();
+			tank.design = new_design;
+		});
 }
 
-void TankRenderable::update_track_animation(entt::registry& registry, f32 frame_time)
-{
-	for (auto [entity, tank, renderable, transform, velocity] : registry.view<Tank, TankRenderable, Transform, Velocity>().each())
-	{
-		// TODO: fix unfortunately
-		f32 speed = glm::dot(velocity.linear, -glm::vec2(std::sin(transform.rot), std::cos(transform.rot)));
-		if (speed == 0 && velocity.angular == 0)
-			continue;
-		 
-		f32 track_1_speed, track_2_speed;
 
-		f32 track_offset = tank.hull_data.get().tracks_off_x * tank.hull_data.get().scale * TANK_SCALE;
-
-		if (velocity.angular != 0)
-		{
-			f32 turn_radius = speed / velocity.angular;
-
-			if (speed != 0)
-			{
-				track_1_speed = speed * (turn_radius - track_offset) / turn_radius;
-				track_2_speed = speed * (turn_radius + track_offset) / turn_radius;
-			}
-			else
-			{
-				track_1_speed = -track_offset * velocity.angular;
-				track_2_speed = track_offset * velocity.angular;
-			}
-		}
-		else
-		{
-			track_1_speed = track_2_speed = speed;
-		}
-		
-		f32 track_step = 20.0f / 256.0f * tank.hull_data.get().tracks_scale * TANK_SCALE;
-
-		renderable.track_animation_1 += track_1_speed / track_step * frame_time;
-		renderable.track_animation_2 += track_2_speed / track_step * frame_time;
-	}
+f32 Tank::get_scale()
+{
+	return TANK_SCALE;
 }
 
-void TankRenderable::render_tanks(entt::registry& registry, Graphics& graphics)
+glm::vec2 Tank::get_hull_size()
 {
-	for (auto [entity, tank, renderable, transform] : registry.view<Tank, TankRenderable, Transform>().each())
-	{
-		auto hull_transform = graphics.create_transform();
-		hull_transform.translate(transform.pos.x, transform.pos.y);
-		hull_transform.scale(TANK_SCALE * tank.hull_data.get().scale, TANK_SCALE * tank.hull_data.get().scale);
-		hull_transform.rotate(transform.rot);
-
-		auto track_transform = hull_transform;
-		track_transform.scale(tank.hull_data.get().tracks_scale);
-		track_transform.translate(-tank.hull_data.get().tracks_off_x, tank.hull_data.get().tracks_off_y);
-
-		graphics.draw_image(renderable.track_textures[((u32)renderable.track_animation_1) % 2].get(), track_transform);
-		track_transform.translate(2.0f * tank.hull_data.get().tracks_off_x, 0.0f);
-		graphics.draw_image(renderable.track_textures[((u32)renderable.track_animation_2) % 2].get(), track_transform);
-
-		graphics.draw_image(renderable.hull_texture.get(), hull_transform);
-
-		auto turret_transform = graphics.create_transform();
-		turret_transform.translate(transform.pos.x, transform.pos.y);
-		turret_transform.scale(TANK_SCALE * tank.turret_data.get().scale, TANK_SCALE * tank.turret_data.get().scale);
-		turret_transform.rotate(transform.rot);
-		turret_transform.translate(0.0f, tank.hull_data.get().turret_pivot_y);
-		turret_transform.rotate(renderable.turret_rotation - transform.rot);
-		turret_transform.translate(0.0f, -tank.turret_data.get().pivot_y);
-
-		graphics.draw_image(renderable.turret_texture.get(), turret_transform);
-	}
+	return glm::vec2(1.32f, 1.88f) * TANK_SCALE;
 }
 
-#include <iostream>
-TankPlayerController::TankPlayerController(const TankMovementSettings& settings)
+TankController::TankController(const TankMovementSettings& settings)
 	: movement_settings(settings),
 	rel_turret_rotation(0.0f),
-	input_user(Window::get_instance().create_input_user()),
-	shoot_key_state(Window::get_instance(), KEY_SPACE)
+	input()
 {
-	
 }
 
-void TankPlayerController::update_tank(entt::registry& registry, const Camera& camera, f32 frame_time)
+void TankController::update_tanks(entt::registry& registry, f32 frame_time)
 {
-	for (auto [entity, controller, physics, tank] : registry.view<TankPlayerController, Physics, Tank>().each())
+	for (auto [entity, controller, physics, tank] : registry.view<TankController, Physics, Tank>().each())
 	{
-		// Make sure tank is always moving in a straight line
 		auto b2_transform = b2Body_GetTransform(physics.body);
 		auto b2_pos = b2_transform.p;
-		auto b2_rot = b2_transform.q;
+		f32 tank_rot = b2Rot_GetAngle(b2_transform.q);
 		auto b2_vel = b2Body_GetLinearVelocity(physics.body);
-		glm::vec2 forward_dir = { b2_rot.s, -b2_rot.c };
-		f32 forwards_mag = glm::dot(glm::vec2(b2_vel.x, b2_vel.y), forward_dir);
-		glm::vec2 new_vel = forward_dir * forwards_mag;
-
-		f32 forwards_force = 0.0;
-		f32 torque = 0.0;
-
-		f32 turning_speed = b2Body_GetAngularVelocity(physics.body);
 
-		InputUser& input_user = controller.input_user;
-		bool input_forwards = input_user.is_key_pressed(KEY_W);
-		bool input_backwards = input_user.is_key_pressed(KEY_S);
-		bool input_left = input_user.is_key_pressed(KEY_A);
-		bool input_right = input_user.is_key_pressed(KEY_D);
+		TankInput& input = controller.input;
+		TankDrive drive = get_drive(controller.movement_settings, input, tank_rot, glm::vec2(b2_vel.x, b2_vel.y), b2Body_GetAngularVelocity(physics.body));
 
-		// forwards and backwards
-		if (input_forwards && !input_backwards)
+		if (drive.stop_turning)
+			b2Body_SetAngularVelocity(physics.body, 0.0f);
+		b2Body_SetLinearVelocity(physics.body, b2Vec2(drive.linear_velocity.x, drive.linear_velocity.y));
+		if (drive.torque != 0.0)
+			b2Body_ApplyTorque(physics.body, drive.torque * b2Body_GetMass(physics.body), true);
+		if (drive.forwards_force != 0.0)
 		{
-			if (forwards_mag > controller.movement_settings.max_speed)
-				new_vel = forward_dir * controller.movement_settings.max_speed;
-			else if (forwards_mag >= 0)
-				forwards_force = controller.movement_settings.acceleration_force;
-			else
-				forwards_force = controller.movement_settings.braking_force;
-		}
-		else if (!input_forwards && input_backwards)
-		{
-			if (forwards_mag < -controller.movement_settings.max_speed)
-				new_vel = forward_dir * -controller.movement_settings.max_speed;
-			else if (forwards_mag <= 0)
-				forwards_force = -controller.movement_settings.acceleration_force;
-			else
-				forwards_force = -controller.movement_settings.braking_force;
-		}
-		else
-		{
-			if (abs(forwards_mag) < 0.1f)
-				new_vel = glm::vec2(0);
-			else if (forwards_mag < 0)
-				forwards_force = controller.movement_settings.braking_force;
-			else
-				forwards_force = -controller.movement_settings.braking_force;
+			glm::vec2 forward_dir = { std::sin(tank_rot), -std::cos(tank_rot) };
+			auto force_vector = b2Body_GetMass(physics.body) * drive.forwards_force * forward_dir;
+			b2Body_ApplyForceToCenter(physics.body, b2Vec2(force_vector.x, force_vector.y), true);
 		}
 
-		// Reverse left and right when driving backwards
-		if (forwards_mag < 0)
-			std::swap(input_left, input_right);
+		controller.rel_turret_rotation = aim_turret(controller.movement_settings, input, glm::vec2(b2_pos.x, b2_pos.y), tank_rot, controller.rel_turret_rotation, frame_time);
+		tank.turret_orientation = tank_rot + controller.rel_turret_rotation;
 
-		// left and right
-		if (input_left && !input_right)
-		{
-			if (turning_speed < -controller.movement_settings.max_turning_speed)
-				turning_speed = -controller.movement_settings.max_turning_speed;
-			else
-				torque = -controller.movement_settings.turning_torque;
-		}
-		else if (!input_left && input_right)
+		if (input.shoot)
 		{
-			if (turning_speed > controller.movement_settings.max_turning_speed)
-				turning_speed = controller.movement_settings.max_turning_speed;
-			else
-				torque = controller.movement_settings.turning_torque;
+			input.shoot = false;
 
+			// Spawning emplaces Physics components, which must not happen while iterating this view
+			registry.ctx().get<CommandBuffer>().invoke(entity, [type = controller.projectile_type](entt::registry& registry, entt::entity entity)
+				{
+					registry.get<Tank>(entity).shoot_projectile(registry, type);
+				});
 		}
-		else
-		{
-			if (abs(turning_speed) < 0.5f)
-				b2Body_SetAngularVelocity(physics.body, 0.0f);
-			else if (turning_speed < 0)
-				torque = controller.movement_settings.turning_torque;
-			else
-				torque = -controller.movement_settings.turning_torque;
-		}
+	}
+}
 
-		b2Body_SetLinearVelocity(physics.body, b2Vec2(new_vel.x, new_vel.y));
-		if (torque != 0.0)
-			b2Body_ApplyTorque(physics.body, torque * b2Body_GetMass(physics.body), true);
-		if (forwards_force != 0.0)
-		{
-			auto force_vector = b2Body_GetMass(physics.body) * forwards_force * forward_dir;
-			b2Body_ApplyForceToCenter(physics.body, b2Vec2(force_vector.x, force_vector.y), true);
-		}
+TankDrive TankController::get_drive(const TankMovementSettings& settings, const TankInput& input, f32 rot, glm::vec2 linear_velocity, f32 angular_velocity)
+{
+	// Make sure tank is always moving in a straight line
+	glm::vec2 forward_dir = { std::sin(rot), -std::cos(rot) };
+	f32 forwards_mag = glm::dot(linear_velocity, forward_dir);
 
-		glm::vec2 mouse_world = camera.to_world_space(input_user.get_cursor_pos());
-		glm::vec2 to_mouse = mouse_world - glm::vec2(b2_pos.x, b2_pos.y);
-		f32 angle_target = std::atan2(to_mouse.x, -to_mouse.y);
-		f32 tank_rot = b2Rot_GetAngle(b2_rot);
-		f32 turret_rotation_speed = MathUtil::normalize_angle_difference(tank_rot + controller.rel_turret_rotation, angle_target) * controller.movement_settings.gun_rotation_speed;
-		controller.rel_turret_rotation += turret_rotation_speed * frame_time;
+	TankDrive drive = { forward_dir * forwards_mag, 0.0f, 0.0f, false };
+	f32 turning_speed = angular_velocity;
 
-		tank.turret_orientation = tank_rot + controller.rel_turret_rotation;
+	bool input_forwards = input.forwards;
+	bool input_backwards = input.backwards;
+	bool input_left = input.left;
+	bool input_right = input.right;
 
-		if (registry.all_of<TankRenderable>(entity))
-			registry.get<TankRenderable>(entity).turret_rotation = tank_rot + controller.rel_turret_rotation;
+	// forwards and backwards
+	if (input_forwards && !input_backwards)
+	{
+		if (forwards_mag > settings.max_speed)
+			drive.linear_velocity = forward_dir * settings.max_speed;
+		else if (forwards_mag >= 0)
+			drive.forwards_force = settings.acceleration_force;
+		else
+			drive.forwards_force = settings.braking_force;
+	}
+	else if (!input_forwards && input_backwards)
+	{
+		if (forwards_mag < -settings.max_speed)
+			drive.linear_velocity = forward_dir * -settings.max_speed;
+		else if (forwards_mag <= 0)
+			drive.forwards_force = -settings.acceleration_force;
+		else
+			drive.forwards_force = -settings.braking_force;
+	}
+	else
+	{
+		if (abs(forwards_mag) < 0.1f)
+			drive.linear_velocity = glm::vec2(0);
+		else if (forwards_mag < 0)
+			drive.forwards_force = settings.braking_force;
+		else
+			drive.forwards_force = -settings.braking_force;
+	}
 
-		controller.shoot_key_state.update_state();
+	// Reverse left and right when driving backwards
+	if (forwards_mag < 0)
+		std::swap(input_left, input_right);
 
-		if (controller.shoot_key_state.is_pressed())
-		{
-			Tank& tank = registry.get<Tank>(entity);
-			tank.shoot_projectile(registry, controller.projectile_type);
-		}
+	// left and right
+	if (input_left && !input_right)
+	{
+		if (turning_speed >= -settings.max_turning_speed)
+			drive.torque = -settings.turning_torque;
+	}
+	else if (!input_left && input_right)
+	{
+		if (turning_speed <= settings.max_turning_speed)
+			drive.torque = settings.turning_torque;
 	}
-}
\ No newline at end of file
+	else
+	{
+		if (abs(turning_speed) < 0.5f)
+			drive.stop_turning = true;
+		else if (turning_speed < 0)
+			drive.torque = settings.turning_torque;
+		else
+			drive.torque = -settings.turning_torque;
+	}
+	return drive;
+}
+
+f32 TankController::aim_turret(const TankMovementSettings& settings, const TankInput& input, glm::vec2 pos, f32 rot, f32 rel_turret_rotation, f32 frame_time)
+{
+	glm::vec2 to_target = input.aim_target - pos;
+	f32 angle_target = std::atan2(to_target.x, -to_target.y);
+	f32 turret_rotation_speed = MathUtil::normalize_angle_difference(rot + rel_turret_rotation, angle_target) * settings.gun_rotation_speed;
+	return rel_turret_rotation + turret_rotation_speed * frame_time;
+}
+
+void TankController::simulate(const TankMovementSettings& settings, const TankInput& input, TankMotion& motion, f32 frame_time)
+{
+	Transform& transform = motion.transform;
+	Velocity& velocity = motion.velocity;
+	TankDrive drive = get_drive(settings, input, transform.rot, velocity.linear, velocity.angular);
+	motion.rel_turret_rotation = aim_turret(settings, input, transform.pos, transform.rot, motion.rel_turret_rotation, frame_time);
+
+	// The torque is applied per mass; the angular acceleration divides it by the inertia of the hull box per mass
+	glm::vec2 hull_size = Tank::get_hull_size();
+	f32 inertia_per_mass = (hull_size.x * hull_size.x + hull_size.y * hull_size.y) / 12.0f;
+
+	// Semi-implicit Euler like the Box2D step
+	glm::vec2 forward_dir = { std::sin(transform.rot), -std::cos(transform.rot) };
+	velocity.linear = drive.linear_velocity + forward_dir * drive.forwards_force * frame_time;
+	if (drive.stop_turning)
+		velocity.angular = 0.0f;
+	velocity.angular += drive.torque / inertia_per_mass * frame_time;
+	transform.pos += velocity.linear * frame_time;
+	transform.rot = MathUtil::normalize_angle(transform.rot + velocity.angular * frame_time);
+}
@@ -2,9 +2,7 @@
 
 #include "Projectile.h"
 
-#include "engine/Graphics.h"
 #include "engine/Asset.h"
-#include "engine/Input.h"
 
 #include "AssetManager.h"
 
@@ -38,11 +36,18 @@ struct TankDesign
 	u8 tracks;
 };
 
+/// Hands out the Tank ids of a registry; lives in its context, so the ids don't depend on the other registries of the process
+struct TankIds
+{
+	u32 next = 1;
+};
+
 struct Tank
 {
 	Tank(u32 id, entt::entity entity, const TankDesign& design);
 
 	glm::vec2 get_shoot_point(entt::registry& registry);
+	/// Returns the projectile entity, entt::null for analytic projectiles (they have none, see AnalyticProjectiles)
 	entt::entity shoot_projectile(entt::registry& registry, const ProjectileType& type);
 
 	u32 id;
@@ -55,24 +60,21 @@ struct Tank
 	// team data, stats, weapon data, name, ...
 
 
-	static entt::entity create_tank(entt::registry& registry, const TankDesign& design, glm::vec2 pos, bool player_control);
+	static entt::entity create_tank(entt::registry& registry, const TankDesign& design, glm::vec2 pos);
+	/// Exhaust while driving, smoke and a flame burst when hit. Added to every tank if the World has a ParticleSystem
+	static void add_particle_emitters(entt::registry& registry, entt::entity tank_entity);
+	/// Smoke and flame burst of a tank hit by a projectile; does nothing for other entities
+	static void trigger_hit_particles(entt::registry& registry, entt::entity entity);
+	/// Patches the Tank, so on_update<Tank> listeners (the client renderables) see the new design
 	static void update_tank_design(entt::registry& registry, entt::entity tank_entity, const TankDesign& new_design);
 
-	static f32 get_scale();
-};
-
-struct TankRenderable 
-{
-	TankRenderable(const TankDesign& design);
-
-	AssetRef<Texture> hull_texture;
-	AssetRef<Texture> turret_texture;
-	AssetRef<Texture> track_textures[2];
-	f32 turret_rotation;
-	f32 track_animation_1, track_animation_2;
+	const static u32 EXHAUST_EMITTER = 0;
+	const static u32 SMOKE_EMITTER = 1;
+	const static u32 FLAME_EMITTER = 2;
 
-	static void update_track_animation(entt::registry& registry, f32 frame_time);
-	static void render_tanks(entt::registry& registry, Graphics& graphics);
+	static f32 get_scale();
+	/// Size of the hull collision box
+	static glm::vec2 get_hull_size();
 };
 
 struct TankMovementSettings
@@ -85,15 +87,56 @@ struct TankMovementSettings
 	f32 gun_rotation_speed;
 };
 
-struct TankPlayerController
+/// Driving, aiming and shooting intent of a tank for one update
+struct TankInput
+{
+	bool forwards = false;
+	bool backwards = false;
+	bool left = false;
+	bool right = false;
+	/// Shoots once on the next update
+	bool shoot = false;
+	/// World position the turret rotates towards
+	glm::vec2 aim_target = glm::vec2(0.0f);
+};
+
+/// What the TankController does to the body of a tank for an input
+struct TankDrive
+{
+	/// Replaces the linear velocity: the sideways part is removed and the speed is clamped
+	glm::vec2 linear_velocity;
+	/// Acceleration along the tank (force per mass) and torque per mass
+	f32 forwards_force;
+	f32 torque;
+	/// The tank stops turning before the torque is applied
+	bool stop_turning;
+};
+
+/// Motion of a tank driven without Box2D, see TankController::simulate
+struct TankMotion
 {
-	TankPlayerController(const TankMovementSettings& settings = { 2.0f, 2.0f, 8.0f, glm::radians(80.0f), glm::radians(200.0f), 5.0f });
+	Transform transform;
+	Velocity velocity;
+	f32 rel_turret_rotation;
+};
+
+/// Drives a tank from its TankInput. The input is written by a CommandSource (the player on the client, bots, network clients)
+struct TankController
+{
+	TankController(const TankMovementSettings& settings = { 2.0f, 2.0f, 8.0f, glm::radians(80.0f), glm::radians(200.0f), 5.0f });
 
 	TankMovementSettings movement_settings;
 	ProjectileType projectile_type;
 	f32 rel_turret_rotation;
-	InputUser input_user;
-	KeyState shoot_key_state;
+	TankInput input;
+
+	/// Applies the input of all controlled tanks; the shoot input is consumed
+	static void update_tanks(entt::registry& registry, f32 frame_time);
 
-	static void update_tank(entt::registry& registry, const Camera& camera, f32 frame_time);
+	/// The driving part of update_tanks, for a tank with the given rotation and velocity
+	static TankDrive get_drive(const TankMovementSettings& settings, const TankInput& input, f32 rot, glm::vec2 linear_velocity, f32 angular_velocity);
+	/// Turns the turret towards the aim target; returns the new turret rotation relative to the hull
+	static f32 aim_turret(const TankMovementSettings& settings, const TankInput& input, glm::vec2 pos, f32 rot, f32 rel_turret_rotation, f32 frame_time);
+	/// Advances the motion like update_tanks and a physics step do, but without collisions. Used by the client to predict its own tank
+	static void simulate(const TankMovementSettings& settings, const TankInput& input, TankMotion& motion, f32 frame_time);
 };
\ No newline at end of file
@@ -0,0 +1,480 @@
+#include "Visibility.h"
+
+#include "Components.h"
+#include "MapDestruction.h"
+#include "engine/util/MathUtil.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Side length of a grid cell in tiles
+const static f32 GRID_CELL_TILES = 2.0f;
+// Circles are approximated by polygons with this many edges
+const static u32 CIRCLE_SEGMENTS = 8;
+// Sweep events closer than this angle are handled together
+const static f32 ANGLE_EPSILON = 1e-5f;
+// Tolerance of the segment parameter when a ray hits exactly at an endpoint
+const static f32 ENDPOINT_EPSILON = 1e-4f;
+// Cache entries not used for this many updates are dropped
+const static u32 CACHE_MAX_AGE = 60;
+
+enum class SweepEventType : u8
+{
+	Begin = 0,
+	End = 1,
+	/// Crossing of two segments, where the closest segment may change without an endpoint
+	Crossing = 2
+};
+
+struct SweepEvent
+{
+	f32 angle;
+	u32 segment;
+	SweepEventType type;
+};
+
+static f32 cross(glm::vec2 a, glm::vec2 b)
+{
+	return a.x * b.y - a.y * b.x;
+}
+
+/// Distance along the ray to the segment, or infinity if the ray misses it
+static f32 intersect_ray(glm::vec2 origin, glm::vec2 dir, const OccluderSegment& segment)
+{
+	glm::vec2 edge = segment.b - segment.a;
+	f32 denom = cross(dir, edge);
+	if (std::abs(denom) < 1e-9f)
+		return std::numeric_limits<f32>::infinity();
+
+	glm::vec2 offset = segment.a - origin;
+	f32 t = cross(offset, edge) / denom;
+	f32 s = cross(offset, dir) / denom;
+	if (t < 0.0f || s < -ENDPOINT_EPSILON || s > 1.0f + ENDPOINT_EPSILON)
+		return std::numeric_limits<f32>::infinity();
+	return t;
+}
+
+/// Proper crossing of the line with the segment; touching an endpoint doesn't block the line
+static bool crosses(glm::vec2 from, glm::vec2 to, const OccluderSegment& segment)
+{
+	glm::vec2 edge = segment.b - segment.a;
+	glm::vec2 line = to - from;
+	f32 d1 = cross(edge, from - segment.a);
+	f32 d2 = cross(edge, to - segment.a);
+	f32 d3 = cross(line, segment.a - from);
+	f32 d4 = cross(line, segment.b - from);
+	return d1 * d2 < 0.0f && d3 * d4 < 0.0f;
+}
+
+/// Clips the segment to the box (Liang-Barsky); returns false if it is outside
+static bool clip_segment(OccluderSegment& segment, glm::vec2 min, glm::vec2 max)
+{
+	glm::vec2 delta = segment.b - segment.a;
+	f32 t0 = 0.0f, t1 = 1.0f;
+	const f32 p[4] = { -delta.x, delta.x, -delta.y, delta.y };
+	const f32 q[4] = { segment.a.x - min.x, max.x - segment.a.x, segment.a.y - min.y, max.y - segment.a.y };
+	for (u32 i = 0; i < 4; i++)
+	{
+		if (p[i] == 0.0f)
+		{
+			if (q[i] < 0.0f)
+				return false;
+			continue;
+		}
+
+		f32 t = q[i] / p[i];
+		if (p[i] < 0.0f)
+			t0 = std::max(t0, t);
+		else
+			t1 = std::min(t1, t);
+		if (t0 > t1)
+			return false;
+	}
+
+	glm::vec2 a = segment.a;
+	segment.a = a + delta * t0;
+	segment.b = a + delta * t1;
+	return true;
+}
+
+static u64 get_pair_key(entt::entity a, entt::entity b)
+{
+	return ((u64)entt::to_integral(a) << 32) | (u64)entt::to_integral(b);
+}
+
+VisibilityObserver::VisibilityObserver(f32 radius, f32 move_threshold)
+	: radius(radius), move_threshold(move_threshold), polygon(), polygon_pos(0.0f), valid(false)
+{
+}
+
+Visibility::Visibility(const Map& map, const Tileset& tileset)
+	: move_threshold(0.25f),
+	cache_hits(0), cache_misses(0),
+	tileset(&tileset),
+	next_tile_change(0),
+	cell_size(GRID_CELL_TILES * map.tile_size),
+	stamp(0),
+	update_index(0)
+{
+	build_occluders(map);
+}
+
+void Visibility::build_occluders(const Map& map)
+{
+	PROFILE_ZONE("Visibility::build_occluders");
+
+	std::vector<MapCollisionShape> shapes;
+	map.get_collision_shapes(*tileset, shapes);
+	map.merge_collision_shapes(shapes);
+
+	segments.clear();
+
+	for (const MapCollisionShape& shape : shapes)
+	{
+		glm::vec2 corners[CIRCLE_SEGMENTS];
+		u32 corner_count;
+		if (shape.type == MapCollisionShapeType::Box)
+		{
+			f32 s = std::sin(shape.rotation);
+			f32 c = std::cos(shape.rotation);
+			glm::vec2 x_axis = glm::vec2(c, s) * shape.half_size.x;
+			glm::vec2 y_axis = glm::vec2(-s, c) * shape.half_size.y;
+			corners[0] = shape.center - x_axis - y_axis;
+			corners[1] = shape.center + x_axis - y_axis;
+			corners[2] = shape.center + x_axis + y_axis;
+			corners[3] = shape.center - x_axis + y_axis;
+			corner_count = 4;
+		}
+		else
+		{
+			for (u32 i = 0; i < CIRCLE_SEGMENTS; i++)
+			{
+				f32 angle = 2.0f * MathUtil::PI_32 * i / CIRCLE_SEGMENTS;
+				corners[i] = shape.center + glm::vec2(std::cos(angle), std::sin(angle)) * shape.radius;
+			}
+			corner_count = CIRCLE_SEGMENTS;
+		}
+
+		for (u32 i = 0; i < corner_count; i++)
+			segments.emplace_back(corners[i], corners[(i + 1) % corner_count]);
+	}
+
+	// The border shapes reach half their width past the map
+	h_cells = (u32)std::ceil(map.world_width / cell_size) + 1;
+	v_cells = (u32)std::ceil(map.world_height / cell_size) + 1;
+	auto get_cell_range = [&](const OccluderSegment& segment, glm::ivec2& min_cell, glm::ivec2& max_cell)
+		{
+			min_cell = glm::clamp(glm::ivec2(glm::floor(glm::min(segment.a, segment.b) / cell_size)), glm::ivec2(0), glm::ivec2(h_cells - 1, v_cells - 1));
+			max_cell = glm::clamp(glm::ivec2(glm::floor(glm::max(segment.a, segment.b) / cell_size)), glm::ivec2(0), glm::ivec2(h_cells - 1, v_cells - 1));
+		};
+
+	// Counting pass, then the segments of each cell are stored contiguously
+	cell_start.assign((usz)h_cells * v_cells + 1, 0);
+	for (const OccluderSegment& segment : segments)
+	{
+		glm::ivec2 min_cell, max_cell;
+		get_cell_range(segment, min_cell, max_cell);
+		for (s32 y = min_cell.y; y <= max_cell.y; y++)
+		{
+			for (s32 x = min_cell.x; x <= max_cell.x; x++)
+				cell_start[y * h_cells + x + 1]++;
+		}
+	}
+	for (usz i = 1; i < cell_start.size(); i++)
+		cell_start[i] += cell_start[i - 1];
+
+	cell_segments.resize(cell_start.back());
+	std::vector<u32> cell_fill(cell_start.begin(), cell_start.end() - 1);
+	for (u32 i = 0; i < segments.size(); i++)
+	{
+		glm::ivec2 min_cell, max_cell;
+		get_cell_range(segments[i], min_cell, max_cell);
+		for (s32 y = min_cell.y; y <= max_cell.y; y++)
+		{
+			for (s32 x = min_cell.x; x <= max_cell.x; x++)
+				cell_segments[cell_fill[y * h_cells + x]++] = i;
+		}
+	}
+
+	segment_stamps.assign(segments.size(), 0);
+}
+
+void Visibility::apply_tile_changes(entt::registry& registry)
+{
+	auto maps = registry.view<Map, MapDestruction>();
+	if (maps.begin() == maps.end())
+		return;
+	auto [map, destruction] = maps.get(*maps.begin());
+	u32 change_count = (u32)destruction.change_log.size();
+	if (change_count == next_tile_change)
+		return;
+
+	// Damage alone doesn't change the shapes; a rewind (see WorldSnapshot) may bring tiles back
+	bool changed = change_count < next_tile_change;
+	for (u32 i = next_tile_change; i < change_count; i++)
+		changed |= destruction.change_log[i].gid < map.first_gid;
+	next_tile_change = change_count;
+	if (!changed)
+		return;
+
+	build_occluders(map);
+	cache.clear();
+	for (auto [entity, observer] : registry.view<VisibilityObserver>().each())
+		observer.valid = false;
+}
+
+void Visibility::create_visibility(entt::registry& registry, entt::entity map_entity, const Tileset& tileset)
+{
+	registry.ctx().emplace<Visibility>(registry.get<Map>(map_entity), tileset);
+}
+
+template<typename F>
+bool Visibility::for_each_segment_on_line(glm::vec2 from, glm::vec2 to, F&& fn)
+{
+	if (++stamp == 0)
+	{
+		std::fill(segment_stamps.begin(), segment_stamps.end(), 0);
+		stamp = 1;
+	}
+
+	// Walks the grid cells the line passes (Amanatides and Woo)
+	glm::vec2 delta = to - from;
+	glm::ivec2 cell = glm::ivec2(glm::floor(from / cell_size));
+	glm::ivec2 end_cell = glm::ivec2(glm::floor(to / cell_size));
+	glm::ivec2 step = { delta.x > 0.0f ? 1 : -1, delta.y > 0.0f ? 1 : -1 };
+
+	const f32 infinity = std::numeric_limits<f32>::infinity();
+	glm::vec2 t_delta = { delta.x != 0.0f ? cell_size / std::abs(delta.x) : infinity, delta.y != 0.0f ? cell_size / std::abs(delta.y) : infinity };
+	glm::vec2 t_max = {
+		delta.x != 0.0f ? ((cell.x + (step.x > 0 ? 1 : 0)) * cell_size - from.x) / delta.x : infinity,
+		delta.y != 0.0f ? ((cell.y + (step.y > 0 ? 1 : 0)) * cell_size - from.y) / delta.y : infinity };
+
+	s32 cell_count = std::abs(end_cell.x - cell.x) + std::abs(end_cell.y - cell.y) + 1;
+	for (s32 i = 0; i < cell_count; i++)
+	{
+		if (cell.x >= 0 && cell.y >= 0 && cell.x < (s32)h_cells && cell.y < (s32)v_cells)
+		{
+			u32 cell_index = cell.y * h_cells + cell.x;
+			for (u32 j = cell_start[cell_index]; j < cell_start[cell_index + 1]; j++)
+			{
+				u32 segment = cell_segments[j];
+				if (segment_stamps[segment] == stamp)
+					continue;
+				segment_stamps[segment] = stamp;
+
+				if (fn(segment))
+					return true;
+			}
+		}
+
+		if (t_max.x < t_max.y)
+		{
+			cell.x += step.x;
+			t_max.x += t_delta.x;
+		}
+		else
+		{
+			cell.y += step.y;
+			t_max.y += t_delta.y;
+		}
+	}
+	return false;
+}
+
+bool Visibility::has_line_of_sight(glm::vec2 from, glm::vec2 to)
+{
+	return !for_each_segment_on_line(from, to, [&](u32 segment) { return crosses(from, to, segments[segment]); });
+}
+
+void Visibility::has_line_of_sight(std::span<const LineOfSightQuery> queries, std::span<u8> results)
+{
+	PROFILE_ZONE("Visibility::has_line_of_sight");
+	for (usz i = 0; i < queries.size(); i++)
+		results[i] = has_line_of_sight(queries[i].from, queries[i].to);
+}
+
+void Visibility::compute_visibility_polygon(glm::vec2 pos, f32 radius, std::vector<glm::vec2>& polygon)
+{
+	PROFILE_ZONE("Visibility::compute_visibility_polygon");
+	thread_local std::vector<OccluderSegment> sweep_segments;
+	thread_local std::vector<SweepEvent> events;
+	thread_local std::vector<u32> active;
+
+	polygon.clear();
+	sweep_segments.clear();
+	events.clear();
+	active.clear();
+
+	// The square around the observer bounds the view, so every ray hits a segment
+	glm::vec2 min = pos - radius;
+	glm::vec2 max = pos + radius;
+	sweep_segments.emplace_back(glm::vec2(min.x, min.y), glm::vec2(max.x, min.y));
+	sweep_segments.emplace_back(glm::vec2(max.x, min.y), glm::vec2(max.x, max.y));
+	sweep_segments.emplace_back(glm::vec2(max.x, max.y), glm::vec2(min.x, max.y));
+	sweep_segments.emplace_back(glm::vec2(min.x, max.y), glm::vec2(min.x, min.y));
+
+	if (++stamp == 0)
+	{
+		std::fill(segment_stamps.begin(), segment_stamps.end(), 0);
+		stamp = 1;
+	}
+	glm::ivec2 min_cell = glm::max(glm::ivec2(glm::floor(min / cell_size)), glm::ivec2(0));
+	glm::ivec2 max_cell = glm::min(glm::ivec2(glm::floor(max / cell_size)), glm::ivec2(h_cells - 1, v_cells - 1));
+	for (s32 y = min_cell.y; y <= max_cell.y; y++)
+	{
+		for (s32 x = min_cell.x; x <= max_cell.x; x++)
+		{
+			u32 cell_index = y * h_cells + x;
+			for (u32 j = cell_start[cell_index]; j < cell_start[cell_index + 1]; j++)
+			{
+				u32 segment = cell_segments[j];
+				if (segment_stamps[segment] != stamp)
+				{
+					segment_stamps[segment] = stamp;
+					OccluderSegment clipped = segments[segment];
+					if (clip_segment(clipped, min, max))
+						sweep_segments.push_back(clipped);
+				}
+			}
+		}
+	}
+
+	// Orient the segments counter-clockwise around the observer; segments seen edge-on hide nothing
+	for (u32 i = 0; i < sweep_segments.size(); i++)
+	{
+		OccluderSegment& segment = sweep_segments[i];
+		f32 orientation = cross(segment.a - pos, segment.b - pos);
+		if (std::abs(orientation) < 1e-9f)
+			continue;
+		if (orientation < 0.0f)
+			std::swap(segment.a, segment.b);
+
+		f32 begin_angle = std::atan2(segment.a.y - pos.y, segment.a.x - pos.x);
+		f32 end_angle = std::atan2(segment.b.y - pos.y, segment.b.x - pos.x);
+		events.emplace_back(begin_angle, i, SweepEventType::Begin);
+		events.emplace_back(end_angle, i, SweepEventType::End);
+
+		// Crosses the start of the sweep
+		if (begin_angle > end_angle)
+			active.push_back(i);
+	}
+
+	// Overlapping shapes have crossing edges. The square edges don't cross anything after the clipping
+	for (u32 i = 4; i < sweep_segments.size(); i++)
+	{
+		for (u32 j = i + 1; j < sweep_segments.size(); j++)
+		{
+			const OccluderSegment& a = sweep_segments[i];
+			const OccluderSegment& b = sweep_segments[j];
+			if (!crosses(a.a, a.b, b))
+				continue;
+
+			glm::vec2 edge = a.b - a.a;
+			glm::vec2 point = a.a + edge * (cross(b.a - a.a, b.b - b.a) / cross(edge, b.b - b.a));
+			events.emplace_back(std::atan2(point.y - pos.y, point.x - pos.x), i, SweepEventType::Crossing);
+		}
+	}
+
+	std::sort(events.begin(), events.end(), [](const SweepEvent& a, const SweepEvent& b) { return a.angle < b.angle; });
+
+	auto get_closest_hit = [&](glm::vec2 dir)
+		{
+			f32 closest = std::numeric_limits<f32>::infinity();
+			for (u32 segment : active)
+				closest = std::min(closest, intersect_ray(pos, dir, sweep_segments[segment]));
+			return closest == std::numeric_limits<f32>::infinity() ? pos : pos + dir * closest;
+		};
+
+	// At every endpoint angle the closest segment before and after the endpoint changes gives the polygon points
+	for (usz i = 0; i < events.size();)
+	{
+		f32 angle = events[i].angle;
+		glm::vec2 dir = { std::cos(angle), std::sin(angle) };
+		glm::vec2 before = get_closest_hit(dir);
+
+		for (; i < events.size() && events[i].angle - angle <= ANGLE_EPSILON; i++)
+		{
+			if (events[i].type == SweepEventType::Begin)
+				active.push_back(events[i].segment);
+			else if (events[i].type == SweepEventType::End)
+				std::erase(active, events[i].segment);
+		}
+
+		glm::vec2 after = get_closest_hit(dir);
+		polygon.push_back(before);
+		if (glm::distance(before, after) > ENDPOINT_EPSILON)
+			polygon.push_back(after);
+	}
+}
+
+void Visibility::can_see(entt::registry& registry, std::span<const std::pair<entt::entity, entt::entity>> pairs, std::span<u8> results)
+{
+	PROFILE_ZONE("Visibility::can_see");
+	miss_queries.clear();
+	miss_indices.clear();
+
+	for (usz i = 0; i < pairs.size(); i++)
+	{
+		// Line of sight is symmetric, both orders share an entry
+		auto [a, b] = pairs[i];
+		if (entt::to_integral(a) > entt::to_integral(b))
+			std::swap(a, b);
+		glm::vec2 from = registry.get<Transform>(a).pos;
+		glm::vec2 to = registry.get<Transform>(b).pos;
+
+		auto it = cache.find(get_pair_key(a, b));
+		if (it != cache.end() && glm::distance(it->second.from, from) <= move_threshold && glm::distance(it->second.to, to) <= move_threshold)
+		{
+			it->second.last_used = update_index;
+			results[i] = it->second.visible;
+			cache_hits++;
+			continue;
+		}
+
+		miss_queries.emplace_back(from, to);
+		miss_indices.push_back(i);
+	}
+
+	cache_misses += miss_queries.size();
+	miss_results.resize(miss_queries.size());
+	has_line_of_sight(miss_queries, miss_results);
+
+	for (usz i = 0; i < miss_indices.size(); i++)
+	{
+		auto [a, b] = pairs[miss_indices[i]];
+		if (entt::to_integral(a) > entt::to_integral(b))
+			std::swap(a, b);
+
+		results[miss_indices[i]] = miss_results[i];
+		cache[get_pair_key(a, b)] = { miss_queries[i].from, miss_queries[i].to, update_index, miss_results[i] != 0 };
+	}
+}
+
+void Visibility::update_observers(entt::registry& registry)
+{
+	if (!registry.ctx().contains<Visibility>())
+		return;
+
+	Visibility& visibility = registry.ctx().get<Visibility>();
+	visibility.update_index++;
+	visibility.apply_tile_changes(registry);
+
+	for (auto [entity, observer, transform] : registry.view<VisibilityObserver, Transform>().each())
+	{
+		if (observer.valid && glm::distance(observer.polygon_pos, transform.pos) <= observer.move_threshold)
+			continue;
+
+		visibility.compute_visibility_polygon(transform.pos, observer.radius, observer.polygon);
+		observer.polygon_pos = transform.pos;
+		observer.valid = true;
+	}
+
+	if (visibility.update_index % CACHE_MAX_AGE == 0)
+	{
+		u32 update_index = visibility.update_index;
+		std::erase_if(visibility.cache, [=](const auto& entry) { return entry.second.last_used + CACHE_MAX_AGE < update_index; });
+	}
+	PROFILE_COUNTER("line of sight cache", visibility.cache.size());
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Map.h"
+
+#include "entt/entt.hpp"
+#include "glm/glm.hpp"
+
+#include <vector>
+#include <span>
+#include <unordered_map>
+
+/// Edge of the map collision geometry that blocks the view
+struct OccluderSegment
+{
+	glm::vec2 a, b;
+};
+
+struct LineOfSightQuery
+{
+	glm::vec2 from, to;
+};
+
+/// Computes the visibility polygon of the entity around its Transform position. The polygon is only recomputed
+/// once the entity moved further than move_threshold from where it was computed
+struct VisibilityObserver
+{
+	VisibilityObserver(f32 radius, f32 move_threshold = 0.25f);
+
+	f32 radius;
+	f32 move_threshold;
+	/// Counter-clockwise around polygon_pos; limited to the square of the radius around it
+	std::vector<glm::vec2> polygon;
+	glm::vec2 polygon_pos;
+	bool valid;
+};
+
+/// Line of sight and visibility queries against the map geometry; one instance lives in the registry context once created with create_visibility.
+/// The occluder segments are the edges of the map collision shapes, stored in a uniform grid so a query only tests the segments near it.
+/// Follows the MapDestruction change log: destroyed tiles rebuild the occluders at the next update_observers, which drops the
+/// cache and recomputes all polygons
+struct Visibility : NoCopy
+{
+	Visibility(const Map& map, const Tileset& tileset);
+
+	static void create_visibility(entt::registry& registry, entt::entity map_entity, const Tileset& tileset);
+
+	/// Visibility polygon by an angular sweep over the segment endpoints around pos
+	void compute_visibility_polygon(glm::vec2 pos, f32 radius, std::vector<glm::vec2>& polygon);
+
+	bool has_line_of_sight(glm::vec2 from, glm::vec2 to);
+	/// Writes 1 for every query with a free line of sight, otherwise 0
+	void has_line_of_sight(std::span<const LineOfSightQuery> queries, std::span<u8> results);
+
+	/// Cached line of sight between the Transform positions of the entities. The cached result is reused
+	/// until one of them moved further than the move threshold from where it was computed
+	void can_see(entt::registry& registry, std::span<const std::pair<entt::entity, entt::entity>> pairs, std::span<u8> results);
+
+	/// Recomputes the polygons of the observers that moved too far and drops the cache entries that weren't used for a while
+	static void update_observers(entt::registry& registry);
+
+	std::vector<OccluderSegment> segments;
+
+	/// Distance an entity may move before its cached line of sight results are recomputed
+	f32 move_threshold;
+	u64 cache_hits, cache_misses;
+
+private:
+	struct CacheEntry
+	{
+		glm::vec2 from, to;
+		u32 last_used;
+		bool visible;
+	};
+
+	/// Calls fn(segment_index) once for every segment in the grid cells the line passes
+	template<typename F>
+	bool for_each_segment_on_line(glm::vec2 from, glm::vec2 to, F&& fn);
+
+	/// Segments of the current map tiles and their grid
+	void build_occluders(const Map& map);
+	/// Rebuilds the occluders if tiles were destroyed or rewound since next_tile_change
+	void apply_tile_changes(entt::registry& registry);
+
+	const Tileset* tileset;
+	/// Index of the next change of the MapDestruction change log
+	u32 next_tile_change;
+	f32 cell_size;
+	u32 h_cells, v_cells;
+	/// Segments of cell i are cell_segments[cell_start[i]] to cell_segments[cell_start[i + 1]]
+	std::vector<u32> cell_start;
+	std::vector<u32> cell_segments;
+	/// Marks the segments tested by the current query
+	std::vector<u32> segment_stamps;
+	u32 stamp;
+
+	std::unordered_map<u64, CacheEntry> cache;
+	u32 update_index;
+
+	/// Reused between queries
+	std::vector<LineOfSightQuery> miss_queries;
+	std::vector<usz> miss_indices;
+	std::vector<u8> miss_results;
+};
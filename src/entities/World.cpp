@@ -1,23 +1,50 @@
 #include "World.h"
 
 #include "Components.h"
+#include "CommandBuffer.h"
 
 #include "Tank.h"
 #include "Map.h"
+#include "MapStreamer.h"
+#include "Navigation.h"
+#include "Visibility.h"
 #include "Projectile.h"
+#include "AnalyticProjectiles.h"
 #include "Particle.h"
+#include "SpatialHash.h"
+#include "MapDestruction.h"
+#include "SystemScheduler.h"
+#include "LagCompensation.h"
 
-World::World()
+#include "engine/Profiler.h"
+
+#include <algorithm>
+
+static b2WorldId create_physics_world()
 {
 	b2WorldDef world_def = b2DefaultWorldDef();
 	world_def.gravity = b2Vec2_zero;
-	physics_world = b2CreateWorld(&world_def);
+	return b2CreateWorld(&world_def);
+}
+
+World::World()
+{
+	physics_world = create_physics_world();
+
+	registry.ctx().emplace<AnalyticProjectiles>(physics_world);
+	registry.ctx().emplace<EntityPools>();
+	registry.ctx().emplace<CommandBuffer>();
+	registry.ctx().emplace<LagCompensation>(physics_world);
+	SpatialHash::create_spatial_hash(registry);
+	registry.ctx().emplace<SystemScheduler>();
 
 	registry.on_construct<Physics>().connect<&World::on_create_physics>(*this);
 	registry.on_destroy<Physics>().connect<&World::on_destroy_physics>(*this);
 
 	this->add_begin_contact_listener<Projectile>(Projectile::on_collision_begin);
 	this->add_end_contact_listener<Projectile>(Projectile::on_collision_end);
+
+	add_systems();
 }
 
 World::~World()
@@ -26,161 +53,250 @@ World::~World()
 	b2DestroyWorld(physics_world);
 }
 
-void World::handle_inputs(f32 delta_time, const Camera& camera)
+void World::handle_inputs(f32 delta_time, CommandSource* commands)
 {
-	TankPlayerController::update_tank(registry, camera, delta_time);
+	PROFILE_ZONE("World::handle_inputs");
+	if (commands)
+		commands->write_inputs(registry, delta_time);
+	Navigation::update_agents(registry, delta_time);
+	TankController::update_tanks(registry, delta_time);
+	registry.ctx().get<CommandBuffer>().flush(registry);
 }
 
 void World::update(f32 delta_time)
 {
-	b2World_Step(physics_world, delta_time, 4);
+	PROFILE_ZONE("World::update");
 
-	b2ContactEvents events = b2World_GetContactEvents(physics_world);
+	SystemScheduler& scheduler = registry.ctx().get<SystemScheduler>();
+	scheduler.run(registry, delta_time);
 
-	for (u32 i = 0; i < events.beginCount; i++)
-	{
-		entt::entity e1 = Physics::get_entity(b2Shape_GetBody(events.beginEvents[i].shapeIdA));
-		entt::entity e2 = Physics::get_entity(b2Shape_GetBody(events.beginEvents[i].shapeIdB));
-		b2Manifold& manifold = events.beginEvents[i].manifold;
+	PROFILE_COUNTER("entities", registry.storage<entt::entity>().free_list());
+	PROFILE_COUNTER("analytic projectiles", registry.ctx().get<AnalyticProjectiles>().size());
+	PROFILE_COUNTER("system parallelism", scheduler.last_frame_ms > 0.0 ? scheduler.last_busy_ms / scheduler.last_frame_ms : 0.0);
+}
+
+void World::add_systems()
+{
+	SystemScheduler& scheduler = registry.ctx().get<SystemScheduler>();
 
-		glm::vec2 pos(0);
-		for (u32 i = 0; i < manifold.pointCount; i++)
+	scheduler.add_system(registry, "physics step", SystemAccess::exclusive(), [this](entt::registry&, f32 delta_time)
 		{
-			pos += glm::vec2(manifold.points[i].point.x, manifold.points[i].point.y);
-		}
-		pos *= (1.0f / (f32)manifold.pointCount);
-		glm::vec2 normal(manifold.normal.x, manifold.normal.y);
+			b2World_Step(physics_world, delta_time, 4);
+		});
+	scheduler.add_system(registry, "contact dispatch", SystemAccess::exclusive(), [this](entt::registry&, f32)
+		{
+			dispatch_contact_events();
+		});
+	// Sync point: apply the changes recorded by the contact listeners
+	scheduler.add_system(registry, "command flush", SystemAccess::exclusive(), [](entt::registry& registry, f32)
+		{
+			registry.ctx().get<CommandBuffer>().flush(registry);
+		});
 
-		for (auto& listener : this->begin_contact_listeners)
+	// The Box2D bodies are modelled as the b2WorldId resource: reading body state is a read, setting it or querying the world a write
+	scheduler.add_system(registry, "Physics::update_components",
+		SystemAccess().read<Physics, Pooled>().write<Transform, Velocity>().read_resource<b2WorldId>(),
+		[](entt::registry& registry, f32) { Physics::update_components(registry); });
+	scheduler.add_system(registry, "SpatialHash::update",
+		SystemAccess().read<Transform, Pooled>().write<SpatialHashed>().write_resource<SpatialHash>(),
+		[](entt::registry& registry, f32) { SpatialHash::update(registry); });
+	scheduler.add_system(registry, "LagCompensation::record",
+		SystemAccess().read<Transform>().write<TransformHistory>().write_resource<LagCompensation>(),
+		[](entt::registry& registry, f32) { LagCompensation::record(registry); });
+	scheduler.add_system(registry, "Projectile::update_projectiles",
+		SystemAccess().read<Physics, Pooled>().write<Projectile, Transform, Velocity>().write_resource<b2WorldId>(),
+		[](entt::registry& registry, f32) { Projectile::update_projectiles(registry); });
+	scheduler.add_system(registry, "AnalyticProjectiles::update_projectiles",
+		SystemAccess().read<Physics, MapDestruction>().write_resource<AnalyticProjectiles, b2WorldId>(),
+		[](entt::registry& registry, f32 delta_time) { AnalyticProjectiles::update_projectiles(registry, delta_time); });
+	scheduler.add_system(registry, "ParticleSystem::update_particles",
+		SystemAccess().read<Transform, Velocity, Pooled>().write<ParticleEmitters>().write_resource<ParticleSystem>(),
+		[](entt::registry& registry, f32 delta_time) { ParticleSystem::update_particles(registry, delta_time); });
+	scheduler.add_system(registry, "Visibility::update_observers",
+		SystemAccess().read<Transform, Map, MapDestruction>().write<VisibilityObserver>().write_resource<Visibility>(),
+		[](entt::registry& registry, f32) { Visibility::update_observers(registry); });
+
+	// Sync point: apply the changes recorded by the systems
+	scheduler.add_system(registry, "command flush", SystemAccess::exclusive(), [](entt::registry& registry, f32)
 		{
-			if (listener.has_component(registry, e1))
-			{
-				listener.callback(registry, e1, e2, pos, normal);
-			}
-			if (listener.has_component(registry, e2))
-			{
-				listener.callback(registry, e2, e1, pos, normal);
-			}
-		}
+			registry.ctx().get<CommandBuffer>().flush(registry);
+		});
+}
+
+void World::get_touching_contacts(std::vector<ContactPair>& contacts)
+{
+	// A rebuilt world only has contacts again after the next step
+	if (contacts_rewound)
+	{
+		contacts.insert(contacts.end(), rewound_contacts.begin(), rewound_contacts.end());
+		return;
 	}
 
-	for (u32 i = 0; i < events.endCount; i++)
+	collect_touching_contacts(touching_contacts);
+	for (const b2ContactData& contact : touching_contacts)
+		contacts.push_back({ contact.shapeIdA, contact.shapeIdB });
+}
+
+/// Orders by shape index first; the generation separates shapes that reused an index
+static bool shape_less(b2ShapeId a, b2ShapeId b)
+{
+	return a.index1 != b.index1 ? a.index1 < b.index1 : a.generation < b.generation;
+}
+
+static bool contact_pair_less(const ContactPair& a, const ContactPair& b)
+{
+	if (!B2_ID_EQUALS(a.shape_a, b.shape_a))
+		return shape_less(a.shape_a, b.shape_a);
+	return shape_less(a.shape_b, b.shape_b);
+}
+
+void World::rewind_contacts(std::span<const ContactPair> touching)
+{
+	rewound_contacts.assign(touching.begin(), touching.end());
+	for (ContactPair& pair : rewound_contacts)
 	{
-		// Removed entities in contact still create end events. Make sure the shapes are still valid
-		if (!b2Shape_IsValid(events.endEvents[i].shapeIdA) || !b2Shape_IsValid(events.endEvents[i].shapeIdB))
-			continue;
+		if (shape_less(pair.shape_b, pair.shape_a))
+			std::swap(pair.shape_a, pair.shape_b);
+	}
+	std::sort(rewound_contacts.begin(), rewound_contacts.end(), contact_pair_less);
+	contacts_rewound = true;
+}
 
-		entt::entity e1 = Physics::get_entity(b2Shape_GetBody(events.endEvents[i].shapeIdA));
-		entt::entity e2 = Physics::get_entity(b2Shape_GetBody(events.endEvents[i].shapeIdB));
+void World::recreate_physics_world()
+{
+	b2DestroyWorld(physics_world);
+	physics_world = create_physics_world();
+	registry.ctx().get<AnalyticProjectiles>().physics_world = physics_world;
+	registry.ctx().get<LagCompensation>().physics_world = physics_world;
+}
+
+void World::collect_touching_contacts(std::vector<b2ContactData>& contacts)
+{
+	contacts.clear();
+	for (auto [entity, physics] : registry.view<Physics>(entt::exclude<Pooled>).each())
+	{
+		if (!physics.dynamic)
+			continue;
 
-		for (auto& listener : this->end_contact_listeners)
+		body_contacts.resize(b2Body_GetContactCapacity(physics.body));
+		u32 count = b2Body_GetContactData(physics.body, body_contacts.data(), (int)body_contacts.size());
+		for (u32 i = 0; i < count; i++)
 		{
-			if (listener.has_component(registry, e1))
-			{
-				listener.callback(registry, e1, e2);
-			}
-			if (listener.has_component(registry, e2))
+			b2ContactData& contact = body_contacts[i];
+			if (!b2Shape_AreContactEventsEnabled(contact.shapeIdA) && !b2Shape_AreContactEventsEnabled(contact.shapeIdB))
+				continue;
+
+			// Both dynamic bodies of a contact list it; it is kept at the lower entity
+			b2BodyId body_a = b2Shape_GetBody(contact.shapeIdA);
+			b2BodyId other = B2_ID_EQUALS(body_a, physics.body) ? b2Shape_GetBody(contact.shapeIdB) : body_a;
+			if (b2Body_GetType(other) != b2_staticBody && Physics::get_entity(other) < entity)
+				continue;
+
+			if (shape_less(contact.shapeIdB, contact.shapeIdA))
 			{
-				listener.callback(registry, e2, e1);
+				std::swap(contact.shapeIdA, contact.shapeIdB);
+				contact.manifold.normal = b2Neg(contact.manifold.normal);
 			}
+			contacts.push_back(contact);
 		}
 	}
+}
+
+void World::dispatch_contact_events()
+{
+	if (contacts_rewound)
+	{
+		dispatch_rewound_contacts();
+		return;
+	}
+
+	b2ContactEvents events = b2World_GetContactEvents(physics_world);
+	PROFILE_COUNTER("contact begin events", events.beginCount);
+
+	for (u32 i = 0; i < events.beginCount; i++)
+		dispatch_begin_contact(events.beginEvents[i].shapeIdA, events.beginEvents[i].shapeIdB, events.beginEvents[i].manifold);
 
-	Physics::update_components(registry);
-	Projectile::update_projectiles(registry);
-	TankRenderable::update_track_animation(registry, delta_time);
-	Particle::update_animations(registry, delta_time);
+	for (u32 i = 0; i < events.endCount; i++)
+		dispatch_end_contact(events.endEvents[i].shapeIdA, events.endEvents[i].shapeIdB);
 }
 
-void World::render(Graphics& graphics)
+void World::dispatch_rewound_contacts()
 {
-	MapRenderable::render_map(registry, graphics);
-	TankRenderable::render_tanks(registry, graphics);
-	ProjectileRenderable::render_projectiles(registry, graphics);
-	Particle::render_particles(registry, graphics);
+	PROFILE_ZONE("World::dispatch_rewound_contacts");
+	contacts_rewound = false;
+
+	// The events of the step are relative to the contacts Box2D had before the restore; they are replaced by the difference
+	// between the rewound contacts and the contacts touching now
+	collect_touching_contacts(touching_contacts);
+	auto pair_of = [](const b2ContactData& contact) { return ContactPair{ contact.shapeIdA, contact.shapeIdB }; };
+	std::sort(touching_contacts.begin(), touching_contacts.end(), [&](const b2ContactData& a, const b2ContactData& b)
+		{
+			return contact_pair_less(pair_of(a), pair_of(b));
+		});
 
-	if (physics_debug_draw)
+	for (const b2ContactData& contact : touching_contacts)
 	{
-		Rect camera_box = graphics.camera.get_bounding_rect();
-		physics_debug_draw->drawingBounds = b2AABB(
-			b2Vec2(camera_box.x, camera_box.y),
-			b2Vec2(camera_box.x + camera_box.width, camera_box.y + camera_box.height)
-		);
-		physics_debug_draw->context = (void*)&graphics;
-
-		b2World_Draw(physics_world, physics_debug_draw.get());
+		if (!std::binary_search(rewound_contacts.begin(), rewound_contacts.end(), pair_of(contact), contact_pair_less))
+			dispatch_begin_contact(contact.shapeIdA, contact.shapeIdB, contact.manifold);
 	}
+
+	for (const ContactPair& pair : rewound_contacts)
+	{
+		auto it = std::lower_bound(touching_contacts.begin(), touching_contacts.end(), pair, [&](const b2ContactData& contact, const ContactPair& pair)
+			{
+				return contact_pair_less(pair_of(contact), pair);
+			});
+		if (it == touching_contacts.end() || contact_pair_less(pair, pair_of(*it)))
+			dispatch_end_contact(pair.shape_a, pair.shape_b);
+	}
+	rewound_contacts.clear();
 }
 
-Color color_from_b2_hex(b2HexColor color)
+void World::dispatch_begin_contact(b2ShapeId shape_a, b2ShapeId shape_b, const b2Manifold& manifold)
 {
-	f32 r = ((color >> 16) & 0xFF) / 255.0f;
-	f32 g = ((color >> 8) & 0xFF) / 255.0f;
-	f32 b = (color & 0xFF) / 255.0f;
-	return { r, g, b, 1.0f };
+	entt::entity e1 = Physics::get_entity(b2Shape_GetBody(shape_a));
+	entt::entity e2 = Physics::get_entity(b2Shape_GetBody(shape_b));
+
+	glm::vec2 pos(0);
+	for (u32 i = 0; i < manifold.pointCount; i++)
+	{
+		pos += glm::vec2(manifold.points[i].point.x, manifold.points[i].point.y);
+	}
+	pos *= (1.0f / (f32)manifold.pointCount);
+	glm::vec2 normal(manifold.normal.x, manifold.normal.y);
+
+	for (auto& listener : this->begin_contact_listeners)
+	{
+		if (listener.has_component(registry, e1))
+		{
+			listener.callback(registry, e1, e2, pos, normal);
+		}
+		if (listener.has_component(registry, e2))
+		{
+			listener.callback(registry, e2, e1, pos, normal);
+		}
+	}
 }
 
-void World::set_physics_debug_draw_enabled(bool enabled)
+void World::dispatch_end_contact(b2ShapeId shape_a, b2ShapeId shape_b)
 {
-	if ((physics_debug_draw.get() != nullptr) == enabled)
+	// Removed entities in contact still create end events. Make sure the shapes are still valid
+	if (!b2Shape_IsValid(shape_a) || !b2Shape_IsValid(shape_b))
 		return;
-	if (enabled)
-	{
-		physics_debug_draw = std::make_unique<b2DebugDraw>(b2DefaultDebugDraw());
-		physics_debug_draw->DrawCircleFcn = [](b2Vec2 center, f32 radius, b2HexColor color, void* context)
-			{
-				Graphics* graphics = static_cast<Graphics*>(context);
-				graphics->draw_circle(glm::vec2(center.x, center.y), radius, color_from_b2_hex(color));
-			};
-		physics_debug_draw->DrawPointFcn = [](b2Vec2 p, f32 size, b2HexColor color, void* context)
-			{
-				Graphics* graphics = static_cast<Graphics*>(context);
-				graphics->fill_circle(glm::vec2(p.x, p.y), size * 0.5f, color_from_b2_hex(color));
-			};
-		physics_debug_draw->DrawPolygonFcn = [](const b2Vec2* vertices, s32 vertex_count, b2HexColor color, void* context)
-			{
-				std::vector<glm::vec2> polygon;
-				for (s32 i = 0; i < vertex_count; i++)
-					polygon.emplace_back(vertices[i].x, vertices[i].y);
-				Graphics* graphics = static_cast<Graphics*>(context);
-				graphics->draw_polygon(polygon, color_from_b2_hex(color));
-			};
-		physics_debug_draw->DrawSegmentFcn = [](b2Vec2 p1, b2Vec2 p2, b2HexColor color, void* context)
-			{
-				Graphics* graphics = static_cast<Graphics*>(context);
-				graphics->draw_line({ p1.x, p1.y }, { p2.x, p2.y }, color_from_b2_hex(color));
-			};
-		physics_debug_draw->DrawSolidCircleFcn = [](b2Transform transform, float radius, b2HexColor color, void* context)
-			{
-				Graphics* graphics = static_cast<Graphics*>(context);
-				graphics->fill_circle(glm::vec2(transform.p.x, transform.p.y), radius, color_from_b2_hex(color));
-			};
-		physics_debug_draw->DrawSolidPolygonFcn = [](b2Transform transform, const b2Vec2* vertices, int vertex_count, float radius, b2HexColor color, void* context)
-			{
-				std::vector<glm::vec2> polygon;
-				for (s32 i = 0; i < vertex_count; i++)
-				{
-					polygon.emplace_back(
-						transform.p.x + vertices[i].x * transform.q.c - vertices[i].y * transform.q.s, 
-						transform.p.y + vertices[i].x * transform.q.s + vertices[i].y * transform.q.c);
-				}
-				Graphics* graphics = static_cast<Graphics*>(context);
-				graphics->fill_polygon(polygon, color_from_b2_hex(color));
-			};
-		physics_debug_draw->drawShapes = true;
-		/*
-		* // TODO: maybe implement someday
-		physics_debug_draw->DrawSolidCapsuleFcn = [](b2Vec2 p1, b2Vec2 p2, f32 radius, b2HexColor color, void* context)
-			{
-			};
-		physics_debug_draw->DrawStringFcn = [](b2Vec2 p, const char* s, b2HexColor color, void* context)
-			{
-			};
-		*/
-	}
-	else
+
+	entt::entity e1 = Physics::get_entity(b2Shape_GetBody(shape_a));
+	entt::entity e2 = Physics::get_entity(b2Shape_GetBody(shape_b));
+
+	for (auto& listener : this->end_contact_listeners)
 	{
-		physics_debug_draw.reset();
+		if (listener.has_component(registry, e1))
+		{
+			listener.callback(registry, e1, e2);
+		}
+		if (listener.has_component(registry, e2))
+		{
+			listener.callback(registry, e2, e1);
+		}
 	}
 }
 
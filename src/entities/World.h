@@ -4,9 +4,13 @@
 #include "box2d/box2d.h"
 
 #include "engine/Types.h"
-#include "engine/Graphics.h"
+
+#include "EntityPool.h"
+#include "CommandSource.h"
 
 #include <functional>
+#include <span>
+#include <vector>
 
 enum class CollisionListenerType : u32
 {
@@ -39,28 +43,32 @@ struct EndContactListener
 };
 
 
+/// Two shapes touching each other; the shape with the lower index is shape_a
+struct ContactPair
+{
+	b2ShapeId shape_a;
+	b2ShapeId shape_b;
+};
+
+
 struct World : NoCopy 
 {
 	World();
 	~World();
 
-	/// Handles player input
-	void handle_inputs(f32 delta_time, const Camera& camera);
+	/// Writes the tank inputs of the command source (if any), steers the NavAgents and drives the tanks from their TankController inputs
+	void handle_inputs(f32 delta_time, CommandSource* commands = nullptr);
 
-	/// Updates the world with the delta time step (last frame time)
+	/// Updates the world with the delta time step (last frame time). Runs the systems added in the constructor on the
+	/// SystemScheduler in the registry context, independent systems run in parallel
 	void update(f32 delta_time);
 
-	/// Draws the entities using the Graphics instance
-	void render(Graphics& graphics);
-
-	/// Enables or disables the physics debug draw. The debug is drawn on render(Graphics&) after the entities have been rendered
-	void set_physics_debug_draw_enabled(bool enabled);
-
 	/// Registers a listener for receiving collision callbacks
 	/// The returned ListenerID can be used to unregister the callback
 	/// type_contact_begin specified whether the callback should be invoked on contact begin or on contact end.
 	/// The template Types specify which components an entity need to have for the callback to be invoked.
 	/// The second callback argument (first entity) always has all template types as components
+	/// Entities parked in an EntityPool never receive callbacks
 	/// If both entities in contact have all component types, the callback is called twice where both entities are the first (entity) argument once.
 	template <typename... Types>
 	CollisionListenerID add_begin_contact_listener(std::function<void(entt::registry&, entt::entity component_entity, entt::entity other_entity, glm::vec2 pos, glm::vec2 normal)> listener)
@@ -70,7 +78,7 @@ struct World : NoCopy
 				id,
 				[](entt::registry& registry, entt::entity entity)
 				{
-					return registry.all_of<Types...>(entity);
+					return registry.all_of<Types...>(entity) && !registry.all_of<Pooled>(entity);
 				}, listener);
 		return id;
 	}
@@ -83,7 +91,7 @@ struct World : NoCopy
 			id,
 			[](entt::registry& registry, entt::entity entity)
 			{
-				return registry.all_of<Types...>(entity);
+				return registry.all_of<Types...>(entity) && !registry.all_of<Pooled>(entity);
 			}, listener);
 		return id;
 	}
@@ -97,16 +105,47 @@ struct World : NoCopy
 			std::erase_if(this->end_contact_listeners, [=](auto& l) { return l.id.value == id.value; });
 	}
 
+	/// Appends the touching shape pairs of the bodies that aren't pooled, once per pair. Only contacts that report events
+	/// (either shape has contact events enabled) are listed. Until the next update after rewind_contacts, the rewound contacts
+	void get_touching_contacts(std::vector<ContactPair>& contacts);
+
+	/// The contact dispatch of the next update reports the changes from these touching contacts to the contacts touching after the
+	/// physics step instead of the events of the step. Used after the physics world was rebuilt (see WorldSnapshot): Box2D has no
+	/// contacts until the next step, the listeners need the events relative to the restored state
+	void rewind_contacts(std::span<const ContactPair> touching);
+
+	/// Destroys the Box2D world with all bodies and creates an empty one. The Physics components keep the ids of the destroyed
+	/// bodies until the caller creates them again; used by WorldSnapshot to rebuild the bodies in a canonical order
+	void recreate_physics_world();
+
 	entt::registry registry;
 	b2WorldId physics_world;
 
 private:
 	static CollisionListenerID next_listener_ID(CollisionListenerType type);
 
+	/// Adds the systems of update to the SystemScheduler; conflicting systems run in the order they are added
+	void add_systems();
+
+	/// Invokes the collision listeners for the contact events of the last physics step
+	void dispatch_contact_events();
+	/// Invokes the collision listeners for the changes to the rewound contacts
+	void dispatch_rewound_contacts();
+	void dispatch_begin_contact(b2ShapeId shape_a, b2ShapeId shape_b, const b2Manifold& manifold);
+	void dispatch_end_contact(b2ShapeId shape_a, b2ShapeId shape_b);
+	/// The touching contacts with the shapes ordered like in a ContactPair (the normal is flipped with them)
+	void collect_touching_contacts(std::vector<b2ContactData>& contacts);
+
 	void on_create_physics(entt::registry& registry, entt::entity entity);
 	void on_destroy_physics(entt::registry& registry, entt::entity entity);
 
-	std::unique_ptr<b2DebugDraw> physics_debug_draw;
 	std::vector<BeginContactListener> begin_contact_listeners;
 	std::vector<EndContactListener> end_contact_listeners;
+
+	/// Sorted; only used by the dispatch if contacts_rewound
+	std::vector<ContactPair> rewound_contacts;
+	bool contacts_rewound = false;
+	/// Reused between collections
+	std::vector<b2ContactData> touching_contacts;
+	std::vector<b2ContactData> body_contacts;
 };
\ No newline at end of file
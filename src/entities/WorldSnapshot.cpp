@@ -0,0 +1,600 @@
+#include "WorldSnapshot.h"
+
+#include "CommandBuffer.h"
+#include "MapDestruction.h"
+#include "MapStreamer.h"
+
+#include "engine/Memory.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+using EntityTraits = entt::entt_traits<entt::entity>;
+
+/// Components of entities that kept them get the saved values, except for the state other systems manage
+template<typename T>
+static void assign_component(T& component, const T& saved)
+{
+	component = saved;
+}
+
+static void assign_component(Physics&, const Physics&)
+{
+	// The body is restored with the bodies
+}
+
+static void assign_component(SpatialHashed& component, const SpatialHashed& saved)
+{
+	component.category = saved.category;
+}
+
+/// Components emplaced again start like new ones where other systems manage their state
+template<typename T>
+static const T& construct_component(const T& saved)
+{
+	return saved;
+}
+
+static Physics construct_component(const Physics& saved)
+{
+	return Physics(saved.dynamic);
+}
+
+static SpatialHashed construct_component(const SpatialHashed& saved)
+{
+	return SpatialHashed(saved.category);
+}
+
+template<typename... Types>
+static bool is_any_of(entt::id_type id)
+{
+	return ((id == entt::type_hash<Types>::value()) || ...);
+}
+
+static bool is_saved_component(entt::id_type id)
+{
+	return is_any_of<Transform, Velocity, Physics, SpatialHashed, Tank, TankController, Projectile, NavAgent, ParticleEmitters,
+		TransformHistory, VisibilityObserver, Pooled>(id);
+}
+
+template<typename T>
+static usz vector_bytes(const std::vector<T>& vector)
+{
+	return vector.capacity() * sizeof(T);
+}
+
+template<typename T>
+void ComponentSnapshot<T>::reserve(u32 count)
+{
+	entities.reserve(count);
+	if constexpr (!std::is_empty_v<T>)
+		values.reserve(count);
+}
+
+template<typename T>
+void ComponentSnapshot<T>::save(const entt::registry& registry)
+{
+	entities.clear();
+	const auto* storage = registry.storage<T>();
+	if (!storage)
+		return;
+
+	if constexpr (std::is_empty_v<T>)
+	{
+		for (auto [entity] : storage->each())
+			entities.push_back(entity);
+	}
+	else
+	{
+		for (auto [entity, component] : storage->each())
+		{
+			if (entities.size() < values.size())
+				values[entities.size()] = component;
+			else
+				values.push_back(component);
+			entities.push_back(entity);
+		}
+	}
+}
+
+template<typename T>
+void ComponentSnapshot<T>::restore(entt::registry& registry) const
+{
+	auto& storage = registry.storage<T>();
+	entt::sparse_set& set = storage;
+
+	// The saved entities that still have the component are moved to the front, the entities behind them didn't have it
+	auto unsaved = set.sort_as(entities.begin(), entities.end());
+	ScratchScope scratch;
+	ArenaVector<entt::entity> removed(unsaved, set.end(), scratch.allocator<entt::entity>());
+	registry.remove<T>(removed.begin(), removed.end());
+
+	bool emplaced = false;
+	for (usz i = 0; i < entities.size(); i++)
+	{
+		if constexpr (std::is_empty_v<T>)
+		{
+			if (!storage.contains(entities[i]))
+			{
+				registry.emplace<T>(entities[i]);
+				emplaced = true;
+			}
+		}
+		else if (storage.contains(entities[i]))
+		{
+			assign_component(storage.get(entities[i]), values[i]);
+		}
+		else
+		{
+			registry.emplace<T>(entities[i], construct_component(values[i]));
+			emplaced = true;
+		}
+	}
+
+	if (emplaced)
+		set.sort_as(entities.begin(), entities.end());
+}
+
+WorldSnapshot::WorldSnapshot()
+	: last_save_ms(0.0), last_restore_ms(0.0), saved(false), world(nullptr), alive_count(0), projectile_pool{},
+	analytic_projectiles(b2_nullWorldId), lag_compensation_tick(0), max_moves{}, navigation_update_index(0)
+{
+}
+
+void WorldSnapshot::reserve(u32 entity_count, u32 contact_count)
+{
+	entities.reserve(entity_count);
+	alive_by_index.reserve(entity_count);
+	destroyed.reserve(entity_count);
+	created.reserve(entity_count);
+
+	transforms.reserve(entity_count);
+	velocities.reserve(entity_count);
+	physics.reserve(entity_count);
+	spatial_hashed.reserve(entity_count);
+	tanks.reserve(entity_count);
+	tank_controllers.reserve(entity_count);
+	projectiles.reserve(entity_count);
+	nav_agents.reserve(entity_count);
+	particle_emitters.reserve(entity_count);
+	transform_histories.reserve(entity_count);
+	visibility_observers.reserve(entity_count);
+	pooled.reserve(entity_count);
+
+	bodies.reserve(entity_count);
+	shapes.reserve(entity_count);
+	body_by_index.reserve(entity_count);
+	rebuilt_shapes.reserve(entity_count);
+	projectile_pool.free_entities.reserve(entity_count);
+
+	contacts.reserve(contact_count);
+	touching_contacts.reserve(contact_count);
+	restored_contacts.reserve(contact_count);
+}
+
+void WorldSnapshot::save(World& world)
+{
+	PROFILE_ZONE("WorldSnapshot::save");
+	auto start = std::chrono::steady_clock::now();
+
+	entt::registry& registry = world.registry;
+	if (registry.ctx().get<CommandBuffer>().size() != 0)
+		throw std::runtime_error("WorldSnapshot: can't save with commands in the CommandBuffer");
+	if (!registry.view<MapStreamer>().empty())
+		throw std::runtime_error("WorldSnapshot: can't save a world with a MapStreamer");
+
+	saved = false;
+	this->world = &world;
+
+	save_entities(registry);
+	transforms.save(registry);
+	velocities.save(registry);
+	physics.save(registry);
+	spatial_hashed.save(registry);
+	tanks.save(registry);
+	tank_controllers.save(registry);
+	projectiles.save(registry);
+	nav_agents.save(registry);
+	particle_emitters.save(registry);
+	transform_histories.save(registry);
+	visibility_observers.save(registry);
+	pooled.save(registry);
+	save_bodies(registry);
+	save_contacts(world);
+	save_resources(registry);
+
+	saved = true;
+	last_save_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void WorldSnapshot::save_entities(const entt::registry& registry)
+{
+	const auto& entity_storage = *registry.storage<entt::entity>();
+	entities.assign(entity_storage.data(), entity_storage.data() + entity_storage.size());
+	alive_count = (u32)entity_storage.free_list();
+
+	alive_by_index.assign(entities.size(), entt::null);
+	for (u32 i = 0; i < alive_count; i++)
+		alive_by_index[EntityTraits::to_entity(entities[i])] = entities[i];
+
+	// Components of other types would be lost if their entity was created again
+	pinned.clear();
+	for (auto [id, storage] : registry.storage())
+	{
+		if (is_saved_component(id))
+			continue;
+		pinned.insert(pinned.end(), storage.begin(), storage.end());
+	}
+	std::sort(pinned.begin(), pinned.end());
+	pinned.erase(std::unique(pinned.begin(), pinned.end()), pinned.end());
+}
+
+static void save_shape(b2ShapeId shape, SavedShape& saved)
+{
+	saved.type = b2Shape_GetType(shape);
+	if (saved.type == b2_polygonShape)
+		saved.polygon = b2Shape_GetPolygon(shape);
+	else if (saved.type == b2_circleShape)
+		saved.circle = b2Shape_GetCircle(shape);
+	else
+		throw std::runtime_error("WorldSnapshot: dynamic bodies can only have polygon and circle shapes");
+
+	saved.filter = b2Shape_GetFilter(shape);
+	saved.density = b2Shape_GetDensity(shape);
+	saved.friction = b2Shape_GetFriction(shape);
+	saved.restitution = b2Shape_GetRestitution(shape);
+	saved.contact_events = b2Shape_AreContactEventsEnabled(shape);
+}
+
+void WorldSnapshot::save_bodies(entt::registry& registry)
+{
+	bodies.clear();
+	shapes.clear();
+	body_by_index.assign(alive_by_index.size(), 0);
+	for (auto [entity, component] : registry.view<Physics>().each())
+	{
+		// Static bodies only change with the map destruction, which is rewound; restore creates them from the map
+		if (!component.dynamic)
+		{
+			if (!registry.all_of<Map, MapDestruction>(entity))
+				throw std::runtime_error("WorldSnapshot: static bodies other than map bodies can't be saved");
+			continue;
+		}
+
+		b2BodyId body = component.body;
+		body_by_index[EntityTraits::to_entity(entity)] = (u32)bodies.size();
+		SavedBody& saved_body = bodies.emplace_back();
+		saved_body.entity = entity;
+		saved_body.transform = b2Body_GetTransform(body);
+		saved_body.linear_velocity = b2Body_GetLinearVelocity(body);
+		saved_body.angular_velocity = b2Body_GetAngularVelocity(body);
+		saved_body.linear_damping = b2Body_GetLinearDamping(body);
+		saved_body.angular_damping = b2Body_GetAngularDamping(body);
+		saved_body.enabled = b2Body_IsEnabled(body);
+		saved_body.awake = b2Body_IsAwake(body);
+		saved_body.sleep_enabled = b2Body_IsSleepEnabled(body);
+		saved_body.bullet = b2Body_IsBullet(body);
+		saved_body.fixed_rotation = b2Body_IsFixedRotation(body);
+
+		body_shapes.resize(b2Body_GetShapeCount(body));
+		b2Body_GetShapes(body, body_shapes.data(), (int)body_shapes.size());
+		saved_body.first_shape = (u32)shapes.size();
+		saved_body.shape_count = (u32)body_shapes.size();
+		for (b2ShapeId shape : body_shapes)
+			save_shape(shape, shapes.emplace_back());
+	}
+}
+
+void WorldSnapshot::save_contacts(World& world)
+{
+	touching_contacts.clear();
+	world.get_touching_contacts(touching_contacts);
+
+	contacts.clear();
+	for (const ContactPair& pair : touching_contacts)
+		contacts.push_back({ save_contact_shape(pair.shape_a), save_contact_shape(pair.shape_b) });
+}
+
+SavedContactShape WorldSnapshot::save_contact_shape(b2ShapeId shape)
+{
+	b2BodyId body = b2Shape_GetBody(shape);
+	entt::entity entity = Physics::get_entity(body);
+	if (b2Body_GetType(body) == b2_staticBody)
+		return { entity, MapDestruction::get_shape_index(shape), true };
+
+	const SavedBody& saved_body = bodies[body_by_index[EntityTraits::to_entity(entity)]];
+	body_shapes.resize(b2Body_GetShapeCount(body));
+	b2Body_GetShapes(body, body_shapes.data(), (int)body_shapes.size());
+	u32 index = (u32)(std::find_if(body_shapes.begin(), body_shapes.end(), [&](b2ShapeId other) { return B2_ID_EQUALS(other, shape); }) -
+		body_shapes.begin());
+	assert(index < saved_body.shape_count);
+	return { entity, saved_body.first_shape + index, false };
+}
+
+void WorldSnapshot::save_resources(entt::registry& registry)
+{
+	const EntityPool& pool = registry.ctx().get<EntityPools>().projectiles;
+	projectile_pool.free_entities = pool.free_entities;
+	projectile_pool.active = pool.active;
+	projectile_pool.created = pool.created;
+	projectile_pool.recycled = pool.recycled;
+	projectile_pool.released = pool.released;
+
+	analytic_projectiles.copy_projectiles(registry.ctx().get<AnalyticProjectiles>());
+
+	if (const TankIds* ids = registry.ctx().find<TankIds>())
+		tank_ids = *ids;
+	else
+		tank_ids.reset();
+
+	const LagCompensation& lag_compensation = registry.ctx().get<LagCompensation>();
+	lag_compensation_tick = lag_compensation.tick;
+	max_moves = lag_compensation.max_moves;
+
+	navigation_queue.clear();
+	navigation_update_index = 0;
+	if (const Navigation* navigation = registry.ctx().find<Navigation>())
+	{
+		navigation_queue = navigation->queue;
+		navigation_update_index = navigation->update_index;
+	}
+
+	map_changes.clear();
+	for (auto [entity, destruction] : registry.view<MapDestruction>().each())
+		map_changes.emplace_back(entity, (u32)destruction.change_log.size());
+}
+
+void WorldSnapshot::restore(World& world)
+{
+	PROFILE_ZONE("WorldSnapshot::restore");
+	auto start = std::chrono::steady_clock::now();
+
+	if (!saved)
+		throw std::runtime_error("WorldSnapshot: nothing saved to restore");
+	if (this->world != &world)
+		throw std::runtime_error("WorldSnapshot: can only restore the World it saved");
+
+	entt::registry& registry = world.registry;
+	if (registry.ctx().get<CommandBuffer>().size() != 0)
+		throw std::runtime_error("WorldSnapshot: can't restore with commands in the CommandBuffer");
+
+	restore_entities(registry);
+
+	// Transforms and velocities first: emplaced Physics create their bodies from them (until rebuild_physics replaces all bodies)
+	transforms.restore(registry);
+	velocities.restore(registry);
+	physics.restore(registry);
+	spatial_hashed.restore(registry);
+	tanks.restore(registry);
+	tank_controllers.restore(registry);
+	projectiles.restore(registry);
+	nav_agents.restore(registry);
+	particle_emitters.restore(registry);
+	transform_histories.restore(registry);
+	visibility_observers.restore(registry);
+	pooled.restore(registry);
+	restore_resources(registry);
+
+	rebuild_physics(world);
+	restore_contacts(world);
+
+	last_restore_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+void WorldSnapshot::restore_entities(entt::registry& registry)
+{
+	auto& entity_storage = registry.storage<entt::entity>();
+
+	// Entities created since the save (also on the index of a saved one) are destroyed, the destroyed ones are created again
+	destroyed.clear();
+	created.clear();
+	for (auto [entity] : entity_storage.each())
+	{
+		u32 index = EntityTraits::to_entity(entity);
+		if (index >= alive_by_index.size() || alive_by_index[index] != entity)
+			destroyed.push_back(entity);
+	}
+	for (u32 i = 0; i < alive_count; i++)
+	{
+		if (registry.valid(entities[i]))
+			continue;
+		if (std::binary_search(pinned.begin(), pinned.end(), entities[i]))
+		{
+			throw std::runtime_error("WorldSnapshot: entity " + std::to_string(entt::to_integral(entities[i])) +
+				" was destroyed and had components that aren't saved");
+		}
+		created.push_back(entities[i]);
+	}
+
+	registry.destroy(destroyed.begin(), destroyed.end());
+	for (entt::entity entity : created)
+	{
+		[[maybe_unused]] entt::entity created_entity = registry.create(entity);
+		assert(created_entity == entity);
+	}
+
+	// Same alive entities, now the same order and versions: the alive ones first, then the released ones in the order the
+	// storage hands them out. Identifiers handed out for the first time after the save follow at version 0 in index order, the
+	// order they were handed out in
+	for (usz pos = 0; pos < entity_storage.size(); pos++)
+	{
+		entt::entity entity = pos < entities.size() ? entities[pos] : EntityTraits::construct((EntityTraits::entity_type)pos, 0);
+		entt::entity in_storage = EntityTraits::construct(EntityTraits::to_entity(entity), entity_storage.current(entity));
+		if (entity_storage.data()[pos] != in_storage)
+			entity_storage.swap_elements(entity_storage.data()[pos], in_storage);
+		if (in_storage != entity)
+			entity_storage.bump(entity);
+	}
+	entity_storage.free_list(alive_count);
+}
+
+static b2ShapeId create_shape(b2BodyId body, const SavedShape& saved)
+{
+	b2ShapeDef shape_def = b2DefaultShapeDef();
+	shape_def.density = saved.density;
+	shape_def.material.friction = saved.friction;
+	shape_def.material.restitution = saved.restitution;
+	shape_def.filter = saved.filter;
+	shape_def.enableContactEvents = saved.contact_events;
+	// The mass is set once all shapes are created
+	shape_def.updateBodyMass = false;
+
+	if (saved.type == b2_polygonShape)
+		return b2CreatePolygonShape(body, &shape_def, &saved.polygon);
+	return b2CreateCircleShape(body, &shape_def, &saved.circle);
+}
+
+void WorldSnapshot::restore_resources(entt::registry& registry)
+{
+	EntityPool& pool = registry.ctx().get<EntityPools>().projectiles;
+	pool.free_entities = projectile_pool.free_entities;
+	pool.active = projectile_pool.active;
+	pool.created = projectile_pool.created;
+	pool.recycled = projectile_pool.recycled;
+	pool.released = projectile_pool.released;
+
+	registry.ctx().get<AnalyticProjectiles>().copy_projectiles(analytic_projectiles);
+
+	if (tank_ids)
+		registry.ctx().insert_or_assign(*tank_ids);
+	else
+		registry.ctx().erase<TankIds>();
+
+	LagCompensation& lag_compensation = registry.ctx().get<LagCompensation>();
+	lag_compensation.tick = lag_compensation_tick;
+	lag_compensation.max_moves = max_moves;
+
+	if (Navigation* navigation = registry.ctx().find<Navigation>())
+	{
+		navigation->queue = navigation_queue;
+		navigation->update_index = navigation_update_index;
+	}
+
+	for (auto [entity, change_count] : map_changes)
+	{
+		if (!registry.valid(entity))
+			continue;
+		const MapDestruction* destruction = registry.try_get<MapDestruction>(entity);
+		if (destruction && destruction->change_log.size() > change_count)
+			MapDestruction::rewind(registry, entity, change_count);
+	}
+}
+
+void WorldSnapshot::rebuild_physics(World& world)
+{
+	PROFILE_ZONE("WorldSnapshot::rebuild_physics");
+	entt::registry& registry = world.registry;
+	world.recreate_physics_world();
+
+	// Ids come from the pools of the new world: the same bodies and shapes created in the same order get the same ids.
+	// The map bodies first, in the order the restore sorted the Physics storage into
+	rebuilt_static_bodies.clear();
+	rebuilt_static_shapes.clear();
+	for (auto [entity, component] : registry.view<Physics>().each())
+	{
+		if (component.dynamic)
+			continue;
+
+		b2BodyDef body_def = b2DefaultBodyDef();
+		body_def.type = b2_staticBody;
+		body_def.userData = reinterpret_cast<void*>((usz)entity);
+		if (const Transform* transform = registry.try_get<Transform>(entity))
+		{
+			body_def.position = b2Vec2(transform->pos.x, transform->pos.y);
+			body_def.rotation = b2MakeRot(transform->rot);
+		}
+		component.body = b2CreateBody(world.physics_world, &body_def);
+
+		auto [map, destruction] = registry.get<Map, MapDestruction>(entity);
+		rebuilt_static_bodies.emplace_back(entity, (u32)rebuilt_static_shapes.size());
+		for (u32 i = 0; i < map.collision_shapes.size(); i++)
+			rebuilt_static_shapes.push_back(Map::create_physics_shape(component, map.collision_shapes[i], i));
+		// Destroyed tiles keep the null id
+		for (u32 i = 0; i < destruction.shapes.size(); i++)
+		{
+			if (!B2_IS_NULL(destruction.shapes[i]))
+				destruction.shapes[i] = Map::create_physics_shape(component, destruction.shape_geometry[i], destruction.first_shape_index + i);
+			rebuilt_static_shapes.push_back(destruction.shapes[i]);
+		}
+	}
+
+	rebuilt_shapes.resize(shapes.size());
+	for (const SavedBody& saved_body : bodies)
+	{
+		b2BodyDef body_def = b2DefaultBodyDef();
+		body_def.type = b2_dynamicBody;
+		body_def.position = saved_body.transform.p;
+		body_def.rotation = saved_body.transform.q;
+		body_def.linearVelocity = saved_body.linear_velocity;
+		body_def.angularVelocity = saved_body.angular_velocity;
+		body_def.linearDamping = saved_body.linear_damping;
+		body_def.angularDamping = saved_body.angular_damping;
+		body_def.enableSleep = saved_body.sleep_enabled;
+		body_def.isAwake = saved_body.awake;
+		body_def.isBullet = saved_body.bullet;
+		body_def.fixedRotation = saved_body.fixed_rotation;
+		body_def.isEnabled = saved_body.enabled;
+		body_def.userData = reinterpret_cast<void*>((usz)saved_body.entity);
+
+		b2BodyId body = b2CreateBody(world.physics_world, &body_def);
+		registry.get<Physics>(saved_body.entity).body = body;
+
+		// Bodies list their newest shape first: created in reverse, they are listed in the saved order again
+		for (u32 i = saved_body.first_shape + saved_body.shape_count; i-- > saved_body.first_shape;)
+			rebuilt_shapes[i] = create_shape(body, shapes[i]);
+		b2Body_ApplyMassFromShapes(body);
+	}
+}
+
+b2ShapeId WorldSnapshot::get_rebuilt_shape(const SavedContactShape& saved) const
+{
+	if (!saved.static_body)
+		return rebuilt_shapes[saved.shape];
+
+	auto it = std::find_if(rebuilt_static_bodies.begin(), rebuilt_static_bodies.end(), [&](const auto& body) { return body.first == saved.entity; });
+	assert(it != rebuilt_static_bodies.end());
+	return rebuilt_static_shapes[it->second + saved.shape];
+}
+
+void WorldSnapshot::restore_contacts(World& world)
+{
+	restored_contacts.clear();
+	for (const SavedContact& contact : contacts)
+		restored_contacts.push_back({ get_rebuilt_shape(contact.a), get_rebuilt_shape(contact.b) });
+	world.rewind_contacts(restored_contacts);
+}
+
+WorldSnapshotStats WorldSnapshot::get_stats() const
+{
+	WorldSnapshotStats stats = {};
+	stats.entities = alive_count;
+	stats.bodies = (u32)bodies.size();
+	stats.shapes = (u32)shapes.size();
+	stats.contacts = (u32)contacts.size();
+	stats.analytic_projectiles = (u32)analytic_projectiles.size();
+	stats.bytes = vector_bytes(entities) + vector_bytes(alive_by_index) + vector_bytes(pinned) + vector_bytes(bodies) +
+		vector_bytes(shapes) + vector_bytes(contacts) + vector_bytes(projectile_pool.free_entities) +
+		vector_bytes(navigation_queue) + vector_bytes(map_changes);
+
+	auto add_component = [&](const auto& component) {
+		stats.bytes += vector_bytes(component.entities) + vector_bytes(component.values);
+	};
+	add_component(transforms);
+	add_component(velocities);
+	add_component(physics);
+	add_component(spatial_hashed);
+	add_component(tanks);
+	add_component(tank_controllers);
+	add_component(projectiles);
+	add_component(nav_agents);
+	add_component(particle_emitters);
+	add_component(transform_histories);
+	add_component(visibility_observers);
+	add_component(pooled);
+	return stats;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include "World.h"
+#include "Components.h"
+#include "EntityPool.h"
+#include "Tank.h"
+#include "Projectile.h"
+#include "AnalyticProjectiles.h"
+#include "Navigation.h"
+#include "Particle.h"
+#include "SpatialHash.h"
+#include "LagCompensation.h"
+#include "Visibility.h"
+
+#include "engine/Types.h"
+
+#include "entt/entt.hpp"
+#include "box2d/box2d.h"
+
+#include <vector>
+#include <optional>
+#include <utility>
+
+/// One component type: the entities in storage order and their components
+template<typename T>
+struct ComponentSnapshot
+{
+	void reserve(u32 entities);
+	void save(const entt::registry& registry);
+	/// Removes the component from the entities that didn't have it and emplaces it on the entities that lost it (the signals run),
+	/// assigns the saved values to the rest and sorts the storage into the saved order
+	void restore(entt::registry& registry) const;
+
+	std::vector<entt::entity> entities;
+	/// values[i] belongs to entities[i]. Kept beyond the saved entities, so saves reuse the memory components own (paths, polygons)
+	std::vector<T> values;
+};
+
+struct SavedShape
+{
+	b2ShapeType type;
+	b2Polygon polygon;
+	b2Circle circle;
+	b2Filter filter;
+	f32 density;
+	f32 friction;
+	f32 restitution;
+	bool contact_events;
+};
+
+struct SavedBody
+{
+	entt::entity entity;
+	b2Transform transform;
+	b2Vec2 linear_velocity;
+	f32 angular_velocity;
+	f32 linear_damping;
+	f32 angular_damping;
+	bool enabled;
+	bool awake;
+	bool sleep_enabled;
+	bool bullet;
+	bool fixed_rotation;
+	/// shapes[first_shape] to shapes[first_shape + shape_count], in b2Body_GetShapes order
+	u32 first_shape;
+	u32 shape_count;
+};
+
+/// A shape of a touching contact without its Box2D id, which a restore changes: the index into the saved shapes for dynamic
+/// bodies, the shape index of the map body for static bodies (see MapDestruction::get_shape_index)
+struct SavedContactShape
+{
+	entt::entity entity;
+	u32 shape;
+	bool static_body;
+};
+
+struct SavedContact
+{
+	SavedContactShape a, b;
+};
+
+struct WorldSnapshotStats
+{
+	/// Alive
+	u32 entities;
+	u32 bodies;
+	u32 shapes;
+	u32 contacts;
+	u32 analytic_projectiles;
+	/// Held by the snapshot buffers, without the memory owned by saved components
+	usz bytes;
+};
+
+/// In-memory copy of the simulation state of a World, for rollback (restore the last confirmed tick and simulate again) and
+/// instant rematches (restore the state after the match setup). save and restore run between updates.
+/// Saved: the entity identifiers with the free list of the registry, the simulation components (Transform, Velocity, Physics,
+/// SpatialHashed, Tank, TankController, Projectile, NavAgent, ParticleEmitters, TransformHistory, VisibilityObserver, Pooled),
+/// the dynamic bodies with their shapes, the touching contacts, the projectile pool, AnalyticProjectiles, TankIds, the
+/// LagCompensation tick, the Navigation queue and the length of the MapDestruction logs.
+/// save only reads the World; its cost depends on the entities and contacts, not on the size of the map.
+/// restore destroys the entities created since, creates the destroyed ones again with the same identifiers, sorts the storages into
+/// the saved order and rewinds the destroyed tiles. Box2D keeps state that can't be set back (warm starting impulses, sleep timers,
+/// island and contact order), so restore replaces the physics world: the static map bodies with the map shapes and the shapes of
+/// the standing tiles in shape index order, then the saved dynamic bodies in the saved order. Every restore of a snapshot gives
+/// the same Box2D state, so peers that restore the same state simulate on identically; a run that never restored keeps its own
+/// Box2D history and can differ. Body and shape ids change with every restore. The collision listeners get the contact events
+/// relative to the restored contacts at the next update (World::rewind_contacts).
+/// Not saved: components of other types, particles, the spatial hash and visibility caches (they follow the restored components at
+/// the next update). Worlds with a MapStreamer or static bodies other than map bodies with a MapDestruction can't be saved.
+/// Entities with components of other types can't be created again; restore throws if one was destroyed.
+/// The buffers are kept between saves: once the snapshot held the largest world, saving doesn't allocate and restoring only
+/// allocates the new Box2D world
+struct WorldSnapshot : NoCopy
+{
+	WorldSnapshot();
+
+	/// Reserves the buffers for worlds with up to this many entities and touching contacts
+	void reserve(u32 entities, u32 contacts);
+
+	/// Throws if the CommandBuffer has commands that weren't applied or the world can't be saved; the World isn't changed
+	void save(World& world);
+	/// Restores the World passed to the last save. Throws if nothing was saved, the CommandBuffer has commands or a destroyed
+	/// entity can't be created again; nothing is changed then
+	void restore(World& world);
+
+	bool is_saved() const { return saved; }
+	WorldSnapshotStats get_stats() const;
+
+	f64 last_save_ms;
+	f64 last_restore_ms;
+
+private:
+	void save_entities(const entt::registry& registry);
+	void save_bodies(entt::registry& registry);
+	void save_contacts(World& world);
+	SavedContactShape save_contact_shape(b2ShapeId shape);
+	void save_resources(entt::registry& registry);
+
+	/// Destroys and creates entities until the alive ones are the saved ones, then puts the identifiers into the saved order
+	void restore_entities(entt::registry& registry);
+	void restore_resources(entt::registry& registry);
+
+	/// Replaces the physics world with one that has the map bodies of the restored state and the saved dynamic bodies
+	void rebuild_physics(World& world);
+	/// The saved contacts with the shape ids of the rebuilt world
+	void restore_contacts(World& world);
+	b2ShapeId get_rebuilt_shape(const SavedContactShape& saved) const;
+
+	bool saved;
+	const World* world;
+
+	/// Every identifier the entity storage handed out, the alive ones first
+	std::vector<entt::entity> entities;
+	u32 alive_count;
+	/// By entity index: the saved entity if it was alive, entt::null otherwise
+	std::vector<entt::entity> alive_by_index;
+	/// Sorted; the entities that can't be created again
+	std::vector<entt::entity> pinned;
+
+	ComponentSnapshot<Transform> transforms;
+	ComponentSnapshot<Velocity> velocities;
+	ComponentSnapshot<Physics> physics;
+	ComponentSnapshot<SpatialHashed> spatial_hashed;
+	ComponentSnapshot<Tank> tanks;
+	ComponentSnapshot<TankController> tank_controllers;
+	ComponentSnapshot<Projectile> projectiles;
+	ComponentSnapshot<NavAgent> nav_agents;
+	ComponentSnapshot<ParticleEmitters> particle_emitters;
+	ComponentSnapshot<TransformHistory> transform_histories;
+	ComponentSnapshot<VisibilityObserver> visibility_observers;
+	ComponentSnapshot<Pooled> pooled;
+
+	std::vector<SavedBody> bodies;
+	std::vector<SavedShape> shapes;
+	std::vector<SavedContact> contacts;
+
+	struct SavedPool
+	{
+		std::vector<entt::entity> free_entities;
+		u32 active;
+		u64 created;
+		u64 recycled;
+		u64 released;
+	};
+
+	SavedPool projectile_pool;
+	AnalyticProjectiles analytic_projectiles;
+	std::optional<TankIds> tank_ids;
+	u32 lag_compensation_tick;
+	Array<f32, TRANSFORM_HISTORY_SIZE> max_moves;
+	std::vector<entt::entity> navigation_queue;
+	u32 navigation_update_index;
+	/// (map entity, length of its MapDestruction change log)
+	std::vector<std::pair<entt::entity, u32>> map_changes;
+
+	// Reused between saves and restores
+	std::vector<entt::entity> destroyed;
+	std::vector<entt::entity> created;
+	std::vector<b2ShapeId> body_shapes;
+	std::vector<ContactPair> touching_contacts;
+	/// By entity index: the index of the saved body
+	std::vector<u32> body_by_index;
+	/// By saved shape index: the id of the rebuilt shape
+	std::vector<b2ShapeId> rebuilt_shapes;
+	/// (map entity, index of its first shape in rebuilt_static_shapes); the shapes of each map body in shape index order
+	std::vector<std::pair<entt::entity, u32>> rebuilt_static_bodies;
+	std::vector<b2ShapeId> rebuilt_static_shapes;
+	std::vector<ContactPair> restored_contacts;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "ByteStream.h"
+
+#include "engine/Types.h"
+
+#include <bit>
+#include <cstring>
+#include <algorithm>
+
+/// Appends values of any bit width to the buffer of a ByteWriter, least significant bit first. Bits are gathered in a
+/// 64 bit register and stored a 32 bit word at a time, so a write is a shift, an or and one well predicted branch.
+/// The bytes after the bits are only valid after flush
+struct BitWriter
+{
+	BitWriter(ByteWriter& out)
+		: buffer(&out.buffer), scratch(0), scratch_bits(0), bits_written(0)
+	{
+	}
+
+	/// bits <= 32; the bits of value above bits are ignored
+	void write(u32 value, u32 bits)
+	{
+		scratch |= ((u64)value & ((1ull << bits) - 1)) << scratch_bits;
+		scratch_bits += bits;
+		bits_written += bits;
+		if (scratch_bits >= 32)
+		{
+			u32 word = (u32)scratch;
+			usz offset = buffer->size();
+			buffer->resize(offset + sizeof(u32));
+			std::memcpy(buffer->data() + offset, &word, sizeof(u32));
+			scratch >>= 32;
+			scratch_bits -= 32;
+		}
+	}
+
+	void write_bool(bool value)
+	{
+		write(value ? 1 : 0, 1);
+	}
+
+	/// Elias gamma code of value + 1: 0 takes one bit, values below 7 three, below 2^15 at most 31. value < 2^31
+	void write_gamma(u32 value)
+	{
+		u32 coded = value + 1;
+		u32 length = (u32)std::bit_width(coded) - 1;
+		// length zeros and the leading one of coded, then the bits below it
+		write(1u << length, length + 1);
+		write(coded, length);
+	}
+
+	/// Stores the bits left in the register; the stream ends on a byte boundary
+	void flush()
+	{
+		for (; scratch_bits > 0; scratch_bits = scratch_bits > 8 ? scratch_bits - 8 : 0)
+		{
+			buffer->push_back((u8)scratch);
+			scratch >>= 8;
+		}
+		scratch = 0;
+	}
+
+	/// Including the bits not flushed yet
+	usz get_bits() const { return bits_written; }
+
+private:
+	std::vector<u8>* buffer;
+	u64 scratch;
+	u32 scratch_bits;
+	usz bits_written;
+};
+
+/// Reads the values of a BitWriter. The bits are loaded into a 64 bit register 32 at a time; past the end the register
+/// is filled with zeros and failed is set once a value reaches past the end, like ByteReader
+struct BitReader
+{
+	BitReader(const u8* data, usz size)
+		: failed(false), data(data), size(size), offset(0), scratch(0), scratch_bits(0), bits_read(0)
+	{
+	}
+
+	/// bits <= 32
+	u32 read(u32 bits)
+	{
+		if (scratch_bits < bits)
+			refill();
+		u32 value = (u32)(scratch & ((1ull << bits) - 1));
+		scratch >>= bits;
+		scratch_bits -= bits;
+		bits_read += bits;
+		failed |= bits_read > size * 8;
+		return value;
+	}
+
+	bool read_bool()
+	{
+		return read(1) != 0;
+	}
+
+	u32 read_gamma()
+	{
+		if (scratch_bits < 32)
+			refill();
+		// The zeros before the first one give the length; a run longer than any written value is malformed
+		u32 length = (u32)std::countr_zero(scratch | (1ull << 32));
+		if (length >= 32)
+		{
+			failed = true;
+			return 0;
+		}
+		read(length + 1);
+		return ((1u << length) | read(length)) - 1;
+	}
+
+	/// Bytes used up to the last read bit
+	usz get_bytes_read() const { return (bits_read + 7) / 8; }
+
+	bool failed;
+
+private:
+	void refill()
+	{
+		// Up to 64 bits in the register; at least 33 afterwards
+		while (scratch_bits <= 32)
+		{
+			u32 word = 0;
+			usz count = offset < size ? std::min<usz>(size - offset, sizeof(u32)) : 0;
+			if (count > 0)
+				std::memcpy(&word, data + offset, count);
+			offset += count;
+			scratch |= (u64)word << scratch_bits;
+			scratch_bits += 32;
+		}
+	}
+
+	const u8* data;
+	usz size;
+	usz offset;
+	u64 scratch;
+	u32 scratch_bits;
+	usz bits_read;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "engine/Types.h"
+
+#include <vector>
+#include <cstring>
+#include <type_traits>
+
+/// Appends plain values to a growing byte buffer. Values are stored in host byte order; all supported platforms are little endian
+struct ByteWriter
+{
+	template<typename T>
+	void write(const T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		usz offset = buffer.size();
+		buffer.resize(offset + sizeof(T));
+		std::memcpy(buffer.data() + offset, &value, sizeof(T));
+	}
+
+	/// 7 bits per byte, small values take one byte
+	void write_varint(u32 value)
+	{
+		while (value >= 0x80)
+		{
+			buffer.push_back((u8)(value | 0x80));
+			value >>= 7;
+		}
+		buffer.push_back((u8)value);
+	}
+
+	void write_bytes(const u8* data, usz size)
+	{
+		buffer.insert(buffer.end(), data, data + size);
+	}
+
+	/// Overwrites a value written before, e.g. a count that is only known at the end
+	template<typename T>
+	void patch(usz offset, const T& value)
+	{
+		std::memcpy(buffer.data() + offset, &value, sizeof(T));
+	}
+
+	void clear() { buffer.clear(); }
+	usz size() const { return buffer.size(); }
+	const u8* data() const { return buffer.data(); }
+
+	std::vector<u8> buffer;
+};
+
+/// Reads the values of a ByteWriter from received bytes. Reading past the end returns zeros and sets failed,
+/// so a truncated or malformed packet is detected once after decoding instead of at every read
+struct ByteReader
+{
+	ByteReader(const u8* data, usz size)
+		: data(data), size(size), offset(0), failed(false)
+	{
+	}
+
+	template<typename T>
+	T read()
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		T value{};
+		if (offset + sizeof(T) > size)
+		{
+			failed = true;
+			offset = size;
+			return value;
+		}
+		std::memcpy(&value, data + offset, sizeof(T));
+		offset += sizeof(T);
+		return value;
+	}
+
+	u32 read_varint()
+	{
+		u32 value = 0;
+		for (u32 shift = 0; shift < 35; shift += 7)
+		{
+			u8 byte = read<u8>();
+			value |= (u32)(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+				return value;
+		}
+		failed = true;
+		return 0;
+	}
+
+	bool at_end() const { return offset >= size; }
+
+	const u8* data;
+	usz size;
+	usz offset;
+	bool failed;
+};
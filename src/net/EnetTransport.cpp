@@ -0,0 +1,155 @@
+#include "EnetTransport.h"
+
+#include <enet/enet.h>
+
+#include <stdexcept>
+#include <string>
+
+static ENetPacket* create_packet(NetChannel channel, const u8* data, usz size)
+{
+	// Snapshots are sequenced unreliable packets: ENet drops the ones older than the last received snapshot
+	return enet_packet_create(data, size, channel == NetChannel::Events ? ENET_PACKET_FLAG_RELIABLE : 0);
+}
+
+static void take_packet(ENetPacket* packet, TransportEvent& event)
+{
+	event.packet.assign(packet->data, packet->data + packet->dataLength);
+	enet_packet_destroy(packet);
+}
+
+EnetServerTransport::EnetServerTransport(u16 port, u32 max_clients)
+	: host(nullptr)
+{
+	if (enet_initialize() != 0)
+		throw std::runtime_error("Failed to initialize ENet");
+
+	ENetAddress address;
+	address.host = ENET_HOST_ANY;
+	address.port = port;
+	host = enet_host_create(&address, max_clients, NET_CHANNEL_COUNT, 0, 0);
+	if (!host)
+	{
+		enet_deinitialize();
+		throw std::runtime_error("Failed to host on port " + std::to_string(port));
+	}
+}
+
+EnetServerTransport::~EnetServerTransport()
+{
+	for (usz i = 0; i < host->peerCount; i++)
+	{
+		if (host->peers[i].state == ENET_PEER_STATE_CONNECTED)
+			enet_peer_disconnect_now(&host->peers[i], 0);
+	}
+	enet_host_destroy(host);
+	enet_deinitialize();
+}
+
+bool EnetServerTransport::poll(TransportEvent& event)
+{
+	ENetEvent enet_event;
+	while (enet_host_service(host, &enet_event, 0) > 0)
+	{
+		event.peer = (u32)(enet_event.peer - host->peers);
+		switch (enet_event.type)
+		{
+		case ENET_EVENT_TYPE_CONNECT:
+			event.type = TransportEventType::Connect;
+			return true;
+		case ENET_EVENT_TYPE_DISCONNECT:
+			event.type = TransportEventType::Disconnect;
+			return true;
+		case ENET_EVENT_TYPE_RECEIVE:
+			event.type = TransportEventType::Receive;
+			take_packet(enet_event.packet, event);
+			return true;
+		default:
+			break;
+		}
+	}
+	return false;
+}
+
+void EnetServerTransport::send(u32 peer, NetChannel channel, const u8* data, usz size)
+{
+	if (peer < host->peerCount)
+		enet_peer_send(&host->peers[peer], static_cast<u8>(channel), create_packet(channel, data, size));
+}
+
+void EnetServerTransport::flush()
+{
+	enet_host_flush(host);
+}
+
+EnetClientTransport::EnetClientTransport(const char* host_name, u16 port, u32 timeout_ms)
+	: host(nullptr), server(nullptr), connected(false)
+{
+	if (enet_initialize() != 0)
+		throw std::runtime_error("Failed to initialize ENet");
+
+	host = enet_host_create(nullptr, 1, NET_CHANNEL_COUNT, 0, 0);
+	if (!host)
+	{
+		enet_deinitialize();
+		throw std::runtime_error("Failed to create the ENet client host");
+	}
+
+	ENetAddress address;
+	address.port = port;
+	ENetEvent event;
+	if (enet_address_set_host(&address, host_name) == 0)
+		server = enet_host_connect(host, &address, NET_CHANNEL_COUNT, 0);
+	if (!server || enet_host_service(host, &event, timeout_ms) <= 0 || event.type != ENET_EVENT_TYPE_CONNECT)
+	{
+		enet_host_destroy(host);
+		enet_deinitialize();
+		throw std::runtime_error(std::string("Failed to connect to ") + host_name + ":" + std::to_string(port));
+	}
+	connected = true;
+}
+
+EnetClientTransport::~EnetClientTransport()
+{
+	if (connected)
+	{
+		enet_peer_disconnect(server, 0);
+		enet_host_flush(host);
+	}
+	enet_host_destroy(host);
+	enet_deinitialize();
+}
+
+bool EnetClientTransport::poll(TransportEvent& event)
+{
+	ENetEvent enet_event;
+	while (connected && enet_host_service(host, &enet_event, 0) > 0)
+	{
+		event.peer = 0;
+		switch (enet_event.type)
+		{
+		case ENET_EVENT_TYPE_RECEIVE:
+			event.type = TransportEventType::Receive;
+			take_packet(enet_event.packet, event);
+			return true;
+		case ENET_EVENT_TYPE_DISCONNECT:
+			event.type = TransportEventType::Disconnect;
+			connected = false;
+			return true;
+		default:
+			break;
+		}
+	}
+	return false;
+}
+
+void EnetClientTransport::send(NetChannel channel, const u8* data, usz size)
+{
+	if (connected)
+		enet_peer_send(server, static_cast<u8>(channel), create_packet(channel, data, size));
+}
+
+void EnetClientTransport::flush()
+{
+	if (connected)
+		enet_host_flush(host);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Transport.h"
+
+struct _ENetHost;
+struct _ENetPeer;
+
+/// Hosts the clients over ENet; the peer ids are ENet's peer indices. ENet's own bandwidth throttling is off,
+/// the ReplicationServer keeps each client within its budget
+struct EnetServerTransport : ServerTransport, NoCopy
+{
+	/// Throws if the port can't be bound
+	EnetServerTransport(u16 port, u32 max_clients);
+	~EnetServerTransport();
+
+	bool poll(TransportEvent& event) override;
+	void send(u32 peer, NetChannel channel, const u8* data, usz size) override;
+	void flush() override;
+
+private:
+	_ENetHost* host;
+};
+
+/// Connection to a server over ENet
+struct EnetClientTransport : ClientTransport, NoCopy
+{
+	/// Blocks until connected; throws if the server doesn't answer within the timeout
+	EnetClientTransport(const char* host_name, u16 port, u32 timeout_ms);
+	/// Disconnects gracefully
+	~EnetClientTransport();
+
+	bool poll(TransportEvent& event) override;
+	void send(NetChannel channel, const u8* data, usz size) override;
+	void flush() override;
+
+private:
+	_ENetHost* host;
+	_ENetPeer* server;
+	bool connected;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "ByteStream.h"
+
+#include "entities/Tank.h"
+
+#include "glm/glm.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+/// The TankInput of one tick as sent by a client. Commands are numbered from 1; the server applies one per tick
+/// and reports the newest applied sequence with each snapshot, so the client knows which of its predictions to check
+struct InputCommand
+{
+	u32 sequence = 0;
+	/// -1 backwards, 0 none, 1 forwards
+	s8 throttle = 0;
+	/// -1 left, 0 none, 1 right
+	s8 turn = 0;
+	/// Shoots once; set on the first command after the key went down
+	bool fire = false;
+	glm::vec2 turret_target = glm::vec2(0.0f);
+
+	static InputCommand from_input(u32 sequence, const TankInput& input)
+	{
+		InputCommand command;
+		command.sequence = sequence;
+		command.throttle = (s8)((input.forwards ? 1 : 0) - (input.backwards ? 1 : 0));
+		command.turn = (s8)((input.right ? 1 : 0) - (input.left ? 1 : 0));
+		command.fire = input.shoot;
+		command.turret_target = input.aim_target;
+		return command;
+	}
+
+	TankInput to_input() const
+	{
+		TankInput input;
+		input.forwards = throttle > 0;
+		input.backwards = throttle < 0;
+		input.left = turn < 0;
+		input.right = turn > 0;
+		input.shoot = fire;
+		input.aim_target = turret_target;
+		return input;
+	}
+
+	/// Without the sequence; it is implied by the position in the Input message
+	void write(ByteWriter& writer) const
+	{
+		writer.write(throttle);
+		writer.write(turn);
+		writer.write<u8>(fire ? 1 : 0);
+		writer.write(turret_target);
+	}
+
+	void read(ByteReader& reader)
+	{
+		throttle = (s8)std::clamp<s32>(reader.read<s8>(), -1, 1);
+		turn = (s8)std::clamp<s32>(reader.read<s8>(), -1, 1);
+		fire = reader.read<u8>() != 0;
+		turret_target = reader.read<glm::vec2>();
+		// A NaN target would stick in the turret rotation of the tank
+		if (!std::isfinite(turret_target.x) || !std::isfinite(turret_target.y))
+			turret_target = glm::vec2(0.0f);
+	}
+};
@@ -0,0 +1,168 @@
+#include "Interest.h"
+#include "Replication.h"
+
+#include "engine/Profiler.h"
+
+#include <algorithm>
+
+/// Larger grids get larger cells; the grid is rebuilt every tick and should stay cheap to clear
+const static s32 MAX_GRID_SIZE = 256;
+
+static bool rect_contains(const Rect& rect, glm::vec2 pos)
+{
+	return pos.x >= rect.x && pos.y >= rect.y && pos.x <= rect.x + rect.width && pos.y <= rect.y + rect.height;
+}
+
+void InterestGrid::build(const std::vector<EntityState>& states, const Rect& bounds, f32 cell_size)
+{
+	PROFILE_ZONE("InterestGrid::build");
+
+	this->states = &states;
+	origin = glm::vec2(bounds.x, bounds.y);
+	f32 extent = std::max(bounds.width, bounds.height);
+	rec_cell_size = std::min(1.0f / cell_size, (f32)MAX_GRID_SIZE / extent);
+	size.x = std::clamp((s32)std::ceil(bounds.width * rec_cell_size), 1, MAX_GRID_SIZE);
+	size.y = std::clamp((s32)std::ceil(bounds.height * rec_cell_size), 1, MAX_GRID_SIZE);
+
+	cell_starts.assign((usz)(size.x * size.y) + 1, 0);
+	item_cells.resize(states.size());
+	for (u32 i = 0; i < states.size(); i++)
+	{
+		glm::ivec2 cell = get_cell(states[i].transform.pos);
+		item_cells[i] = (u32)(cell.y * size.x + cell.x);
+		cell_starts[item_cells[i] + 1]++;
+	}
+	for (usz c = 1; c < cell_starts.size(); c++)
+		cell_starts[c] += cell_starts[c - 1];
+
+	// Filling moves the start of each cell to its end, which is the start of the next one
+	items.resize(states.size());
+	for (u32 i = 0; i < states.size(); i++)
+		items[cell_starts[item_cells[i]]++] = i;
+	for (usz c = cell_starts.size() - 1; c > 0; c--)
+		cell_starts[c] = cell_starts[c - 1];
+	cell_starts[0] = 0;
+}
+
+glm::ivec2 InterestGrid::get_cell(glm::vec2 pos) const
+{
+	// Written so NaN ends up in the first cell
+	glm::vec2 cell = (pos - origin) * rec_cell_size;
+	return glm::ivec2(cell.x > 0.0f ? (s32)std::min(cell.x, (f32)(size.x - 1)) : 0, cell.y > 0.0f ? (s32)std::min(cell.y, (f32)(size.y - 1)) : 0);
+}
+
+void InterestGrid::query(const Rect& rect, ArenaVector<u32>& indices) const
+{
+	if (!states)
+		return;
+
+	glm::ivec2 min = get_cell(glm::vec2(rect.x, rect.y));
+	glm::ivec2 max = get_cell(glm::vec2(rect.x + rect.width, rect.y + rect.height));
+	for (s32 y = min.y; y <= max.y; y++)
+	{
+		for (s32 x = min.x; x <= max.x; x++)
+		{
+			u32 cell = (u32)(y * size.x + x);
+			for (u32 k = cell_starts[cell]; k < cell_starts[cell + 1]; k++)
+			{
+				if (rect_contains(rect, (*states)[items[k]].transform.pos))
+					indices.push_back(items[k]);
+			}
+		}
+	}
+}
+
+void InterestSet::update(const InterestGrid& grid, const std::vector<EntityState>& states, const Rect* view, const InterestSettings& settings,
+	u32 always_relevant, ArenaVector<u32>& indices, ArenaVector<u32>& entered, ArenaVector<u32>& left)
+{
+	indices.clear();
+	entered.clear();
+	left.clear();
+
+	everything = view == nullptr;
+	if (everything)
+	{
+		for (u32 i = 0; i < states.size(); i++)
+			indices.push_back(i);
+	}
+	else
+	{
+		enter_area = expand(*view, settings.margin);
+		center = glm::vec2(view->x + view->width * 0.5f, view->y + view->height * 0.5f);
+
+		// Everything inside the leave area is a candidate; those outside the enter area only stay if they were in the set
+		grid.query(expand(*view, 2.0f * settings.margin), indices);
+		std::sort(indices.begin(), indices.end());
+		usz kept = 0;
+		usz o = 0;
+		for (u32 i : indices)
+		{
+			u32 net_id = states[i].net_id;
+			while (o < net_ids.size() && net_ids[o] < net_id)
+				o++;
+			if ((o < net_ids.size() && net_ids[o] == net_id) || rect_contains(enter_area, states[i].transform.pos))
+				indices[kept++] = i;
+		}
+		indices.resize(kept);
+	}
+
+	if (always_relevant != 0)
+	{
+		auto by_id = [](const EntityState& state, u32 id) { return state.net_id < id; };
+		auto found = std::lower_bound(states.begin(), states.end(), always_relevant, by_id);
+		if (found != states.end() && found->net_id == always_relevant)
+		{
+			u32 index = (u32)(found - states.begin());
+			auto position = std::lower_bound(indices.begin(), indices.end(), index);
+			if (position == indices.end() || *position != index)
+				indices.insert(position, index);
+			if (everything)
+				center = found->transform.pos;
+		}
+	}
+
+	// Both sorted by net id; the entities only in the new set entered, those only in the old one left
+	next_net_ids.clear();
+	next_priorities.clear();
+	usz o = 0;
+	for (u32 i : indices)
+	{
+		u32 net_id = states[i].net_id;
+		while (o < net_ids.size() && net_ids[o] < net_id)
+			left.push_back(net_ids[o++]);
+		f32 priority = 0.0f;
+		if (o < net_ids.size() && net_ids[o] == net_id)
+			priority = priorities[o++];
+		else
+			entered.push_back(i);
+		next_net_ids.push_back(net_id);
+		next_priorities.push_back(priority);
+	}
+	while (o < net_ids.size())
+		left.push_back(net_ids[o++]);
+
+	net_ids.swap(next_net_ids);
+	priorities.swap(next_priorities);
+}
+
+bool InterestSet::is_inside(glm::vec2 pos) const
+{
+	return everything || rect_contains(enter_area, pos);
+}
+
+bool InterestSet::contains(u32 net_id) const
+{
+	return std::binary_search(net_ids.begin(), net_ids.end(), net_id);
+}
+
+f32 InterestSet::get_priority(const EntityState& state, glm::vec2 center, const InterestSettings& settings)
+{
+	f32 distance = glm::length(state.transform.pos - center);
+	f32 speed = glm::length(state.velocity.linear);
+	return (1.0f + settings.priority_speed * speed) / (1.0f + distance / settings.priority_distance);
+}
+
+Rect InterestSet::expand(const Rect& rect, f32 margin)
+{
+	return { rect.x - margin, rect.y - margin, rect.width + 2.0f * margin, rect.height + 2.0f * margin };
+}
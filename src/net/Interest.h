@@ -0,0 +1,80 @@
+#pragma once
+
+#include "engine/Types.h"
+#include "engine/Memory.h"
+
+#include "glm/glm.hpp"
+
+#include <vector>
+
+struct EntityState;
+
+/// Which entities a client gets: those around its camera view (Camera::get_bounding_rect of the client). Clients that
+/// didn't send a view get default_view_size around their tank, clients without both get everything
+struct InterestSettings
+{
+	bool enabled = true;
+	/// Added to every side of the view. Entities enter inside the view plus the margin and leave outside the view plus
+	/// twice the margin, so entities at the edge don't spawn and despawn over and over
+	f32 margin = 4.0f;
+	glm::vec2 default_view_size = glm::vec2(24.0f, 13.5f);
+	/// The largest camera view around the own tank a client can have. Views beyond it are cut to it, larger views are replaced
+	/// by default_view_size: a client can't get entities it couldn't see by reporting a huge view
+	glm::vec2 max_view_size = glm::vec2(64.0f, 36.0f);
+	/// Entity updates that don't fit into the budget go by priority: closer to the view center is more important, faster
+	/// entities are more important; an entity deferred for a tick adds its priority again, so it can't starve
+	f32 priority_distance = 8.0f;
+	f32 priority_speed = 0.1f;
+	f32 cell_size = 8.0f;
+};
+
+/// Uniform grid over the entity states of a tick; rebuilt for every update, queried by every client.
+/// Positions outside the bounds are put into the border cells
+struct InterestGrid
+{
+	void build(const std::vector<EntityState>& states, const Rect& bounds, f32 cell_size);
+
+	/// Appends the indices of the states inside the rect, in no particular order
+	void query(const Rect& rect, ArenaVector<u32>& indices) const;
+
+private:
+	glm::ivec2 get_cell(glm::vec2 pos) const;
+
+	const std::vector<EntityState>* states = nullptr;
+	glm::vec2 origin = glm::vec2(0.0f);
+	f32 rec_cell_size = 1.0f;
+	glm::ivec2 size = glm::ivec2(1);
+	/// Counting sort of the state indices by cell: the states of cell i are items[cell_starts[i]] to items[cell_starts[i + 1]]
+	std::vector<u32> cell_starts;
+	std::vector<u32> items;
+	std::vector<u32> item_cells;
+};
+
+/// The entities one client is interested in, kept from update to update so only the changes are sent
+struct InterestSet
+{
+	/// Recomputes the set from the states of the tick (sorted by net id). view nullptr takes all states. The entity with the
+	/// net id always_relevant (the client's tank, 0 for none) is in the set wherever it is. Outputs the indices of the
+	/// states in the set, the indices of the states that entered it and the net ids of the entities that left it
+	void update(const InterestGrid& grid, const std::vector<EntityState>& states, const Rect* view, const InterestSettings& settings,
+		u32 always_relevant, ArenaVector<u32>& indices, ArenaVector<u32>& entered, ArenaVector<u32>& left);
+
+	/// Whether the position is inside the area entities enter; everywhere if the last update had no view
+	bool is_inside(glm::vec2 pos) const;
+	bool contains(u32 net_id) const;
+
+	static f32 get_priority(const EntityState& state, glm::vec2 center, const InterestSettings& settings);
+	static Rect expand(const Rect& rect, f32 margin);
+
+	/// Sorted
+	std::vector<u32> net_ids;
+	/// Of net_ids[i]: accumulated while its update is deferred, reset once it is sent
+	std::vector<f32> priorities;
+	bool everything = true;
+	Rect enter_area = {};
+	glm::vec2 center = glm::vec2(0.0f);
+
+private:
+	std::vector<u32> next_net_ids;
+	std::vector<f32> next_priorities;
+};
@@ -0,0 +1,224 @@
+#include "Loopback.h"
+
+#include <algorithm>
+
+void LoopbackPipe::send(f64 time, std::mt19937& rng, NetChannel channel, const u8* data, usz size)
+{
+	std::uniform_real_distribution<f64> unit(0.0, 1.0);
+	bool reliable = channel == NetChannel::Events;
+	stats.packets_sent++;
+	stats.bytes_sent += size;
+
+	if (!reliable && unit(rng) < conditions.loss)
+	{
+		stats.packets_lost++;
+		return;
+	}
+
+	f64 departure = time;
+	if (conditions.bytes_per_second > 0)
+	{
+		f64 start = std::max(time, queue_free_time);
+		if (!reliable && start - time > conditions.max_queue_delay)
+		{
+			stats.packets_dropped++;
+			return;
+		}
+		queue_free_time = start + (f64)size / (f64)conditions.bytes_per_second;
+		departure = queue_free_time;
+	}
+
+	u32 copies = 1;
+	if (!reliable && unit(rng) < conditions.duplication)
+	{
+		stats.packets_duplicated++;
+		copies = 2;
+	}
+	for (u32 i = 0; i < copies; i++)
+	{
+		f64 arrival = departure + conditions.latency + conditions.jitter * unit(rng);
+		if (unit(rng) < conditions.reordering)
+			arrival += conditions.reorder_delay;
+		if (reliable)
+		{
+			arrival = std::max(arrival, last_reliable_arrival);
+			last_reliable_arrival = arrival;
+		}
+
+		// After the packets arriving at the same time, so those keep the order they were sent in
+		auto position = std::upper_bound(packets.begin(), packets.end(), arrival, [](f64 time, const Packet& packet) { return time < packet.arrival_time; });
+		packets.insert(position, { arrival, next_index++, std::vector<u8>(data, data + size) });
+	}
+}
+
+bool LoopbackPipe::receive(f64 time, std::vector<u8>& packet)
+{
+	// The tolerance keeps a latency of whole ticks from slipping a tick through rounding
+	if (packets.empty() || packets.front().arrival_time > time + 1e-9)
+		return false;
+
+	Packet& front = packets.front();
+	if (front.index < received_index_end)
+		stats.packets_reordered++;
+	received_index_end = std::max(received_index_end, front.index + 1);
+	packet = std::move(front.data);
+	packets.pop_front();
+	return true;
+}
+
+LoopbackLink::LoopbackLink(const LinkConditions& to_client, const LinkConditions& to_server, u32 seed)
+	: time(0.0), rng(seed)
+{
+	this->to_client.conditions = to_client;
+	this->to_server.conditions = to_server;
+}
+
+void LoopbackLink::send_to_client(NetChannel channel, const u8* data, usz size)
+{
+	to_client.send(time, rng, channel, data, size);
+}
+
+void LoopbackLink::send_to_server(NetChannel channel, const u8* data, usz size)
+{
+	to_server.send(time, rng, channel, data, size);
+}
+
+void LoopbackLink::advance(f64 delta_time)
+{
+	time += delta_time;
+}
+
+bool LoopbackLink::receive_on_client(std::vector<u8>& packet)
+{
+	return to_client.receive(time, packet);
+}
+
+bool LoopbackLink::receive_on_server(std::vector<u8>& packet)
+{
+	return to_server.receive(time, packet);
+}
+
+LoopbackConnection::LoopbackConnection(const LinkConditions& to_client, const LinkConditions& to_server, u32 seed)
+	: link(to_client, to_server, seed), client_closed(false), server_closed(false)
+{
+}
+
+LoopbackServerTransport::LoopbackServerTransport(u32 seed)
+	: rng(seed), poll_peer(0)
+{
+}
+
+LoopbackServerTransport::~LoopbackServerTransport()
+{
+	for (const std::shared_ptr<LoopbackConnection>& connection : connections)
+	{
+		if (connection)
+			connection->server_closed = true;
+	}
+}
+
+std::unique_ptr<LoopbackClientTransport> LoopbackServerTransport::connect(const LinkConditions& to_client, const LinkConditions& to_server)
+{
+	// A peer id is only reused after the server polled the disconnect of its last connection
+	u32 peer = 0;
+	while (peer < connections.size() && connections[peer])
+		peer++;
+	if (peer == connections.size())
+		connections.emplace_back();
+
+	connections[peer] = std::make_shared<LoopbackConnection>(to_client, to_server, (u32)rng());
+	connected.push_back(peer);
+	return std::make_unique<LoopbackClientTransport>(connections[peer]);
+}
+
+void LoopbackServerTransport::advance(f64 delta_time)
+{
+	for (const std::shared_ptr<LoopbackConnection>& connection : connections)
+	{
+		if (connection)
+			connection->link.advance(delta_time);
+	}
+}
+
+bool LoopbackServerTransport::poll(TransportEvent& event)
+{
+	if (!connected.empty())
+	{
+		event.type = TransportEventType::Connect;
+		event.peer = connected.front();
+		connected.pop_front();
+		return true;
+	}
+
+	for (; poll_peer < connections.size(); poll_peer++)
+	{
+		LoopbackConnection* connection = connections[poll_peer].get();
+		if (!connection)
+			continue;
+		event.peer = poll_peer;
+		if (connection->link.receive_on_server(event.packet))
+		{
+			event.type = TransportEventType::Receive;
+			return true;
+		}
+		// The packets that arrived before the client closed come first
+		if (connection->client_closed)
+		{
+			event.type = TransportEventType::Disconnect;
+			connections[poll_peer].reset();
+			return true;
+		}
+	}
+	poll_peer = 0;
+	return false;
+}
+
+void LoopbackServerTransport::send(u32 peer, NetChannel channel, const u8* data, usz size)
+{
+	if (peer < connections.size() && connections[peer] && !connections[peer]->client_closed)
+		connections[peer]->link.send_to_client(channel, data, size);
+}
+
+void LoopbackServerTransport::flush()
+{
+}
+
+LoopbackClientTransport::LoopbackClientTransport(std::shared_ptr<LoopbackConnection> connection)
+	: connection(std::move(connection)), disconnected(false)
+{
+}
+
+LoopbackClientTransport::~LoopbackClientTransport()
+{
+	connection->client_closed = true;
+}
+
+bool LoopbackClientTransport::poll(TransportEvent& event)
+{
+	if (disconnected)
+		return false;
+
+	event.peer = 0;
+	if (connection->link.receive_on_client(event.packet))
+	{
+		event.type = TransportEventType::Receive;
+		return true;
+	}
+	if (connection->server_closed)
+	{
+		event.type = TransportEventType::Disconnect;
+		disconnected = true;
+		return true;
+	}
+	return false;
+}
+
+void LoopbackClientTransport::send(NetChannel channel, const u8* data, usz size)
+{
+	if (!disconnected && !connection->server_closed)
+		connection->link.send_to_server(channel, data, size);
+}
+
+void LoopbackClientTransport::flush()
+{
+}
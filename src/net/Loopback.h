@@ -0,0 +1,147 @@
+#pragma once
+
+#include "NetProtocol.h"
+#include "Transport.h"
+
+#include "engine/Types.h"
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <random>
+
+/// Network conditions of one direction of a LoopbackLink. Loss, duplication and the bandwidth drops only hit unreliable
+/// packets (NetChannel::Snapshots); reliable packets arrive once and in order, late if a packet before them is late
+struct LinkConditions
+{
+	/// One way, in seconds
+	f64 latency = 0.0;
+	/// Each packet takes up to this much longer, at random; packets overtake each other
+	f64 jitter = 0.0;
+	f32 loss = 0.0f;
+	f32 duplication = 0.0f;
+	/// Share of the packets held back by reorder_delay, so the packets sent after them arrive first
+	f32 reordering = 0.0f;
+	f64 reorder_delay = 0.05;
+	/// 0 for no cap. A packet is sent once the packets before it went out at this rate
+	u32 bytes_per_second = 0;
+	/// Unreliable packets that would wait longer than this for the cap are dropped, like by a full router queue
+	f64 max_queue_delay = 0.25;
+};
+
+struct LinkStats
+{
+	u64 packets_sent = 0;
+	u64 bytes_sent = 0;
+	u64 packets_lost = 0;
+	u64 packets_duplicated = 0;
+	/// Dropped by the bandwidth cap
+	u64 packets_dropped = 0;
+	/// Received after a packet that was sent later
+	u64 packets_reordered = 0;
+};
+
+/// One direction of a LoopbackLink: the packets on their way, ordered by arrival
+struct LoopbackPipe
+{
+	void send(f64 time, std::mt19937& rng, NetChannel channel, const u8* data, usz size);
+	bool receive(f64 time, std::vector<u8>& packet);
+
+	LinkConditions conditions;
+	LinkStats stats;
+
+private:
+	struct Packet
+	{
+		f64 arrival_time;
+		u64 index;
+		std::vector<u8> data;
+	};
+
+	std::deque<Packet> packets;
+	u64 next_index = 0;
+	/// One past the newest index received so far
+	u64 received_index_end = 0;
+	/// When the cap has sent the packets queued so far
+	f64 queue_free_time = 0.0;
+	f64 last_reliable_arrival = 0.0;
+};
+
+/// In process link between a server and one client, so the netcode runs offline (benchmarks, tests) without sockets.
+/// Each direction has its own LinkConditions; all randomness comes from the seed
+struct LoopbackLink : NoCopy
+{
+	LoopbackLink(const LinkConditions& to_client, const LinkConditions& to_server, u32 seed = 1);
+
+	void send_to_client(NetChannel channel, const u8* data, usz size);
+	void send_to_server(NetChannel channel, const u8* data, usz size);
+
+	/// Moves the clock of the link; packets whose time has come can be received
+	void advance(f64 delta_time);
+	/// Takes the next arrived packet; false if none has arrived
+	bool receive_on_client(std::vector<u8>& packet);
+	bool receive_on_server(std::vector<u8>& packet);
+
+	LoopbackPipe to_client;
+	LoopbackPipe to_server;
+
+private:
+	f64 time;
+	std::mt19937 rng;
+};
+
+/// A LoopbackLink and which of its ends is gone
+struct LoopbackConnection
+{
+	LoopbackConnection(const LinkConditions& to_client, const LinkConditions& to_server, u32 seed);
+
+	LoopbackLink link;
+	bool client_closed;
+	bool server_closed;
+};
+
+struct LoopbackClientTransport;
+
+/// ServerTransport of clients in the same process. Clients connect with connect(); every connection is a LoopbackLink whose
+/// seed is drawn from the seed of the transport, so the same seed and the same calls give the same packets
+struct LoopbackServerTransport : ServerTransport, NoCopy
+{
+	LoopbackServerTransport(u32 seed = 1);
+	/// The clients see a Disconnect
+	~LoopbackServerTransport();
+
+	/// The server sees the Connect with its next poll
+	std::unique_ptr<LoopbackClientTransport> connect(const LinkConditions& to_client, const LinkConditions& to_server);
+	/// Moves the clock of all links
+	void advance(f64 delta_time);
+
+	/// Connects first, then the events of each peer in order of the peer ids
+	bool poll(TransportEvent& event) override;
+	void send(u32 peer, NetChannel channel, const u8* data, usz size) override;
+	void flush() override;
+
+	/// By peer id; nullptr once the Disconnect was polled
+	std::vector<std::shared_ptr<LoopbackConnection>> connections;
+
+private:
+	std::mt19937 rng;
+	std::deque<u32> connected;
+	u32 poll_peer;
+};
+
+/// Client end of a connection of a LoopbackServerTransport; closing it disconnects the client
+struct LoopbackClientTransport : ClientTransport, NoCopy
+{
+	LoopbackClientTransport(std::shared_ptr<LoopbackConnection> connection);
+	~LoopbackClientTransport();
+
+	bool poll(TransportEvent& event) override;
+	void send(NetChannel channel, const u8* data, usz size) override;
+	void flush() override;
+
+	LoopbackLink& get_link() { return connection->link; }
+
+private:
+	std::shared_ptr<LoopbackConnection> connection;
+	bool disconnected;
+};
@@ -0,0 +1,40 @@
+#include "NetClient.h"
+#include "EnetTransport.h"
+
+#include "engine/Profiler.h"
+
+NetClient::NetClient(entt::registry& registry, const char* host_name, u16 port, u32 timeout_ms)
+	: NetClient(registry, std::make_unique<EnetClientTransport>(host_name, port, timeout_ms))
+{
+}
+
+NetClient::NetClient(entt::registry& registry, std::unique_ptr<ClientTransport> transport)
+	: replication(registry), prediction(registry), transport(std::move(transport)), connected(true)
+{
+}
+
+bool NetClient::update(f32 delta_time)
+{
+	PROFILE_ZONE("NetClient::update");
+
+	while (connected && transport->poll(event))
+	{
+		if (event.type == TransportEventType::Receive)
+			replication.receive(event.packet.data(), event.packet.size());
+		else if (event.type == TransportEventType::Disconnect)
+			connected = false;
+	}
+
+	if (!connected)
+		return false;
+
+	prediction.reconcile(replication);
+	prediction.update(replication, delta_time);
+
+	if (prediction.write_inputs(inputs))
+		transport->send(NetChannel::Snapshots, inputs.data(), inputs.size());
+	if (replication.write_ack(ack))
+		transport->send(NetChannel::Snapshots, ack.data(), ack.size());
+	transport->flush();
+	return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Replication.h"
+#include "Prediction.h"
+#include "Transport.h"
+
+#include "entt/entt.hpp"
+
+#include <memory>
+
+/// Connection of a client to a NetServer. The replicated entities are created in the registry (see ReplicationClient),
+/// the tank the server gives the client is driven by its TankInput (see ClientPrediction)
+struct NetClient : NoCopy
+{
+	/// Connects over ENet and blocks until connected; throws if the server doesn't answer within the timeout
+	NetClient(entt::registry& registry, const char* host_name, u16 port, u32 timeout_ms = 5000);
+	NetClient(entt::registry& registry, std::unique_ptr<ClientTransport> transport);
+
+	/// Handles the packets of the server, predicts the own tank from its TankInput and sends the input commands and the ack
+	/// of the newest snapshot; doesn't block. Returns false once disconnected
+	bool update(f32 delta_time);
+
+	ReplicationClient replication;
+	ClientPrediction prediction;
+
+private:
+	std::unique_ptr<ClientTransport> transport;
+	TransportEvent event;
+	bool connected;
+	ByteWriter ack;
+	ByteWriter inputs;
+};
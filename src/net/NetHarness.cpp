@@ -0,0 +1,105 @@
+#include "NetHarness.h"
+
+#include "entities/World.h"
+#include "entities/Map.h"
+#include "entities/Tank.h"
+#include "engine/Profiler.h"
+
+#include <chrono>
+#include <random>
+
+static f64 elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void add_stats(LinkStats& total, const LinkStats& stats)
+{
+	total.packets_sent += stats.packets_sent;
+	total.bytes_sent += stats.bytes_sent;
+	total.packets_lost += stats.packets_lost;
+	total.packets_duplicated += stats.packets_duplicated;
+	total.packets_dropped += stats.packets_dropped;
+	total.packets_reordered += stats.packets_reordered;
+}
+
+NetHarness::Client::Client(const Map& map, u32 seed, std::unique_ptr<LoopbackClientTransport> transport)
+	: link(&transport->get_link()), net(registry, std::move(transport)), inputs(map, seed), connected(true)
+{
+}
+
+NetHarness::NetHarness(World& world, const Map& map, const NetHarnessSettings& settings)
+	: server(world.registry, settings.replication, std::make_unique<LoopbackServerTransport>(settings.seed)), server_ms(0.0), clients_ms(0.0),
+	tick_count(0), world(&world), tile_size(map.tile_size), projectile_type(settings.projectile_type), next_spawn_point(settings.first_spawn_point)
+{
+	transport = static_cast<LoopbackServerTransport*>(&server.get_transport());
+	std::mt19937 rng(settings.seed);
+	spawn_points = ScriptedTanks::find_spawn_points(map, rng);
+
+	server.on_connect = [this](u32 client)
+		{
+			TankDesign design{ (u8)(client % 4), (u8)(client % 8), (u8)(client % 8), (u8)(client % 4) };
+			entt::entity tank = Tank::create_tank(this->world->registry, design, ScriptedTanks::get_spawn_point(spawn_points, next_spawn_point++, tile_size));
+			this->world->registry.get<TankController>(tank).projectile_type = projectile_type;
+			if (client >= tanks.size())
+				tanks.resize(client + 1, entt::null);
+			tanks[client] = tank;
+			server.replication.set_controlled_tank(client, tank);
+		};
+	server.on_disconnect = [this](u32 client)
+		{
+			if (client < tanks.size() && this->world->registry.valid(tanks[client]))
+				this->world->registry.destroy(tanks[client]);
+		};
+
+	for (u32 i = 0; i < settings.clients; i++)
+		clients.push_back(std::make_unique<Client>(map, settings.seed + 1 + i, transport->connect(settings.to_client, settings.to_server)));
+}
+
+void NetHarness::tick(f32 delta_time, CommandSource* commands)
+{
+	PROFILE_ZONE("NetHarness::tick");
+
+	auto start = std::chrono::steady_clock::now();
+	server.receive();
+	CommandSources sources{ &server.replication };
+	if (commands)
+		sources.sources.insert(sources.sources.begin(), commands);
+	world->handle_inputs(delta_time, &sources);
+	world->update(delta_time);
+	server.send(++tick_count);
+	server_ms = elapsed_ms(start);
+
+	transport->advance(delta_time);
+
+	start = std::chrono::steady_clock::now();
+	for (const std::unique_ptr<Client>& client : clients)
+	{
+		if (!client->connected)
+			continue;
+		// Drives the tank the server gave the client, like the window input in the game
+		entt::entity tank = client->net.prediction.get_tank();
+		if (tank != entt::null && client->inputs.tanks.empty())
+			client->inputs.add_tank(tank);
+		client->inputs.write_inputs(client->registry, delta_time);
+		client->connected = client->net.update(delta_time);
+		ReplicationClient::extrapolate(client->registry, delta_time);
+	}
+	clients_ms = elapsed_ms(start);
+}
+
+LinkStats NetHarness::get_to_client_stats() const
+{
+	LinkStats total;
+	for (const std::unique_ptr<Client>& client : clients)
+		add_stats(total, client->link->to_client.stats);
+	return total;
+}
+
+LinkStats NetHarness::get_to_server_stats() const
+{
+	LinkStats total;
+	for (const std::unique_ptr<Client>& client : clients)
+		add_stats(total, client->link->to_server.stats);
+	return total;
+}
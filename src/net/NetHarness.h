@@ -0,0 +1,75 @@
+#pragma once
+
+#include "NetServer.h"
+#include "NetClient.h"
+#include "Loopback.h"
+
+#include "entities/CommandSource.h"
+#include "entities/Projectile.h"
+
+#include "entt/entt.hpp"
+
+#include <vector>
+#include <memory>
+
+struct World;
+struct Map;
+
+struct NetHarnessSettings
+{
+	u32 clients = 8;
+	u32 seed = 1;
+	/// Of every client's link
+	LinkConditions to_client;
+	LinkConditions to_server;
+	ReplicationSettings replication;
+	ProjectileType projectile_type;
+	/// Spawn point of the first client's tank; bots usually have the ones before
+	u32 first_spawn_point = 0;
+};
+
+/// A NetServer and simulated NetClients in one process, connected through a LoopbackServerTransport. The server runs the
+/// match of the given world and gives every client a tank; each client has a registry of its own and drives its tank with
+/// ScriptedTanks inputs through its prediction. The links, the inputs and the spawn points are seeded and every clock moves
+/// by the delta time of the ticks, so the same settings replay the same run
+struct NetHarness : NoCopy
+{
+	struct Client : NoCopy
+	{
+		Client(const Map& map, u32 seed, std::unique_ptr<LoopbackClientTransport> transport);
+
+		entt::registry registry;
+		LoopbackLink* link;
+		NetClient net;
+		ScriptedTanks inputs;
+		bool connected;
+	};
+
+	/// The clients connect with the first tick
+	NetHarness(World& world, const Map& map, const NetHarnessSettings& settings);
+
+	/// A server tick (receive, inputs, World::update, send), then one update of every client after the links moved by
+	/// delta_time. commands drives the tanks of the server's own, e.g. bots
+	void tick(f32 delta_time, CommandSource* commands = nullptr);
+
+	/// Totals of all links
+	LinkStats get_to_client_stats() const;
+	LinkStats get_to_server_stats() const;
+
+	NetServer server;
+	std::vector<std::unique_ptr<Client>> clients;
+	/// Duration of the parts of the last tick
+	f64 server_ms;
+	f64 clients_ms;
+	u32 tick_count;
+
+private:
+	World* world;
+	LoopbackServerTransport* transport;
+	std::vector<glm::vec2> spawn_points;
+	f32 tile_size;
+	ProjectileType projectile_type;
+	u32 next_spawn_point;
+	/// By replication client id
+	std::vector<entt::entity> tanks;
+};
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "engine/Types.h"
+
+/// Bumped whenever the layout of a message changes; clients of another version are refused
+const static u16 NET_PROTOCOL_VERSION = 5;
+const static u16 NET_DEFAULT_PORT = 27015;
+
+/// ENet channels. Snapshots, acks and inputs are unreliable, a lost one is superseded by the next one.
+/// Spawns, despawns, the welcome, the control and the tile changes are reliable and ordered
+enum class NetChannel : u8
+{
+	Snapshots = 0,
+	Events = 1
+};
+
+const static u32 NET_CHANNEL_COUNT = 2;
+
+/// First byte of every packet
+enum class NetMessage : u8
+{
+	/// Server to client, reliable: protocol version, tick rate and the quantization bounds
+	Welcome = 0,
+	/// Server to client, unreliable: entity states delta encoded against a baseline the client acknowledged, and the particle events
+	Snapshot = 1,
+	/// Server to client, reliable: the entities that entered and left the interest of the client since its last snapshot
+	EntityEvents = 2,
+	/// Client to server, unreliable: the newest snapshot the client decoded, which becomes the baseline of the next snapshots,
+	/// the camera view of the client and the snapshot rate it wants
+	Ack = 3,
+	/// Server to client, reliable: the net id of the tank the client drives, 0 for none
+	Control = 4,
+	/// Client to server, unreliable: the newest input commands; each packet repeats the ones the server hasn't applied yet
+	Input = 5,
+	/// Server to client, reliable: the index of the first change and the following changes of the MapDestruction change log,
+	/// applied in log order. A new client gets the whole log after its welcome
+	TileChanges = 6
+};
+
+/// Kind of a replicated entity, sent with its spawn
+enum class ReplicatedType : u8
+{
+	Tank = 0,
+	Projectile = 1
+};
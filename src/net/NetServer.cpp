@@ -0,0 +1,62 @@
+#include "NetServer.h"
+#include "EnetTransport.h"
+
+#include "engine/Profiler.h"
+
+NetServer::NetServer(entt::registry& registry, const NetServerSettings& settings)
+	: NetServer(registry, settings.replication, std::make_unique<EnetServerTransport>(settings.port, settings.max_clients))
+{
+}
+
+NetServer::NetServer(entt::registry& registry, const ReplicationSettings& settings, std::unique_ptr<ServerTransport> transport)
+	: replication(registry, settings), transport(std::move(transport))
+{
+}
+
+void NetServer::receive()
+{
+	PROFILE_ZONE("NetServer::receive");
+
+	while (transport->poll(event))
+	{
+		if (event.peer >= clients.size())
+			clients.resize(event.peer + 1, NO_CLIENT);
+		u32& client = clients[event.peer];
+
+		switch (event.type)
+		{
+		case TransportEventType::Connect:
+			client = replication.add_client();
+			if (client >= peers.size())
+				peers.resize(client + 1);
+			peers[client] = event.peer;
+			if (on_connect)
+				on_connect(client);
+			break;
+		case TransportEventType::Disconnect:
+			if (client != NO_CLIENT)
+			{
+				if (on_disconnect)
+					on_disconnect(client);
+				replication.remove_client(client);
+				client = NO_CLIENT;
+			}
+			break;
+		case TransportEventType::Receive:
+			if (client != NO_CLIENT)
+				replication.receive(client, event.packet.data(), event.packet.size());
+			break;
+		}
+	}
+}
+
+void NetServer::send(u32 tick)
+{
+	PROFILE_ZONE("NetServer::send");
+
+	replication.update(tick, [this](u32 client, NetChannel channel, const u8* data, usz size)
+		{
+			transport->send(peers[client], channel, data, size);
+		});
+	transport->flush();
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Replication.h"
+#include "Transport.h"
+
+#include "entt/entt.hpp"
+
+#include <vector>
+#include <memory>
+#include <functional>
+
+struct NetServerSettings
+{
+	u16 port = NET_DEFAULT_PORT;
+	u32 max_clients = 32;
+	ReplicationSettings replication;
+};
+
+/// Hosts the clients of a match and replicates the registry to them (see ReplicationServer).
+/// The connections go through a ServerTransport: ENet by default, a LoopbackServerTransport to run offline
+struct NetServer : NoCopy
+{
+	/// Hosts over ENet on the port of the settings; throws if the port can't be bound
+	NetServer(entt::registry& registry, const NetServerSettings& settings);
+	NetServer(entt::registry& registry, const ReplicationSettings& settings, std::unique_ptr<ServerTransport> transport);
+
+	/// Handles connects, disconnects and the acks of the clients; doesn't block. Called once per tick before the update
+	void receive();
+	/// Sends the state after the tick to all clients
+	void send(u32 tick);
+
+	ServerTransport& get_transport() { return *transport; }
+
+	ReplicationServer replication;
+	/// Called by receive with the replication client id, e.g. to give a new client a tank (ReplicationServer::set_controlled_tank)
+	std::function<void(u32 client)> on_connect;
+	std::function<void(u32 client)> on_disconnect;
+
+private:
+	std::unique_ptr<ServerTransport> transport;
+	TransportEvent event;
+	/// Replication client id by peer id, NO_CLIENT for none
+	std::vector<u32> clients;
+	/// Peer id by replication client id
+	std::vector<u32> peers;
+
+	constexpr static u32 NO_CLIENT = UINT32_MAX;
+};
@@ -0,0 +1,162 @@
+#include "Prediction.h"
+
+#include "engine/util/MathUtil.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+
+// Differences below these are float noise between Box2D and TankController::simulate and the quantization of the
+// snapshots, not a misprediction
+const static f32 POSITION_TOLERANCE = 0.01f;
+const static f32 ROTATION_TOLERANCE = 0.01f;
+// A long frame drops time instead of sending a burst of commands
+const static u32 MAX_COMMANDS_PER_UPDATE = 8;
+
+static TankMotion get_motion(const EntityState& state)
+{
+	return { state.transform, state.velocity, MathUtil::normalize_angle(state.turret_orientation - state.transform.rot) };
+}
+
+ClientPrediction::ClientPrediction(entt::registry& registry)
+	: registry(&registry), tank(entt::null), net_id(0), next_sequence(1), acked_sequence(0), sent_sequence(0), reconciled_tick(0),
+	tick_time(0.0f), accumulator(0.0f), motion(), previous_motion()
+{
+}
+
+void ClientPrediction::take_control(const ReplicationClient& replication)
+{
+	// The replication destroys the entity when its tank despawns
+	if (tank != entt::null && !registry->valid(tank))
+	{
+		tank = entt::null;
+		net_id = 0;
+	}
+	if (replication.controlled_net_id == net_id && tank != entt::null)
+		return;
+
+	if (tank != entt::null)
+		registry->remove<Predicted, TankController>(tank);
+	tank = replication.find_entity(replication.controlled_net_id);
+	net_id = tank != entt::null ? replication.controlled_net_id : 0;
+	if (tank == entt::null)
+		return;
+
+	registry->emplace_or_replace<Predicted>(tank);
+	registry->emplace_or_replace<TankController>(tank);
+	const Transform& transform = registry->get<Transform>(tank);
+	motion = { transform, registry->get<Velocity>(tank), MathUtil::normalize_angle(registry->get<Tank>(tank).turret_orientation - transform.rot) };
+	previous_motion = motion;
+	accumulator = 0.0f;
+	// The history of another tank can't be replayed on this one
+	acked_sequence = next_sequence - 1;
+	sent_sequence = acked_sequence;
+}
+
+void ClientPrediction::reconcile(const ReplicationClient& replication)
+{
+	PROFILE_ZONE("ClientPrediction::reconcile");
+
+	take_control(replication);
+	if (tank == entt::null || replication.latest_tick == reconciled_tick || replication.tick_rate == 0)
+		return;
+	reconciled_tick = replication.latest_tick;
+
+	const EntityState* state = replication.find_latest_state(net_id);
+	u32 sequence = replication.input_sequence;
+	if (!state || sequence < acked_sequence || sequence >= next_sequence)
+		return;
+	acked_sequence = sequence;
+	tick_time = 1.0f / (f32)replication.tick_rate;
+
+	TankMotion server = get_motion(*state);
+	u32 newest = next_sequence - 1;
+	const PredictedTick& predicted = history[sequence % PREDICTION_HISTORY];
+	if (sequence > 0 && predicted.command.sequence == sequence)
+	{
+		stats.last_error = glm::distance(predicted.motion.transform.pos, server.transform.pos);
+		stats.max_error = std::max(stats.max_error, stats.last_error);
+		f32 rotation_error = std::abs(MathUtil::normalize_angle_difference(predicted.motion.transform.rot, server.transform.rot));
+		if (stats.last_error <= POSITION_TOLERANCE && rotation_error <= ROTATION_TOLERANCE)
+			return;
+	}
+	stats.corrections++;
+
+	// Replays the commands the server hasn't applied yet on top of its state. Without all of them in the history
+	// the server state is the best guess left
+	if (newest - sequence >= PREDICTION_HISTORY)
+		newest = sequence;
+	const TankMovementSettings& settings = registry->get<TankController>(tank).movement_settings;
+	motion = server;
+	previous_motion = server;
+	for (u32 s = sequence + 1; s <= newest; s++)
+	{
+		PredictedTick& tick = history[s % PREDICTION_HISTORY];
+		previous_motion = motion;
+		TankController::simulate(settings, tick.command.to_input(), motion, tick_time);
+		tick.motion = motion;
+		stats.resimulated_commands++;
+	}
+	apply_motion(accumulator / tick_time);
+}
+
+void ClientPrediction::update(const ReplicationClient& replication, f32 delta_time)
+{
+	PROFILE_ZONE("ClientPrediction::update");
+
+	take_control(replication);
+	if (tank == entt::null || replication.tick_rate == 0)
+		return;
+	tick_time = 1.0f / (f32)replication.tick_rate;
+
+	TankController& controller = registry->get<TankController>(tank);
+	accumulator += delta_time;
+	for (u32 i = 0; accumulator >= tick_time; i++)
+	{
+		if (i == MAX_COMMANDS_PER_UPDATE)
+		{
+			accumulator = 0.0f;
+			break;
+		}
+		accumulator -= tick_time;
+
+		InputCommand command = InputCommand::from_input(next_sequence++, controller.input);
+		controller.input.shoot = false;
+
+		previous_motion = motion;
+		TankController::simulate(controller.movement_settings, command.to_input(), motion, tick_time);
+		history[command.sequence % PREDICTION_HISTORY] = { command, motion };
+		stats.commands++;
+	}
+	apply_motion(accumulator / tick_time);
+}
+
+bool ClientPrediction::write_inputs(ByteWriter& writer)
+{
+	u32 newest = next_sequence - 1;
+	u32 count = std::min({ newest - acked_sequence, INPUT_REDUNDANCY, PREDICTION_HISTORY });
+	if (tank == entt::null || newest == sent_sequence || count == 0)
+		return false;
+	sent_sequence = newest;
+
+	writer.clear();
+	writer.write(NetMessage::Input);
+	writer.write(newest);
+	writer.write((u8)count);
+	for (u32 i = 0; i < count; i++)
+		history[(newest - i) % PREDICTION_HISTORY].command.write(writer);
+	return true;
+}
+
+void ClientPrediction::apply_motion(f32 alpha)
+{
+	const Transform& from = previous_motion.transform;
+	const Transform& to = motion.transform;
+
+	Transform& transform = registry->get<Transform>(tank);
+	transform.pos = glm::mix(from.pos, to.pos, alpha);
+	transform.rot = MathUtil::normalize_angle(from.rot + MathUtil::normalize_angle_difference(from.rot, to.rot) * alpha);
+	registry->get<Velocity>(tank) = motion.velocity;
+
+	f32 rel_turret_rotation = previous_motion.rel_turret_rotation + MathUtil::normalize_angle_difference(previous_motion.rel_turret_rotation, motion.rel_turret_rotation) * alpha;
+	registry->get<Tank>(tank).turret_orientation = transform.rot + rel_turret_rotation;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Replication.h"
+#include "InputCommand.h"
+
+#include "entt/entt.hpp"
+
+/// Commands kept for re-simulation; at 60 ticks per second enough for a round trip of one second
+const static u32 PREDICTION_HISTORY = 64;
+/// Commands repeated in each Input message at most, so a lost packet doesn't lose the commands in it
+const static u32 INPUT_REDUNDANCY = 8;
+
+struct PredictionStats
+{
+	u64 commands = 0;
+	/// Snapshots that differed from the prediction of the same command, and the commands simulated again because of them
+	u64 corrections = 0;
+	u64 resimulated_commands = 0;
+	/// Position difference between the server and the prediction of the last checked command, and the largest one
+	f32 last_error = 0.0f;
+	f32 max_error = 0.0f;
+};
+
+/// Client side prediction of the tank the server lets the client drive (ReplicationClient::controlled_net_id).
+/// Every tick the TankInput of the tank becomes an InputCommand, which is sent to the server and simulated right away with
+/// TankController::simulate, so driving doesn't wait a round trip. The commands and their predicted motion are kept; when a
+/// snapshot arrives, the server state after the newest command it applied is compared to the prediction of that command,
+/// and if they differ the newer commands are simulated again from the server state. Collisions aren't predicted, the next
+/// snapshot corrects them
+struct ClientPrediction : NoCopy
+{
+	ClientPrediction(entt::registry& registry);
+
+	/// Checks the prediction against the newest snapshot; call after receiving
+	void reconcile(const ReplicationClient& replication);
+	/// Turns the passed time into commands at the tick rate of the server, from the TankInput of the tank, and predicts them.
+	/// The Transform of the tank is interpolated between the last two predicted ticks
+	void update(const ReplicationClient& replication, f32 delta_time);
+	/// Writes the newest commands the server hasn't applied yet; false if there are no new commands since the last call
+	bool write_inputs(ByteWriter& writer);
+
+	/// entt::null until the server gives control of a spawned tank
+	entt::entity get_tank() const { return tank; }
+
+	PredictionStats stats;
+
+private:
+	struct PredictedTick
+	{
+		InputCommand command;
+		/// After the command was simulated
+		TankMotion motion;
+	};
+
+	void take_control(const ReplicationClient& replication);
+	void apply_motion(f32 alpha);
+
+	entt::registry* registry;
+	entt::entity tank;
+	u32 net_id;
+	/// By sequence % PREDICTION_HISTORY
+	Array<PredictedTick, PREDICTION_HISTORY> history;
+	u32 next_sequence;
+	/// Newest command the server applied and newest command written by write_inputs
+	u32 acked_sequence;
+	u32 sent_sequence;
+	u32 reconciled_tick;
+	f32 tick_time;
+	f32 accumulator;
+	/// After the newest command and the one before, for the interpolation
+	TankMotion motion;
+	TankMotion previous_motion;
+};
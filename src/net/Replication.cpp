@@ -0,0 +1,1138 @@
+#include "Replication.h"
+
+#include "entities/Projectile.h"
+#include "entities/EntityPool.h"
+#include "entities/MapDestruction.h"
+#include "AssetManager.h"
+#include "engine/Memory.h"
+#include "engine/Profiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <bit>
+#include <cmath>
+#include <numeric>
+
+// Fields of an entity record; a record only carries the fields that changed since the baseline. The bits of the Transform
+// and Velocity fields follow the order of their Serialized descriptors
+const static u32 FIELD_POS = 1 << 0;
+const static u32 FIELD_ROT = 1 << 1;
+const static u32 FIELD_LINEAR = 1 << 2;
+const static u32 FIELD_ANGULAR = 1 << 3;
+const static u32 FIELD_TURRET = 1 << 4;
+const static u32 FIELD_DESIGN = 1 << 5;
+const static u32 FIELD_BITS = 6;
+const static u32 FIELDS_MOTION = FIELD_POS | FIELD_ROT | FIELD_LINEAR | FIELD_ANGULAR;
+const static u32 FIELDS_ALL = FIELDS_MOTION | FIELD_TURRET | FIELD_DESIGN;
+const static u32 VELOCITY_FIELDS_SHIFT = 2;
+static_assert(Serializer<Transform>::ALL_FIELDS == (FIELD_POS | FIELD_ROT));
+static_assert(Serializer<Velocity>::ALL_FIELDS << VELOCITY_FIELDS_SHIFT == (FIELD_LINEAR | FIELD_ANGULAR));
+
+const static AngleCodec TURRET_CODEC = { 12 };
+
+const static u32 PROJECTILE_SPRITE_TYPE_BITS = 3;
+const static u32 PROJECTILE_PARTICLE_TYPE_BITS = 1;
+const static u32 EMITTER_BITS = std::bit_width(ParticleEmitters::MAX_EMITTERS - 1);
+/// Particle events a client can have queued for its next snapshot; more are dropped, they are only visual
+const static usz MAX_PENDING_PARTICLE_EVENTS = 256;
+
+/// Baseline of entities that are not in the baseline snapshot
+const static EntityState EMPTY_STATE = {};
+const static std::vector<EntityState> EMPTY_SNAPSHOT;
+
+static bool operator==(const TankDesign& a, const TankDesign& b)
+{
+	return a.color == b.color && a.hull == b.hull && a.turret == b.turret && a.tracks == b.tracks;
+}
+
+static u32 get_changed_fields(const EntityState& state, const EntityState& baseline)
+{
+	u32 fields = 0;
+	if (state.transform.pos != baseline.transform.pos)
+		fields |= FIELD_POS;
+	if (state.transform.rot != baseline.transform.rot)
+		fields |= FIELD_ROT;
+	if (state.velocity.linear != baseline.velocity.linear)
+		fields |= FIELD_LINEAR;
+	if (state.velocity.angular != baseline.velocity.angular)
+		fields |= FIELD_ANGULAR;
+	if (state.turret_orientation != baseline.turret_orientation)
+		fields |= FIELD_TURRET;
+	if (!(state.design == baseline.design))
+		fields |= FIELD_DESIGN;
+	return fields;
+}
+
+static u32 get_gamma_bits(u32 value)
+{
+	return 2 * ((u32)std::bit_width(value + 1) - 1) + 1;
+}
+
+/// The state as the clients decode it. The server keeps quantized states, so both sides compare the same values
+static EntityState quantize_state(const EntityState& state, const QuantizationBounds& bounds)
+{
+	EntityState quantized = state;
+	quantized.transform = Serializer<Transform>::quantize(state.transform, bounds);
+	quantized.velocity = Serializer<Velocity>::quantize(state.velocity, bounds);
+	quantized.turret_orientation = TURRET_CODEC.quantize(state.turret_orientation, bounds);
+	quantized.design = Serializer<TankDesign>::quantize(state.design, bounds);
+	return quantized;
+}
+
+static u32 get_fields_bits(u32 fields, const QuantizationBounds& bounds)
+{
+	u32 bits = Serializer<Transform>::get_bits(bounds, fields & Serializer<Transform>::ALL_FIELDS)
+		+ Serializer<Velocity>::get_bits(bounds, (fields >> VELOCITY_FIELDS_SHIFT) & Serializer<Velocity>::ALL_FIELDS);
+	if (fields & FIELD_TURRET)
+		bits += TURRET_CODEC.get_bits(bounds);
+	if (fields & FIELD_DESIGN)
+		bits += Serializer<TankDesign>::get_bits(bounds);
+	return bits;
+}
+
+static void write_fields(BitWriter& writer, const EntityState& state, u32 fields, const QuantizationBounds& bounds)
+{
+	Serializer<Transform>::write(writer, state.transform, bounds, fields & Serializer<Transform>::ALL_FIELDS);
+	Serializer<Velocity>::write(writer, state.velocity, bounds, (fields >> VELOCITY_FIELDS_SHIFT) & Serializer<Velocity>::ALL_FIELDS);
+	if (fields & FIELD_TURRET)
+		TURRET_CODEC.write(writer, state.turret_orientation, bounds);
+	if (fields & FIELD_DESIGN)
+		Serializer<TankDesign>::write(writer, state.design, bounds);
+}
+
+static void read_fields(BitReader& reader, EntityState& state, u32 fields, const QuantizationBounds& bounds)
+{
+	Serializer<Transform>::read(reader, state.transform, bounds, fields & Serializer<Transform>::ALL_FIELDS);
+	Serializer<Velocity>::read(reader, state.velocity, bounds, (fields >> VELOCITY_FIELDS_SHIFT) & Serializer<Velocity>::ALL_FIELDS);
+	if (fields & FIELD_TURRET)
+		TURRET_CODEC.read(reader, state.turret_orientation, bounds);
+	if (fields & FIELD_DESIGN)
+		Serializer<TankDesign>::read(reader, state.design, bounds);
+}
+
+static void write_spawn(BitWriter& writer, const EntitySpawn& spawn, const QuantizationBounds& bounds)
+{
+	writer.write_gamma(spawn.state.net_id);
+	writer.write_bool(spawn.type == ReplicatedType::Projectile);
+	if (spawn.type == ReplicatedType::Tank)
+	{
+		write_fields(writer, spawn.state, FIELDS_ALL, bounds);
+		writer.write_gamma(spawn.tank_id);
+		return;
+	}
+
+	write_fields(writer, spawn.state, FIELDS_MOTION, bounds);
+	writer.write_gamma(spawn.shooter_net_id);
+	writer.write(static_cast<u32>(spawn.sprite_type), PROJECTILE_SPRITE_TYPE_BITS);
+	writer.write(spawn.particle_type, PROJECTILE_PARTICLE_TYPE_BITS);
+	// Spawns are rare, the projectile type keeps its exact values
+	writer.write(std::bit_cast<u32>(spawn.scale), 32);
+	writer.write(std::bit_cast<u32>(spawn.initial_velocity), 32);
+	writer.write_bool(spawn.fix_orientation);
+	writer.write_bool(spawn.fix_velocity);
+}
+
+/// Returns false if the spawn is malformed
+static bool read_spawn(BitReader& reader, EntitySpawn& spawn, const QuantizationBounds& bounds)
+{
+	spawn = {};
+	spawn.state.net_id = reader.read_gamma();
+	spawn.type = reader.read_bool() ? ReplicatedType::Projectile : ReplicatedType::Tank;
+	if (spawn.type == ReplicatedType::Tank)
+	{
+		read_fields(reader, spawn.state, FIELDS_ALL, bounds);
+		spawn.tank_id = reader.read_gamma();
+		return !reader.failed;
+	}
+
+	read_fields(reader, spawn.state, FIELDS_MOTION, bounds);
+	spawn.shooter_net_id = reader.read_gamma();
+	spawn.sprite_type = static_cast<ProjectileSpriteType>(reader.read(PROJECTILE_SPRITE_TYPE_BITS));
+	spawn.particle_type = (u8)reader.read(PROJECTILE_PARTICLE_TYPE_BITS);
+	spawn.scale = std::bit_cast<f32>(reader.read(32));
+	spawn.initial_velocity = std::bit_cast<f32>(reader.read(32));
+	spawn.fix_orientation = reader.read_bool();
+	spawn.fix_velocity = reader.read_bool();
+	return !reader.failed;
+}
+
+/// Ascending ids: a gamma coded count and the gamma coded differences
+static void write_ids(BitWriter& writer, const u32* ids, usz count)
+{
+	writer.write_gamma((u32)count);
+	u32 previous = 0;
+	for (usz i = 0; i < count; i++)
+	{
+		// Net ids start at 1 and never repeat, so the differences are at least 1
+		writer.write_gamma(ids[i] - previous - 1);
+		previous = ids[i];
+	}
+}
+
+template<typename Vector>
+static void read_ids(BitReader& reader, Vector& ids)
+{
+	u32 count = reader.read_gamma();
+	u32 id = 0;
+	for (u32 i = 0; i < count && !reader.failed; i++)
+	{
+		id += reader.read_gamma() + 1;
+		ids.push_back(id);
+	}
+}
+
+ReplicationServer::ReplicationServer(entt::registry& registry, const ReplicationSettings& settings)
+	: settings(settings), bounds(settings.world_bounds), last_tick_bytes(0), last_tick_entities(0), registry(&registry), next_net_id(1)
+{
+	registry.ctx().emplace<ParticleEvents>();
+
+	registry.on_construct<Tank>().connect<&ReplicationServer::on_spawn>(*this);
+	registry.on_destroy<Tank>().connect<&ReplicationServer::on_despawn>(*this);
+	registry.on_construct<Projectile>().connect<&ReplicationServer::on_spawn>(*this);
+	registry.on_destroy<Projectile>().connect<&ReplicationServer::on_despawn>(*this);
+	// Pooled projectiles despawn on release and spawn again when they are acquired
+	registry.on_construct<Pooled>().connect<&ReplicationServer::on_pooled>(*this);
+	registry.on_destroy<Pooled>().connect<&ReplicationServer::on_unpooled>(*this);
+
+	for (entt::entity entity : registry.view<Tank>())
+		on_spawn(registry, entity);
+	for (entt::entity entity : registry.view<Projectile>(entt::exclude<Pooled>))
+		on_spawn(registry, entity);
+}
+
+ReplicationServer::~ReplicationServer()
+{
+	registry->on_construct<Tank>().disconnect(this);
+	registry->on_destroy<Tank>().disconnect(this);
+	registry->on_construct<Projectile>().disconnect(this);
+	registry->on_destroy<Projectile>().disconnect(this);
+	registry->on_construct<Pooled>().disconnect(this);
+	registry->on_destroy<Pooled>().disconnect(this);
+	registry->ctx().erase<ParticleEvents>();
+}
+
+u32 ReplicationServer::add_client()
+{
+	for (u32 i = 0; i < clients.size(); i++)
+	{
+		if (!clients[i])
+		{
+			clients[i] = std::make_unique<Client>();
+			return i;
+		}
+	}
+	clients.push_back(std::make_unique<Client>());
+	return (u32)clients.size() - 1;
+}
+
+void ReplicationServer::remove_client(u32 client)
+{
+	if (client < clients.size())
+		clients[client].reset();
+}
+
+u32 ReplicationServer::get_client_count() const
+{
+	return (u32)std::count_if(clients.begin(), clients.end(), [](const std::unique_ptr<Client>& client) { return client != nullptr; });
+}
+
+void ReplicationServer::receive(u32 client, const u8* data, usz size)
+{
+	if (client >= clients.size() || !clients[client])
+		return;
+
+	ByteReader reader(data, size);
+	switch (reader.read<NetMessage>())
+	{
+	case NetMessage::Ack:
+		receive_ack(*clients[client], reader);
+		break;
+	case NetMessage::Input:
+		receive_inputs(*clients[client], reader);
+		break;
+	default:
+		break;
+	}
+}
+
+void ReplicationServer::receive_ack(Client& client, ByteReader& reader)
+{
+	u32 tick = reader.read<u32>();
+	bool has_view = reader.read<u8>() != 0;
+	Rect view = has_view ? reader.read<Rect>() : Rect{};
+	u16 snapshot_rate = reader.read<u16>();
+	// Acks can arrive out of order; only a newer one moves the baseline and the view
+	if (reader.failed || tick <= client.acked_tick)
+		return;
+
+	client.acked_tick = tick;
+	client.has_view = has_view && std::isfinite(view.x) && std::isfinite(view.y) && std::isfinite(view.width) && std::isfinite(view.height)
+		&& view.width >= 0.0f && view.height >= 0.0f;
+	client.view = view;
+	client.snapshot_rate = snapshot_rate;
+}
+
+void ReplicationServer::receive_inputs(Client& client, ByteReader& reader)
+{
+	// Newest first, the sequences count down from the newest
+	u32 newest = reader.read<u32>();
+	u8 count = reader.read<u8>();
+	if (reader.failed || count == 0 || count > newest)
+		return;
+
+	Array<InputCommand, 255> commands;
+	for (u32 i = 0; i < count; i++)
+	{
+		commands[i].sequence = newest - i;
+		commands[i].read(reader);
+	}
+	if (reader.failed)
+		return;
+
+	for (u32 i = count; i-- > 0;)
+	{
+		if (commands[i].sequence <= client.received_sequence)
+			continue;
+		client.inputs.push_back(commands[i]);
+		client.received_sequence = commands[i].sequence;
+	}
+	while (client.inputs.size() > INPUT_QUEUE_LIMIT)
+		client.inputs.pop_front();
+}
+
+void ReplicationServer::set_controlled_tank(u32 client, entt::entity tank)
+{
+	if (client >= clients.size() || !clients[client])
+		return;
+	clients[client]->tank = tank;
+	clients[client]->control_changed = true;
+}
+
+void ReplicationServer::write_inputs(entt::registry& registry, f32)
+{
+	for (const std::unique_ptr<Client>& client : clients)
+	{
+		if (!client || client->tank == entt::null)
+			continue;
+		TankController* controller = registry.valid(client->tank) ? registry.try_get<TankController>(client->tank) : nullptr;
+		if (!controller)
+			continue;
+
+		if (!client->inputs.empty())
+		{
+			client->last_command = client->inputs.front();
+			client->inputs.pop_front();
+			client->applied_sequence = client->last_command.sequence;
+		}
+		controller->input = client->last_command.to_input();
+		// A shot is only fired by the command that carries it, not by its repetitions
+		client->last_command.fire = false;
+	}
+}
+
+void ReplicationServer::on_spawn(entt::registry&, entt::entity entity)
+{
+	u32 index = entt::to_entity(entity);
+	if (index >= net_ids.size())
+		net_ids.resize(index + 1, 0);
+	if (net_ids[index] == 0)
+		net_ids[index] = next_net_id++;
+}
+
+void ReplicationServer::on_despawn(entt::registry&, entt::entity entity)
+{
+	// The clients learn it when the entity is missing from the states of the next update. Entities that live shorter
+	// than a tick are never announced
+	u32 index = entt::to_entity(entity);
+	if (index < net_ids.size())
+		net_ids[index] = 0;
+}
+
+void ReplicationServer::on_pooled(entt::registry& registry, entt::entity entity)
+{
+	if (registry.all_of<Projectile>(entity))
+		on_despawn(registry, entity);
+}
+
+void ReplicationServer::on_unpooled(entt::registry& registry, entt::entity entity)
+{
+	if (registry.all_of<Projectile>(entity))
+		on_spawn(registry, entity);
+}
+
+u32 ReplicationServer::get_net_id(entt::entity entity) const
+{
+	u32 index = entt::to_entity(entity);
+	return index < net_ids.size() ? net_ids[index] : 0;
+}
+
+void ReplicationServer::collect_states()
+{
+	PROFILE_ZONE("ReplicationServer::collect_states");
+	ScratchScope scratch;
+	ArenaVector<EntityState> collected(scratch.allocator<EntityState>());
+	ArenaVector<entt::entity> entities(scratch.allocator<entt::entity>());
+	for (auto [entity, tank, transform, velocity] : registry->view<Tank, Transform, Velocity>().each())
+	{
+		if (u32 net_id = get_net_id(entity))
+		{
+			collected.push_back(quantize_state({ net_id, transform, velocity, tank.turret_orientation, tank.design }, bounds));
+			entities.push_back(entity);
+		}
+	}
+	for (auto [entity, projectile, transform, velocity] : registry->view<Projectile, Transform, Velocity>(entt::exclude<Pooled>).each())
+	{
+		if (u32 net_id = get_net_id(entity))
+		{
+			collected.push_back(quantize_state({ net_id, transform, velocity, 0.0f, {} }, bounds));
+			entities.push_back(entity);
+		}
+	}
+
+	ArenaVector<u32> order(collected.size(), 0, scratch.allocator<u32>());
+	std::iota(order.begin(), order.end(), 0u);
+	std::sort(order.begin(), order.end(), [&](u32 a, u32 b) { return collected[a].net_id < collected[b].net_id; });
+	states.resize(collected.size());
+	state_entities.resize(collected.size());
+	for (usz i = 0; i < order.size(); i++)
+	{
+		states[i] = collected[order[i]];
+		state_entities[i] = entities[order[i]];
+	}
+}
+
+EntitySpawn ReplicationServer::get_spawn(entt::entity entity, u32 net_id) const
+{
+	EntitySpawn spawn = {};
+	spawn.state.net_id = net_id;
+	spawn.state.transform = registry->get<Transform>(entity);
+	spawn.state.velocity = registry->get<Velocity>(entity);
+
+	if (const Tank* tank = registry->try_get<Tank>(entity))
+	{
+		spawn.type = ReplicatedType::Tank;
+		spawn.state.turret_orientation = tank->turret_orientation;
+		spawn.state.design = tank->design;
+		spawn.tank_id = tank->id;
+		spawn.state = quantize_state(spawn.state, bounds);
+		return spawn;
+	}
+
+	const Projectile& projectile = registry->get<Projectile>(entity);
+	spawn.type = ReplicatedType::Projectile;
+	spawn.shooter_net_id = registry->valid(projectile.shooter_entity) ? get_net_id(projectile.shooter_entity) : 0;
+	spawn.sprite_type = projectile.sprite_type;
+	spawn.particle_type = projectile.particle_type;
+	spawn.scale = projectile.scale;
+	spawn.initial_velocity = projectile.initial_velocity;
+	spawn.fix_orientation = projectile.fix_orientation;
+	spawn.fix_velocity = projectile.fix_velocity;
+	spawn.state = quantize_state(spawn.state, bounds);
+	return spawn;
+}
+
+void ReplicationServer::update_interest(Client& client, ArenaVector<u32>& indices, ArenaVector<u32>& entered, ArenaVector<u32>& left)
+{
+	u32 controlled_id = registry->valid(client.tank) ? get_net_id(client.tank) : 0;
+	const InterestSettings& interest = settings.interest;
+	Rect view = client.view;
+	bool use_view = client.has_view && view.width <= interest.max_view_size.x && view.height <= interest.max_view_size.y;
+	if (use_view && controlled_id != 0)
+	{
+		// Cut to the largest view around the tank
+		glm::vec2 pos = registry->get<Transform>(client.tank).pos;
+		glm::vec2 min = glm::max(glm::vec2(view.x, view.y), pos - interest.max_view_size * 0.5f);
+		glm::vec2 max = glm::min(glm::vec2(view.x + view.width, view.y + view.height), pos + interest.max_view_size * 0.5f);
+		use_view = min.x <= max.x && min.y <= max.y;
+		view = { min.x, min.y, max.x - min.x, max.y - min.y };
+	}
+
+	const Rect* area = nullptr;
+	if (interest.enabled && use_view)
+	{
+		area = &view;
+	}
+	else if (interest.enabled && controlled_id != 0)
+	{
+		glm::vec2 size = interest.default_view_size;
+		glm::vec2 pos = registry->get<Transform>(client.tank).pos;
+		view = { pos.x - size.x * 0.5f, pos.y - size.y * 0.5f, size.x, size.y };
+		area = &view;
+	}
+	client.interest.update(grid, states, area, settings.interest, controlled_id, indices, entered, left);
+}
+
+void ReplicationServer::write_entity_events(u32 tick, const ArenaVector<u32>& entered, const ArenaVector<u32>& left, ByteWriter& writer)
+{
+	writer.clear();
+	if (entered.empty() && left.empty())
+		return;
+
+	writer.write(NetMessage::EntityEvents);
+	writer.write(tick);
+	BitWriter bits(writer);
+	bits.write_gamma((u32)entered.size());
+	for (u32 i : entered)
+		write_spawn(bits, get_spawn(state_entities[i], states[i].net_id), bounds);
+	// Ascending, so the differences are small
+	write_ids(bits, left.data(), left.size());
+	bits.flush();
+}
+
+void ReplicationServer::collect_particle_events()
+{
+	registry->ctx().get<ParticleEvents>().take(particle_spawns, particle_triggers);
+	for (ParticleEvents::Trigger& trigger : particle_triggers)
+	{
+		if (!registry->valid(trigger.entity) || get_net_id(trigger.entity) == 0)
+			trigger.entity = entt::null;
+	}
+}
+
+void ReplicationServer::write_particle_block(Client& client)
+{
+	AssetManager& assets = AssetManager::get_instance();
+	particle_block.clear();
+	BitWriter writer(particle_block);
+
+	writer.write_gamma((u32)client.particle_spawns.size());
+	for (const ParticleEvents::Spawn& spawn : client.particle_spawns)
+	{
+		writer.write_gamma(assets.get_particle_effect_index(*spawn.effect));
+		Serializer<ParticleSpawn>::write(writer, spawn.spawn, bounds);
+	}
+	writer.write_gamma((u32)client.particle_triggers.size());
+	for (auto [net_id, emitter] : client.particle_triggers)
+	{
+		writer.write_gamma(net_id);
+		writer.write(emitter, EMITTER_BITS);
+	}
+	// Byte aligned, the snapshot copies it as is
+	writer.flush();
+
+	client.particle_spawns.clear();
+	client.particle_triggers.clear();
+}
+
+void ReplicationServer::write_snapshot(Client& client, u32 tick, const ArenaVector<u32>& relevant, ByteWriter& writer)
+{
+	ScratchScope scratch;
+
+	// The baseline must still be in the history and must not be the slot this snapshot replaces
+	const SentSnapshot* baseline = nullptr;
+	if (client.acked_tick != 0 && tick - client.acked_tick < SNAPSHOT_HISTORY)
+	{
+		const SentSnapshot& acked = client.history[client.acked_tick % SNAPSHOT_HISTORY];
+		if (acked.tick == client.acked_tick)
+			baseline = &acked;
+	}
+	const std::vector<EntityState>& base = baseline ? baseline->entities : EMPTY_SNAPSHOT;
+
+	writer.clear();
+	writer.write(NetMessage::Snapshot);
+	writer.write(tick);
+	writer.write(baseline ? baseline->tick : 0u);
+	writer.write(client.applied_sequence);
+	writer.write_bytes(particle_block.data(), particle_block.size());
+
+	// Merge of the baseline and the states the client is interested in, both sorted by net id. Indices into relevant
+	// (and the priorities of the InterestSet) from here on
+	ArenaVector<s32> base_indices(relevant.size(), -1, scratch.allocator<s32>());
+	ArenaVector<u32> fields(relevant.size(), 0, scratch.allocator<u32>());
+	ArenaVector<u32> changed(scratch.allocator<u32>());
+	ArenaVector<u32> removed(scratch.allocator<u32>());
+	std::vector<f32>& priorities = client.interest.priorities;
+	u32 controlled_id = registry->valid(client.tank) ? get_net_id(client.tank) : 0;
+	s32 controlled = -1;
+	usz b = 0;
+	for (u32 k = 0; k < relevant.size(); k++)
+	{
+		const EntityState& state = states[relevant[k]];
+		while (b < base.size() && base[b].net_id < state.net_id)
+			removed.push_back(base[b++].net_id);
+
+		const EntityState* previous = &EMPTY_STATE;
+		if (b < base.size() && base[b].net_id == state.net_id)
+		{
+			base_indices[k] = (s32)b;
+			previous = &base[b++];
+		}
+		fields[k] = get_changed_fields(state, *previous);
+		// Entities new to the client are always written, even if their state is all zeros
+		if (fields[k] == 0 && base_indices[k] >= 0)
+		{
+			priorities[k] = 0.0f;
+			continue;
+		}
+		if (state.net_id == controlled_id)
+			controlled = (s32)k;
+		else
+			changed.push_back(k);
+	}
+	while (b < base.size())
+		removed.push_back(base[b++].net_id);
+
+	BitWriter bits(writer);
+	write_ids(bits, removed.data(), removed.size());
+
+	// The records are picked first and written sorted by net id, so their ids can be coded as differences.
+	// The size of a record is estimated with its full id
+	ArenaVector<u32> records(scratch.allocator<u32>());
+	usz used_bits = writer.size() * 8 + bits.get_bits() + get_gamma_bits((u32)changed.size() + 1);
+	auto get_record_bits = [&](u32 k) { return (usz)(get_gamma_bits(states[relevant[k]].net_id) + FIELD_BITS + get_fields_bits(fields[k], bounds)); };
+
+	// The tank the client drives is never deferred, the client checks its prediction against it
+	if (controlled >= 0)
+	{
+		records.push_back((u32)controlled);
+		used_bits += get_record_bits((u32)controlled);
+	}
+	u32 controlled_count = (u32)records.size();
+
+	// Highest accumulated priority first. Deferred records keep theirs and add to it next time, so with a tight budget
+	// far and slow entities are sent less often, but still sent
+	for (u32 k : changed)
+		priorities[k] += InterestSet::get_priority(states[relevant[k]], client.interest.center, settings.interest);
+	std::sort(changed.begin(), changed.end(), [&](u32 a, u32 b) { return priorities[a] != priorities[b] ? priorities[a] > priorities[b] : a < b; });
+	usz limit = (usz)std::max(client.credit, 0.0f) * 8;
+	for (u32 k : changed)
+	{
+		usz record_bits = get_record_bits(k);
+		if (used_bits + record_bits > limit)
+			break;
+		records.push_back(k);
+		used_bits += record_bits;
+	}
+	u32 record_count = (u32)records.size();
+	stats.entity_records += record_count;
+	stats.deferred_records += changed.size() + controlled_count - record_count;
+
+	// States are sorted by net id, so are their indices
+	std::sort(records.begin(), records.end());
+	ArenaVector<u8> written(relevant.size(), 0, scratch.allocator<u8>());
+	bits.write_gamma(record_count);
+	u32 previous_id = 0;
+	for (u32 k : records)
+	{
+		const EntityState& state = states[relevant[k]];
+		bits.write_gamma(state.net_id - previous_id - 1);
+		previous_id = state.net_id;
+		bits.write(fields[k], FIELD_BITS);
+		write_fields(bits, state, fields[k], bounds);
+		written[k] = 1;
+		priorities[k] = 0.0f;
+	}
+	bits.flush();
+
+	// What the client will have for this tick: deferred entities keep their baseline state
+	SentSnapshot& sent = client.history[tick % SNAPSHOT_HISTORY];
+	sent.tick = tick;
+	sent.entities.clear();
+	for (u32 k = 0; k < relevant.size(); k++)
+	{
+		if (written[k])
+			sent.entities.push_back(states[relevant[k]]);
+		else if (base_indices[k] >= 0)
+			sent.entities.push_back(base[base_indices[k]]);
+	}
+}
+
+bool ReplicationServer::write_tile_changes(Client& client, ByteWriter& writer)
+{
+	auto view = registry->view<MapDestruction>();
+	if (view.begin() == view.end())
+		return false;
+	const std::vector<MapTileChange>& change_log = view.get<MapDestruction>(*view.begin()).change_log;
+	// A rewound log can't be taken back from the clients, they keep the changes they have
+	client.next_tile_change = std::min(client.next_tile_change, (u32)change_log.size());
+	if (client.next_tile_change == change_log.size())
+		return false;
+
+	writer.clear();
+	writer.write(NetMessage::TileChanges);
+	writer.write_varint(client.next_tile_change);
+	writer.write_varint((u32)change_log.size() - client.next_tile_change);
+	for (u32 i = client.next_tile_change; i < change_log.size(); i++)
+	{
+		const MapTileChange& change = change_log[i];
+		writer.write_varint(change.gid);
+		writer.write_varint(change.layer);
+		writer.write(change.x);
+		writer.write(change.y);
+		writer.write(change.health);
+	}
+	client.next_tile_change = (u32)change_log.size();
+	return true;
+}
+
+void ReplicationServer::update(u32 tick, const NetSendFunction& send)
+{
+	PROFILE_ZONE("ReplicationServer::update");
+
+	collect_states();
+	if (settings.interest.enabled)
+		grid.build(states, settings.world_bounds, settings.interest.cell_size);
+	collect_particle_events();
+
+	stats.ticks++;
+	last_tick_bytes = 0;
+	last_tick_entities = (u32)states.size();
+	f32 refill = (f32)settings.bytes_per_second / (f32)settings.tick_rate;
+
+	ScratchScope scratch;
+	ArenaVector<u32> relevant(scratch.allocator<u32>());
+	ArenaVector<u32> entered(scratch.allocator<u32>());
+	ArenaVector<u32> left(scratch.allocator<u32>());
+
+	for (u32 id = 0; id < clients.size(); id++)
+	{
+		Client* client = clients[id].get();
+		if (!client)
+			continue;
+		client->credit = std::min(client->credit + refill, refill * 2.0f);
+
+		usz event_bytes = 0;
+		if (!client->joined)
+		{
+			// The live entities follow as they enter the interest of the new client
+			ByteWriter& welcome = snapshot_message;
+			welcome.clear();
+			welcome.write(NetMessage::Welcome);
+			welcome.write(NET_PROTOCOL_VERSION);
+			welcome.write((u16)settings.tick_rate);
+			welcome.write(settings.world_bounds);
+			send(id, NetChannel::Events, welcome.data(), welcome.size());
+			event_bytes += welcome.size();
+			client->joined = true;
+			client->next_snapshot_tick = tick;
+		}
+
+		// Between its snapshots a throttled client gets no spawns and despawns either, its interest stays as it was
+		bool snapshot_tick = tick >= client->next_snapshot_tick;
+		if (snapshot_tick)
+		{
+			update_interest(*client, relevant, entered, left);
+			write_entity_events(tick, entered, left, events_message);
+			if (events_message.size() > 0)
+			{
+				send(id, NetChannel::Events, events_message.data(), events_message.size());
+				event_bytes += events_message.size();
+				stats.entity_enters += entered.size();
+				stats.entity_leaves += left.size();
+			}
+		}
+		if (client->control_changed)
+		{
+			ByteWriter& control = snapshot_message;
+			control.clear();
+			control.write(NetMessage::Control);
+			control.write_varint(registry->valid(client->tank) ? get_net_id(client->tank) : 0);
+			send(id, NetChannel::Events, control.data(), control.size());
+			event_bytes += control.size();
+			client->control_changed = false;
+		}
+		if (write_tile_changes(*client, events_message))
+		{
+			send(id, NetChannel::Events, events_message.data(), events_message.size());
+			event_bytes += events_message.size();
+		}
+		client->credit -= (f32)event_bytes;
+		stats.event_bytes += event_bytes;
+		last_tick_bytes += event_bytes;
+
+		for (const ParticleEvents::Spawn& spawn : particle_spawns)
+		{
+			if (client->particle_spawns.size() < MAX_PENDING_PARTICLE_EVENTS && client->interest.is_inside(spawn.spawn.pos))
+				client->particle_spawns.push_back(spawn);
+		}
+		for (const ParticleEvents::Trigger& trigger : particle_triggers)
+		{
+			u32 net_id = trigger.entity != entt::null ? get_net_id(trigger.entity) : 0;
+			if (client->particle_triggers.size() < MAX_PENDING_PARTICLE_EVENTS && net_id != 0 && client->interest.contains(net_id))
+				client->particle_triggers.emplace_back(net_id, trigger.emitter);
+		}
+
+		if (!snapshot_tick)
+		{
+			stats.snapshots_throttled++;
+			continue;
+		}
+		u32 interval = client->snapshot_rate > 0 ? std::max(1u, (settings.tick_rate + client->snapshot_rate - 1) / client->snapshot_rate) : 1;
+		client->next_snapshot_tick = tick + interval;
+
+		if (client->credit <= 0.0f)
+		{
+			stats.snapshots_skipped++;
+			continue;
+		}
+
+		write_particle_block(*client);
+		write_snapshot(*client, tick, relevant, snapshot_message);
+		send(id, NetChannel::Snapshots, snapshot_message.data(), snapshot_message.size());
+		client->credit -= (f32)snapshot_message.size();
+		stats.snapshots_sent++;
+		stats.snapshot_bytes += snapshot_message.size();
+		stats.entity_ticks += relevant.size();
+		last_tick_bytes += snapshot_message.size();
+	}
+
+	PROFILE_COUNTER("replication bytes", last_tick_bytes);
+	PROFILE_COUNTER("replicated entities", last_tick_entities);
+}
+
+ReplicationClient::ReplicationClient(entt::registry& registry)
+	: welcomed(false), tick_rate(0), latest_tick(0), bytes_received(0), snapshots_received(0), snapshots_dropped(0),
+	controlled_net_id(0), input_sequence(0), snapshot_rate(0), registry(&registry), acked_tick(0), has_view(false), view{}, next_tile_change(0)
+{
+}
+
+ReplicationClient::~ReplicationClient()
+{
+	for (auto [net_id, entity] : entities)
+	{
+		if (registry->valid(entity))
+			registry->destroy(entity);
+	}
+}
+
+bool ReplicationClient::receive(const u8* data, usz size)
+{
+	bytes_received += size;
+
+	ByteReader reader(data, size);
+	switch (reader.read<NetMessage>())
+	{
+	case NetMessage::Welcome:
+		return receive_welcome(reader);
+	case NetMessage::EntityEvents:
+		return receive_entity_events(reader);
+	case NetMessage::Snapshot:
+		return receive_snapshot(reader);
+	case NetMessage::Control:
+		return receive_control(reader);
+	case NetMessage::TileChanges:
+		return receive_tile_changes(reader);
+	default:
+		return false;
+	}
+}
+
+bool ReplicationClient::write_ack(ByteWriter& writer)
+{
+	if (latest_tick == acked_tick)
+		return false;
+
+	writer.clear();
+	writer.write(NetMessage::Ack);
+	writer.write(latest_tick);
+	writer.write<u8>(has_view ? 1 : 0);
+	if (has_view)
+		writer.write(view);
+	writer.write(snapshot_rate);
+	acked_tick = latest_tick;
+	return true;
+}
+
+void ReplicationClient::set_view(const Rect& view)
+{
+	this->view = view;
+	has_view = true;
+}
+
+void ReplicationClient::extrapolate(entt::registry& registry, f32 delta_time)
+{
+	for (auto [entity, replicated, transform, velocity] : registry.view<Replicated, Transform, Velocity>(entt::exclude<Predicted>).each())
+	{
+		transform.pos += velocity.linear * delta_time;
+		transform.rot += velocity.angular * delta_time;
+	}
+}
+
+bool ReplicationClient::receive_welcome(ByteReader& reader)
+{
+	u16 version = reader.read<u16>();
+	u16 rate = reader.read<u16>();
+	Rect world_bounds = reader.read<Rect>();
+	if (reader.failed)
+		return false;
+	if (version != NET_PROTOCOL_VERSION)
+		throw std::runtime_error("Server runs protocol version " + std::to_string(version) + ", this client " + std::to_string(NET_PROTOCOL_VERSION));
+	if (!std::isfinite(world_bounds.x) || !std::isfinite(world_bounds.y) || !(world_bounds.width > 0.0f) || !(world_bounds.height > 0.0f))
+		return false;
+
+	welcomed = true;
+	tick_rate = rate;
+	bounds = QuantizationBounds(world_bounds);
+	return true;
+}
+
+bool ReplicationClient::receive_control(ByteReader& reader)
+{
+	u32 net_id = reader.read_varint();
+	if (reader.failed)
+		return false;
+	controlled_net_id = net_id;
+	return true;
+}
+
+bool ReplicationClient::receive_tile_changes(ByteReader& reader)
+{
+	u32 first_change = reader.read_varint();
+	u32 change_count = reader.read_varint();
+	if (reader.failed || !welcomed || first_change > next_tile_change)
+		return false;
+
+	auto view = registry->view<Map, MapDestruction>();
+	entt::entity map_entity = view.begin() != view.end() ? *view.begin() : entt::null;
+	for (u32 i = 0; i < change_count; i++)
+	{
+		MapTileChange change;
+		change.gid = reader.read_varint();
+		change.layer = (u16)reader.read_varint();
+		change.x = reader.read<u16>();
+		change.y = reader.read<u16>();
+		change.health = reader.read<u16>();
+		if (reader.failed)
+			return false;
+		// Changes the client already has
+		if (first_change + i < next_tile_change)
+			continue;
+		next_tile_change++;
+		// A streamed map keeps its destructible tiles static
+		if (map_entity == entt::null)
+			continue;
+
+		const Map& map = view.get<Map>(map_entity);
+		if (change.layer >= map.layers.size() || !std::holds_alternative<MapGridLayer>(map.layers[change.layer]))
+			return false;
+		const MapGridLayer& layer = std::get<MapGridLayer>(map.layers[change.layer]);
+		if (change.x >= layer.h_tiles || change.y >= layer.v_tiles)
+			return false;
+		MapDestruction::apply_change(*registry, map_entity, change);
+	}
+	return true;
+}
+
+bool ReplicationClient::receive_entity_events(ByteReader& reader)
+{
+	reader.read<u32>();
+	if (reader.failed || !welcomed)
+		return false;
+
+	BitReader bits(reader.data + reader.offset, reader.size - reader.offset);
+	u32 spawn_count = bits.read_gamma();
+	for (u32 i = 0; i < spawn_count && !bits.failed; i++)
+	{
+		EntitySpawn spawn;
+		if (!read_spawn(bits, spawn, bounds))
+			return false;
+		spawn_entity(spawn);
+	}
+
+	ScratchScope scratch;
+	ArenaVector<u32> despawned(scratch.allocator<u32>());
+	read_ids(bits, despawned);
+	for (u32 net_id : despawned)
+		despawn_entity(net_id);
+	return !bits.failed;
+}
+
+bool ReplicationClient::receive_snapshot(ByteReader& reader)
+{
+	PROFILE_ZONE("ReplicationClient::receive_snapshot");
+
+	u32 tick = reader.read<u32>();
+	u32 baseline_tick = reader.read<u32>();
+	u32 sequence = reader.read<u32>();
+	if (reader.failed)
+		return false;
+	// Positions can't be decoded without the bounds of the welcome, which may arrive after the first snapshots
+	if (tick <= latest_tick || !welcomed)
+	{
+		snapshots_dropped++;
+		return true;
+	}
+
+	const std::vector<EntityState>* base = &EMPTY_SNAPSHOT;
+	if (baseline_tick != 0)
+	{
+		const ReceivedSnapshot& baseline = snapshots[baseline_tick % SNAPSHOT_HISTORY];
+		if (baseline.tick != baseline_tick || baseline_tick >= tick || tick - baseline_tick >= SNAPSHOT_HISTORY)
+		{
+			snapshots_dropped++;
+			return false;
+		}
+		base = &baseline.entities;
+	}
+
+	// The particle block is byte aligned, the records follow it
+	BitReader particles(reader.data + reader.offset, reader.size - reader.offset);
+	AssetManager& assets = AssetManager::get_instance();
+	particle_spawns.clear();
+	u32 spawn_count = particles.read_gamma();
+	for (u32 i = 0; i < spawn_count && !particles.failed; i++)
+	{
+		Asset<ParticleEffect>* effect = assets.get_particle_effect(particles.read_gamma());
+		ParticleSpawn spawn = {};
+		Serializer<ParticleSpawn>::read(particles, spawn, bounds);
+		if (effect)
+			particle_spawns.push_back({ effect, spawn });
+	}
+	particle_triggers.clear();
+	u32 trigger_count = particles.read_gamma();
+	for (u32 i = 0; i < trigger_count && !particles.failed; i++)
+	{
+		u32 net_id = particles.read_gamma();
+		u32 emitter = particles.read(EMITTER_BITS);
+		if (emitter < ParticleEmitters::MAX_EMITTERS)
+			particle_triggers.emplace_back(net_id, emitter);
+	}
+	if (particles.failed)
+		return false;
+	usz offset = reader.offset + particles.get_bytes_read();
+
+	BitReader bits(reader.data + offset, reader.size - offset);
+	ScratchScope scratch;
+	ArenaVector<u32> removed(scratch.allocator<u32>());
+	read_ids(bits, removed);
+
+	// The baseline without the removed entities, then the records on top
+	ReceivedSnapshot& snapshot = snapshots[tick % SNAPSHOT_HISTORY];
+	snapshot.tick = 0;
+	snapshot.entities.clear();
+	usz r = 0;
+	for (const EntityState& state : *base)
+	{
+		while (r < removed.size() && removed[r] < state.net_id)
+			r++;
+		if (r < removed.size() && removed[r] == state.net_id)
+			continue;
+		snapshot.entities.push_back(state);
+	}
+	usz base_count = snapshot.entities.size();
+
+	// Records ascend by net id, so the search for the next one starts after the last
+	u32 record_count = bits.read_gamma();
+	u32 net_id = 0;
+	usz next = 0;
+	for (u32 i = 0; i < record_count && !bits.failed; i++)
+	{
+		net_id += bits.read_gamma() + 1;
+		u32 fields = bits.read(FIELD_BITS);
+
+		auto begin = snapshot.entities.begin();
+		next = std::lower_bound(begin + next, begin + base_count, net_id, [](const EntityState& state, u32 id) { return state.net_id < id; }) - begin;
+		if (next < base_count && snapshot.entities[next].net_id == net_id)
+		{
+			read_fields(bits, snapshot.entities[next], fields, bounds);
+			continue;
+		}
+		EntityState state = EMPTY_STATE;
+		state.net_id = net_id;
+		read_fields(bits, state, fields, bounds);
+		snapshot.entities.push_back(state);
+	}
+	if (bits.failed)
+		return false;
+
+	// The new entities are sorted already
+	if (snapshot.entities.size() > base_count)
+	{
+		auto by_id = [](const EntityState& a, const EntityState& b) { return a.net_id < b.net_id; };
+		std::inplace_merge(snapshot.entities.begin(), snapshot.entities.begin() + base_count, snapshot.entities.end(), by_id);
+	}
+	snapshot.tick = tick;
+	latest_tick = tick;
+	input_sequence = sequence;
+	snapshots_received++;
+
+	for (const EntityState& state : snapshot.entities)
+		apply_state(state);
+
+	for (const ParticleEvents::Spawn& spawn : particle_spawns)
+		ParticleSystem::spawn(*registry, *spawn.effect, { spawn.spawn.pos, spawn.spawn.rot }, spawn.spawn.frames_per_second, spawn.spawn.scale, spawn.spawn.velocity);
+	for (auto [net_id, emitter] : particle_triggers)
+	{
+		entt::entity entity = find_entity(net_id);
+		if (entity != entt::null)
+			ParticleEmitters::trigger(*registry, entity, emitter);
+	}
+	return true;
+}
+
+void ReplicationClient::spawn_entity(const EntitySpawn& spawn)
+{
+	if (entities.contains(spawn.state.net_id))
+		return;
+
+	entt::registry& registry = *this->registry;
+	entt::entity entity = registry.create();
+	if (spawn.type == ReplicatedType::Tank)
+	{
+		registry.emplace<Tank>(entity, spawn.tank_id, entity, spawn.state.design).turret_orientation = spawn.state.turret_orientation;
+		registry.emplace<Transform>(entity, spawn.state.transform);
+		registry.emplace<Velocity>(entity, spawn.state.velocity);
+		if (registry.ctx().contains<ParticleSystem>())
+			Tank::add_particle_emitters(registry, entity);
+	}
+	else
+	{
+		ProjectileType type;
+		type.sprite_type = spawn.sprite_type;
+		type.particle_type = spawn.particle_type;
+		type.scale = spawn.scale;
+		type.velocity = spawn.initial_velocity;
+		type.fix_orientation = spawn.fix_orientation;
+		type.fix_velocity = spawn.fix_velocity;
+
+		registry.emplace<Transform>(entity, spawn.state.transform);
+		registry.emplace<Velocity>(entity, spawn.state.velocity);
+		registry.emplace<Projectile>(entity, entity, find_entity(spawn.shooter_net_id), type);
+		if (registry.ctx().contains<ParticleSystem>())
+			Projectile::add_smoke_trail(registry, entity, type);
+	}
+	registry.emplace<Replicated>(entity, spawn.state.net_id);
+	entities.emplace(spawn.state.net_id, entity);
+}
+
+void ReplicationClient::despawn_entity(u32 net_id)
+{
+	auto found = entities.find(net_id);
+	if (found == entities.end())
+		return;
+	if (registry->valid(found->second))
+		registry->destroy(found->second);
+	entities.erase(found);
+}
+
+void ReplicationClient::apply_state(const EntityState& state)
+{
+	entt::entity entity = find_entity(state.net_id);
+	if (entity == entt::null || registry->all_of<Predicted>(entity))
+		return;
+
+	registry->get<Transform>(entity) = state.transform;
+	registry->get<Velocity>(entity) = state.velocity;
+	if (Tank* tank = registry->try_get<Tank>(entity))
+	{
+		tank->turret_orientation = state.turret_orientation;
+		if (!(tank->design == state.design))
+			Tank::update_tank_design(*registry, entity, state.design);
+	}
+}
+
+entt::entity ReplicationClient::find_entity(u32 net_id) const
+{
+	auto found = entities.find(net_id);
+	return found != entities.end() ? found->second : entt::null;
+}
+
+const EntityState* ReplicationClient::find_latest_state(u32 net_id) const
+{
+	if (latest_tick == 0)
+		return nullptr;
+	const std::vector<EntityState>& states = snapshots[latest_tick % SNAPSHOT_HISTORY].entities;
+	auto found = std::lower_bound(states.begin(), states.end(), net_id, [](const EntityState& state, u32 id) { return state.net_id < id; });
+	return found != states.end() && found->net_id == net_id ? &*found : nullptr;
+}
@@ -0,0 +1,286 @@
+#pragma once
+
+#include "NetProtocol.h"
+#include "ByteStream.h"
+#include "InputCommand.h"
+#include "Serialization.h"
+#include "Interest.h"
+
+#include "entities/Components.h"
+#include "entities/Tank.h"
+#include "entities/Particle.h"
+#include "entities/CommandSource.h"
+
+#include "entt/entt.hpp"
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+/// Snapshots kept per client on both sides; an acknowledged snapshot older than this can't be a baseline anymore
+const static u32 SNAPSHOT_HISTORY = 64;
+/// Input commands the server queues per client. A client that runs ahead of the server loses its oldest commands
+/// instead of driving with an ever growing delay
+const static u32 INPUT_QUEUE_LIMIT = 8;
+
+/// Replicated state of one entity at a tick. Snapshots hold these sorted by net_id
+struct EntityState
+{
+	u32 net_id;
+	Transform transform;
+	Velocity velocity;
+	/// Tanks only
+	f32 turret_orientation;
+	TankDesign design;
+};
+
+/// What a client needs to create a replicated entity; sent reliably when the entity spawns
+struct EntitySpawn
+{
+	ReplicatedType type;
+	EntityState state;
+	/// Tanks: the Tank id
+	u32 tank_id;
+	/// Projectiles: the net id of the shooting tank (0 if none) and the visual part of the ProjectileType
+	u32 shooter_net_id;
+	ProjectileSpriteType sprite_type;
+	u8 particle_type;
+	f32 scale;
+	f32 initial_velocity;
+	bool fix_orientation;
+	bool fix_velocity;
+};
+
+struct ReplicationSettings
+{
+	u32 tick_rate = 60;
+	/// Per client, snapshots and entity events together. The default keeps a 60 Hz snapshot within one datagram;
+	/// entity updates that don't fit are deferred to the next snapshots
+	u32 bytes_per_second = 64 * 1024;
+	/// Area the positions are quantized in (see QuantizationBounds), usually the map
+	Rect world_bounds = { 0.0f, 0.0f, 1024.0f, 1024.0f };
+	InterestSettings interest;
+};
+
+/// Totals over all clients since the server started
+struct ReplicationStats
+{
+	u64 ticks = 0;
+	u64 snapshots_sent = 0;
+	/// Snapshots not sent because the client was over its budget
+	u64 snapshots_skipped = 0;
+	/// Snapshots not sent because the client asked for a lower rate
+	u64 snapshots_throttled = 0;
+	u64 snapshot_bytes = 0;
+	u64 event_bytes = 0;
+	/// Entities the clients are interested in, summed over the ticks and clients a snapshot was sent for
+	u64 entity_ticks = 0;
+	/// Spawns and despawns sent to the clients, for entities created and destroyed or coming into and going out of their interest
+	u64 entity_enters = 0;
+	u64 entity_leaves = 0;
+	/// Entities written into the snapshots (changed since the baseline) and those deferred by the budget
+	u64 entity_records = 0;
+	u64 deferred_records = 0;
+
+	/// Bytes per tick per entity, for one client
+	f64 get_bytes_per_entity() const { return entity_ticks > 0 ? (f64)(snapshot_bytes + event_bytes) / (f64)entity_ticks : 0.0; }
+};
+
+/// Sends a packet to a client; unreliable on NetChannel::Snapshots, reliable on NetChannel::Events
+using NetSendFunction = std::function<void(u32 client, NetChannel channel, const u8* data, usz size)>;
+
+/// Server side of the replication: the tanks and projectiles of the registry and the ParticleEvents, sent to the clients
+/// interested in them (see InterestSet); entities entering and leaving the interest of a client are spawned and despawned
+/// on it. Each snapshot is delta encoded against the newest snapshot the client acknowledged: only the entities that changed since
+/// are written, and only their changed fields. The server keeps what each client has received for the last SNAPSHOT_HISTORY
+/// ticks, so entities deferred by the bandwidth budget keep their baseline state on both sides. The states are quantized
+/// before they are compared, changes below the precision of Serialized<T> aren't sent; records are bit packed.
+/// Net ids are assigned through registry signals (pooled projectiles get a new one on every acquire); spawns and despawns
+/// are sent reliably, as are the changes of the MapDestruction change log. Transport independent: packets go out through a NetSendFunction.
+/// It is also the CommandSource of the tanks the clients drive: every tick applies the next received InputCommand of each client
+struct ReplicationServer : CommandSource, NoCopy
+{
+	/// Adds ParticleEvents to the registry context
+	ReplicationServer(entt::registry& registry, const ReplicationSettings& settings);
+	~ReplicationServer();
+
+	/// The client gets the welcome and the spawns of all live entities with the next update; returns its id
+	u32 add_client();
+	void remove_client(u32 client);
+	/// Handles a packet of the client (acks and inputs). Malformed packets are ignored
+	void receive(u32 client, const u8* data, usz size);
+	/// The client drives the tank with its inputs; entt::null takes the control away. The client learns it with the next update
+	void set_controlled_tank(u32 client, entt::entity tank);
+
+	/// Applies one queued command per client to its tank. A client without a new command keeps driving with its last one, without shooting
+	void write_inputs(entt::registry& registry, f32 delta_time) override;
+
+	/// Replicates the state after the tick to all clients; called once per tick after World::update. Ticks start at 1
+	void update(u32 tick, const NetSendFunction& send);
+
+	u32 get_client_count() const;
+
+	ReplicationSettings settings;
+	QuantizationBounds bounds;
+	ReplicationStats stats;
+	/// Bytes sent in the last update to all clients and the replicated entities at that tick
+	u64 last_tick_bytes;
+	u32 last_tick_entities;
+
+private:
+	struct SentSnapshot
+	{
+		u32 tick = 0;
+		std::vector<EntityState> entities;
+	};
+
+	struct Client
+	{
+		bool joined = false;
+		u32 acked_tick = 0;
+		/// Bytes the client may still get; refilled every tick up to two ticks worth
+		f32 credit = 0.0f;
+		/// From the acks: the camera view of the client and the snapshot rate it wants (0 for every tick)
+		bool has_view = false;
+		Rect view = {};
+		u16 snapshot_rate = 0;
+		u32 next_snapshot_tick = 0;
+		InterestSet interest;
+		/// Particle events inside the interest since the last snapshot
+		std::vector<ParticleEvents::Spawn> particle_spawns;
+		std::vector<std::pair<u32, u32>> particle_triggers;
+		/// What the client has received, by tick % SNAPSHOT_HISTORY
+		Array<SentSnapshot, SNAPSHOT_HISTORY> history;
+
+		entt::entity tank = entt::null;
+		bool control_changed = false;
+		/// Index of the first change of the MapDestruction change log the client hasn't got yet
+		u32 next_tile_change = 0;
+		/// Received commands not applied yet, oldest first
+		std::deque<InputCommand> inputs;
+		/// Newest received and newest applied sequence
+		u32 received_sequence = 0;
+		u32 applied_sequence = 0;
+		InputCommand last_command;
+	};
+
+	void on_spawn(entt::registry& registry, entt::entity entity);
+	void on_despawn(entt::registry& registry, entt::entity entity);
+	void on_pooled(entt::registry& registry, entt::entity entity);
+	void on_unpooled(entt::registry& registry, entt::entity entity);
+
+	u32 get_net_id(entt::entity entity) const;
+	void collect_states();
+	EntitySpawn get_spawn(entt::entity entity, u32 net_id) const;
+	void update_interest(Client& client, ArenaVector<u32>& indices, ArenaVector<u32>& entered, ArenaVector<u32>& left);
+	void write_entity_events(u32 tick, const ArenaVector<u32>& entered, const ArenaVector<u32>& left, ByteWriter& writer);
+	void collect_particle_events();
+	void write_particle_block(Client& client);
+	void receive_ack(Client& client, ByteReader& reader);
+	void receive_inputs(Client& client, ByteReader& reader);
+	/// Writes the changes of the map since the client's next_tile_change; false if there are none
+	bool write_tile_changes(Client& client, ByteWriter& writer);
+	void write_snapshot(Client& client, u32 tick, const ArenaVector<u32>& relevant, ByteWriter& writer);
+
+	entt::registry* registry;
+	std::vector<std::unique_ptr<Client>> clients;
+
+	/// By entity index; 0 for entities that aren't replicated (or are pooled)
+	std::vector<u32> net_ids;
+	u32 next_net_id;
+
+	/// State of the current update; the entities by state
+	std::vector<EntityState> states;
+	std::vector<entt::entity> state_entities;
+	InterestGrid grid;
+	std::vector<ParticleEvents::Spawn> particle_spawns;
+	std::vector<ParticleEvents::Trigger> particle_triggers;
+	ByteWriter events_message;
+	ByteWriter particle_block;
+	ByteWriter snapshot_message;
+};
+
+/// Marks an entity created on the client for an entity of the server
+struct Replicated
+{
+	u32 net_id;
+};
+
+/// Marks the replicated tank the client drives itself (see ClientPrediction); the snapshots don't move it
+struct Predicted
+{
+};
+
+/// Client side of the replication: decodes the snapshots into the registry and creates and destroys the replicated entities.
+/// The entities get no physics; they are placed by the snapshots and moved along their velocity in between (extrapolate).
+/// The tile changes of the server are applied to the MapDestruction of the client map
+struct ReplicationClient : NoCopy
+{
+	ReplicationClient(entt::registry& registry);
+	~ReplicationClient();
+
+	/// Handles a packet of the server; returns false if it was malformed or its baseline is gone.
+	/// Throws if the server runs another protocol version
+	bool receive(const u8* data, usz size);
+	/// Writes the ack of the newest decoded snapshot with the view and the snapshot rate; returns false if there is nothing
+	/// new to acknowledge
+	bool write_ack(ByteWriter& writer);
+	/// The camera view (Camera::get_bounding_rect); the server sends the entities around it. Without one the server picks a
+	/// view around the own tank
+	void set_view(const Rect& view);
+
+	/// Moves the replicated entities along their velocity; predicted entities are left alone
+	static void extrapolate(entt::registry& registry, f32 delta_time);
+
+	/// entt::null if the entity isn't (or not yet) spawned
+	entt::entity find_entity(u32 net_id) const;
+	/// State of the entity in the newest snapshot, nullptr if it isn't in it
+	const EntityState* find_latest_state(u32 net_id) const;
+
+	bool welcomed;
+	u32 tick_rate;
+	/// Newest decoded snapshot, 0 before the first
+	u32 latest_tick;
+	u64 bytes_received;
+	u64 snapshots_received;
+	/// Snapshots that arrived after a newer one or whose baseline was gone
+	u64 snapshots_dropped;
+	/// Net id of the tank the server lets this client drive, 0 for none
+	u32 controlled_net_id;
+	/// Newest input command the server had applied at latest_tick
+	u32 input_sequence;
+	/// From the welcome
+	QuantizationBounds bounds;
+	/// Snapshots per second the server should send at most, 0 for its tick rate
+	u16 snapshot_rate;
+
+private:
+	struct ReceivedSnapshot
+	{
+		u32 tick = 0;
+		std::vector<EntityState> entities;
+	};
+
+	bool receive_welcome(ByteReader& reader);
+	bool receive_entity_events(ByteReader& reader);
+	bool receive_snapshot(ByteReader& reader);
+	bool receive_control(ByteReader& reader);
+	bool receive_tile_changes(ByteReader& reader);
+	void spawn_entity(const EntitySpawn& spawn);
+	void despawn_entity(u32 net_id);
+	void apply_state(const EntityState& state);
+
+	entt::registry* registry;
+	std::unordered_map<u32, entt::entity> entities;
+	Array<ReceivedSnapshot, SNAPSHOT_HISTORY> snapshots;
+	u32 acked_tick;
+	bool has_view;
+	Rect view;
+	/// Index of the next change of the server's change log
+	u32 next_tile_change;
+
+	std::vector<ParticleEvents::Spawn> particle_spawns;
+	std::vector<std::pair<u32, u32>> particle_triggers;
+};
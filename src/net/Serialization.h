@@ -0,0 +1,323 @@
+#pragma once
+
+#include "BitStream.h"
+
+#include "entities/Components.h"
+#include "entities/Tank.h"
+#include "entities/Particle.h"
+#include "engine/util/MathUtil.h"
+
+#include "glm/glm.hpp"
+
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <bit>
+
+/// Area the positions are quantized in; the server sends it to the clients with the welcome. A position is a fixed point
+/// number relative to min, its integer part gets as many bits as the size needs. Positions outside are clamped
+struct QuantizationBounds
+{
+	/// A margin around the area keeps entities just outside the map exact
+	QuantizationBounds(const Rect& area = { 0.0f, 0.0f, 1024.0f, 1024.0f })
+		: area(area)
+	{
+		min = glm::vec2(area.x, area.y) - MARGIN;
+		glm::vec2 size = glm::vec2(area.width, area.height) + 2.0f * MARGIN;
+		for (u32 axis = 0; axis < 2; axis++)
+			integer_bits[axis] = (u32)std::bit_width((u32)std::ceil(std::clamp(size[axis], 1.0f, (f32)MAX_SIZE)));
+	}
+
+	Rect area;
+	glm::vec2 min;
+	Array<u32, 2> integer_bits;
+
+	const static u32 MAX_SIZE = 1 << 16;
+	constexpr static f32 MARGIN = 8.0f;
+};
+
+/// Rounds a non-negative scaled value to an integer in [0, max]; NaN becomes 0. Compiles to min, max and a conversion
+inline u32 quantize_scaled(f32 scaled, u32 max)
+{
+	return (u32)std::min(std::max(0.0f, scaled + 0.5f), (f32)max);
+}
+
+/// glm::vec2 as a fixed point number inside the QuantizationBounds with fraction_bits bits after the point
+struct PositionCodec
+{
+	u32 fraction_bits;
+
+	u32 get_bits(const QuantizationBounds& bounds) const
+	{
+		return bounds.integer_bits[0] + bounds.integer_bits[1] + 2 * fraction_bits;
+	}
+
+	void write(BitWriter& writer, glm::vec2 value, const QuantizationBounds& bounds) const
+	{
+		for (u32 axis = 0; axis < 2; axis++)
+		{
+			u32 bits = bounds.integer_bits[axis] + fraction_bits;
+			writer.write(quantize_scaled((value[axis] - bounds.min[axis]) * (f32)(1u << fraction_bits), (1u << bits) - 1), bits);
+		}
+	}
+
+	void read(BitReader& reader, glm::vec2& value, const QuantizationBounds& bounds) const
+	{
+		for (u32 axis = 0; axis < 2; axis++)
+			value[axis] = dequantize(reader.read(bounds.integer_bits[axis] + fraction_bits), axis, bounds);
+	}
+
+	glm::vec2 quantize(glm::vec2 value, const QuantizationBounds& bounds) const
+	{
+		for (u32 axis = 0; axis < 2; axis++)
+		{
+			u32 bits = bounds.integer_bits[axis] + fraction_bits;
+			value[axis] = dequantize(quantize_scaled((value[axis] - bounds.min[axis]) * (f32)(1u << fraction_bits), (1u << bits) - 1), axis, bounds);
+		}
+		return value;
+	}
+
+private:
+	f32 dequantize(u32 quantized, u32 axis, const QuantizationBounds& bounds) const
+	{
+		return (f32)quantized / (f32)(1u << fraction_bits) + bounds.min[axis];
+	}
+};
+
+/// An angle in radians as bits bits over the full circle; decodes to [-pi, pi)
+struct AngleCodec
+{
+	u32 bits;
+
+	u32 get_bits(const QuantizationBounds&) const
+	{
+		return bits;
+	}
+
+	void write(BitWriter& writer, f32 value, const QuantizationBounds&) const
+	{
+		writer.write(encode(value), bits);
+	}
+
+	void read(BitReader& reader, f32& value, const QuantizationBounds&) const
+	{
+		value = decode(reader.read(bits));
+	}
+
+	f32 quantize(f32 value, const QuantizationBounds&) const
+	{
+		return decode(encode(value));
+	}
+
+private:
+	u32 encode(f32 value) const
+	{
+		// pi wraps around to -pi
+		f32 turns = (MathUtil::normalize_angle(value) + MathUtil::PI_32) * (1.0f / (2.0f * MathUtil::PI_32));
+		return quantize_scaled(turns * (f32)(1u << bits), 1u << bits) & ((1u << bits) - 1);
+	}
+
+	f32 decode(u32 quantized) const
+	{
+		return (f32)quantized * (2.0f * MathUtil::PI_32 / (f32)(1u << bits)) - MathUtil::PI_32;
+	}
+};
+
+/// f32 or glm::vec2 components in [-limit, limit] with bits bits each. Zero is exact, so a resting entity doesn't change
+struct RangeCodec
+{
+	f32 limit;
+	u32 bits;
+
+	u32 get_bits(const QuantizationBounds&) const
+	{
+		return bits;
+	}
+
+	void write(BitWriter& writer, f32 value, const QuantizationBounds&) const
+	{
+		writer.write(encode(value), bits);
+	}
+
+	void write(BitWriter& writer, glm::vec2 value, const QuantizationBounds&) const
+	{
+		writer.write(encode(value.x), bits);
+		writer.write(encode(value.y), bits);
+	}
+
+	void read(BitReader& reader, f32& value, const QuantizationBounds&) const
+	{
+		value = decode(reader.read(bits));
+	}
+
+	void read(BitReader& reader, glm::vec2& value, const QuantizationBounds&) const
+	{
+		value.x = decode(reader.read(bits));
+		value.y = decode(reader.read(bits));
+	}
+
+	f32 quantize(f32 value, const QuantizationBounds&) const
+	{
+		return decode(encode(value));
+	}
+
+	glm::vec2 quantize(glm::vec2 value, const QuantizationBounds&) const
+	{
+		return glm::vec2(decode(encode(value.x)), decode(encode(value.y)));
+	}
+
+private:
+	u32 get_half() const { return (1u << (bits - 1)) - 1; }
+
+	u32 encode(f32 value) const
+	{
+		f32 half = (f32)get_half();
+		return quantize_scaled(value / limit * half + half, 2 * get_half());
+	}
+
+	f32 decode(u32 quantized) const
+	{
+		return ((f32)quantized - (f32)get_half()) * (limit / (f32)get_half());
+	}
+};
+
+/// Integers and enums with bits bits; the values must fit
+struct BitsCodec
+{
+	u32 bits;
+
+	u32 get_bits(const QuantizationBounds&) const
+	{
+		return bits;
+	}
+
+	template<typename T>
+	void write(BitWriter& writer, T value, const QuantizationBounds&) const
+	{
+		writer.write(static_cast<u32>(value), bits);
+	}
+
+	template<typename T>
+	void read(BitReader& reader, T& value, const QuantizationBounds&) const
+	{
+		value = static_cast<T>(reader.read(bits));
+	}
+
+	template<typename T>
+	T quantize(T value, const QuantizationBounds&) const
+	{
+		return static_cast<T>(static_cast<u32>(value) & ((1u << bits) - 1));
+	}
+};
+
+/// Describes how a member of a component is serialized
+template<auto Member, typename Codec>
+struct Field
+{
+	constexpr static auto MEMBER = Member;
+
+	const char* name;
+	Codec codec;
+};
+
+/// Specialized for every serializable type with a constexpr tuple FIELDS of Field descriptors.
+/// Members without a descriptor aren't serialized
+template<typename T>
+struct Serialized;
+
+template<>
+struct Serialized<Transform>
+{
+	constexpr static auto FIELDS = std::make_tuple(
+		Field<&Transform::pos, PositionCodec>{ "pos", { 8 } },
+		Field<&Transform::rot, AngleCodec>{ "rot", { 12 } });
+};
+
+template<>
+struct Serialized<Velocity>
+{
+	constexpr static auto FIELDS = std::make_tuple(
+		Field<&Velocity::linear, RangeCodec>{ "linear", { 32.0f, 14 } },
+		Field<&Velocity::angular, RangeCodec>{ "angular", { 32.0f, 12 } });
+};
+
+/// Sized for the asset arrays the client indexes with a design
+template<>
+struct Serialized<TankDesign>
+{
+	constexpr static auto FIELDS = std::make_tuple(
+		Field<&TankDesign::color, BitsCodec>{ "color", { 2 } },
+		Field<&TankDesign::hull, BitsCodec>{ "hull", { 3 } },
+		Field<&TankDesign::turret, BitsCodec>{ "turret", { 3 } },
+		Field<&TankDesign::tracks, BitsCodec>{ "tracks", { 2 } });
+};
+
+/// Only what a replicated particle effect looks like; the angular velocity isn't sent
+template<>
+struct Serialized<ParticleSpawn>
+{
+	constexpr static auto FIELDS = std::make_tuple(
+		Field<&ParticleSpawn::pos, PositionCodec>{ "pos", { 6 } },
+		Field<&ParticleSpawn::rot, AngleCodec>{ "rot", { 8 } },
+		Field<&ParticleSpawn::scale, RangeCodec>{ "scale", { 16.0f, 10 } },
+		Field<&ParticleSpawn::frames_per_second, RangeCodec>{ "frames_per_second", { 64.0f, 10 } },
+		Field<&ParticleSpawn::velocity, RangeCodec>{ "velocity", { 32.0f, 10 } });
+};
+
+/// Serializes the fields of a type described by Serialized<T>. A field mask selects fields, field i is bit i
+template<typename T>
+struct Serializer
+{
+	constexpr static u32 FIELD_COUNT = (u32)std::tuple_size_v<decltype(Serialized<T>::FIELDS)>;
+	constexpr static u32 ALL_FIELDS = (1u << FIELD_COUNT) - 1;
+
+	static void write(BitWriter& writer, const T& value, const QuantizationBounds& bounds, u32 fields = ALL_FIELDS)
+	{
+		for_each_field([&](u32 i, const auto& field)
+			{
+				if (fields & (1u << i))
+					field.codec.write(writer, value.*field.MEMBER, bounds);
+			});
+	}
+
+	static void read(BitReader& reader, T& value, const QuantizationBounds& bounds, u32 fields = ALL_FIELDS)
+	{
+		for_each_field([&](u32 i, const auto& field)
+			{
+				if (fields & (1u << i))
+					field.codec.read(reader, value.*field.MEMBER, bounds);
+			});
+	}
+
+	/// The value as a reader decodes it
+	static T quantize(const T& value, const QuantizationBounds& bounds)
+	{
+		T quantized = value;
+		for_each_field([&](u32, const auto& field)
+			{
+				quantized.*field.MEMBER = field.codec.quantize(value.*field.MEMBER, bounds);
+			});
+		return quantized;
+	}
+
+	static u32 get_bits(const QuantizationBounds& bounds, u32 fields = ALL_FIELDS)
+	{
+		u32 bits = 0;
+		for_each_field([&](u32 i, const auto& field)
+			{
+				if (fields & (1u << i))
+					bits += field.codec.get_bits(bounds);
+			});
+		return bits;
+	}
+
+	/// Calls f(index, field) for every field descriptor
+	template<typename F>
+	static void for_each_field(F&& f)
+	{
+		[&]<usz... I>(std::index_sequence<I...>)
+		{
+			(f((u32)I, std::get<I>(Serialized<T>::FIELDS)), ...);
+		}(std::make_index_sequence<FIELD_COUNT>());
+	}
+};
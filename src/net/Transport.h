@@ -0,0 +1,48 @@
+#pragma once
+
+#include "NetProtocol.h"
+
+#include "engine/Types.h"
+
+#include <vector>
+
+enum class TransportEventType : u8
+{
+	Connect,
+	Disconnect,
+	Receive
+};
+
+/// Something that happened on a transport since the last poll
+struct TransportEvent
+{
+	TransportEventType type;
+	/// Server side: the connection it happened on. Ids of closed connections are reused
+	u32 peer;
+	/// Receive only
+	std::vector<u8> packet;
+};
+
+/// Server end of the connections to the clients. Packets on NetChannel::Snapshots are unreliable, packets on
+/// NetChannel::Events reliable and ordered. Implemented over ENet (EnetServerTransport) and in process (LoopbackServerTransport)
+struct ServerTransport
+{
+	virtual ~ServerTransport() = default;
+
+	/// Takes the next event without blocking; false if there is none
+	virtual bool poll(TransportEvent& event) = 0;
+	virtual void send(u32 peer, NetChannel channel, const u8* data, usz size) = 0;
+	/// Hands the packets sent since the last flush to the network
+	virtual void flush() = 0;
+};
+
+/// Client end of the connection to a server; connected when it is created
+struct ClientTransport
+{
+	virtual ~ClientTransport() = default;
+
+	/// Takes the next event without blocking; false if there is none. A Disconnect is the last event
+	virtual bool poll(TransportEvent& event) = 0;
+	virtual void send(NetChannel channel, const u8* data, usz size) = 0;
+	virtual void flush() = 0;
+};
@@ -0,0 +1,26 @@
+#include "AssetManager.h"
+#include "entities/MapBlob.h"
+
+#include <iostream>
+#include <exception>
+
+/// Map compiler: compiles a TMX map and its TSX tileset into a binary map blob (see MapBlob)
+int main(int argc, char** argv)
+{
+	if (argc != 4)
+	{
+		std::cerr << "Usage: mapc <map.tmx> <tileset.tsx> <output.tgmap>" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		Map map = MapBlob::compile(argv[1], argv[2], argv[3], PIXEL_SCALE);
+		std::cout << argv[3] << ": " << map.unmerged_collision_shape_count << " collision shapes merged into " << map.collision_shapes.size() << std::endl;
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "mapc: " << e.what() << std::endl;
+		return 1;
+	}
+}